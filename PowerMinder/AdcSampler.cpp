@@ -0,0 +1,232 @@
+//------------------------------------------------------------------------------
+//   Copyright 2014 Janick Bergeron
+//   All Rights Reserved Worldwide
+//
+//   Licensed under the Apache License, Version 2.0 (the
+//   "License"); you may not use this file except in
+//   compliance with the License.  You may obtain a copy of
+//   the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in
+//   writing, software distributed under the License is
+//   distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+//   CONDITIONS OF ANY KIND, either express or implied.  See
+//   the License for the specific language governing
+//   permissions and limitations under the License.
+//------------------------------------------------------------------------------
+
+
+#include <Arduino.h>
+
+#include "AdcSampler.h"
+
+using namespace PowerMinder;
+
+/** ADC multiplexer setting for analog pins 0-3: Vcc reference, right-adjusted */
+static const uint8_t ADC_MUX[AdcSampler_t::MAX_CHANNELS] = {0x00, 0x01, 0x02, 0x03};
+
+/** Digital input buffer to disable for analog pins 0-3 (ADC0=PB5, ADC1=PB2, ADC2=PB4, ADC3=PB3) */
+static const uint8_t ADC_DIDR[AdcSampler_t::MAX_CHANNELS] = {_BV(5), _BV(2), _BV(4), _BV(3)};
+
+
+AdcSampler_t *AdcSampler_t::s_active = 0;
+
+
+uint8_t
+AdcSampler_t::add(uint8_t pin)
+{
+  if (m_channels == MAX_CHANNELS || pin >= MAX_CHANNELS) return 0xFF;
+
+  DIDR0 |= ADC_DIDR[pin];
+  m_mux[m_channels] = ADC_MUX[pin];
+  return m_channels++;
+}
+
+
+void
+AdcSampler_t::start()
+{
+  if (m_channels == 0) return;
+
+  stop();
+  s_active = this;
+
+  // Free-running, interrupt on completion, /128 prescaler
+  ADCSRB = 0;
+  ADMUX  = m_mux[0];
+  ADCSRA = _BV(ADEN) | _BV(ADSC) | _BV(ADATE) | _BV(ADIE) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);
+
+  // The channel cannot be changed until one ADC clock after the start,
+  // so the second conversion is also on the first channel.
+  // The interrupt routine selects the channel of the third one.
+  m_converting = 0;
+  m_selected   = 0;
+}
+
+
+void
+AdcSampler_t::stop()
+{
+  if (s_active != this) return;
+
+  ADCSRA &= ~(_BV(ADATE) | _BV(ADIE));
+  s_active = 0;
+}
+
+
+bool
+AdcSampler_t::read(uint8_t   index,
+		   uint16_t &value)
+{
+  uint8_t tail = m_tail[index];
+  if (tail == m_head[index]) return false;
+
+  value = m_fifo[index][tail];
+  m_tail[index] = (tail + 1) & (DEPTH - 1);
+  return true;
+}
+
+
+uint16_t
+AdcSampler_t::overruns(uint8_t index)
+{
+  uint8_t sreg = SREG;
+  cli();
+  uint16_t n = m_overruns[index];
+  SREG = sreg;
+  return n;
+}
+
+
+void
+AdcSampler_t::isr()
+{
+  AdcSampler_t *self = s_active;
+  if (self == 0) return;
+
+  // The conversion that just completed was for the channel being converted.
+  // The selected channel is being converted now,
+  // so select the one after that for the next conversion.
+  uint8_t index = self->m_converting;
+  self->m_converting = self->m_selected;
+  self->m_selected   = self->m_next(self->m_selected);
+  ADMUX = self->m_mux[self->m_selected];
+
+  uint16_t value = ADC;
+  uint8_t  head  = self->m_head[index];
+  uint8_t  next  = (head + 1) & (DEPTH - 1);
+  if (next == self->m_tail[index]) {
+    self->m_overruns[index]++;
+    return;
+  }
+  self->m_fifo[index][head] = value;
+  self->m_head[index] = next;
+}
+
+
+#ifdef TEST
+// Runs on the host simulator: two meters on analog pins 1 & 3,
+// each followed by its own light sensor & pulse detector
+
+#include <stdio.h>
+
+#include "LightSensor.h"
+#include "PulseDetector.h"
+
+ISR(ADC_vect)
+{
+  AdcSampler_t::isr();
+}
+
+
+/** A meter LED, seen by a light sensor */
+struct meter_s {
+  uint8_t  pin;
+  uint16_t ambient;
+  uint16_t lit;
+  uint32_t period;     ///< Between pulses, in us
+  uint32_t width;      ///< Of a pulse, in us
+
+  /** The first pulse is after the baseline is calibrated */
+  static const uint32_t FIRST = 100000;
+
+  uint16_t level(uint64_t now) const
+  {
+    return (now >= FIRST && (now - FIRST) % period < width) ? lit : ambient;
+  }
+
+  /** Number of complete pulses by the specified time */
+  uint32_t pulses(uint64_t now) const
+  {
+    return (now < FIRST + width) ? 0 : (now - FIRST - width) / period + 1;
+  }
+};
+
+
+int
+main(int argc, char *argv[])
+{
+  // Distinct levels, so a sample converted on the wrong channel is spotted
+  static const meter_s meters[2] = {{1, 0x100, 0x300, 250000, 40000},
+				    {3, 0x180, 0x380, 370000, 30000}};
+  const uint64_t DURATION = 10000000;
+  const uint64_t STEP     = 400;
+
+  Sim::init(argc, argv);
+
+  AdcSampler_t    sampler;
+  LightSensor_t   lights[2] = {LightSensor_t(meters[0].pin), LightSensor_t(meters[1].pin)};
+  PulseDetector_t detectors[2];
+  uint8_t         channels[2];
+  uint32_t        samples[2]    = {0, 0};
+  uint32_t        mismatches[2] = {0, 0};
+  uint16_t        driven[2];
+
+  for (int m = 0; m < 2; m++) {
+    driven[m] = meters[m].ambient;
+    Sim::override_analog(meters[m].pin, driven[m]);
+    lights[m].init();
+    channels[m] = sampler.add(meters[m].pin);
+  }
+  sampler.start();
+
+  // The analog inputs only change between steps,
+  // so every sample read after a step must be at the level driven during it
+  while (Sim::now() < DURATION) {
+    Sim::advance(STEP);
+
+    for (int m = 0; m < 2; m++) {
+      uint16_t value;
+      while (sampler.read(channels[m], value)) {
+	if (value != driven[m]) mismatches[m]++;
+	samples[m]++;
+	lights[m].update(value);
+	detectors[m].update(value, lights[m].baseline(), millis());
+      }
+      driven[m] = meters[m].level(Sim::now());
+      Sim::override_analog(meters[m].pin, driven[m]);
+    }
+  }
+  sampler.stop();
+
+  int errors = 0;
+
+  // Round-robin: both channels at half the conversion rate.
+  // The first channel gets one more sample at the start.
+  uint32_t expected = DURATION / 104 / 2;
+  for (int m = 0; m < 2; m++) {
+    uint32_t pulses = meters[m].pulses(DURATION);
+    bool ok = (mismatches[m] == 0 && sampler.overruns(channels[m]) == 0
+	       && samples[m] + 2 >= expected && samples[m] <= expected + 2
+	       && detectors[m].count() == pulses);
+    printf("%s: Pin %d: %u samples, %u on the wrong channel, %u overruns, %u/%u pulses\n",
+	   (ok) ? "PASS" : "FAIL", meters[m].pin, samples[m], mismatches[m],
+	   sampler.overruns(channels[m]), detectors[m].count(), pulses);
+    if (!ok) errors++;
+  }
+
+  return (errors) ? 1 : 0;
+}
+#endif
@@ -0,0 +1,127 @@
+//------------------------------------------------------------------------------
+//   Copyright 2014 Janick Bergeron
+//   All Rights Reserved Worldwide
+//
+//   Licensed under the Apache License, Version 2.0 (the
+//   "License"); you may not use this file except in
+//   compliance with the License.  You may obtain a copy of
+//   the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in
+//   writing, software distributed under the License is
+//   distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+//   CONDITIONS OF ANY KIND, either express or implied.  See
+//   the License for the specific language governing
+//   permissions and limitations under the License.
+//------------------------------------------------------------------------------
+
+
+#ifndef _AdcSampler_h
+#define _AdcSampler_h
+
+#include <stdint.h>
+
+namespace PowerMinder {
+
+  /** Class to sample several analog channels, round-robin, from the ADC interrupt.
+   *
+   *  The ADC is run in free-running mode. When a conversion completes,
+   *  the next one has already started on the following channel, so the
+   *  interrupt routine selects the channel for the conversion after that.
+   *  The multiplexer thus always switches a whole conversion ahead of the
+   *  sample-and-hold and no conversion is discarded: N channels are each
+   *  sampled at 1/N of the ADC conversion rate.
+   *
+   *  With the /128 prescaler on a 16.5MHz DigiSpark, the ADC runs at 129kHz
+   *  for ~9900 conversions per second in total.
+   *
+   *  Each channel has a small FIFO of samples that must be drained
+   *  with read() more often than every DEPTH conversions on that channel.
+   *  Each channel is typically fed to its own LightSensor_t and PulseDetector_t:
+   *
+   *      uint16_t value;
+   *      while (sampler.read(meter, value)) {
+   *        light.update(value);
+   *        if (pulses.update(value, light.baseline(), millis())) ...
+   *      }
+   *
+   *  The sketch routes the ADC interrupt to the sampler:
+   *
+   *      ISR(ADC_vect)
+   *      {
+   *        AdcSampler_t::isr();
+   *      }
+   */
+  class AdcSampler_t {
+
+  public:
+    /** Maximum number of channels */
+    static const uint8_t MAX_CHANNELS = 4;
+
+    /** Number of samples buffered per channel. Must be a power of 2 */
+    static const uint8_t DEPTH = 4;
+
+    /** Add an analog channel to the round-robin.
+     *  Returns the index of the channel in the sampler, or 0xFF if there is no more room.
+     *  Channels must be added before calling start().
+     */
+    uint8_t add(uint8_t pin);            ///< Analog pin number (0-3)
+
+    /** Start sampling. Any other sampler is stopped. */
+    void start();
+
+    /** Stop sampling */
+    void stop();
+
+    /** Get the oldest unread sample for the specified channel.
+     *  Returns TRUE if there was one.
+     */
+    bool read(uint8_t   index,           ///< Channel index, as returned by add()
+	      uint16_t &value);          ///< The sample, 0-1023
+
+    /** Number of samples dropped because the channel FIFO was full (wraps around) */
+    uint16_t overruns(uint8_t index);    ///< Channel index, as returned by add()
+
+    /** ADC conversion complete interrupt service routine.
+     *  The sketch must call it from its ISR(ADC_vect).
+     */
+    static void isr();
+
+  // Looks like Sketches don't support private constructors...
+  //private:
+    /** Create a sampler with no channels */
+    constexpr AdcSampler_t()
+      : m_channels(0), m_mux(), m_converting(0), m_selected(0),
+	m_fifo(), m_head(), m_tail(), m_overruns()
+    {
+    }
+
+  private:
+    /** The sampler serviced by the ADC interrupt */
+    static AdcSampler_t *s_active;
+
+    uint8_t  m_channels;
+    uint8_t  m_mux[MAX_CHANNELS];
+
+    /** Index of the channel being converted */
+    uint8_t  m_converting;
+
+    /** Index of the channel selected for the next conversion */
+    uint8_t  m_selected;
+
+    uint16_t          m_fifo[MAX_CHANNELS][DEPTH];
+    volatile uint8_t  m_head[MAX_CHANNELS];   ///< Written by the ISR
+    volatile uint8_t  m_tail[MAX_CHANNELS];   ///< Written by read()
+    volatile uint16_t m_overruns[MAX_CHANNELS];
+
+    uint8_t m_next(uint8_t index)
+    {
+      return (index + 1 == m_channels) ? 0 : index + 1;
+    }
+  };
+
+}
+
+#endif
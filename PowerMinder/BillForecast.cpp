@@ -0,0 +1,376 @@
+//------------------------------------------------------------------------------
+//   Copyright 2014 Janick Bergeron
+//   All Rights Reserved Worldwide
+//
+//   Licensed under the Apache License, Version 2.0 (the
+//   "License"); you may not use this file except in
+//   compliance with the License.  You may obtain a copy of
+//   the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in
+//   writing, software distributed under the License is
+//   distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+//   CONDITIONS OF ANY KIND, either express or implied.  See
+//   the License for the specific language governing
+//   permissions and limitations under the License.
+//------------------------------------------------------------------------------
+
+
+
+#include "BillForecast.h"
+
+using namespace PowerMinder;
+
+
+/** Days in months, in non-leap years */
+static const uint8_t daysInMonth[12] = {31, 28, 31, 30, 31, 30,
+					31, 31, 30, 31, 30, 31};
+
+
+void
+BillForecast_t::init()
+{
+  for (uint8_t i = 0; i < FORECAST_HOURS; i++) {
+    m_profile[i] = 0;
+    m_learned[i] = 0;
+  }
+  m_learnedHours = 0;
+  m_learnedSum   = 0;
+  m_days    = 0;
+  for (uint8_t p = 0; p <= ON_PEAK; p++) m_energy[p] = 0;
+}
+
+
+void
+BillForecast_t::begin(const Calendar &calendar,
+		      uint8_t  year,
+		      uint8_t  month,
+		      uint8_t  day,
+		      uint8_t  dayOfWeek,
+		      uint8_t  days,
+		      const LocalTime_t *local)
+{
+  if (days > MAX_DAYS) days = MAX_DAYS;
+  m_days           = days;
+  m_startDay       = day;
+  m_startMonthDays = monthDays(year, month);
+  m_startSlot      = ((dayOfWeek - 1) * 24) % FORECAST_HOURS;
+  m_day            = 0;
+  m_hour           = 0;
+  m_hourPulses     = 0;
+  m_shiftDay       = 0xFF;
+  m_shift          = 0;
+  for (uint8_t p = 0; p <= ON_PEAK; p++) {
+    m_weighted[p]    = 0;
+    m_unlearned[p]   = 0;
+    m_energy[p]      = 0;
+    m_metered[p]     = 0;
+    m_today[p]       = 0;
+    m_hourMinutes[p] = 0;
+  }
+
+  // Follow the period changes, in 30-min slots, one day at a time
+  m_prefix[0][0] = 0;
+  m_prefix[0][1] = 0;
+  for (uint8_t d = 0; d < days; d++) {
+    m_prefix[d+1][0] = m_prefix[d][0];
+    m_prefix[d+1][1] = m_prefix[d][1];
+
+    uint8_t slot = 0;
+    while (slot < 48) {
+      uint8_t  hour = slot / 2;
+      uint8_t  min  = (slot % 2) * 30;
+      period_t period;
+      period_t next;
+      uint16_t time;
+      calendar.findPeriods(1, &month, &day, &dayOfWeek, &hour, &min, &period, &next, &time);
+
+      // A saturated time to the next period is still a lower bound
+      uint16_t n = time / 30;
+      if (n == 0) n = 1;
+      if (n > 48 - slot) n = 48 - slot;
+
+      if (period != OFF_PEAK) m_prefix[d+1][period - 1] += n * 30;
+      for (; n > 0; n--, slot++) {
+	uint8_t hour = (m_startSlot + d * 24U + slot / 2) % FORECAST_HOURS;
+	if (m_learned[hour]) m_weighted[period] += m_profile[hour] * 30UL;
+	else m_unlearned[period] += 30;
+      }
+    }
+
+    // The wall clock skips or repeats an hour when daylight saving time starts or ends
+    uint8_t hour;
+    int8_t  shift = (local) ? local->shift(year, month, day, hour) : 0;
+    if (shift != 0) {
+      uint8_t  min = 0;
+      period_t period;
+      period_t next;
+      uint16_t time;
+      calendar.findPeriods(1, &month, &day, &dayOfWeek, &hour, &min, &period, &next, &time);
+
+      if (period != OFF_PEAK) m_prefix[d+1][period - 1] += shift * 60;
+      uint8_t slot = (m_startSlot + d * 24U + hour) % FORECAST_HOURS;
+      if (m_learned[slot]) m_weighted[period] += (int32_t) shift * 60 * m_profile[slot];
+      else m_unlearned[period] += shift * 60;
+      m_shiftDay = d;
+      m_shift    = shift;
+    }
+
+    if (++day > monthDays(year, month)) {
+      day = 1;
+      if (++month > 12) {
+	month = 1;
+	year++;
+      }
+    }
+    dayOfWeek = dayOfWeek % 7 + 1;
+  }
+}
+
+
+void
+BillForecast_t::advance(uint8_t  day,
+			uint8_t  hour,
+			uint16_t pulses,
+			period_t period,
+			uint8_t  minutes)
+{
+  if (m_days == 0) return;
+
+  uint8_t d = m_cycleDay(day);
+  if (d >= m_days) return;
+
+  if (d != m_day || hour != m_hour) {
+    m_closeHour();
+    if (d != m_day) {
+      for (uint8_t p = 0; p <= ON_PEAK; p++) m_today[p] = 0;
+    }
+    m_day  = d;
+    m_hour = hour;
+  }
+
+  m_energy[period]      += pulses;
+  m_metered[period]     += minutes;
+  m_today[period]       += minutes;
+  m_hourMinutes[period] += minutes;
+  m_hourPulses = (m_hourPulses > 65535 - pulses) ? 65535 : m_hourPulses + pulses;
+}
+
+
+uint32_t
+BillForecast_t::toDate(period_t period)
+{
+  return m_energy[period];
+}
+
+
+uint16_t
+BillForecast_t::minutesLeft(period_t period)
+{
+  uint16_t total   = m_minutesBefore(period, m_days);
+  uint16_t elapsed = m_minutesBefore(period, m_day) + m_today[period];
+
+  return (total > elapsed) ? total - elapsed : 0;
+}
+
+
+uint32_t
+BillForecast_t::forecast(period_t period)
+{
+  uint16_t total = m_minutesBefore(period, m_days);
+  if (total == 0) return m_energy[period];
+
+  // Average energy per hour of this period over the cycle, in pulses << PROFILE_SHIFT.
+  // The hours not learned yet are at the mean of the learned ones.
+  uint32_t weighted = m_weighted[period];
+  if (m_learnedHours > 0) weighted += m_unlearned[period] * (m_learnedSum / m_learnedHours);
+  uint32_t rate = weighted / total;
+
+  uint16_t unmetered = (total > m_metered[period]) ? total - m_metered[period] : 0;
+  return m_energy[period] + rate * unmetered / (60U << PROFILE_SHIFT);
+}
+
+
+uint32_t
+BillForecast_t::bill(const uint16_t price[ON_PEAK + 1])
+{
+  uint32_t total = 0;
+  for (uint8_t p = 0; p <= ON_PEAK; p++) {
+    uint32_t energy = forecast((period_t) p);
+    total += (energy / 1000) * price[p] + (energy % 1000) * price[p] / 1000;
+  }
+  return total;
+}
+
+
+uint16_t
+BillForecast_t::profile(uint8_t dayOfWeek,
+			uint8_t hour)
+{
+  return m_profile[((dayOfWeek - 1) * 24 + hour) % FORECAST_HOURS];
+}
+
+
+uint8_t
+BillForecast_t::monthDays(uint8_t year,
+			  uint8_t month)
+{
+  return daysInMonth[month-1] + (month == 2 && year % 4 == 0);
+}
+
+
+uint8_t
+BillForecast_t::m_cycleDay(uint8_t day)
+{
+  return (day >= m_startDay) ? day - m_startDay : day + m_startMonthDays - m_startDay;
+}
+
+
+uint16_t
+BillForecast_t::m_minutesBefore(period_t period,
+				uint8_t  day)
+{
+  if (period == OFF_PEAK) {
+    uint16_t minutes = day * 1440U + ((day > m_shiftDay) ? m_shift * 60 : 0);
+    return minutes - m_prefix[day][0] - m_prefix[day][1];
+  }
+  return m_prefix[day][period - 1];
+}
+
+
+void
+BillForecast_t::m_closeHour()
+{
+  uint8_t minutes = m_hourMinutes[OFF_PEAK] + m_hourMinutes[PARTIAL_PEAK] + m_hourMinutes[ON_PEAK];
+
+  if (minutes == 60) {
+    uint8_t slot = (m_startSlot + m_day * 24U + m_hour) % FORECAST_HOURS;
+
+    // The first time around, take the hour as is. Then average over 2 then 4 weeks.
+    uint32_t sample = (uint32_t) m_hourPulses << PROFILE_SHIFT;
+    if (sample > 65535) sample = 65535;
+    uint8_t learned = m_learned[slot];
+    int32_t delta   = ((int32_t) sample - m_profile[slot]) / (1 << learned);
+    m_profile[slot] += delta;
+    m_learnedSum    += delta;
+    if (learned == 0) m_learnedHours++;
+    if (learned < 2) m_learned[slot] = learned + 1;
+
+    // The same hour comes back every FORECAST_HOURS hours in the cycle.
+    // Assume it always has the same minutes in every cost period:
+    // the rates are exact again at the start of the next cycle.
+    uint16_t hours = m_days * 24U;
+    uint8_t  first = (slot + FORECAST_HOURS - m_startSlot) % FORECAST_HOURS;
+    uint8_t  count = (first < hours) ? (hours - 1 - first) / FORECAST_HOURS + 1 : 0;
+    for (uint8_t p = 0; p <= ON_PEAK; p++) {
+      m_weighted[p] += (uint32_t) (delta * count * m_hourMinutes[p]);
+      if (learned == 0) {
+	// Those minutes are no longer at the mean of the learned hours
+	uint16_t minutes = count * m_hourMinutes[p];
+	m_unlearned[p] = (m_unlearned[p] > minutes) ? m_unlearned[p] - minutes : 0;
+      }
+    }
+  }
+
+  m_hourPulses = 0;
+  for (uint8_t p = 0; p <= ON_PEAK; p++) m_hourMinutes[p] = 0;
+}
+
+
+#ifdef TEST
+// Forecasts a month of a known load profile, metered from various points in the cycle
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "Calendar.h"
+
+
+/** Energy in a minute: higher in the evening, and on weekends if "weekly" */
+static uint16_t
+load(uint8_t dayOfWeek,
+     uint8_t hour,
+     bool    weekly)
+{
+  uint16_t pulses = 10;
+  if (hour >= 17 && hour < 21) pulses += 30;
+  if (weekly && (dayOfWeek == 1 || dayOfWeek == 7)) pulses += 15;
+  return pulses;
+}
+
+
+static int errors = 0;
+
+/** Meter days [from, to) of June 2014, then compare the forecast with the month's actual energy, within 2%.
+ *  Each cost period is checked only once every hour of the week is learned:
+ *  until then, the hours not learned are at the mean of the others.
+ */
+static void
+check(BillForecast_t &forecast,
+      Calendar       &calendar,
+      uint8_t         from,
+      uint8_t         to,
+      bool            weekly,
+      bool            perPeriod,
+      const char     *what)
+{
+  const uint8_t SUNDAY_1ST = 1;   // June 1st 2014 was a Sunday
+
+  forecast.begin(calendar, 14, 6, 1, SUNDAY_1ST, 30);
+
+  uint32_t actual[ON_PEAK + 1] = {0, 0, 0};
+  for (uint8_t day = 1; day <= 30; day++) {
+    uint8_t dayOfWeek = (SUNDAY_1ST + day - 2) % 7 + 1;
+    for (uint8_t hour = 0; hour < 24; hour++) {
+      for (uint8_t min = 0; min < 60; min++) {
+	calendar.findPeriod(6, day, dayOfWeek, hour, min);
+	period_t period = calendar.getCurrentCost();
+	uint16_t pulses = load(dayOfWeek, hour, weekly);
+
+	actual[period] += pulses;
+	if (day >= from && day < to) forecast.advance(day, hour, pulses, period);
+      }
+    }
+  }
+
+  uint32_t total = 0;
+  uint32_t projected = 0;
+  bool     ok = true;
+  for (uint8_t p = 0; p <= ON_PEAK; p++) {
+    uint32_t f = forecast.forecast((period_t) p);
+    total     += actual[p];
+    projected += f;
+    if (perPeriod && labs((long) f - (long) actual[p]) > actual[p] / 50) ok = false;
+  }
+  if (labs((long) projected - (long) total) > total / 50) ok = false;
+
+  printf("%s: %s: forecast %u vs %u actual\n", (ok) ? "PASS" : "FAIL", what, projected, total);
+  if (!ok) errors++;
+}
+
+
+int
+main()
+{
+  Calendar calendar;
+  calendar.init();
+
+  BillForecast_t forecast;
+
+  forecast.init();
+  check(forecast, calendar, 1, 2, false, false, "Daily profile, first day learned");
+  forecast.init();
+  check(forecast, calendar, 1, 5, false, false, "Daily profile, first 4 days learned");
+  forecast.init();
+  check(forecast, calendar, 8, 10, false, false, "Daily profile, metered from the 8th");
+  forecast.init();
+  check(forecast, calendar, 1, 15, true,  true,  "Weekly profile, first 2 weeks learned");
+
+  // The learned profile carries over to the next cycle, even if it starts late
+  check(forecast, calendar, 20, 21, true,  true,  "Weekly profile, next cycle metered from the 20th");
+
+  return (errors == 0) ? 0 : 1;
+}
+#endif
@@ -0,0 +1,176 @@
+//------------------------------------------------------------------------------
+//   Copyright 2014 Janick Bergeron
+//   All Rights Reserved Worldwide
+//
+//   Licensed under the Apache License, Version 2.0 (the
+//   "License"); you may not use this file except in
+//   compliance with the License.  You may obtain a copy of
+//   the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in
+//   writing, software distributed under the License is
+//   distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+//   CONDITIONS OF ANY KIND, either express or implied.  See
+//   the License for the specific language governing
+//   permissions and limitations under the License.
+//------------------------------------------------------------------------------
+
+
+
+#ifndef _BillForecast_h
+#define _BillForecast_h
+
+#include <stdint.h>
+#include "Calendar.h"
+#include "LocalTime.h"
+
+/** Number of hourly averages in the learned load profile:
+ *  168 for an hour-of-week profile (504 bytes), 24 for an hour-of-day one (72 bytes).
+ *  Even the smaller one, with the prefix sums, needs ~200 bytes:
+ *  more than the ATtiny85 has left next to the rest of the sketch.
+ */
+#ifndef FORECAST_HOURS
+#define FORECAST_HOURS 168
+#endif
+
+namespace PowerMinder {
+
+  /** Class to project the energy consumed per cost period by the end of a billing cycle.
+   *
+   *  When a cycle begins, the tariff's period changes are followed once,
+   *  day by day, to build the prefix sums of the minutes spent in each cost
+   *  period before every day of the cycle. The number of minutes left in
+   *  each period is then a difference of two prefix sums and the minutes
+   *  already counted today.
+   *
+   *  The load is learned as an average energy for every hour of the week,
+   *  in fixed point. The profile is folded into an average rate per cost
+   *  period, weighted by the minutes of that period in every hour of the
+   *  cycle, and kept up to date as every complete hour is learned.
+   *  Until an hour of the week is learned, it is assumed to be the mean of
+   *  the hours that are: the minutes of every cost period in unlearned hours
+   *  are kept apart and weighted by that mean.
+   *
+   *  With daylight saving time, the day an hour is skipped or repeated
+   *  has 23 or 25 hours: its cost period gets 60 minutes less or more.
+   *
+   *  The forecast is the energy so far plus the average rate of each period
+   *  times its minutes not metered: the remaining ones, and any missed
+   *  before the device started or while it was off. Every update and query is O(1).
+   *  Energy is in meter pulses.
+   */
+  class BillForecast_t {
+
+  public:
+    /** Maximum number of days in a billing cycle */
+    static const uint8_t MAX_DAYS = 31;
+
+    /** Number of fractional bits in the learned hourly averages */
+    static const uint8_t PROFILE_SHIFT = 2;
+
+    /** Forget the learned load profile and the current cycle */
+    void init();
+
+    /** Start a new billing cycle at 00:00 on the specified date.
+     *  The learned load profile is kept.
+     *  Follows the period changes of the entire cycle: call again if the tariff changes.
+     *  The current period of the calendar is left as is.
+     */
+    void begin(const Calendar &calendar,   ///< The tariff
+	       uint8_t  year,              ///< 0-99
+	       uint8_t  month,             ///< 1-12
+	       uint8_t  day,               ///< 1-31
+	       uint8_t  dayOfWeek,         ///< 1-7  (1 == Sunday)
+	       uint8_t  days,              ///< Length of the cycle, 1..MAX_DAYS
+	       const LocalTime_t *local = 0);   ///< Daylight saving time rules, if any
+
+    /** Close an interval of the current cycle. Call once per minute or per interval, in order.
+     *  An interval must not span two hours. Hours are learned when all of their minutes were seen.
+     */
+    void advance(uint8_t  day,           ///< 1-31, day of the interval
+		 uint8_t  hour,          ///< 0-23, hour of the interval
+		 uint16_t pulses,        ///< Energy in the interval
+		 period_t period,        ///< Cost period of the interval
+		 uint8_t  minutes = 1);  ///< Duration of the interval
+
+    /** Energy so far in the current cycle, for the specified cost period */
+    uint32_t toDate(period_t period);
+
+    /** Minutes left in the current cycle, for the specified cost period */
+    uint16_t minutesLeft(period_t period);
+
+    /** Projected energy at the end of the current cycle, for the specified cost period */
+    uint32_t forecast(period_t period);
+
+    /** Projected bill at the end of the current cycle,
+     *  in the units of the prices (per 1000 pulses, e.g. per kWh with 1 Wh/pulse)
+     */
+    uint32_t bill(const uint16_t price[ON_PEAK + 1]);
+
+    /** Learned average energy in the specified hour of the week, in pulses << PROFILE_SHIFT */
+    uint16_t profile(uint8_t  dayOfWeek,  ///< 1-7  (1 == Sunday)
+		     uint8_t  hour);      ///< 0-23
+
+    /** Number of days in the specified month */
+    static uint8_t monthDays(uint8_t year,    ///< 0-99
+			     uint8_t month);  ///< 1-12
+
+  // Looks like Sketches don't support private constructors...
+  //private:
+    /** Create a bill forecaster */
+    constexpr BillForecast_t()
+      : m_profile(), m_learned(), m_learnedHours(0), m_learnedSum(0),
+	m_prefix(), m_weighted(), m_unlearned(), m_energy(), m_metered(), m_today(),
+	m_hourPulses(0), m_hourMinutes(), m_days(0), m_startDay(0), m_startMonthDays(0),
+	m_startSlot(0), m_day(0), m_hour(0), m_shiftDay(0xFF), m_shift(0)
+    {
+    }
+
+  private:
+    /** Index in the cycle of the specified day of the month */
+    uint8_t m_cycleDay(uint8_t day);
+
+    /** Minutes in the specified cost period before the specified day of the cycle */
+    uint16_t m_minutesBefore(period_t period,
+			     uint8_t  day);
+
+    /** Learn the hour that just ended, if it is complete */
+    void m_closeHour();
+
+    uint16_t m_profile[FORECAST_HOURS];  ///< Average energy per hour, in pulses << PROFILE_SHIFT
+    uint8_t  m_learned[FORECAST_HOURS];  ///< Times each hour was learned (saturates at 2)
+    uint8_t  m_learnedHours;             ///< Number of hours learned at least once
+    uint32_t m_learnedSum;               ///< Sum of their averages
+
+    /** Partial- & on-peak minutes before every day of the cycle.
+     *  Off-peak minutes are the rest of the day.
+     */
+    uint16_t m_prefix[MAX_DAYS + 1][2];
+
+    /** Learned hourly averages times their minutes in every cost period, over the cycle */
+    uint32_t m_weighted[ON_PEAK + 1];
+
+    /** Minutes in every cost period in hours not learned yet, over the cycle */
+    uint16_t m_unlearned[ON_PEAK + 1];
+
+    uint32_t m_energy[ON_PEAK + 1];       ///< Energy so far in the cycle
+    uint16_t m_metered[ON_PEAK + 1];      ///< Minutes metered so far in the cycle
+    uint16_t m_today[ON_PEAK + 1];        ///< Minutes so far today
+    uint16_t m_hourPulses;                ///< Energy so far in the current hour
+    uint8_t  m_hourMinutes[ON_PEAK + 1];  ///< Minutes so far in the current hour
+
+    uint8_t  m_days;                      ///< Length of the cycle (0 if none)
+    uint8_t  m_startDay;                  ///< Day of the month the cycle started
+    uint8_t  m_startMonthDays;            ///< Days in the month the cycle started
+    uint8_t  m_startSlot;                 ///< Profile hour of 00:00 on the first day
+    uint8_t  m_day;                       ///< Current day in the cycle
+    uint8_t  m_hour;                      ///< Current hour
+    uint8_t  m_shiftDay;                  ///< Day of the cycle with 23 or 25 hours (0xFF if none)
+    int8_t   m_shift;                     ///< Hours added to that day
+  };
+
+}
+
+#endif
@@ -24,90 +24,36 @@
 
 using namespace PowerMinder;
 
-Button_t::Button_t(uint8_t pin,
-		   uint8_t when_pressed,
-		   uint8_t pulled)
-  : m_pin(pin), m_pulled(pulled), m_previous_state(0),
-    m_was_pressed(0), m_was_released(0), m_HIGH((when_pressed == HIGH) ? HIGH : LOW)
-{
-  init();
-}
-
-
-Button_t::~Button_t()
-{
-}
-
 
 void
-Button_t::init()
+ButtonMask_t::init()
 {
-  pinMode(m_pin, INPUT);
+  PortB_t::input(m_mask);
   // Set the pull-up/down
-  digitalWrite(m_pin, m_pulled);
-  m_previous_state = m_is_pressed();
+  if (m_pulled == HIGH) PortB_t::set(m_mask);
+  else PortB_t::clear(m_mask);
 }
 
 
 bool
-Button_t::m_is_pressed()
+ButtonMask_t::read() const
 {
-  // All switches have "bounce" and a single sampling is not reliable of the state
-  // of the button as it may bounce between ON/OFF states
-  // We can trust that the button has been pressed or released
-  // only after we have observed X consecutive HIGH/LOW samples.
-  bool previous_state = (digitalRead(m_pin) == m_HIGH);
-  while (1) {
-    unsigned char n = 10;
-    while (n > 0) {
-      bool state = (digitalRead(m_pin) == m_HIGH);
-      if (state != previous_state) {
-	previous_state = state;
-	break;
-      }
-      n--;
-    }
-    // If we get here through normal while loop exit, we have a stable value!
-    if (n == 0) return previous_state;
-  }
+  PROFILE_READ();
+  return PortB_t::read(m_mask) == (m_HIGH == HIGH);
 }
 
 
-bool
-Button_t::is_pressed()
-{
-  m_previous_state = m_is_pressed();
-  m_was_pressed  = 0;
-  m_was_released = 0;
-  return m_previous_state;
-}
+template class PowerMinder::ButtonControl_t<ButtonMask_t>;
 
 
-bool
-Button_t::has_been_pressed()
-{
-  loop();
-  bool tmp = m_was_pressed;
-  m_was_pressed  = 0;
-  return tmp;
-}
-
-
-bool
-Button_t::has_been_released()
-{
-  loop();
-  bool tmp = m_was_released;
-  m_was_released  = 0;
-  return tmp;
-}
+#ifdef PIN_CHECK
+// Compiled for the AVR by "make check-pins": each function must use the
+// instruction in its name, without reading & writing back the whole port
 
+#include "LED.h"
 
-void
-Button_t::loop()
-{
-  bool curr_state = m_is_pressed();
-  if (m_previous_state && !curr_state) m_was_released = true;
-  if (!m_previous_state && curr_state) m_was_pressed  = true;
-  m_previous_state = curr_state;
-}
+extern "C" void check_cbi_button_input() {PortBPin_t<4>::input();}
+extern "C" void check_sbi_button_pull()  {ButtonPin_t<4, HIGH, HIGH>::init();}
+extern "C" void check_sbic_button_read() {if (ButtonPin_t<4, HIGH>::read()) LedPin_t<0>::on();}
+extern "C" void check_sbic_button_low()  {if (ButtonPin_t<4, LOW>::read()) LedPin_t<0>::on();}
+#endif
@@ -19,11 +19,92 @@
 
 
 #include <stdint.h>
+#include <Arduino.h>
+#include "Gpio.h"
+#include "Profile.h"
 
 namespace PowerMinder {
 
-  /** Class to manage & debounce a button connected to a digital pin */
-  class Button_t {
+  /** Number of consecutive identical reads giving the state of a button.
+   *  The reads are only a few cycles apart, so they filter glitches, not the bounce itself:
+   *  that is left to the callers, which run on every pin change or every few milliseconds.
+   */
+  static const uint8_t DEBOUNCE_READS = 3;
+
+  /** Software debouncing: sample the button until it reads the same DEBOUNCE_READS consecutive times.
+   *  Returns TRUE if it is pressed.
+   *
+   *  All switches have "bounce" and a single sampling is not reliable of the state
+   *  of the button as it may bounce between ON/OFF states.
+   */
+  template <typename Input>   ///< Has read(), returning TRUE if the button reads as pressed
+  bool debounce(const Input &input)
+  {
+    bool    previous_state = input.read();
+    uint8_t n = 1;
+    while (n < DEBOUNCE_READS) {
+      bool state = input.read();
+      if (state == previous_state) n++;
+      else {
+	previous_state = state;
+	n = 1;
+      }
+    }
+    return previous_state;
+  }
+
+
+  /** A button on a PORTB pin known at compile time.
+   *  Each read is meant to compile to a single sbic/sbis instruction (see make check-pins).
+   */
+  template <uint8_t Pin,                  ///< Pin number reading the button
+	    uint8_t ActiveLevel = HIGH,   ///< Digital value when pressed
+	    uint8_t Pull        = LOW>    ///< Pull up/down
+  struct ButtonPin_t {
+    /** Set the pin as an input, with its pull up/down */
+    static void init()
+    {
+      PortBPin_t<Pin>::input();
+      if (Pull == HIGH) PortBPin_t<Pin>::set();
+      else PortBPin_t<Pin>::clear();
+    }
+
+    /** Does the button read as pressed right now? (not debounced) */
+    static bool read()
+    {
+      PROFILE_READ();
+      return PortBPin_t<Pin>::read() == (ActiveLevel == HIGH);
+    }
+  };
+
+
+  /** A button on a PORTB pin specified at run time */
+  class ButtonMask_t {
+
+  public:
+    /** Set the pin as an input, with its pull up/down */
+    void init();
+
+    /** Does the button read as pressed right now? (not debounced) */
+    bool read() const;
+
+    constexpr ButtonMask_t(uint8_t pin,             ///< Pin number reading the button
+			   uint8_t when_pressed,    ///< digital value when pressed
+			   uint8_t pulled)          ///< Pull up/down
+      : m_mask(PortB_t::mask(pin)), m_pulled(pulled), m_HIGH((when_pressed == HIGH) ? HIGH : LOW)
+    {
+    }
+
+  private:
+    uint8_t  m_mask;
+    uint8_t  m_pulled;
+    uint8_t  m_HIGH;
+  };
+
+
+  /** Class to manage & debounce a button read by a ButtonPin_t or a ButtonMask_t */
+  template <typename Input>
+  class ButtonControl_t : private Input {
 
   public:
     /** Initialize the button */
@@ -44,22 +125,99 @@ namespace PowerMinder {
   // Looks like Sketches don't support private constructors...
   //private:
     /** Create a button control class */
-    Button_t(uint8_t pin,                     ///< Pin number controlling the LED
-	     uint8_t when_pressed = HIGH,     ///< digital value when pressed
-	     uint8_t pulled       = LOW);     ///< Pull up/down
-    ~Button_t();
+    explicit constexpr ButtonControl_t(const Input &input = Input())   ///< Only needed for a ButtonMask_t
+      : Input(input), m_previous_state(0), m_was_pressed(0), m_was_released(0)
+    {
+    }
 
   private:
     /** Check the state of the button, with SW debouncing */
     bool m_is_pressed();
 
-    uint8_t  m_pin;
-    uint8_t  m_pulled;
     bool     m_previous_state;
     bool     m_was_pressed;
     bool     m_was_released;
+  };
 
-    uint8_t  m_HIGH;
+
+  /** Class to manage & debounce a button connected to a digital pin.
+   *  The pin is specified at run time but read directly from PORTB, like ButtonPin_t.
+   */
+  class Button_t : public ButtonControl_t<ButtonMask_t> {
+
+  public:
+    /** Create a button control class */
+    constexpr Button_t(uint8_t pin,                     ///< Pin number reading the button
+		       uint8_t when_pressed = HIGH,     ///< digital value when pressed
+		       uint8_t pulled       = LOW)      ///< Pull up/down
+      : ButtonControl_t<PowerMinder::ButtonMask_t>(PowerMinder::ButtonMask_t(pin, when_pressed, pulled))
+    {
+    }
   };
 
+
+  template <typename Input>
+  void
+  ButtonControl_t<Input>::init()
+  {
+    Input::init();
+    m_previous_state = m_is_pressed();
+  }
+
+
+  template <typename Input>
+  bool
+  ButtonControl_t<Input>::m_is_pressed()
+  {
+    PROFILE_SCOPE(BUTTON_IO);
+    return debounce(static_cast<const Input &>(*this));
+  }
+
+
+  template <typename Input>
+  bool
+  ButtonControl_t<Input>::is_pressed()
+  {
+    m_previous_state = m_is_pressed();
+    m_was_pressed  = 0;
+    m_was_released = 0;
+    return m_previous_state;
+  }
+
+
+  template <typename Input>
+  bool
+  ButtonControl_t<Input>::has_been_pressed()
+  {
+    loop();
+    bool tmp = m_was_pressed;
+    m_was_pressed  = 0;
+    return tmp;
+  }
+
+
+  template <typename Input>
+  bool
+  ButtonControl_t<Input>::has_been_released()
+  {
+    loop();
+    bool tmp = m_was_released;
+    m_was_released  = 0;
+    return tmp;
+  }
+
+
+  template <typename Input>
+  void
+  ButtonControl_t<Input>::loop()
+  {
+    bool curr_state = m_is_pressed();
+    if (m_previous_state && !curr_state) m_was_released = true;
+    if (!m_previous_state && curr_state) m_was_pressed  = true;
+    m_previous_state = curr_state;
+  }
+
+  // Compiled once, in Button.cpp
+  extern template class ButtonControl_t<ButtonMask_t>;
+
 }
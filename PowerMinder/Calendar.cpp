@@ -20,10 +20,14 @@
 
 
 #include <stdint.h>
+#include <string.h>
 #ifdef DEBUG
 #include <stdio.h>
 #endif
 #include "Calendar.h"
+#ifdef TEST
+#include "Crc16.h"
+#endif
 
 using namespace PowerMinder;
 
@@ -32,39 +36,42 @@ using namespace PowerMinder;
 const unsigned int MAX_CHANGE_POINTS = 5;
 
 
-/** A daily schedule, composed of MAX_CHANGE_POINTS period change points.
- *
- *  The first period change point MUST be at midnight (m_time == 0).
- *  Subsequent period change points must be in chronological order.
- *  If fewer than MAX_CHANGE_POINTS period change points are required,
- *  the daily schedule must be padded with dummy period change points with
- *  a m_time == 0.
- *
- *  Time is specified using 30-min precision, so 0 == midnight, 5 = 2:30a, and 28 == 2:00p.
- */
-
-typedef struct schedule_s {
-  struct period_change_s {
-    uint8_t  m_time   : 6;  ///< Time of the period change, in 30-min intervals
-    period_t m_period : 2;  ///< Type of period that starts at this time
-  } m_periodChange[MAX_CHANGE_POINTS];
-} schedule_t;
-
-
-
-/** A season specification.
- * 
- *  A season starts at the specified date and lasts until the start of the next season.
- * 
- *  A calendar is composed by a an array of season descriptors, in chronological order.
- *  A calendar is terminated by a season with an ID == 0xFF.
- */
-typedef struct season_s {
-  uint8_t m_startMonth;
-  uint8_t m_startDay;
-  uint8_t m_workdayScheduleIdx;
-  uint8_t m_holidayScheduleIdx;
-} season_t;
+namespace PowerMinder {
+
+  /** A daily schedule, composed of MAX_CHANGE_POINTS period change points.
+   *
+   *  The first period change point MUST be at midnight (m_time == 0).
+   *  Subsequent period change points must be in chronological order.
+   *  If fewer than MAX_CHANGE_POINTS period change points are required,
+   *  the daily schedule must be padded with dummy period change points with
+   *  a m_time == 0.
+   *
+   *  Time is specified using 30-min precision, so 0 == midnight, 5 = 2:30a, and 28 == 2:00p.
+   */
+
+  typedef struct schedule_s {
+    struct period_change_s {
+      uint8_t  m_time   : 6;  ///< Time of the period change, in 30-min intervals
+      period_t m_period : 2;  ///< Type of period that starts at this time
+    } m_periodChange[MAX_CHANGE_POINTS];
+  } schedule_t;
+
+
+
+  /** A season specification.
+   * 
+   *  A season starts at the specified date and lasts until the start of the next season.
+   * 
+   *  A calendar is composed by a an array of season descriptors, in chronological order.
+   *  A calendar is terminated by a season with an ID == 0xFF.
+   */
+  typedef struct season_s {
+    uint8_t m_startMonth;
+    uint8_t m_startDay;
+    uint8_t m_workdayScheduleIdx;
+    uint8_t m_holidayScheduleIdx;
+  } season_t;
+}
 
 
 
@@ -92,167 +99,261 @@ static const season_t PGE_seasons[3] = {{5, 1, 0, 1},
 
 
 
-/** Where the user-defined schedules are stored in NVRAM */
-static schedule_t *user_schedules = 0x0000; //*/ new schedule_t[31];
-// When using new operator these two lines do not compile.  Several attempts to make this comile have failed.
-// I am at a lostt at this moment  reverted to null.
-
-/** Where the user-defined seasons are stored in NVRAM */
-static season_t *user_seasons = 0x0000;//*/ new season_t[64];
-
-
-/** Days in months */
-static uint8_t daysInMonth[12] = {31, 28, 31, 30, 31, 30,
-				  31, 31, 30, 31, 30, 31};
-
+/** Where the user-defined schedules are edited.
+ *  Schedule #0 starts out undefined (its first period change is not at 00:00).
+ */
+static schedule_t user_schedules[Calendar::MAX_SCHEDULES] = {{{{1, OFF_PEAK}}}};
 
+/** Where the user-defined seasons are edited.
+ *  There is always room for the terminating season.
+ */
+static season_t user_seasons[Calendar::MAX_SEASONS + 1];
 
-/** PIMPL idiom to truly hide private stuff */
-struct Calendar::Implementation {
+/** Number of period changes in each user-defined schedule, 0 if undefined */
+static uint8_t user_changes[Calendar::MAX_SCHEDULES];
 
-  /** Set of active schedules (default ones or user-defined) */
-  const schedule_t *schedules;
+/** Number of uses of each user-defined schedule by the user-defined seasons */
+static uint8_t user_uses[Calendar::MAX_SCHEDULES];
 
-  /** Active calendar (default one or user-defined) */
-  const season_t *seasons;
+/** Number of user-defined seasons */
+static uint8_t user_nSeasons = 0;
 
+/** User-defined schedules that are defined & used, one bit per schedule */
+static uint8_t user_defined = 0;
+static uint8_t user_used    = 0;
 
-  /** The current cost period, as found by Calendar::fidnPeriod */
-  period_t m_currentCost;
+/** The user-defined tables were edited since they were last committed */
+static bool user_dirty = false;
 
-  /** The next cost period, as found by Calendar::fidnPeriod */
-  period_t m_nextPeriod;
+/** The user-defined tables last committed.
+ *  Only referenced by commit(), so they take no space if it is never called.
+ */
+static schedule_t committed_schedules[Calendar::MAX_SCHEDULES];
+static season_t   committed_seasons[Calendar::MAX_SEASONS + 1];
 
-  /** The number minutes until the start of the next period */
-  unsigned short m_timeToNextPeriod;
+/** The tables in use: the default ones, or those last committed */
+static const schedule_t *live_schedules = PGE_schedules;
+static const season_t   *live_seasons   = PGE_seasons;
 
 
-  Implementation()
-    : schedules(user_schedules), seasons(user_seasons)
-  {
-    if (schedules[0].m_periodChange[0].m_time != 0) schedules = PGE_schedules;
-    if (seasons[0].m_startMonth == 0) seasons = PGE_seasons;
-  }
+/** Days in the specified month (1-12), in non-leap years.
+ *  Unpacked from 2 bits per month above 28, to keep the table out of SRAM.
+ */
+static inline uint8_t
+daysInMonth(uint8_t month)
+{
+  return 28 + ((0x3BBEECCUL >> (2 * month)) & 3);
+}
 
-  ~Implementation()
-  {}
 
 
-#ifdef DEBUG  
-  void printPeriodChange(int unsigned time,
-			 period_t     cost)
-  {
-    printf("      %02d:%02d ", time / 2, time % 2 * 30);
+#ifdef DEBUG
+static void
+printPeriodChange(int unsigned time,
+		  period_t     cost)
+{
+  printf("      %02d:%02d ", time / 2, time % 2 * 30);
 
-    switch (cost) {
+  switch (cost) {
 
-    case OFF_PEAK: {
-      printf("OFF-PEAK");
-      break;
-    }
+  case OFF_PEAK: {
+    printf("OFF-PEAK");
+    break;
+  }
 
-    case PARTIAL_PEAK: {
-      printf("MID-PEAK");
-      break;
-    }
+  case PARTIAL_PEAK: {
+    printf("MID-PEAK");
+    break;
+  }
 
-    case ON_PEAK: {
-      printf("ON-PEAK");
-      break;
-    }
+  case ON_PEAK: {
+    printf("ON-PEAK");
+    break;
+  }
 
-    default: {
-      printf("?? (%d)", cost);
-      break;
-    }
+  default: {
+    printf("?? (%d)", cost);
+    break;
+  }
 
-    }
-    printf("\n");
   }
+  printf("\n");
+}
 
-  void printSchedule(const schedule_t *schedule)
-  {
-    printPeriodChange(schedule->m_periodChange[0].m_time,
+static void
+printSchedule(const schedule_t *schedule)
+{
+  printPeriodChange(schedule->m_periodChange[0].m_time,
 		      schedule->m_periodChange[0].m_period);
 
-    unsigned char i = 1;
-    while (i < MAX_CHANGE_POINTS &&
+  unsigned char i = 1;
+  while (i < MAX_CHANGE_POINTS &&
 	   schedule->m_periodChange[i].m_time > 0) {
 
-      printPeriodChange(schedule->m_periodChange[i].m_time,
+    printPeriodChange(schedule->m_periodChange[i].m_time,
 			schedule->m_periodChange[i].m_period);
-      i++;
-    }
+    i++;
   }
+}
 #endif
 
-  /** Find the index of the schedule corresponding to the specified date */
-  unsigned char
-  findScheduleIndex(uint8_t month,     ///< 1-12
-		    uint8_t day,       ///< 1-31
-		    uint8_t dayOfWeek) ///< 1-7  (1 == Sunday)
-  {
-    unsigned char i = 0;
-
-    // Find the first calendar entry with a start date
-    // PAST the current date. The current entry will be
-    // the one before it. If we reach the end of the calendar,
-    // that means there are no further entries, so the last one
-    // is the current one.
-    while (seasons[i].m_startMonth > 0) {
-      if (seasons[i].m_startMonth > month ||
-          seasons[i].m_startDay > day) {
-	if (i == 0) {
-	  // Calendars are circular, hence the entry previous to
-	  // the first one is the last one
-	  while (seasons[++i].m_startMonth != 0);
-	}
-	break;
-      }
-    }
-    // “i” is now the index of the current season in the calendar
 
-    // Find the relevant schedule for this season
-    unsigned char j = seasons[i].m_workdayScheduleIdx;
-    if (dayOfWeek > 5) j = seasons[i].m_holidayScheduleIdx;
-    
-    return j;
+void
+Calendar::init()
+{
+  selectTables();
+
+  m_image.close();
+  m_tables = 0;
+
+  m_currentCost      = OFF_PEAK;
+  m_nextPeriod       = OFF_PEAK;
+  m_timeToNextPeriod = 0;
+}
+
+
+void
+Calendar::selectTables()
+{
+  m_schedules = live_schedules;
+  m_seasons   = live_seasons;
+}
+
+
+bool
+Calendar::commit()
+{
+  // All deleted: back to the defaults
+  if (user_defined == 0 && user_nSeasons == 0) {
+    live_schedules = PGE_schedules;
+    live_seasons   = PGE_seasons;
+  }
+  else {
+    // Every schedule used by the seasons must be defined
+    if (user_nSeasons == 0 || (user_used & ~user_defined) != 0) return false;
+
+    memcpy(committed_schedules, user_schedules, sizeof(committed_schedules));
+    memcpy(committed_seasons, user_seasons, sizeof(committed_seasons));
+    live_schedules = committed_schedules;
+    live_seasons   = committed_seasons;
   }
 
+  user_dirty = false;
+  selectTables();
+  return true;
+}
 
-};
 
+bool
+Calendar::isPending() const
+{
+  return user_dirty;
+}
 
 
+bool
+Calendar::useImage(const uint8_t         *image,
+		   uint16_t               size,
+		   TariffImage_t::read_t  read)
+{
+  m_tables = 0;
+  return m_image.open(image, size, read);
+}
+
 
-Calendar::Calendar()
-  : m_impl(new Implementation)
+void
+Calendar::useTables(const TariffTables_t *tables)
 {
+  m_image.close();
+  m_tables = tables;
 }
 
 
+uint8_t
+Calendar::startMonth(unsigned char season) const
+{
+  if (m_image.isOpen()) return (season < m_image.seasons()) ? m_image.startMonth(season) : 0;
+  return m_seasons[season].m_startMonth;
+}
 
-Calendar::~Calendar()
+
+uint8_t
+Calendar::startDay(unsigned char season) const
 {
-  delete m_impl;
+  if (m_image.isOpen()) return m_image.startDay(season);
+  return m_seasons[season].m_startDay;
 }
 
 
+uint8_t
+Calendar::periodChange(unsigned char schedule,
+		       unsigned char k) const
+{
+  if (m_tables) {
+    uint8_t at = m_tables->read(m_tables->starts + schedule) + k;
+    return (at < m_tables->read(m_tables->starts + schedule + 1)) ? m_tables->read(m_tables->transitions + at) : 0;
+  }
+  if (m_image.isOpen()) return (k < m_image.changes(schedule)) ? m_image.change(schedule, k) : 0;
+  if (k >= MAX_CHANGE_POINTS) return 0;
+  return (m_schedules[schedule].m_periodChange[k].m_period << 6) | m_schedules[schedule].m_periodChange[k].m_time;
+}
+
+
+unsigned char
+Calendar::findScheduleIndex(uint8_t month,
+			    uint8_t day,
+			    uint8_t dayOfWeek) const
+{
+  bool weekend = (dayOfWeek == 1 || dayOfWeek == 7);
+
+  if (m_tables) {
+    uint8_t both = m_tables->read(m_tables->days + (month - 1) * 31 + day - 1);
+    return (weekend) ? both >> 4 : both & 0x0F;
+  }
+
+  unsigned char i = 0;
+
+  // Find the first calendar entry with a start date
+  // PAST the current date. The current entry will be
+  // the one before it. If we reach the end of the calendar,
+  // that means there are no further entries, so the last one
+  // is the current one.
+  while (startMonth(i) > 0 &&
+	   (startMonth(i) < month ||
+	    (startMonth(i) == month && startDay(i) <= day))) i++;
+
+  if (i == 0) {
+    // Calendars are circular, hence the entry previous to
+    // the first one is the last one
+    while (startMonth(i+1) != 0) i++;
+  }
+  else i--;
+  // “i” is now the index of the current season in the calendar
+
+  // Find the relevant schedule for this season
+  if (m_image.isOpen()) return m_image.scheduleIdx(i, weekend);
+
+  return (weekend) ? m_seasons[i].m_holidayScheduleIdx : m_seasons[i].m_workdayScheduleIdx;
+}
+
 
 bool
 Calendar::defineSchedule(unsigned char id,
 			 period_t      cost_at_00_00)
 {
-  if (id > 31) return false;
+  if (id >= MAX_SCHEDULES) return false;
+  if (cost_at_00_00 > ON_PEAK) return false;
 
   user_schedules[id].m_periodChange[0].m_time = 0;
   user_schedules[id].m_periodChange[0].m_period = cost_at_00_00;
 
-  for (int i = 1; i < MAX_CHANGE_POINTS; i++ ) {
+  for (unsigned char i = 1; i < MAX_CHANGE_POINTS; i++ ) {
     user_schedules[id].m_periodChange[i].m_time = 0;
   }
 
-  if (id == 0) m_impl->schedules = user_schedules;
+  user_changes[id] = 1;
+  user_defined |= 1 << id;
+  user_dirty = true;
 
   return true;
 }
@@ -264,36 +365,46 @@ Calendar::addPeriod(unsigned char id,
 		    unsigned char mins,
 		    period_t      cost)
 {
-  if (id > 31) return false;
-  if (user_schedules[id].m_periodChange[0].m_time != 0) return false;
+  if (id >= MAX_SCHEDULES) return false;
+  if (user_changes[id] == 0) return false;
   if (hrs > 23) return false;
   if (mins > 59) return false; 
+  if (cost > ON_PEAK) return false;
 
-  int time = (hrs * 60 * mins + 15) / 30;
-  if (hrs == 0) return false;
-
-  // Find the next "empty" entry in the scedule
-  for (int i = 1; i < MAX_CHANGE_POINTS; i++ ) {
-    if (user_schedules[id].m_periodChange[i].m_time == 0 ||
-	user_schedules[id].m_periodChange[i].m_time == time) {
-      user_schedules[id].m_periodChange[i].m_time = time;
-      user_schedules[id].m_periodChange[i].m_period = cost;
-      return true;
-    }
+  unsigned char time = (hrs * 60 + mins + 15) / 30;
+  // 00:00 is specified by defineSchedule() and 23:45+ rounds to the next day
+  if (time == 0 || time >= 48) return false;
 
+  // Only the last period change is a neighbor: replace it, or follow it
+  unsigned char n    = user_changes[id];
+  unsigned char last = user_schedules[id].m_periodChange[n-1].m_time;
+  if (n > 1 && time == last) n--;
+  else {
     // Not in chronological order?
-    if (user_schedules[id].m_periodChange[i].m_time > time) return false;
+    if (time < last) return false;
+    // We ran out of room!
+    if (n == MAX_CHANGE_POINTS) return false;
   }
 
-  // We ran out of room!
-  return false;
+  user_schedules[id].m_periodChange[n].m_time = time;
+  user_schedules[id].m_periodChange[n].m_period = cost;
+  user_changes[id] = n + 1;
+  user_dirty = true;
+
+  return true;
 }
 
 
 bool
 Calendar::deleteSchedules()
 {
-  m_impl->schedules = PGE_schedules;
+  for (unsigned char i = 0; i < MAX_SCHEDULES; i++) {
+    user_schedules[i].m_periodChange[0].m_time = 1;
+    user_changes[i] = 0;
+  }
+  user_defined = 0;
+  user_dirty = true;
+  return true;
 }
 
 
@@ -304,16 +415,35 @@ Calendar::defineSeason(unsigned char id,
 		       unsigned char workdayScheduleId,
 		       unsigned char weekendScheduleId)
 {
-  if (id > 63) return false;
+  if (id >= MAX_SEASONS || id > user_nSeasons) return false;
   if (month < 1 || month > 12) return false;
-  if (day < 1 || day > daysInMonth[month-1]) return false;
+  if (day < 1 || day > daysInMonth(month)) return false;
+  if (workdayScheduleId >= MAX_SCHEDULES || weekendScheduleId >= MAX_SCHEDULES) return false;
+
+  // Must start after the previous season and before the next one, if any
+  uint16_t date = month * 32 + day;
+  if (id > 0 &&
+      user_seasons[id-1].m_startMonth * 32 + user_seasons[id-1].m_startDay >= date) return false;
+  if (id + 1 < user_nSeasons &&
+      user_seasons[id+1].m_startMonth * 32 + user_seasons[id+1].m_startDay <= date) return false;
+
+  // A redefined season no longer uses its previous schedules
+  if (id < user_nSeasons) {
+    if (--user_uses[user_seasons[id].m_workdayScheduleIdx] == 0) user_used &= ~(1 << user_seasons[id].m_workdayScheduleIdx);
+    if (--user_uses[user_seasons[id].m_holidayScheduleIdx] == 0) user_used &= ~(1 << user_seasons[id].m_holidayScheduleIdx);
+  }
+  else user_nSeasons++;
+
+  user_uses[workdayScheduleId]++;
+  user_uses[weekendScheduleId]++;
+  user_used |= (1 << workdayScheduleId) | (1 << weekendScheduleId);
 
   user_seasons[id].m_startMonth           = month;
   user_seasons[id].m_startDay             = day;
   user_seasons[id].m_workdayScheduleIdx = workdayScheduleId;
   user_seasons[id].m_holidayScheduleIdx = weekendScheduleId;
 
-  if (id == 0) m_impl->seasons = user_seasons;
+  user_dirty = true;
 
   return true;
 }
@@ -322,7 +452,16 @@ Calendar::defineSeason(unsigned char id,
 bool
 Calendar::deleteSeasons()
 {
-  m_impl->seasons = PGE_seasons;
+  for (unsigned char i = 0; i < MAX_SEASONS; i++) {
+    user_seasons[i].m_startMonth = 0;
+  }
+  for (unsigned char i = 0; i < MAX_SCHEDULES; i++) {
+    user_uses[i] = 0;
+  }
+  user_nSeasons = 0;
+  user_used = 0;
+  user_dirty = true;
+  return true;
 }
 
 
@@ -355,7 +494,7 @@ Calendar::check(bool user)
   while (seasons[i+1].m_startMonth > 0) {
     if (seasons[i].m_startMonth > seasons[i+1].m_startMonth ||
 	(seasons[i].m_startMonth == seasons[i+1].m_startMonth &&
-	 seasons[i].m_startDay > seasons[i+1].m_startDay)) {
+	 seasons[i].m_startDay >= seasons[i+1].m_startDay)) {
       fprintf(stderr, "ERROR: Seasons #%d & #%d are not in chronological order (mm/dd): %d/%d..%d/%d\n",
 	      i, i+1, seasons[i].m_startMonth, seasons[i].m_startDay,
 	      seasons[i+1].m_startMonth, seasons[i+1].m_startDay);
@@ -374,16 +513,8 @@ Calendar::check(bool user)
   unsigned long long usedSchedules = 0;
   while (seasons[i].m_startMonth > 0) {
     if (seasons[i].m_startMonth > 12
-	|| seasons[i].m_startDay < 0
-	|| seasons[i].m_startDay >= daysInMonth[seasons[i].m_startMonth-1] ) {
-      fprintf(stderr, "ERROR: Season #%d has an invalid date (mm/dd): %d/%d\n",
-	      i, seasons[i].m_startMonth, seasons[i].m_startDay);
-      is_ok = false;
-    }
-
-    if (seasons[i].m_startMonth > 12
-	|| seasons[i].m_startDay < 0
-	|| seasons[i].m_startDay >= daysInMonth[seasons[i].m_startMonth-1] ) {
+	|| seasons[i].m_startDay < 1
+	|| seasons[i].m_startDay > daysInMonth(seasons[i].m_startMonth) ) {
       fprintf(stderr, "ERROR: Season #%d has an invalid date (mm/dd): %d/%d\n",
 	      i, seasons[i].m_startMonth, seasons[i].m_startDay);
       is_ok = false;
@@ -395,15 +526,15 @@ Calendar::check(bool user)
 	      i, seasons[i].m_workdayScheduleIdx);
       is_ok = false;
     } else {
-      usedSchedules |= 1 << seasons[i].m_workdayScheduleIdx;
+      usedSchedules |= 1ULL << seasons[i].m_workdayScheduleIdx;
     }
     if (seasons[i].m_holidayScheduleIdx > 63
 	|| schedules[seasons[i].m_holidayScheduleIdx].m_periodChange[0].m_time != 0) {
       fprintf(stderr, "ERROR: Season #%d has an invalid holiday schedule ID: %d\n",
-	      i, seasons[i].m_workdayScheduleIdx);
+	      i, seasons[i].m_holidayScheduleIdx);
       is_ok = false;
     } else {
-      usedSchedules |= 1 << seasons[i].m_holidayScheduleIdx;
+      usedSchedules |= 1ULL << seasons[i].m_holidayScheduleIdx;
     }
     
     i++;
@@ -424,16 +555,17 @@ Calendar::check(bool user)
       }
 
       // Subsequent period changes must be in increasing order
-      int j = 0;
+      unsigned int j = 0;
       while (j+1 < MAX_CHANGE_POINTS
-	     && schedules[j+1].m_periodChange[0].m_time != 0) {
-	if (schedules[j].m_periodChange[0].m_time >= schedules[j+1].m_periodChange[0].m_time) {
+	     && schedules[i].m_periodChange[j+1].m_time != 0) {
+	if (schedules[i].m_periodChange[j].m_time >= schedules[i].m_periodChange[j+1].m_time) {
 	  fprintf(stderr, "ERROR: Period changes #%d & #%d in schedule #%d are not in chronological order: %02d:%02d..%02d:%02d\n",
 		  j+1, j+2, i,
 		  schedules[i].m_periodChange[j].m_time/2, (schedules[i].m_periodChange[j].m_time % 2) * 30,
 		  schedules[i].m_periodChange[j+1].m_time/2, (schedules[i].m_periodChange[j+1].m_time % 2) * 30);
 	  is_ok = false;
 	}
+	j++;
       }
     } else {
       fprintf(stderr, "WARNING: Schedule #%d is not used.\n", i);
@@ -459,9 +591,9 @@ Calendar::print(bool user)
   while (seasons[i].m_startMonth > 0) {
     printf("  %02d/%02d\n", seasons[i].m_startMonth, seasons[i].m_startDay);
     printf("    Workday Schedule:\n");
-    m_impl->printSchedule(&schedules[seasons[i].m_workdayScheduleIdx]);
+    printSchedule(&schedules[seasons[i].m_workdayScheduleIdx]);
     printf("    Weekend Schedule:\n");
-    m_impl->printSchedule(&schedules[seasons[i].m_holidayScheduleIdx]);
+    printSchedule(&schedules[seasons[i].m_holidayScheduleIdx]);
 
     i++;
   }
@@ -476,76 +608,341 @@ Calendar::findPeriod(uint8_t month,
 		     uint8_t hour,
 		     uint8_t min)
 {
-  unsigned char schedIdx = m_impl->findScheduleIndex(month, day, dayOfWeek);
-  
-  // Find the period based on current time
-  uint8_t timeOfDay = 2 * hour + min / 30;
+  findPeriods(1, &month, &day, &dayOfWeek, &hour, &min, &m_currentCost, &m_nextPeriod, &m_timeToNextPeriod);
+  return true;
+}
+
+
+void
+Calendar::findPeriods(size_t         n,
+		      const uint8_t  month[],
+		      const uint8_t  day[],
+		      const uint8_t  dayOfWeek[],
+		      const uint8_t  hour[],
+		      const uint8_t  min[],
+		      period_t       cost[],
+		      period_t       next[],
+		      uint16_t       timeToNext[]) const
+{
+  // The last period found, valid from..to on the last date
+  uint8_t       lastMonth = 0;
+  uint8_t       lastDay   = 0;
+  uint8_t       lastDayOfWeek = 0;
+  unsigned char schedIdx  = 0;
+  uint8_t       from      = 0;
+  uint32_t      to        = 0;
+  period_t      current   = OFF_PEAK;
+  period_t      following = OFF_PEAK;
+
+  for (size_t i = 0; i < n; i++) {
+    uint8_t timeOfDay = 2 * hour[i] + min[i] / 30;
+
+    if (month[i] != lastMonth || day[i] != lastDay || dayOfWeek[i] != lastDayOfWeek) {
+      schedIdx      = findScheduleIndex(month[i], day[i], dayOfWeek[i]);
+      lastMonth     = month[i];
+      lastDay       = day[i];
+      lastDayOfWeek = dayOfWeek[i];
+      to            = 0;
+    }
+    if (timeOfDay < from || timeOfDay >= to) {
+      current = findPeriod(schedIdx, month[i], day[i], dayOfWeek[i], timeOfDay, from, to, following);
+    }
+
+    uint32_t units = to - timeOfDay;
+    cost[i]       = current;
+    next[i]       = following;
+    timeToNext[i] = (units > 65535 / 30) ? 65535 : units * 30;
+  }
+}
+
+
+period_t
+Calendar::findPeriod(unsigned char  schedIdx,
+		     uint8_t        month,
+		     uint8_t        day,
+		     uint8_t        dayOfWeek,
+		     uint8_t        timeOfDay,
+		     uint8_t       &from,
+		     uint32_t      &to,
+		     period_t      &next) const
+{
+  // Find the period based on current time.
+  // Period changes are (period << 6) | time and there is no change at 00:00 after the first one.
   unsigned char k = 0;
-  while (k < MAX_CHANGE_POINTS-1 &&
-	 m_impl->schedules[schedIdx].m_periodChange[k+1].m_time < timeOfDay) k++;
+  while ((periodChange(schedIdx, k+1) & 0x3F) > 0 &&
+	 (periodChange(schedIdx, k+1) & 0x3F) <= timeOfDay) k++;
   // “k” is now the index of the current period
   
-  m_impl->m_currentCost = m_impl->schedules[schedIdx].m_periodChange[k].m_period;
+  period_t current = (period_t) (periodChange(schedIdx, k) >> 6);
+  from = periodChange(schedIdx, k) & 0x3F;
 
-  // Now find next period
-  m_impl->m_timeToNextPeriod = 0;
-  while (m_impl->schedules[schedIdx].m_periodChange[k].m_period != m_impl->m_currentCost) {
+  // Now find next period, i.e. the next period change to a different cost
+  to = 0;
+  k++;
+  while (1) {
     // Is there another valid period in this schedule?
-    if (k < MAX_CHANGE_POINTS-1 &&
-	m_impl->schedules[schedIdx].m_periodChange[k+1].m_time > 0) {
+    if (k == 0 || (periodChange(schedIdx, k) & 0x3F) > 0) {
+      if ((period_t) (periodChange(schedIdx, k) >> 6) != current) break;
       k++;
       continue;
     }
 
     // Need to go to the next day
-    m_impl->m_timeToNextPeriod += 48;
-    // Must increment M/D/DOW variables to avoid infinite loop
-    // if there is no period change in the next period
-    // e.g. we’re OFF-PEAK and tomorrow is OFF-PEAK all day.
-    month     = month % 12 + 1;
-    day       = (day >= daysInMonth[month-1]) ? 1 : day+1;
-    dayOfWeek = dayOfWeek%7 + 1;
-    schedIdx = m_impl->findScheduleIndex(month, day, dayOfWeek);
+    to += 48;
+    // Give up after a year: there is no period change
+    if (to > 366 * 48) {
+      next = current;
+      to   = 0xFFFFFFFF;
+      return current;
+    }
+    day++;
+    if (day > daysInMonth(month)) {
+      day   = 1;
+      month = month % 12 + 1;
+    }
+    dayOfWeek = dayOfWeek % 7 + 1;
+    schedIdx = findScheduleIndex(month, day, dayOfWeek);
     k = 0;
   }
 
-  m_impl->m_nextPeriod = m_impl->schedules[schedIdx].m_periodChange[k].m_period;
-  m_impl->m_timeToNextPeriod += m_impl->schedules[schedIdx].m_periodChange[k].m_time - timeOfDay;
+  next = (period_t) (periodChange(schedIdx, k) >> 6);
+  to  += periodChange(schedIdx, k) & 0x3F;
 
-  return true;
+  return current;
 }
 
 
 period_t
 Calendar::getCurrentCost()
 {
-  return m_impl->m_currentCost;
+  return m_currentCost;
 }
 
 
 period_t
 Calendar::getNextCost()
 {
-  return m_impl->m_nextPeriod;
+  return m_nextPeriod;
 }
 
 
 uint16_t
 Calendar::getTimeToNextCost()
 {
-  return (m_impl->m_timeToNextPeriod > 65535/30) ? 65535 : m_impl->m_timeToNextPeriod * 30;
+  return m_timeToNextPeriod;
 }
 
 
 #ifdef TEST
+#include <string.h>
+#include <stdlib.h>
+#ifdef TARIFF_HEADER
+// A tariff compiled by tariff-compile -H
+#include TARIFF_HEADER
+#endif
+
+/** Convert a set of schedules & seasons into a tariff, for encoding */
+static void
+toTariff(const schedule_t         *schedules,
+	 uint8_t                   nSchedules,
+	 const season_t           *seasons,
+	 TariffImage_t::tariff_t  &tariff)
+{
+  memset(&tariff, 0, sizeof(tariff));
+
+  while (seasons[tariff.seasons].m_startMonth > 0) {
+    tariff.season[tariff.seasons].month   = seasons[tariff.seasons].m_startMonth;
+    tariff.season[tariff.seasons].day     = seasons[tariff.seasons].m_startDay;
+    tariff.season[tariff.seasons].workday = seasons[tariff.seasons].m_workdayScheduleIdx;
+    tariff.season[tariff.seasons].weekend = seasons[tariff.seasons].m_holidayScheduleIdx;
+    tariff.seasons++;
+  }
+
+  tariff.schedules = nSchedules;
+  for (uint8_t i = 0; i < nSchedules; i++) {
+    uint8_t &n = tariff.schedule[i].changes;
+    do {
+      tariff.schedule[i].change[n] = (schedules[i].m_periodChange[n].m_period << 6) | schedules[i].m_periodChange[n].m_time;
+      n++;
+    } while (n < MAX_CHANGE_POINTS && schedules[i].m_periodChange[n].m_time > 0);
+  }
+}
+
+
 int
-main(int argc, const char* argv[])
+main()
 {
+  int errors = 0;
+
   Calendar c;
+  c.init();
 
   c.check(0);
   c.print();
 
-  return 0;
+  // Round-trip the default tariff through an image
+  TariffImage_t::tariff_t pge, decoded;
+  toTariff(PGE_schedules, sizeof(PGE_schedules) / sizeof(PGE_schedules[0]), PGE_seasons, pge);
+
+  uint8_t  image[128];
+  uint16_t len = TariffImage_t::encode(pge, image, sizeof(image));
+  bool ok = (len > 0 && TariffImage_t::decode(image, len, decoded) && memcmp(&pge, &decoded, sizeof(pge)) == 0);
+  printf("%s: Default tariff encoded in %d bytes and decoded\n", (ok) ? "PASS" : "FAIL", len);
+  if (!ok) errors++;
+
+  // Executing the image in place finds the same periods, every 30 mins for a year
+  Calendar fromImage;
+  fromImage.init();
+  ok = fromImage.useImage(image, len);
+  uint8_t month = 1, day = 1, dayOfWeek = 4;
+  for (int d = 0; ok && d < 365; d++) {
+    for (uint8_t time = 0; ok && time < 48; time++) {
+      c.findPeriod(month, day, dayOfWeek, time / 2, (time % 2) * 30);
+      fromImage.findPeriod(month, day, dayOfWeek, time / 2, (time % 2) * 30);
+      ok = (c.getCurrentCost() == fromImage.getCurrentCost() &&
+	    c.getNextCost() == fromImage.getNextCost() &&
+	    c.getTimeToNextCost() == fromImage.getTimeToNextCost());
+      if (!ok) printf("ERROR: Image differs on %02d/%02d at %02d:%02d\n", month, day, time / 2, (time % 2) * 30);
+    }
+    if (++day > daysInMonth(month)) {
+      day = 1;
+      month++;
+    }
+    dayOfWeek = dayOfWeek % 7 + 1;
+  }
+  printf("%s: Default tariff executed in place\n", (ok) ? "PASS" : "FAIL");
+  if (!ok) errors++;
+
+#ifdef TARIFF_HEADER
+  // The tables compiled from a tariff find the same periods as its image,
+  // every 30 mins for a leap year
+  Calendar fromTables;
+  fromTables.init();
+  fromTables.useTables(&TARIFF_TABLES);
+  ok = fromImage.useImage(TARIFF_IMAGE, sizeof(TARIFF_IMAGE), tariff_read);
+  month = 1; day = 1; dayOfWeek = 4;
+  for (int d = 0; ok && d < 366; d++) {
+    for (uint8_t time = 0; ok && time < 48; time++) {
+      fromImage.findPeriod(month, day, dayOfWeek, time / 2, (time % 2) * 30);
+      fromTables.findPeriod(month, day, dayOfWeek, time / 2, (time % 2) * 30);
+      ok = (fromImage.getCurrentCost() == fromTables.getCurrentCost() &&
+	    fromImage.getNextCost() == fromTables.getNextCost() &&
+	    fromImage.getTimeToNextCost() == fromTables.getTimeToNextCost());
+      if (!ok) printf("ERROR: Tables differ on %02d/%02d at %02d:%02d\n", month, day, time / 2, (time % 2) * 30);
+    }
+    if (++day > daysInMonth(month) + (month == 2)) {
+      day = 1;
+      month++;
+    }
+    dayOfWeek = dayOfWeek % 7 + 1;
+  }
+  printf("%s: Compiled tariff tables\n", (ok) ? "PASS" : "FAIL");
+  if (!ok) errors++;
+  fromImage.useImage(image, len);
+#endif
+
+  // A batch finds the same periods as single queries, every 15 mins for a year,
+  // in chronological order then shuffled
+  static const size_t N = 365 * 96;
+  static uint8_t  months[N], days[N], daysOfWeek[N], hours[N], mins[N];
+  static period_t costs[N], nexts[N];
+  static uint16_t times[N];
+  month = 1; day = 1; dayOfWeek = 4;
+  for (size_t i = 0; i < N; i++) {
+    months[i]     = month;
+    days[i]       = day;
+    daysOfWeek[i] = dayOfWeek;
+    hours[i]      = (i % 96) / 4;
+    mins[i]       = (i % 4) * 15;
+    if (i % 96 == 95) {
+      if (++day > daysInMonth(month)) {
+	day = 1;
+	month++;
+      }
+      dayOfWeek = dayOfWeek % 7 + 1;
+    }
+  }
+  ok = true;
+  for (int pass = 0; pass < 2; pass++) {
+    if (pass == 1) {
+      srand(1);
+      for (size_t i = N - 1; i > 0; i--) {
+	size_t j = rand() % (i + 1);
+	uint8_t t;
+	t = months[i];     months[i]     = months[j];     months[j]     = t;
+	t = days[i];       days[i]       = days[j];       days[j]       = t;
+	t = daysOfWeek[i]; daysOfWeek[i] = daysOfWeek[j]; daysOfWeek[j] = t;
+	t = hours[i];      hours[i]      = hours[j];      hours[j]      = t;
+	t = mins[i];       mins[i]       = mins[j];       mins[j]       = t;
+      }
+    }
+    fromImage.findPeriods(N, months, days, daysOfWeek, hours, mins, costs, nexts, times);
+    for (size_t i = 0; ok && i < N; i++) {
+      c.findPeriod(months[i], days[i], daysOfWeek[i], hours[i], mins[i]);
+      ok = (c.getCurrentCost() == costs[i] &&
+	    c.getNextCost() == nexts[i] &&
+	    c.getTimeToNextCost() == times[i]);
+      if (!ok) printf("ERROR: Batch differs on %02d/%02d at %02d:%02d\n", months[i], days[i], hours[i], mins[i]);
+    }
+  }
+  printf("%s: Batch of %d dates & times\n", (ok) ? "PASS" : "FAIL", (int) N);
+  if (!ok) errors++;
+
+  // Any bit error or a truncation is detected
+  ok = true;
+  for (uint16_t i = 0; i < len * 8; i++) {
+    image[i / 8] ^= 1 << (i % 8);
+    if (fromImage.useImage(image, len)) ok = false;
+    image[i / 8] ^= 1 << (i % 8);
+  }
+  if (fromImage.useImage(image, len - 1)) ok = false;
+  printf("%s: Corrupted images rejected\n", (ok) ? "PASS" : "FAIL");
+  if (!ok) errors++;
+
+  // An image of another version is rejected, even with a valid CRC
+  image[2] = TariffImage_t::VERSION + 1;
+  uint16_t crc = crc16(image, len - 2);
+  image[len - 2] = crc & 0xFF;
+  image[len - 1] = crc >> 8;
+  ok = !fromImage.useImage(image, len);
+  printf("%s: Other versions rejected\n", (ok) ? "PASS" : "FAIL");
+  if (!ok) errors++;
+
+  // Edits are checked against their neighbors and staged until committed.
+  // The user calendar replaces the one in use only once all of its schedules are defined.
+  Calendar u;
+  u.init();
+  ok = !u.isPending();
+  ok = ok && u.defineSchedule(0, OFF_PEAK) && u.addPeriod(0, 14, 0, ON_PEAK) && u.addPeriod(0, 20, 0, OFF_PEAK);
+  ok = ok && !u.addPeriod(0, 19, 30, ON_PEAK) && u.addPeriod(0, 20, 10, PARTIAL_PEAK);
+  ok = ok && u.defineSeason(0, 1, 1, 0, 1) && u.isPending();
+  ok = ok && !u.defineSeason(2, 6, 1, 0, 1) && !u.defineSeason(1, 1, 1, 0, 1) && !u.defineSeason(1, 2, 30, 0, 1);
+  ok = ok && !u.commit() && u.isPending();
+  ok = ok && u.findPeriod(1, 8, 4, 8, 0) && u.getCurrentCost() == PARTIAL_PEAK;
+  ok = ok && u.defineSchedule(1, OFF_PEAK) && u.isPending() && u.check(true);
+  ok = ok && u.findPeriod(1, 8, 4, 8, 0) && u.getCurrentCost() == PARTIAL_PEAK;
+  ok = ok && u.commit() && !u.isPending();
+  ok = ok && u.findPeriod(1, 8, 4, 8, 0) && u.getCurrentCost() == OFF_PEAK;
+  ok = ok && u.findPeriod(1, 8, 4, 20, 0) && u.getCurrentCost() == PARTIAL_PEAK;
+
+  // A failed commit keeps the calendar last committed, also used by other Calendars
+  ok = ok && u.defineSeason(1, 6, 1, 2, 1) && u.isPending() && !u.commit();
+  ok = ok && u.findPeriod(6, 3, 4, 15, 0) && u.getCurrentCost() == ON_PEAK;
+  Calendar v;
+  v.init();
+  ok = ok && v.findPeriod(6, 3, 4, 15, 0) && v.getCurrentCost() == ON_PEAK;
+  ok = ok && u.defineSeason(1, 6, 1, 1, 0) && u.check(true) && u.commit() && !u.isPending();
+  ok = ok && u.findPeriod(6, 3, 4, 15, 0) && u.getCurrentCost() == OFF_PEAK;
+  ok = ok && u.findPeriod(6, 7, 7, 15, 0) && u.getCurrentCost() == ON_PEAK;
+
+  // Seasons without schedules are not a calendar. With neither, the default one is used again.
+  ok = ok && u.deleteSchedules() && u.isPending() && !u.commit();
+  ok = ok && u.findPeriod(6, 7, 7, 15, 0) && u.getCurrentCost() == ON_PEAK;
+  ok = ok && u.deleteSeasons() && u.isPending() && u.commit() && !u.isPending();
+  ok = ok && u.findPeriod(1, 8, 4, 8, 0) && u.getCurrentCost() == PARTIAL_PEAK;
+  printf("%s: User calendar validated edit by edit, used once committed\n", (ok) ? "PASS" : "FAIL");
+  if (!ok) errors++;
+
+  return (errors) ? 1 : 0;
 }
 #endif
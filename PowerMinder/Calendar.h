@@ -18,6 +18,12 @@
 //   permissions and limitations under the License.
 //------------------------------------------------------------------------------
 
+#ifndef _Calendar_h
+#define _Calendar_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include "Tariff.h"
 
 namespace PowerMinder {
 
@@ -28,44 +34,76 @@ namespace PowerMinder {
 			 ON_PEAK      = 2} period_t;
 
 
-  /** Class to manage rate period schedules and calendars */
+  struct schedule_s;
+  struct season_s;
+
+  /** Class to manage rate period schedules and calendars.
+   *
+   *  Every edit of the user-defined schedules and seasons is checked against its
+   *  neighbors only, and keeps track of the schedules defined and used.
+   *  Edits are staged: the calendar in use does not change until they are committed,
+   *  and then only if all the schedules used by the seasons are defined.
+   */
   class Calendar {
   public:
-    Calendar();
-    ~Calendar();
+    /** Number of user-defined schedules that can be stored */
+    static const unsigned char MAX_SCHEDULES = 8;
+
+    /** Number of user-defined seasons that can be stored */
+    static const unsigned char MAX_SEASONS = 16;
+
+    /** Create a calendar. Call init() before use. */
+    constexpr Calendar()
+      : m_schedules(0), m_seasons(0),
+	m_image(), m_tables(0), m_currentCost(OFF_PEAK), m_nextPeriod(OFF_PEAK), m_timeToNextPeriod(0)
+    {
+    }
 
-    /** Define a new user schedule.
-     *  User-defined schedule #0 must be defined for the Calendar to use
-     *  the user-defined schedules instead of the default ones.
+    /** Select the user-defined schedules and seasons last committed, or the default ones */
+    void init();
+
+    /** Use the schedules and seasons of a tariff image instead, read in place.
+     *  The image must stay where it is until the next call to init().
+     *  Returns TRUE if the image is valid.
+     */
+    bool useImage(const uint8_t         *image,                             ///< Where the image is stored
+		  uint16_t               size,                              ///< Bytes available there
+		  TariffImage_t::read_t  read = TariffImage_t::readRam);    ///< How to read them
+
+    /** Use the lookup tables compiled from a tariff instead, read in place.
+     *  The tables must stay where they are until the next call to init().
+     */
+    void useTables(const TariffTables_t *tables);
+
+    /** Define a new user schedule, or redefine one.
      *  Returns TRUE if succesful.
      */
-    bool defineSchedule(unsigned char id,                ///< The schedule ID. Must be 0-31
+    bool defineSchedule(unsigned char id,                ///< The schedule ID. Must be 0..MAX_SCHEDULES-1
 			period_t      cost_at_00_00);    ///< Cost period at 00:00
 
     /** Add a period change time to a previsouly-defined scheduled.
      *  Returns TRUE if succesful.
      *
-     *  Time changes must be specified in chronological order and must be at least 30 mins apart.
+     *  Time changes are rounded to 30 mins and must be specified in chronological order, at least 30 mins apart.
+     *  A time change at the same time as the last one replaces it.
      *  Specify only as many time changes as required.
      */
-    bool addPeriod(unsigned char id,     ///< The schedule ID. Must be 0-31
+    bool addPeriod(unsigned char id,     ///< The schedule ID. Must be 0..MAX_SCHEDULES-1
 		   unsigned char hrs,    ///< Hours of next period change 0..23
 		   unsigned char mins,   ///< Minutes of next period change 0..59
 		   period_t      cost);  ///< Cost period at HH:MM #1
 
-    /** Delete ALL user schedules. The default ones will be used. */
+    /** Delete ALL user schedules. The default ones will be used once the seasons are also deleted & committed. */
     bool deleteSchedules();
 
-    /** Define a new user season.
-     *  User-defined season #0 must be defined for the Calendar to use
-     *  the user-defined seasons instead of the default ones.
+    /** Define a new user season, or redefine one.
      *  Returns TRUE if succesful.
      *
-     *  Seasons must have consecutive ID numbers and must be specified in chronological order
+     *  Seasons must have consecutive ID numbers and must be specified in chronological order.
      *
      *  To define a holiday, insert a 1-day season with an appropriate workday schedule ID.
      */
-    bool defineSeason(unsigned char id,                 ///< The season ID. Must be 0-63
+    bool defineSeason(unsigned char id,                 ///< The season ID. Must be 0..MAX_SEASONS-1
 		      unsigned char month,              ///< The start month 1..12
 		      unsigned char day,                ///< The start day 1..30
 		      unsigned char workdayScheduleId,  ///< The schedule ID for workdays (M-F)
@@ -73,9 +111,20 @@ namespace PowerMinder {
 		      );
 
 
-    /** Delete ALL user seasons. The default ones will be used. */
+    /** Delete ALL user seasons. The default ones will be used once the schedules are also deleted & committed. */
     bool deleteSeasons();
 
+    /** Use the user schedules & seasons edited so far, as a whole, or the default ones if they were all deleted.
+     *  Returns FALSE if a schedule used by a season is not defined, or if there are schedules but no season:
+     *  the calendar in use is then left as is.
+     *
+     *  Other Calendars should be init() again.
+     */
+    bool commit();
+
+    /** Returns TRUE if the user schedules & seasons were edited since they were last committed */
+    bool isPending() const;
+
 #ifdef DEBUG
     /** Check the calendar for correctness. Returns TRUE of it is OK */
     bool check(bool user = true);
@@ -86,6 +135,8 @@ namespace PowerMinder {
 
     /** Find the rate period information corresponding to the specified date and time.
      *  Returns TRUE if succesful.
+     *
+     *  Same as findPeriods() for a single date & time, remembered for the getters below.
      */
     bool findPeriod(uint8_t month,      ///< 1-12
 		    uint8_t day,        ///< 1-31
@@ -94,6 +145,23 @@ namespace PowerMinder {
 		    uint8_t min         ///< 0-59
 		    );
 
+    /** Find the rate period information for a batch of dates & times, in structure-of-arrays form.
+     *
+     *  Does not use or change the state of the calendar, which can then be shared by several threads.
+     *  A cost period found is reused for the following times on the same day, until the next period change:
+     *  dates & times in chronological order are the fastest.
+     */
+    void findPeriods(size_t         n,              ///< Number of dates & times
+		     const uint8_t  month[],        ///< 1-12
+		     const uint8_t  day[],          ///< 1-31
+		     const uint8_t  dayOfWeek[],    ///< 1-7  (1 == Sunday)
+		     const uint8_t  hour[],         ///< 0-23
+		     const uint8_t  min[],          ///< 0-59
+		     period_t       cost[],         ///< Current cost periods
+		     period_t       next[],         ///< Next cost periods
+		     uint16_t       timeToNext[]    ///< Minutes until the next cost period (up to a maximum of 65535 mins)
+		     ) const;
+
     /** Returns the current cost period, as identified by a previous call to findPeriod */
     period_t getCurrentCost();
 
@@ -106,10 +174,61 @@ namespace PowerMinder {
 
 
   private:
-    class Implementation;
-    Implementation *m_impl;
+    /** Use the user-defined schedules and seasons last committed, or the default ones */
+    void selectTables();
+
+    /** Find the index of the schedule corresponding to the specified date */
+    unsigned char findScheduleIndex(uint8_t month,             ///< 1-12
+				    uint8_t day,               ///< 1-31
+				    uint8_t dayOfWeek) const;  ///< 1-7  (1 == Sunday)
+
+    /** Find the cost period at the specified time on a date using the specified schedule,
+     *  and the next cost period. Returns the current cost period.
+     */
+    period_t findPeriod(unsigned char  schedIdx,    ///< Schedule of the date
+			uint8_t        month,       ///< 1-12
+			uint8_t        day,         ///< 1-31
+			uint8_t        dayOfWeek,   ///< 1-7  (1 == Sunday)
+			uint8_t        timeOfDay,   ///< 0-47, in 30-min intervals
+			uint8_t       &from,        ///< Time of the current period change, in 30-min intervals
+			uint32_t      &to,          ///< Start of the next period, in 30-min intervals after 00:00 (0xFFFFFFFF if none)
+			period_t      &next) const;
+
+    /** Start month of a season, 0 past the last one */
+    uint8_t startMonth(unsigned char season) const;
+
+    /** Start day of a season */
+    uint8_t startDay(unsigned char season) const;
+
+    /** A period change in a schedule, as (period << 6) | time in 30-min units.
+     *  0 past the last one.
+     */
+    uint8_t periodChange(unsigned char schedule,
+			 unsigned char k) const;
+
+    /** Set of active schedules (default ones or user-defined) */
+    const schedule_s *m_schedules;
+
+    /** Active calendar (default one or user-defined) */
+    const season_s *m_seasons;
+
+    /** Tariff image used instead, if open */
+    TariffImage_t m_image;
+
+    /** Compiled tariff tables used instead, if any */
+    const TariffTables_t *m_tables;
+
+    /** The current cost period, as found by findPeriod */
+    period_t m_currentCost;
+
+    /** The next cost period, as found by findPeriod */
+    period_t m_nextPeriod;
+
+    /** The number of minutes until the start of the next period */
+    uint16_t m_timeToNextPeriod;
 
   };
   
 }
 
+#endif
@@ -0,0 +1,171 @@
+//------------------------------------------------------------------------------
+//   Copyright 2014 Janick Bergeron
+//   All Rights Reserved Worldwide
+//
+//   Licensed under the Apache License, Version 2.0 (the
+//   "License"); you may not use this file except in
+//   compliance with the License.  You may obtain a copy of
+//   the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in
+//   writing, software distributed under the License is
+//   distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+//   CONDITIONS OF ANY KIND, either express or implied.  See
+//   the License for the specific language governing
+//   permissions and limitations under the License.
+//------------------------------------------------------------------------------
+
+
+
+// Coroutine_t is entirely in Coroutine.h: this only holds its test
+
+
+#ifdef TEST
+// Runs on the host simulator, for millis()
+
+#include <stdio.h>
+
+#include "Coroutine.h"
+
+using namespace PowerMinder;
+
+
+/** A button pressed & released by the test */
+struct button_s {
+  bool pressed;
+  bool released;
+
+  bool has_been_pressed()
+  {
+    bool was = pressed;
+    pressed = false;
+    return was;
+  }
+
+  bool has_been_released()
+  {
+    bool was = released;
+    released = false;
+    return was;
+  }
+};
+
+static Coroutine_t co;
+static button_s    button;
+static bool        ready;
+static int         step;        ///< Last step reached by the flow
+static int         runs;        ///< Number of times the flow ran
+static bool        timed_out;
+
+
+/** Goes through every kind of wait, noting how far it got */
+static void
+flow()
+{
+  runs++;
+
+  CO_BEGIN(co);
+  step = 1;
+  CO_YIELD(co);
+  step = 2;
+  CO_AWAIT(co, ready);
+  step = 3;
+  CO_AWAIT_TIMEOUT(co, 1000);
+  step = 4;
+  CO_AWAIT_PRESS(co, button);
+  step = 5;
+  CO_AWAIT_RELEASE(co, button);
+  step = 6;
+  CO_AWAIT_OR_TIMEOUT(co, ready, 500);
+  timed_out = !co.event();
+  step = 7;
+  CO_AWAIT_OR_TIMEOUT(co, button.has_been_pressed(), 500);
+  timed_out = !co.event();
+  step = 8;
+  if (timed_out) CO_EXIT(co);
+  step = 9;
+  CO_END(co);
+}
+
+
+static int errors = 0;
+
+static void
+check(const char *what,
+      bool        ok)
+{
+  printf("%s: %s\n", (ok) ? "PASS" : "FAIL", what);
+  if (!ok) errors++;
+}
+
+
+/** Run the flow every ms for the specified number of ms */
+static void
+run(unsigned long ms)
+{
+  for (unsigned long i = 0; i < ms; i++) {
+    flow();
+    delay(1);
+  }
+}
+
+
+int
+main(int argc, char *argv[])
+{
+  Sim::init(argc, argv);
+
+  flow();
+  check("Runs up to the first yield", step == 1);
+  flow();
+  check("Resumes after a yield", step == 2);
+  run(10);
+  check("Awaits a condition", step == 2);
+  ready = true;
+  flow();
+  check("Resumes once the condition is true", step == 3);
+
+  ready = false;
+  run(998);
+  check("Awaits a timeout", step == 3);
+  run(3);
+  check("Resumes after the timeout", step == 4);
+
+  run(10);
+  check("Awaits a press", step == 4);
+  button.released = true;
+  run(10);
+  check("Ignores a release while awaiting a press", step == 4);
+  button.pressed = true;
+  flow();
+  check("Resumes after a press, then after the release already seen", step == 6);
+
+  run(499);
+  check("Awaits a condition with a timeout", step == 6);
+  run(2);
+  check("Times out", step == 7 && timed_out);
+
+  run(100);
+  button.pressed = true;
+  flow();
+  check("Resumes on the condition before the timeout, then ends", step == 9 && !timed_out && co.is_done());
+
+  int before = runs;
+  step = 0;
+  flow();
+  check("Does nothing once ended", step == 0 && runs == before + 1);
+
+  co.restart();
+  ready = true;
+  run(1100);
+  button.pressed  = true;
+  flow();
+  button.released = true;
+  run(600);
+  check("Exits early after a restart", step == 8 && timed_out && co.is_done());
+
+  return (errors == 0) ? 0 : 1;
+}
+#endif
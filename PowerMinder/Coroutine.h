@@ -0,0 +1,172 @@
+//------------------------------------------------------------------------------
+//   Copyright 2014 Janick Bergeron
+//   All Rights Reserved Worldwide
+//
+//   Licensed under the Apache License, Version 2.0 (the
+//   "License"); you may not use this file except in
+//   compliance with the License.  You may obtain a copy of
+//   the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in
+//   writing, software distributed under the License is
+//   distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+//   CONDITIONS OF ANY KIND, either express or implied.  See
+//   the License for the specific language governing
+//   permissions and limitations under the License.
+//------------------------------------------------------------------------------
+
+
+
+#ifndef _Coroutine_h
+#define _Coroutine_h
+
+#include <stdint.h>
+#include <Arduino.h>
+
+namespace PowerMinder {
+
+  /** State of a stackless coroutine (a.k.a. protothread).
+   *
+   *  A coroutine is a task function whose body is written sequentially
+   *  between CO_BEGIN() and CO_END(). Each CO_YIELD() or CO_AWAIT*() returns
+   *  to the scheduler and the next call to the task function resumes right
+   *  after it, so the task must be run periodically while it waits.
+   *
+   *  The resume point is the source line of the wait, so:
+   *   - local variables are NOT preserved across waits: use globals or members,
+   *   - there can be only one wait per source line,
+   *   - the body cannot contain a switch statement that spans a wait.
+   *
+   *  For example:
+   *
+   *    Coroutine_t co;
+   *
+   *    void flow(Task_t &task)
+   *    {
+   *      CO_BEGIN(co);
+   *      CO_AWAIT_PRESS(co, button);
+   *      LED::red.on();
+   *      CO_AWAIT_TIMEOUT(co, 1000);
+   *      LED::red.off();
+   *      CO_END(co);
+   *    }
+   */
+  class Coroutine_t {
+
+  public:
+    /** Resume point of a coroutine that has ended */
+    static const uint16_t DONE = 0xFFFF;
+
+    /** Restart the coroutine from its beginning */
+    void restart()
+    {
+      m_line = 0;
+    }
+
+    /** Has the coroutine reached CO_END() or CO_EXIT()? */
+    bool is_done()
+    {
+      return m_line == DONE;
+    }
+
+    /** Did the condition of the last CO_AWAIT_OR_TIMEOUT() occur (vs timing out)? */
+    bool event()
+    {
+      return m_event;
+    }
+
+    /** Have the specified number of milliseconds elapsed since the last wait started? */
+    bool has_elapsed(unsigned long ms)
+    {
+      return millis() - m_stamp >= ms;
+    }
+
+  // Looks like Sketches don't support private constructors...
+  //private:
+    /** Create a coroutine, at its beginning */
+    constexpr Coroutine_t()
+      : m_line(0), m_event(false), m_stamp(0)
+    {
+    }
+
+    uint16_t      m_line;      ///< Resume point (0 == beginning)
+    bool          m_event;     ///< Result of the last CO_AWAIT_OR_TIMEOUT()
+    unsigned long m_stamp;     ///< Time when the last timed wait started
+  };
+
+}
+
+
+/** Marks the intended fall through into the resume point of a wait */
+#if defined(__GNUC__) && __GNUC__ >= 7
+#define CO_FALLTHROUGH __attribute__ ((fallthrough))
+#else
+#define CO_FALLTHROUGH
+#endif
+
+/** Start the body of a coroutine. Does nothing once it has ended. */
+#define CO_BEGIN(co)							\
+  switch ((co).m_line) {						\
+  case PowerMinder::Coroutine_t::DONE: return;				\
+  case 0:
+
+/** End the body of a coroutine */
+#define CO_END(co)							\
+  }									\
+  (co).m_line = PowerMinder::Coroutine_t::DONE;				\
+  return
+
+/** End the coroutine now */
+#define CO_EXIT(co)							\
+  do {									\
+    (co).m_line = PowerMinder::Coroutine_t::DONE;			\
+    return;								\
+  } while (0)
+
+/** Return to the scheduler, resume here on the next run */
+#define CO_YIELD(co)							\
+  do {									\
+    (co).m_line = __LINE__;						\
+    return;								\
+  case __LINE__: ;							\
+  } while (0)
+
+/** Return to the scheduler until the condition is true.
+ *  The condition is re-evaluated on every run.
+ */
+#define CO_AWAIT(co, cond)						\
+  do {									\
+    (co).m_line = __LINE__;						\
+    CO_FALLTHROUGH;							\
+  case __LINE__:							\
+    if (!(cond)) return;						\
+  } while (0)
+
+/** Return to the scheduler for the specified number of milliseconds */
+#define CO_AWAIT_TIMEOUT(co, ms)					\
+  do {									\
+    (co).m_stamp = millis();						\
+    CO_AWAIT(co, (co).has_elapsed(ms));					\
+  } while (0)
+
+/** Return to the scheduler until the condition is true
+ *  or for at most the specified number of milliseconds.
+ *  Use event() afterward to tell which one happened.
+ */
+#define CO_AWAIT_OR_TIMEOUT(co, cond, ms)				\
+  do {									\
+    (co).m_stamp = millis();						\
+    CO_AWAIT(co, ((co).m_event = (cond)) || (co).has_elapsed(ms));	\
+  } while (0)
+
+/** Return to the scheduler until the button has been pressed */
+#define CO_AWAIT_PRESS(co, button)					\
+  CO_AWAIT(co, (button).has_been_pressed())
+
+/** Return to the scheduler until the button has been released */
+#define CO_AWAIT_RELEASE(co, button)					\
+  CO_AWAIT(co, (button).has_been_released())
+
+#endif
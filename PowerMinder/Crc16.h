@@ -0,0 +1,62 @@
+//------------------------------------------------------------------------------
+//   Copyright 2014 Janick Bergeron
+//   All Rights Reserved Worldwide
+//
+//   Licensed under the Apache License, Version 2.0 (the
+//   "License"); you may not use this file except in
+//   compliance with the License.  You may obtain a copy of
+//   the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in
+//   writing, software distributed under the License is
+//   distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+//   CONDITIONS OF ANY KIND, either express or implied.  See
+//   the License for the specific language governing
+//   permissions and limitations under the License.
+//------------------------------------------------------------------------------
+
+
+#ifndef _Crc16_h
+#define _Crc16_h
+
+#include <stdint.h>
+#ifdef __AVR__
+#include <util/crc16.h>
+#endif
+
+namespace PowerMinder {
+
+  /** Initial value of a CRC-16 */
+  const uint16_t CRC16_INIT = 0xFFFF;
+
+  /** Update a CRC-16/CCITT (polynomial 0x1021, MSB first) with one more byte */
+  inline uint16_t
+  crc16_update(uint16_t crc,
+	       uint8_t  data)
+  {
+#ifdef __AVR__
+    return _crc_xmodem_update(crc, data);
+#else
+    crc ^= (uint16_t) data << 8;
+    for (uint8_t i = 0; i < 8; i++) {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+#endif
+  }
+
+  /** Compute the CRC-16 of a block of bytes */
+  inline uint16_t
+  crc16(const uint8_t *data,
+	uint16_t       len,
+	uint16_t       crc = CRC16_INIT)
+  {
+    while (len--) crc = crc16_update(crc, *data++);
+    return crc;
+  }
+
+}
+
+#endif
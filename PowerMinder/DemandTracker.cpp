@@ -0,0 +1,188 @@
+//------------------------------------------------------------------------------
+//   Copyright 2014 Janick Bergeron
+//   All Rights Reserved Worldwide
+//
+//   Licensed under the Apache License, Version 2.0 (the
+//   "License"); you may not use this file except in
+//   compliance with the License.  You may obtain a copy of
+//   the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in
+//   writing, software distributed under the License is
+//   distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+//   CONDITIONS OF ANY KIND, either express or implied.  See
+//   the License for the specific language governing
+//   permissions and limitations under the License.
+//------------------------------------------------------------------------------
+
+
+#include "DemandTracker.h"
+
+using namespace PowerMinder;
+
+
+void
+DemandTracker_t::init()
+{
+  for (uint8_t i = 0; i <= BUCKETS; i++) m_buckets[i] = 0;
+  m_current = 0;
+  m_filled  = 0;
+  m_sum     = 0;
+  m_head    = 0;
+  m_count   = 0;
+  m_ticks   = 0;
+  reset_peaks();
+}
+
+
+void
+DemandTracker_t::pulse()
+{
+  if (m_buckets[m_current] < 65535) m_buckets[m_current]++;
+}
+
+
+void
+DemandTracker_t::tick(period_t period)
+{
+  // The current sub-interval is now complete...
+  m_sum += m_buckets[m_current];
+  if (++m_current > BUCKETS) m_current = 0;
+
+  // ...and the oldest one leaves the window
+  if (m_filled == BUCKETS) m_sum -= m_buckets[m_current];
+  else m_filled++;
+  m_buckets[m_current] = 0;
+
+  m_ticks++;
+  if (!is_complete()) return;
+
+  if (m_sum > m_peaks[period]) m_peaks[period] = m_sum;
+
+  // Drop the demands that can no longer be the maximum:
+  // the ones that are too old (only the first one can be)
+  // and the ones lower than the new one
+  if (m_count > 0 && (uint8_t) (m_ticks - m_stamps[m_head]) >= HORIZON) {
+    if (++m_head == HORIZON) m_head = 0;
+    m_count--;
+  }
+  while (m_count > 0 && m_queue[(m_head + m_count - 1) % HORIZON] <= m_sum) m_count--;
+
+  uint8_t tail = (m_head + m_count) % HORIZON;
+  m_queue[tail]  = m_sum;
+  m_stamps[tail] = m_ticks;
+  m_count++;
+}
+
+
+bool
+DemandTracker_t::is_complete()
+{
+  return m_filled == BUCKETS;
+}
+
+
+uint16_t
+DemandTracker_t::demand()
+{
+  return m_sum;
+}
+
+
+uint16_t
+DemandTracker_t::recent_peak()
+{
+  return (m_count > 0) ? m_queue[m_head] : 0;
+}
+
+
+uint16_t
+DemandTracker_t::peak(period_t period)
+{
+  return m_peaks[period];
+}
+
+
+void
+DemandTracker_t::reset_peaks()
+{
+  for (uint8_t i = 0; i <= ON_PEAK; i++) m_peaks[i] = 0;
+}
+
+
+#ifdef TEST
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+int
+main()
+{
+  DemandTracker_t tracker;
+  tracker.init();
+
+  // Reference: pulses per sub-interval, and the demand of every complete window
+  std::vector<uint16_t> buckets;
+  std::vector<uint16_t> demands;
+  uint16_t peaks[ON_PEAK + 1] = {0, 0, 0};
+  int errors = 0;
+
+  srand(1);
+  // More than 256 ticks, so the tick stamps wrap around
+  for (int t = 0; t < 1000; t++) {
+    // Bursts now & then, so that the recent peak is not always the latest demand
+    uint16_t pulses = rand() % 5;
+    if (t % 97 < 6) pulses += 40;
+    for (uint16_t i = 0; i < pulses; i++) tracker.pulse();
+
+    // The periods change in the middle of windows
+    period_t period = (period_t) ((t / 23) % 3);
+    tracker.tick(period);
+    buckets.push_back(pulses);
+
+    // Until the window is complete, the demand covers the sub-intervals so far
+    bool complete = (buckets.size() >= DemandTracker_t::BUCKETS);
+    uint16_t demand = 0;
+    for (size_t i = (complete) ? buckets.size() - DemandTracker_t::BUCKETS : 0; i < buckets.size(); i++) demand += buckets[i];
+    if (complete) {
+      demands.push_back(demand);
+      if (demand > peaks[period]) peaks[period] = demand;
+    }
+    uint16_t recent = 0;
+    for (size_t i = (demands.size() > DemandTracker_t::HORIZON) ? demands.size() - DemandTracker_t::HORIZON : 0;
+	 i < demands.size(); i++) {
+      if (demands[i] > recent) recent = demands[i];
+    }
+
+    if (tracker.is_complete() != complete || tracker.demand() != demand || tracker.recent_peak() != recent) errors++;
+    for (uint8_t p = 0; p <= ON_PEAK; p++) {
+      if (tracker.peak((period_t) p) != peaks[p]) errors++;
+    }
+
+    // A new billing cycle
+    if (t == 500) {
+      tracker.reset_peaks();
+      for (uint8_t p = 0; p <= ON_PEAK; p++) peaks[p] = 0;
+    }
+  }
+  bool ok = (errors == 0);
+  printf("%s: Demand, recent peak & peaks per period over %d ticks, %d mismatches\n",
+	 (ok) ? "PASS" : "FAIL", (int) buckets.size(), errors);
+
+  // Pulses in the current sub-interval are not part of the demand yet
+  tracker.init();
+  for (uint8_t i = 0; i < DemandTracker_t::BUCKETS; i++) {
+    tracker.pulse();
+    tracker.tick(OFF_PEAK);
+  }
+  tracker.pulse();
+  bool counted = (tracker.is_complete() && tracker.demand() == DemandTracker_t::BUCKETS);
+  tracker.tick(ON_PEAK);
+  counted = counted && tracker.demand() == DemandTracker_t::BUCKETS && tracker.peak(ON_PEAK) == DemandTracker_t::BUCKETS;
+  printf("%s: Current sub-interval counted once complete\n", (counted) ? "PASS" : "FAIL");
+
+  return (ok && counted) ? 0 : 1;
+}
+#endif
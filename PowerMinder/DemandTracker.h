@@ -0,0 +1,100 @@
+//------------------------------------------------------------------------------
+//   Copyright 2014 Janick Bergeron
+//   All Rights Reserved Worldwide
+//
+//   Licensed under the Apache License, Version 2.0 (the
+//   "License"); you may not use this file except in
+//   compliance with the License.  You may obtain a copy of
+//   the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in
+//   writing, software distributed under the License is
+//   distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+//   CONDITIONS OF ANY KIND, either express or implied.  See
+//   the License for the specific language governing
+//   permissions and limitations under the License.
+//------------------------------------------------------------------------------
+
+
+#ifndef _DemandTracker_h
+#define _DemandTracker_h
+
+#include <stdint.h>
+#include "Calendar.h"
+
+namespace PowerMinder {
+
+  /** Class to track the rolling-window power demand from meter pulses.
+   *
+   *  The demand window (e.g. 15 or 30 minutes) is divided in BUCKETS
+   *  sub-intervals. Pulses are counted in the current sub-interval and the
+   *  window slides by one sub-interval on every call to tick(). The demand
+   *  is the number of pulses in the last complete window.
+   *
+   *  The maximum demand is kept for each cost period, and over the
+   *  last HORIZON ticks using a monotonic queue: every update and query is O(1).
+   *  A window spanning a period change counts entirely toward the period it ends in,
+   *  i.e. the period of its last sub-interval, as meters do for interval demand.
+   */
+  class DemandTracker_t {
+
+  public:
+    /** Number of sub-intervals in a demand window */
+    static const uint8_t BUCKETS = 15;
+
+    /** Number of ticks over which the recent peak demand is tracked */
+    static const uint8_t HORIZON = 8;
+
+    /** Forget all pulses and peaks */
+    void init();
+
+    /** Count a meter pulse */
+    void pulse();
+
+    /** Slide the window by one sub-interval (window length / BUCKETS) */
+    void tick(period_t period);   ///< Cost period of the sub-interval that just ended
+
+    /** Is there enough history for the demand to cover an entire window? */
+    bool is_complete();
+
+    /** Return the number of pulses in the last complete window */
+    uint16_t demand();
+
+    /** Return the maximum demand over the last HORIZON ticks */
+    uint16_t recent_peak();
+
+    /** Return the maximum demand in the specified cost period since the last reset */
+    uint16_t peak(period_t period);
+
+    /** Restart the per-period maximum demands (e.g. at the start of a billing cycle) */
+    void reset_peaks();
+
+  // Looks like Sketches don't support private constructors...
+  //private:
+    /** Create a demand tracker */
+    constexpr DemandTracker_t()
+      : m_buckets(), m_current(0), m_filled(0), m_sum(0), m_peaks(),
+	m_queue(), m_stamps(), m_head(0), m_count(0), m_ticks(0)
+    {
+    }
+
+  private:
+    uint16_t m_buckets[BUCKETS+1]; ///< Pulses per sub-interval, including the current one
+    uint8_t  m_current;            ///< Sub-interval receiving the pulses
+    uint8_t  m_filled;             ///< Number of complete sub-intervals, up to BUCKETS
+    uint16_t m_sum;                ///< Pulses in the complete sub-intervals of the window
+    uint16_t m_peaks[ON_PEAK + 1];
+
+    /** Monotonic queue of (demand, tick) pairs with decreasing demands */
+    uint16_t m_queue[HORIZON];
+    uint8_t  m_stamps[HORIZON];
+    uint8_t  m_head;
+    uint8_t  m_count;
+    uint8_t  m_ticks;
+  };
+
+}
+
+#endif
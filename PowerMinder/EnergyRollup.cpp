@@ -0,0 +1,298 @@
+//------------------------------------------------------------------------------
+//   Copyright 2014 Janick Bergeron
+//   All Rights Reserved Worldwide
+//
+//   Licensed under the Apache License, Version 2.0 (the
+//   "License"); you may not use this file except in
+//   compliance with the License.  You may obtain a copy of
+//   the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in
+//   writing, software distributed under the License is
+//   distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+//   CONDITIONS OF ANY KIND, either express or implied.  See
+//   the License for the specific language governing
+//   permissions and limitations under the License.
+//------------------------------------------------------------------------------
+
+
+#include "EnergyRollup.h"
+
+using namespace PowerMinder;
+
+
+void
+EnergyRollup_t::init()
+{
+  m_minute     = 0;
+  m_overflowed = false;
+  for (uint8_t p = 0; p <= ON_PEAK; p++) {
+    m_hour.m_energy[p]  = 0;
+    m_day.m_energy[p]   = 0;
+    m_month.m_energy[p] = 0;
+  }
+  m_date[0] = 0;
+
+  m_minutes.init();
+  m_hours.init();
+  m_days.init();
+  m_months.init();
+}
+
+
+void
+EnergyRollup_t::pulse()
+{
+  if (m_minute < 65535) m_minute++;
+  else m_overflowed = true;
+}
+
+
+void
+EnergyRollup_t::advance(uint8_t  month,
+			uint8_t  day,
+			uint8_t  hour,
+			period_t period)
+{
+  // Close the minute
+  m_minutes.push() = m_minute;
+  uint16_t *energy = &m_hour.m_energy[period];
+  if (*energy > 65535 - m_minute) {
+    *energy = 65535;
+    m_overflowed = true;
+  }
+  else *energy += m_minute;
+  m_minute = 0;
+
+  bool newHour  = (hour  != m_date[2] || day != m_date[1] || month != m_date[0]);
+  bool newDay   = (day   != m_date[1] || month != m_date[0]);
+  bool newMonth = (month != m_date[0]);
+  bool first    = (m_date[0] == 0);
+  m_date[0] = month;
+  m_date[1] = day;
+  m_date[2] = hour;
+  if (first || !newHour) return;
+
+  // Close the hour
+  m_hours.push() = m_hour;
+  for (uint8_t p = 0; p <= ON_PEAK; p++) {
+    m_day.m_energy[p] += m_hour.m_energy[p];
+    m_hour.m_energy[p] = 0;
+  }
+  if (!newDay) return;
+
+  // Close the day
+  m_days.push() = m_day;
+  for (uint8_t p = 0; p <= ON_PEAK; p++) {
+    m_month.m_energy[p] += m_day.m_energy[p];
+    m_day.m_energy[p] = 0;
+  }
+  if (!newMonth) return;
+
+  // Close the month
+  m_months.push() = m_month;
+  for (uint8_t p = 0; p <= ON_PEAK; p++) m_month.m_energy[p] = 0;
+}
+
+
+uint16_t
+EnergyRollup_t::thisHour(period_t period)
+{
+  return m_hour.m_energy[period];
+}
+
+
+uint32_t
+EnergyRollup_t::today(period_t period)
+{
+  return m_day.m_energy[period] + m_hour.m_energy[period];
+}
+
+
+uint32_t
+EnergyRollup_t::thisMonth(period_t period)
+{
+  return m_month.m_energy[period] + today(period);
+}
+
+
+uint16_t
+EnergyRollup_t::minute(uint8_t ago)
+{
+  const uint16_t *entry = m_minutes.get(ago);
+  return (entry) ? *entry : 0;
+}
+
+
+uint16_t
+EnergyRollup_t::hour(uint8_t  ago,
+		     period_t period)
+{
+  const short_totals_t *entry = m_hours.get(ago);
+  return (entry) ? entry->m_energy[period] : 0;
+}
+
+
+uint32_t
+EnergyRollup_t::day(uint8_t  ago,
+		    period_t period)
+{
+  const long_totals_t *entry = m_days.get(ago);
+  return (entry) ? entry->m_energy[period] : 0;
+}
+
+
+uint32_t
+EnergyRollup_t::month(uint8_t  ago,
+		      period_t period)
+{
+  const long_totals_t *entry = m_months.get(ago);
+  return (entry) ? entry->m_energy[period] : 0;
+}
+
+
+bool
+EnergyRollup_t::overflowed()
+{
+  return m_overflowed;
+}
+
+
+#ifdef TEST
+#include <stdio.h>
+#include <vector>
+
+typedef struct {uint32_t energy[ON_PEAK + 1];} totals_t;
+
+static const uint8_t daysInMonth[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+
+static period_t
+periodOf(uint8_t hour)
+{
+  if (hour < 7) return OFF_PEAK;
+  if (hour < 17) return PARTIAL_PEAK;
+  return ON_PEAK;
+}
+
+
+/** Compare the rollup with the reference totals.
+ *  Past intervals are checked one further than kept: they must read 0.
+ */
+static int
+check(EnergyRollup_t                 &rollup,
+      const std::vector<uint16_t>    &minutes,
+      const std::vector<totals_t>    &hours,
+      const std::vector<totals_t>    &days,
+      const std::vector<totals_t>    &months,
+      const totals_t                 &hour,
+      const totals_t                 &day,
+      const totals_t                 &month)
+{
+  int errors = 0;
+
+  for (uint8_t ago = 1; ago <= ROLLUP_MINUTES + 1; ago++) {
+    uint16_t expect = (ago <= ROLLUP_MINUTES && ago <= minutes.size()) ? minutes[minutes.size() - ago] : 0;
+    if (rollup.minute(ago) != expect) errors++;
+  }
+
+  for (uint8_t p = 0; p <= ON_PEAK; p++) {
+    period_t period = (period_t) p;
+    if (rollup.thisHour(period) != hour.energy[p]) errors++;
+    if (rollup.today(period) != day.energy[p] + hour.energy[p]) errors++;
+    if (rollup.thisMonth(period) != month.energy[p] + day.energy[p] + hour.energy[p]) errors++;
+
+    for (uint8_t ago = 1; ago <= ROLLUP_HOURS + 1; ago++) {
+      uint32_t expect = (ago <= ROLLUP_HOURS && ago <= hours.size()) ? hours[hours.size() - ago].energy[p] : 0;
+      if (rollup.hour(ago, period) != expect) errors++;
+    }
+    for (uint8_t ago = 1; ago <= ROLLUP_DAYS + 1; ago++) {
+      uint32_t expect = (ago <= ROLLUP_DAYS && ago <= days.size()) ? days[days.size() - ago].energy[p] : 0;
+      if (rollup.day(ago, period) != expect) errors++;
+    }
+    for (uint8_t ago = 1; ago <= ROLLUP_MONTHS + 1; ago++) {
+      uint32_t expect = (ago <= ROLLUP_MONTHS && ago <= months.size()) ? months[months.size() - ago].energy[p] : 0;
+      if (rollup.month(ago, period) != expect) errors++;
+    }
+  }
+
+  return errors;
+}
+
+
+int
+main()
+{
+  EnergyRollup_t rollup;
+  rollup.init();
+
+  // Reference totals: closed minutes, hours, days & months, and the open ones
+  std::vector<uint16_t> minutes;
+  std::vector<totals_t> hours, days, months;
+  totals_t hour = {}, day = {}, month = {};
+
+  // From Jan 30 to Apr 2, minute by minute
+  uint8_t  m = 1, d = 30, h = 0, mi = 0;
+  uint32_t n = 0;
+  int      errors = 0;
+
+  // The first call only sets the date
+  rollup.advance(m, d, h, OFF_PEAK);
+  minutes.push_back(0);
+
+  while (!(m == 4 && d == 2)) {
+    // Two hours at the highest rate make a day of more than 65535 pulses
+    uint16_t pulses = (n * 37) % 23;
+    if (m == 2 && d == 10 && (h == 18 || h == 19)) pulses = EnergyRollup_t::MAX_PULSES_PER_MINUTE;
+    for (uint16_t i = 0; i < pulses; i++) rollup.pulse();
+    period_t period = periodOf(h);
+
+    uint8_t m2 = m, d2 = d, h2 = h, mi2 = mi + 1;
+    if (mi2 == 60) {mi2 = 0; h2++;}
+    if (h2 == 24)  {h2 = 0;  d2++;}
+    if (d2 > daysInMonth[m - 1]) {d2 = 1; m2++;}
+
+    rollup.advance(m2, d2, h2, period);
+
+    minutes.push_back(pulses);
+    hour.energy[period] += pulses;
+    if (h2 != h) {
+      hours.push_back(hour);
+      for (uint8_t p = 0; p <= ON_PEAK; p++) day.energy[p] += hour.energy[p];
+      hour = totals_t();
+    }
+    if (d2 != d) {
+      days.push_back(day);
+      for (uint8_t p = 0; p <= ON_PEAK; p++) month.energy[p] += day.energy[p];
+      day = totals_t();
+    }
+    if (m2 != m) {
+      months.push_back(month);
+      month = totals_t();
+    }
+
+    errors += check(rollup, minutes, hours, days, months, hour, day, month);
+
+    m = m2; d = d2; h = h2; mi = mi2;
+    n++;
+  }
+
+  bool big = false;
+  for (size_t i = 0; i < days.size(); i++) big |= days[i].energy[ON_PEAK] > 65535;
+
+  bool ok = (errors == 0 && big && !rollup.overflowed());
+  printf("%s: %u minutes, %u hours, %u days, %u months rolled up, %d mismatches%s\n",
+	 (ok) ? "PASS" : "FAIL", n, (unsigned) hours.size(), (unsigned) days.size(),
+	 (unsigned) months.size(), errors, (big) ? "" : " (no day over 65535)");
+
+  // A minute beyond 65535 pulses saturates and is flagged
+  for (uint32_t i = 0; i < 70000; i++) rollup.pulse();
+  rollup.advance(m, d, h, OFF_PEAK);
+  bool flagged = (rollup.minute(1) == 65535 && rollup.overflowed());
+  printf("%s: Saturated minute flagged\n", (flagged) ? "PASS" : "FAIL");
+  if (!flagged) ok = false;
+
+  return (ok) ? 0 : 1;
+}
+#endif
@@ -0,0 +1,158 @@
+//------------------------------------------------------------------------------
+//   Copyright 2014 Janick Bergeron
+//   All Rights Reserved Worldwide
+//
+//   Licensed under the Apache License, Version 2.0 (the
+//   "License"); you may not use this file except in
+//   compliance with the License.  You may obtain a copy of
+//   the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in
+//   writing, software distributed under the License is
+//   distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+//   CONDITIONS OF ANY KIND, either express or implied.  See
+//   the License for the specific language governing
+//   permissions and limitations under the License.
+//------------------------------------------------------------------------------
+
+
+#ifndef _EnergyRollup_h
+#define _EnergyRollup_h
+
+#include <stdint.h>
+#include "Calendar.h"
+
+/** Number of past minutes, hours, days and months kept.
+ *  The defaults keep only the last one of each, for 76 bytes of SRAM on the ATtiny85.
+ *  Each extra minute costs 2 bytes, hour 6, day or month 12.
+ *  Define them on the command line so that every file sees the same sizes.
+ */
+#ifndef ROLLUP_MINUTES
+#define ROLLUP_MINUTES 1
+#endif
+#ifndef ROLLUP_HOURS
+#define ROLLUP_HOURS   1
+#endif
+#ifndef ROLLUP_DAYS
+#define ROLLUP_DAYS    1
+#endif
+#ifndef ROLLUP_MONTHS
+#define ROLLUP_MONTHS  1
+#endif
+
+namespace PowerMinder {
+
+  /** Class to aggregate meter pulses per cost period, per minute, hour, day and month.
+   *
+   *  Pulses are counted in the current minute. Every minute, the minute
+   *  is closed and added to the current hour total of its cost period.
+   *  When the hour changes, the hour is closed and added to the current day, and so on.
+   *  Closed minutes, hours, days and months are kept in rings of fixed size.
+   *
+   *  All updates and queries are O(1). Energy is in meter pulses.
+   *
+   *  Counters are sized for MAX_PULSES_PER_MINUTE: minutes hold up to 65535 pulses
+   *  and hours up to 65535 per cost period, days and months 2^32.
+   *  Beyond that, minutes and hours saturate and overflowed() becomes TRUE.
+   */
+  class EnergyRollup_t {
+
+  public:
+    /** Highest meter rate: 48kW (200A at 240V) at 1Wh/pulse */
+    static const uint16_t MAX_PULSES_PER_MINUTE = 800;
+
+    /** Forget everything */
+    void init();
+
+    /** Count a meter pulse in the current minute */
+    void pulse();
+
+    /** Close the current minute. Call once per minute, at the start of the new one. */
+    void advance(uint8_t  month,     ///< 1-12
+		 uint8_t  day,       ///< 1-31
+		 uint8_t  hour,      ///< 0-23
+		 period_t period);   ///< Cost period of the minute that just ended
+
+    /** Energy in the current hour up to the last closed minute, for the specified cost period */
+    uint16_t thisHour(period_t period);
+
+    /** Energy in the current day up to the last closed minute, for the specified cost period */
+    uint32_t today(period_t period);
+
+    /** Energy in the current month up to the last closed minute, for the specified cost period */
+    uint32_t thisMonth(period_t period);
+
+    /** Energy in a past minute, all periods (0 if not available) */
+    uint16_t minute(uint8_t ago);   ///< 1 == last minute, up to ROLLUP_MINUTES
+
+    /** Energy in a past hour, for the specified cost period (0 if not available) */
+    uint16_t hour(uint8_t  ago,     ///< 1 == last hour, up to ROLLUP_HOURS
+		  period_t period);
+
+    /** Energy in a past day, for the specified cost period (0 if not available) */
+    uint32_t day(uint8_t  ago,      ///< 1 == yesterday, up to ROLLUP_DAYS
+		 period_t period);
+
+    /** Energy in a past month, for the specified cost period (0 if not available) */
+    uint32_t month(uint8_t  ago,    ///< 1 == last month, up to ROLLUP_MONTHS
+		   period_t period);
+
+    /** Has a minute or an hour saturated since init()? Its energy was partly lost */
+    bool overflowed();
+
+  // Looks like Sketches don't support private constructors...
+  //private:
+    /** Create an energy aggregator */
+    constexpr EnergyRollup_t()
+      : m_minute(0), m_overflowed(0), m_hour(), m_day(), m_month(), m_date(),
+	m_minutes(), m_hours(), m_days(), m_months()
+    {
+    }
+
+  private:
+    /** A ring of closed intervals */
+    template <typename T, uint8_t N>
+    struct ring_s {
+      T       m_entries[N];
+      uint8_t m_head;      ///< Where the next closed interval goes
+      uint8_t m_count;
+
+      void init() {m_head = 0; m_count = 0;}
+
+      T& push()
+      {
+	T& entry = m_entries[m_head];
+	if (++m_head == N) m_head = 0;
+	if (m_count < N) m_count++;
+	return entry;
+      }
+
+      /** Returns 0 if not available */
+      const T* get(uint8_t ago) const
+      {
+	if (ago == 0 || ago > m_count) return 0;
+	return &m_entries[(m_head + N - ago) % N];
+      }
+    };
+
+    typedef struct {uint16_t m_energy[ON_PEAK + 1];} short_totals_t;
+    typedef struct {uint32_t m_energy[ON_PEAK + 1];} long_totals_t;
+
+    uint16_t       m_minute;                ///< Pulses in the current minute
+    bool           m_overflowed;
+    short_totals_t m_hour;                  ///< Current hour
+    long_totals_t  m_day;                   ///< Current day, excluding the current hour
+    long_totals_t  m_month;                 ///< Current month, excluding the current day
+    uint8_t        m_date[3];               ///< Month, day & hour of the current hour
+
+    ring_s<uint16_t,       ROLLUP_MINUTES> m_minutes;
+    ring_s<short_totals_t, ROLLUP_HOURS>   m_hours;
+    ring_s<long_totals_t,  ROLLUP_DAYS>    m_days;
+    ring_s<long_totals_t,  ROLLUP_MONTHS>  m_months;
+  };
+
+}
+
+#endif
@@ -0,0 +1,78 @@
+//------------------------------------------------------------------------------
+//   Copyright 2014 Janick Bergeron
+//   All Rights Reserved Worldwide
+//
+//   Licensed under the Apache License, Version 2.0 (the
+//   "License"); you may not use this file except in
+//   compliance with the License.  You may obtain a copy of
+//   the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in
+//   writing, software distributed under the License is
+//   distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+//   CONDITIONS OF ANY KIND, either express or implied.  See
+//   the License for the specific language governing
+//   permissions and limitations under the License.
+//------------------------------------------------------------------------------
+
+
+
+#ifndef _Gpio_h
+#define _Gpio_h
+
+#include <stdint.h>
+#include <avr/io.h>
+
+namespace PowerMinder {
+
+  /** Direct access to PORTB, using runtime bit masks.
+   *
+   *  On the ATtiny85, Arduino digital pin N is PBN, so its mask is (1 << N).
+   *  Each operation is a single read-modify-write of the port,
+   *  without any of the pin-number decoding done by digitalWrite/digitalRead.
+   */
+  struct PortB_t {
+    /** Mask for a pin number */
+    static constexpr uint8_t mask(uint8_t pin)
+    {
+      return 1 << pin;
+    }
+
+    static void output(uint8_t mask) {DDRB |= mask;}
+    static void input(uint8_t mask)  {DDRB &= ~mask;}
+    static void set(uint8_t mask)    {PORTB |= mask;}
+    static void clear(uint8_t mask)  {PORTB &= ~mask;}
+    /** Writing a 1 to PINB toggles the corresponding PORTB bit */
+    static void toggle(uint8_t mask) {PINB = mask;}
+    static bool read(uint8_t mask)   {return (PINB & mask) != 0;}
+
+    /** Drive the masked pins to the specified levels, in one read-modify-write */
+    static void write(uint8_t mask,
+		      uint8_t levels)
+    {
+      PORTB = (PORTB & ~mask) | (levels & mask);
+    }
+  };
+
+
+  /** A PORTB pin known at compile time.
+   *  Each operation is meant to compile to a single sbi, cbi or sbic instruction:
+   *  make check-pins verifies it with avr-gcc.
+   */
+  template <uint8_t Pin>
+  struct PortBPin_t {
+    static const uint8_t MASK = 1 << Pin;
+
+    static void output() {DDRB |= MASK;}
+    static void input()  {DDRB &= ~MASK;}
+    static void set()    {PORTB |= MASK;}
+    static void clear()  {PORTB &= ~MASK;}
+    static void toggle() {PINB = MASK;}
+    static bool read()   {return (PINB & MASK) != 0;}
+  };
+
+}
+
+#endif
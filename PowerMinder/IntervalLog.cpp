@@ -0,0 +1,426 @@
+//------------------------------------------------------------------------------
+//   Copyright 2014 Janick Bergeron
+//   All Rights Reserved Worldwide
+//
+//   Licensed under the Apache License, Version 2.0 (the
+//   "License"); you may not use this file except in
+//   compliance with the License.  You may obtain a copy of
+//   the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in
+//   writing, software distributed under the License is
+//   distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+//   CONDITIONS OF ANY KIND, either express or implied.  See
+//   the License for the specific language governing
+//   permissions and limitations under the License.
+//------------------------------------------------------------------------------
+
+
+#include <avr/eeprom.h>
+
+#include "IntervalLog.h"
+
+using namespace PowerMinder;
+
+/** Number of days before the start of the specified month (1-12), in a non-leap year.
+ *  Computed rather than tabulated, to save 24 bytes of SRAM on the ATtiny85.
+ */
+static inline uint16_t
+daysBeforeMonth(uint8_t month)
+{
+  return (367 * month - 362) / 12 - ((month > 2) ? 2 : 0);
+}
+
+
+static inline uint8_t
+readByte(uint16_t addr)
+{
+  return eeprom_read_byte((const uint8_t *) (uintptr_t) addr);
+}
+
+
+static inline void
+writeByte(uint16_t addr,
+	  uint8_t  data)
+{
+  eeprom_update_byte((uint8_t *) (uintptr_t) addr, data);
+}
+
+
+uint32_t
+IntervalLog_t::interval(uint8_t year,
+			uint8_t month,
+			uint8_t day,
+			uint8_t hour,
+			uint8_t min)
+{
+  uint16_t days = year * 365 + (year + 3) / 4 + daysBeforeMonth(month) + day - 1;
+  if (month > 2 && year % 4 == 0) days++;
+
+  return days * 96UL + hour * 4 + min / 15;
+}
+
+
+uint8_t
+IntervalLog_t::encode(uint8_t  skip,
+		      int32_t  delta,
+		      uint8_t  record[4])
+{
+  uint8_t n = 0;
+  if (skip > 0) record[n++] = 0xF0 | (skip - 1);
+
+  uint32_t zz = ((uint32_t) delta << 1) ^ (uint32_t) (delta >> 31);
+  if (zz < 0x80) record[n++] = zz;
+  else if (zz < 0x4000) {
+    record[n++] = 0x80 | (zz >> 8);
+    record[n++] = zz;
+  }
+  else {
+    record[n++] = 0xC0 | (zz >> 16);
+    record[n++] = zz >> 8;
+    record[n++] = zz;
+  }
+
+  return n;
+}
+
+
+void
+IntervalLog_t::init()
+{
+  // The head is the page not followed by the next one in sequence
+  m_head = 0xFF;
+  for (uint8_t p = 0; p < m_pages; p++) {
+    uint8_t seq = readByte(m_base + p * PAGE_SIZE);
+    if (seq == 0xFF) continue;
+
+    uint8_t next = readByte(m_base + ((p + 1) % m_pages) * PAGE_SIZE);
+    if (next != (seq + 1) % 255) {
+      m_head = p;
+      break;
+    }
+  }
+  if (m_head == 0xFF) return;
+
+  m_offset = m_scan(m_head, 0, 0, 0);
+}
+
+
+void
+IntervalLog_t::erase()
+{
+  for (uint8_t p = 0; p < m_pages; p++) writeByte(m_base + p * PAGE_SIZE, 0xFF);
+  m_head = 0xFF;
+}
+
+
+void
+IntervalLog_t::m_open(uint32_t interval)
+{
+  uint8_t page = 0;
+  uint8_t seq  = 0;
+  if (m_head != 0xFF) {
+    page = (m_head + 1) % m_pages;
+    seq  = (readByte(m_base + m_head * PAGE_SIZE) + 1) % 255;
+  }
+  uint16_t addr = m_base + page * PAGE_SIZE;
+
+  // The page is valid only once its sequence number is written
+  writeByte(addr, 0xFF);
+  for (uint8_t i = HEADER_SIZE; i < PAGE_SIZE; i++) writeByte(addr + i, 0xFF);
+  for (uint8_t i = 0; i < 4; i++) writeByte(addr + 1 + i, interval >> (8 * i));
+  writeByte(addr, seq);
+
+  m_head   = page;
+  m_offset = HEADER_SIZE;
+  m_last   = 0;
+  m_next   = interval;
+}
+
+
+void
+IntervalLog_t::append(uint32_t interval,
+		      uint16_t energy)
+{
+  if (m_head != 0xFF && interval < m_next) return;
+
+  while (1) {
+    // Long gaps are recorded by starting a new page
+    if (m_head == 0xFF || interval - m_next > 15) m_open(interval);
+
+    uint8_t record[4];
+    uint8_t n = encode(interval - m_next, (int32_t) energy - m_last, record);
+
+    if (m_offset + n > PAGE_SIZE) {
+      m_open(interval);
+      continue;
+    }
+
+    // Write the record(s) backward: the first byte commits them
+    uint16_t addr = m_base + m_head * PAGE_SIZE + m_offset;
+    while (n-- > 0) {
+      writeByte(addr + n, record[n]);
+      m_offset++;
+    }
+    m_last = energy;
+    m_next = interval + 1;
+    return;
+  }
+}
+
+
+uint8_t
+IntervalLog_t::m_scan(uint8_t   page,
+		      reader_t  reader,
+		      void     *context,
+		      uint16_t *count)
+{
+  uint16_t addr = m_base + page * PAGE_SIZE;
+
+  uint32_t interval = 0;
+  for (uint8_t i = 0; i < 4; i++) interval |= (uint32_t) readByte(addr + 1 + i) << (8 * i);
+
+  uint16_t last   = 0;
+  uint8_t  offset = HEADER_SIZE;
+  while (offset < PAGE_SIZE) {
+    uint8_t b = readByte(addr + offset);
+    if (b == 0xFF) break;
+
+    if (b >= 0xF0) {
+      interval += (b & 0x0F) + 1;
+      offset++;
+      continue;
+    }
+
+    uint8_t  n;
+    uint32_t zz;
+    if (b < 0x80) {
+      n  = 1;
+      zz = b;
+    }
+    else if (b < 0xC0) {
+      n  = 2;
+      zz = ((uint32_t) (b & 0x3F) << 8) | readByte(addr + offset + 1);
+    }
+    else if (b < 0xE0) {
+      n  = 3;
+      zz = ((uint32_t) (b & 0x1F) << 16) | ((uint16_t) readByte(addr + offset + 1) << 8) | readByte(addr + offset + 2);
+    }
+    else break;
+    if (offset + n > PAGE_SIZE) break;
+
+    last += (int32_t) (zz >> 1) ^ -(int32_t) (zz & 1);
+    if (reader) reader(interval, last, context);
+    if (count) (*count)++;
+
+    interval++;
+    offset += n;
+  }
+
+  m_last = last;
+  m_next = interval;
+  return offset;
+}
+
+
+uint16_t
+IntervalLog_t::read(reader_t  reader,
+		    void     *context)
+{
+  uint16_t count = 0;
+  if (m_head == 0xFF) return 0;
+
+  // Oldest page first: the one after the head, skipping unused ones
+  for (uint8_t i = 1; i <= m_pages; i++) {
+    uint8_t page = (m_head + i) % m_pages;
+    if (readByte(m_base + page * PAGE_SIZE) == 0xFF) continue;
+    m_scan(page, reader, context, &count);
+  }
+  return count;
+}
+
+
+bool
+IntervalLog_t::is_empty()
+{
+  return m_head == 0xFF;
+}
+
+
+uint32_t
+IntervalLog_t::next()
+{
+  return m_next;
+}
+
+
+#ifdef TEST
+// Runs on the simulated EEPROM, with power failures in the middle of appends
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+typedef std::vector<std::pair<uint32_t, uint16_t> > intervals_t;
+
+static void
+collect(uint32_t  interval,
+	uint16_t  energy,
+	void     *context)
+{
+  ((intervals_t *) context)->push_back(std::make_pair(interval, energy));
+}
+
+
+/** Read back the log as found at boot */
+static intervals_t
+boot(IntervalLog_t &log)
+{
+  log.init();
+  intervals_t found;
+  log.read(collect, &found);
+  return found;
+}
+
+
+/** Is the log read back the newest part of the logged intervals, up to the last one? */
+static bool
+is_tail(const intervals_t &found,
+	const intervals_t &logged)
+{
+  if (found.empty() || found.size() > logged.size()) return false;
+  return std::equal(found.begin(), found.end(), logged.end() - found.size());
+}
+
+
+/** Append an interval with the power lost at the n-th EEPROM write (with the specified bits
+ *  left erased in that byte), then boot. Returns the number of writes left unmade.
+ */
+static int32_t
+interrupt(IntervalLog_t  log,
+	  uint32_t       interval,
+	  uint16_t       energy,
+	  int32_t        n,
+	  uint8_t        torn = 0xFF)
+{
+  Sim::eeprom_writes = n;
+  Sim::eeprom_torn   = torn;
+  log.append(interval, energy);
+  int32_t left = Sim::eeprom_writes;
+  Sim::eeprom_writes = -1;
+  return left;
+}
+
+
+int
+main()
+{
+  const uint8_t PAGES = 16;
+
+  memset(Sim::eeprom, 0xFF, sizeof(Sim::eeprom));
+  srand(1);
+
+  IntervalLog_t log(0, PAGES);
+  log.init();
+
+  intervals_t logged;
+  uint32_t    interval = 1000;
+  uint16_t    energy   = 100;
+  uint16_t    opened[PAGES] = {0};
+  uint32_t    failures = 0;
+  int         errors   = 0;
+
+  for (int i = 0; i < 3000; i++) {
+    // Mostly steady, with some jumps (multi-byte records), short gaps (skips)
+    // and long gaps (new pages)
+    int r = rand() % 100;
+    if (r < 10) energy = rand() % 2000;
+    else if (r < 30) energy += rand() % 5 - 2;
+    interval += (r < 95) ? 1 : (r < 98) ? 2 + rand() % 14 : 16 + rand() % 100;
+
+    uint8_t saved[sizeof(Sim::eeprom)];
+    memcpy(saved, Sim::eeprom, sizeof(saved));
+    int32_t writes = 1000 - interrupt(log, interval, energy, 1000);
+    memcpy(Sim::eeprom, saved, sizeof(saved));
+
+    // Lose the power before each write of the append: the log must be found
+    // intact at boot, without the interrupted interval, and carry on
+    for (int32_t n = 1; n <= writes; n++) {
+      interrupt(log, interval, energy, n);
+
+      IntervalLog_t rebooted(0, PAGES);
+      intervals_t found = boot(rebooted);
+      if ((!logged.empty() || !found.empty()) && !is_tail(found, logged)) {
+	printf("FAIL: Interval %u, power lost at write %d/%d: log not recovered\n", interval, n, writes);
+	errors++;
+      }
+      rebooted.append(interval, energy);
+      found = boot(rebooted);
+      if (found.empty() || found.back() != std::make_pair(interval, energy)) {
+	printf("FAIL: Interval %u, power lost at write %d/%d: logging not resumed\n", interval, n, writes);
+	errors++;
+      }
+      memcpy(Sim::eeprom, saved, sizeof(saved));
+      failures++;
+    }
+
+    // Lose the power while writing the first byte of the record, which is the last
+    // write: it may be read back as any record or skip. The intervals before it
+    // must be intact and logging must resume after any skip (at most 15 intervals).
+    uint8_t torn = 1 << (rand() % 8) | 1 << (rand() % 8);
+    interrupt(log, interval, energy, writes, torn);
+    {
+      IntervalLog_t rebooted(0, PAGES);
+      intervals_t found = boot(rebooted);
+      if (!found.empty() && !is_tail(found, logged)) found.pop_back();
+      if (!logged.empty() && !is_tail(found, logged)) {
+	printf("FAIL: Interval %u, first byte torn (0x%02x): log not recovered\n", interval, torn);
+	errors++;
+      }
+      rebooted.append(interval + 16, energy);
+      found = boot(rebooted);
+      if (found.empty() || found.back() != std::make_pair(interval + 16, energy)) {
+	printf("FAIL: Interval %u, first byte torn (0x%02x): logging not resumed\n", interval, torn);
+	errors++;
+      }
+      memcpy(Sim::eeprom, saved, sizeof(saved));
+    }
+
+    // Append for real, noting which page is opened
+    uint8_t seqs[PAGES];
+    for (uint8_t p = 0; p < PAGES; p++) seqs[p] = Sim::eeprom[p * IntervalLog_t::PAGE_SIZE];
+    log.append(interval, energy);
+    logged.push_back(std::make_pair(interval, energy));
+    for (uint8_t p = 0; p < PAGES; p++) {
+      if (Sim::eeprom[p * IntervalLog_t::PAGE_SIZE] != seqs[p]) opened[p]++;
+    }
+
+    // The head & tail are found again at boot
+    IntervalLog_t rebooted(0, PAGES);
+    intervals_t found = boot(rebooted);
+    if (!is_tail(found, logged) || rebooted.next() != log.next()) {
+      printf("FAIL: Interval %u: %u intervals read back at boot\n", interval, (unsigned) found.size());
+      errors++;
+    }
+  }
+
+  // Every page was rewritten about as often
+  uint16_t least = 0xFFFF, most = 0;
+  for (uint8_t p = 0; p < PAGES; p++) {
+    if (opened[p] < least) least = opened[p];
+    if (opened[p] > most) most = opened[p];
+  }
+  if (least < 2 || most - least > 1) {
+    printf("FAIL: Pages opened %u to %u times\n", least, most);
+    errors++;
+  }
+
+  printf("%s: %u intervals logged, pages opened %u-%u times, %u power failures recovered\n",
+	 (errors == 0) ? "PASS" : "FAIL", (unsigned) logged.size(), least, most, failures);
+
+  return (errors == 0) ? 0 : 1;
+}
+#endif
@@ -0,0 +1,138 @@
+//------------------------------------------------------------------------------
+//   Copyright 2014 Janick Bergeron
+//   All Rights Reserved Worldwide
+//
+//   Licensed under the Apache License, Version 2.0 (the
+//   "License"); you may not use this file except in
+//   compliance with the License.  You may obtain a copy of
+//   the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in
+//   writing, software distributed under the License is
+//   distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+//   CONDITIONS OF ANY KIND, either express or implied.  See
+//   the License for the specific language governing
+//   permissions and limitations under the License.
+//------------------------------------------------------------------------------
+
+
+#ifndef _IntervalLog_h
+#define _IntervalLog_h
+
+#include <stdint.h>
+
+namespace PowerMinder {
+
+  /** Class to log the energy in consecutive 15-min intervals in EEPROM.
+   *
+   *  The log is a circular sequence of PAGE_SIZE-byte pages, so every page
+   *  (and every byte) is rewritten once per trip around the log.
+   *  A page starts with a sequence number and the index of its first interval:
+   *
+   *      SEQ                  0..254, +1 (mod 255) from the previous page. 0xFF == erased.
+   *      INTERVAL[4]          Little-endian
+   *
+   *  and is followed by records, each encoding the energy of the next interval
+   *  as the zig-zag encoded difference with the previous one (or 0 for the first one):
+   *
+   *      0xxxxxxx                      7-bit value
+   *      10xxxxxx xxxxxxxx             14-bit value
+   *      110xxxxx xxxxxxxx xxxxxxxx    21-bit value
+   *      1111nnnn                      Skip nnnn+1 intervals (nnnn < 15)
+   *      0xFF                          End of page
+   *
+   *  The first byte of a record is written last, so a record interrupted by
+   *  a power loss is never seen. The head of the log is found at boot by reading
+   *  the sequence numbers, then scanning the records of the last page.
+   *
+   *  Steady consumption takes one byte per interval, so a page holds up to
+   *  PAGE_SIZE - HEADER_SIZE = 27 intervals (6.75 hours). As the oldest page is
+   *  erased when the head page fills, N pages keep the last (N-1) x 27 to N x 27
+   *  intervals: 16 pages (512 bytes) hold 4.2 to 4.5 days. Varying consumption
+   *  takes two bytes per interval more often and shortens the retention.
+   */
+  class IntervalLog_t {
+
+  public:
+    /** Number of bytes in a page */
+    static const uint8_t PAGE_SIZE = 32;
+
+    /** Number of bytes in a page header */
+    static const uint8_t HEADER_SIZE = 5;
+
+    /** Function called for each logged interval by read() */
+    typedef void (*reader_t)(uint32_t  interval,   ///< Interval index
+			     uint16_t  energy,     ///< Energy in the interval, in pulses
+			     void     *context);
+
+    /** Return the index of the 15-min interval containing the specified date & time */
+    static uint32_t interval(uint8_t year,      ///< 0-99 (2000-2099)
+			     uint8_t month,     ///< 1-12
+			     uint8_t day,       ///< 1-31
+			     uint8_t hour,      ///< 0-23
+			     uint8_t min);      ///< 0-59
+
+    /** Encode the record(s) for an interval: a skip over the intervals
+     *  missing before it (0..15) then its energy difference with the previous one.
+     *  Returns the number of bytes in the record, 1..4.
+     */
+    static uint8_t encode(uint8_t  skip,
+			  int32_t  delta,
+			  uint8_t  record[4]);
+
+    /** Find the head & tail of the log */
+    void init();
+
+    /** Erase the entire log */
+    void erase();
+
+    /** Log the energy of an interval.
+     *  Intervals must be logged in chronological order.
+     */
+    void append(uint32_t interval,    ///< Interval index
+		uint16_t energy);     ///< Energy in the interval, in pulses
+
+    /** Call the reader function for each logged interval, from oldest to newest.
+     *  Returns the number of intervals read.
+     */
+    uint16_t read(reader_t  reader,
+		  void     *context = 0);
+
+    /** Is the log empty? */
+    bool is_empty();
+
+    /** Index of the interval after the last logged one */
+    uint32_t next();
+
+  // Looks like Sketches don't support private constructors...
+  //private:
+    /** Create a log in the specified EEPROM area */
+    constexpr IntervalLog_t(uint16_t base  = 0,     ///< EEPROM address of the first page
+			    uint8_t  pages = 16)    ///< Number of pages
+      : m_base(base), m_pages(pages), m_head(0xFF), m_offset(0), m_last(0), m_next(0)
+    {
+    }
+
+  private:
+    /** Open a new page for the specified interval */
+    void m_open(uint32_t interval);
+
+    /** Read the records of a page. Returns the offset of the end of the page. */
+    uint8_t m_scan(uint8_t   page,
+		   reader_t  reader,
+		   void     *context,
+		   uint16_t *count);
+
+    uint16_t m_base;
+    uint8_t  m_pages;
+    uint8_t  m_head;       ///< Page being appended (0xFF == log is empty)
+    uint8_t  m_offset;     ///< Offset of the next record in the head page
+    uint16_t m_last;       ///< Energy of the last logged interval
+    uint32_t m_next;       ///< Index of the next interval
+  };
+
+}
+
+#endif
@@ -25,84 +25,16 @@
 
 using namespace PowerMinder;
 
-LED_t::LED_t(uint8_t pin,
-	     uint8_t turn_on)
-  : m_pin(pin), m_is_on(0), m_ON(turn_on), m_OFF(turn_on == HIGH ? LOW : HIGH),
-    m_msec_on(0), m_msec_off(0), m_blink_stamp(0)
-{
-  init();
-}
 
+template class PowerMinder::LedControl_t<LedMask_t>;
 
-LED_t::~LED_t()
-{
-}
 
+#ifdef PIN_CHECK
+// Compiled for the AVR by "make check-pins": each function must use the
+// instruction in its name, without reading & writing back the whole port
 
-void
-LED_t::init()
-{
-  pinMode(m_pin, OUTPUT);
-  off();
-}
-
-
-bool
-LED_t::is_on()
-{
-  return m_is_on;
-}
-
-
-void
-LED_t::on()
-{
-  m_on();
-  m_msec_on = 0;
-}
-
-
-void
-LED_t::off()
-{
-  m_off();
-  m_msec_on = 0;
-}
-
-
-void
-LED_t::toggle()
-{
-  m_toggle();
-  m_msec_on = 0;
-}
-
-
-void
-LED_t::blink(uint16_t msec_on,
-	     uint16_t msec_off)
-{
-  m_msec_on  = msec_on;
-  m_msec_off = (msec_off == 0) ? msec_on : msec_off;
-  if (msec_on == 0) return;
-
-  m_blink_stamp = millis();
-  m_off();
-}
-
-
-void
-LED_t::loop()
-{
-  // Is blink mode ON?
-  if (m_msec_on > 0) {
-    unsigned long now = millis();
-    // If the clock has wrapped around, consider the interval over.
-    // This will cause a glitch once every 50 days so acceptable
-    if (now < m_blink_stamp
-	|| (now - m_blink_stamp) > ((m_is_on) ? m_msec_on : m_msec_off)) {
-      m_toggle();
-      m_blink_stamp = now;
-    }
-  }
-}
+extern "C" void check_sbi_led_output() {LedPin_t<5>::output();}
+extern "C" void check_sbi_led_on()     {LedPin_t<0>::on();}
+extern "C" void check_cbi_led_off()    {LedPin_t<0>::off();}
+extern "C" void check_cbi_led_on_low() {LedPin_t<1, LOW>::on();}
+#endif
@@ -18,11 +18,101 @@
 //------------------------------------------------------------------------------
 
 #include <stdint.h>
+#include <Arduino.h>
+#include "Gpio.h"
+#include "Profile.h"
 
 namespace PowerMinder {
 
-  /** Class to manage a LED connected to a digital pin */
-  class LED_t {
+  /** A LED on a PORTB pin known at compile time.
+   *  Each operation is meant to compile to a single sbi/cbi instruction (see make check-pins).
+   */
+  template <uint8_t Pin,                 ///< Pin number controlling the LED
+	    uint8_t ActiveLevel = HIGH>  ///< Digital level to turn LED ON
+  struct LedPin_t {
+    static const uint8_t MASK = PortBPin_t<Pin>::MASK;
+
+    /** PORTB bits driving the LED on or off */
+    static constexpr uint8_t level(bool on)
+    {
+      return (on == (ActiveLevel == HIGH)) ? MASK : 0;
+    }
+
+    /** Initialize the LED, turned off */
+    static void init()
+    {
+      off();
+      output();
+    }
+
+    /** Drive the pin */
+    static void output()
+    {
+      PortBPin_t<Pin>::output();
+    }
+
+    static void on()
+    {
+      PROFILE_WRITE();
+      if (ActiveLevel == HIGH) PortBPin_t<Pin>::set();
+      else PortBPin_t<Pin>::clear();
+    }
+
+    static void off()
+    {
+      PROFILE_WRITE();
+      if (ActiveLevel == HIGH) PortBPin_t<Pin>::clear();
+      else PortBPin_t<Pin>::set();
+    }
+  };
+
+
+  /** A LED on a PORTB pin specified at run time */
+  class LedMask_t {
+
+  public:
+    /** Initialize the LED, turned off */
+    void init()
+    {
+      off();
+      output();
+    }
+
+    /** Drive the pin */
+    void output()
+    {
+      PortB_t::output(m_mask);
+    }
+
+    void on()
+    {
+      PROFILE_WRITE();
+      if (m_ON == HIGH) PortB_t::set(m_mask);
+      else PortB_t::clear(m_mask);
+    }
+
+    void off()
+    {
+      PROFILE_WRITE();
+      if (m_ON == HIGH) PortB_t::clear(m_mask);
+      else PortB_t::set(m_mask);
+    }
+
+    constexpr LedMask_t(uint8_t pin,        ///< Pin number controlling the LED
+			uint8_t turn_on)    ///< Digital level to turn LED ON
+      : m_mask(PortB_t::mask(pin)), m_ON(turn_on)
+    {
+    }
+
+  private:
+    uint8_t m_mask;
+    uint8_t m_ON;
+  };
+
+
+  /** Class to manage a LED driven by a LedPin_t or a LedMask_t */
+  template <typename Output>
+  class LedControl_t : private Output {
 
   public:
     /** Initialize the LED */
@@ -40,40 +130,48 @@ namespace PowerMinder {
     /** Toggle the LED (turns off blink mode) */
     void toggle();
 
+    /** Record the LED as on or off (turns off blink mode), without driving the pin.
+     *  For LedGroup_t, which then drives the pins of all its LEDs at once.
+     */
+    void set(bool on);
+
     /** Blink the LED at the specified on/off interval */
     void blink(uint16_t msec_on,       ///< ON Interval in milliseconds (0 == turn off blink mode)
 	       uint16_t msec_off = 0); ///< OFF Interval in milliseconds (0 == same as ON interval)
 
+    /** Restore the pin mode and LED state, after the pin was used by another device */
+    void refresh();
+
     /** LED Service loop method: Call in the main loop() routine */
     void loop();
 
+    /** Time until loop() next changes the state of the LED, in milliseconds (0 == not blinking) */
+    unsigned long time_to_change();
+
   // Looks like Sketches don't support private constructors...
   //private:
     /** Create a LED control class */
-    LED_t(uint8_t pin,               ///< Pin number controlling the LED
-	  uint8_t turn_on = HIGH);   ///< Digital level to turn LED ON
-    ~LED_t();
+    explicit constexpr LedControl_t(const Output &output = Output())   ///< Only needed for a LedMask_t
+      : Output(output), m_is_on(0), m_msec_on(0), m_msec_off(0), m_blink_stamp(0)
+    {
+    }
 
   private:
-    uint8_t m_pin;
     bool    m_is_on;
 
-    uint8_t m_ON;
-    uint8_t m_OFF;
-
     uint16_t      m_msec_on;
     uint16_t      m_msec_off;
     unsigned long m_blink_stamp;
 
     void m_on()
     {
-      digitalWrite(m_pin, m_ON);
+      Output::on();
       m_is_on = true;
     }
 
     void m_off()
     {
-      digitalWrite(m_pin, m_OFF);
+      Output::off();
       m_is_on = false;
     }
 
@@ -84,4 +182,182 @@ namespace PowerMinder {
     }
   };
 
+
+  /** Class to manage a LED connected to a digital pin.
+   *  The pin is specified at run time but driven directly on PORTB, like LedPin_t.
+   */
+  class LED_t : public LedControl_t<LedMask_t> {
+
+  public:
+    /** Create a LED control class */
+    constexpr LED_t(uint8_t pin,               ///< Pin number controlling the LED
+		    uint8_t turn_on = HIGH)    ///< Digital level to turn LED ON
+      : LedControl_t<PowerMinder::LedMask_t>(PowerMinder::LedMask_t(pin, turn_on))
+    {
+    }
+  };
+
+
+  /** Three LEDs on PORTB pins known at compile time, turned on or off together.
+   *  The state of each LedControl_t is updated, then the port is written
+   *  in one read-modify-write, so the LEDs change at the same time.
+   *  Holds references only: declare it const to let the compiler fold it away.
+   *
+   *  Not interrupt-safe if an ISR also writes to PORTB.
+   */
+  template <typename A,   ///< LedPin_t of each LED
+	    typename B,
+	    typename C>
+  class LedGroup_t {
+
+  public:
+    /** Pins in the group */
+    static const uint8_t MASK = A::MASK | B::MASK | C::MASK;
+
+    /** Turn each LED on or off (turns off blink mode) */
+    void write(bool a,
+	       bool b,
+	       bool c) const
+    {
+      m_a.set(a);
+      m_b.set(b);
+      m_c.set(c);
+      PROFILE_WRITE();
+      PortB_t::write(MASK, A::level(a) | B::level(b) | C::level(c));
+    }
+
+    /** Turn all LEDs off (turns off blink mode) */
+    void off() const
+    {
+      write(false, false, false);
+    }
+
+    constexpr LedGroup_t(LedControl_t<A> &a,
+			 LedControl_t<B> &b,
+			 LedControl_t<C> &c)
+      : m_a(a), m_b(b), m_c(c)
+    {
+    }
+
+  private:
+    LedControl_t<A> &m_a;
+    LedControl_t<B> &m_b;
+    LedControl_t<C> &m_c;
+  };
+
+
+  template <typename Output>
+  void
+  LedControl_t<Output>::init()
+  {
+    Output::init();
+    m_is_on   = false;
+    m_msec_on = 0;
+  }
+
+
+  template <typename Output>
+  void
+  LedControl_t<Output>::refresh()
+  {
+    if (m_is_on) m_on();
+    else m_off();
+    Output::output();
+  }
+
+
+  template <typename Output>
+  bool
+  LedControl_t<Output>::is_on()
+  {
+    return m_is_on;
+  }
+
+
+  template <typename Output>
+  void
+  LedControl_t<Output>::on()
+  {
+    m_on();
+    m_msec_on = 0;
+  }
+
+
+  template <typename Output>
+  void
+  LedControl_t<Output>::off()
+  {
+    m_off();
+    m_msec_on = 0;
+  }
+
+
+  template <typename Output>
+  void
+  LedControl_t<Output>::set(bool on)
+  {
+    m_is_on   = on;
+    m_msec_on = 0;
+  }
+
+
+  template <typename Output>
+  void
+  LedControl_t<Output>::toggle()
+  {
+    m_toggle();
+    m_msec_on = 0;
+  }
+
+
+  template <typename Output>
+  void
+  LedControl_t<Output>::blink(uint16_t msec_on,
+			      uint16_t msec_off)
+  {
+    m_msec_on  = msec_on;
+    m_msec_off = (msec_off == 0) ? msec_on : msec_off;
+    if (msec_on == 0) return;
+
+    m_blink_stamp = millis();
+    m_off();
+  }
+
+
+  template <typename Output>
+  void
+  LedControl_t<Output>::loop()
+  {
+    PROFILE_SCOPE(LED_IO);
+
+    // Is blink mode ON?
+    if (m_msec_on > 0) {
+      unsigned long now = millis();
+      // If the clock has wrapped around, consider the interval over.
+      // This will cause a glitch once every 50 days so acceptable
+      if (now < m_blink_stamp
+	  || (now - m_blink_stamp) > ((m_is_on) ? m_msec_on : m_msec_off)) {
+	m_toggle();
+	m_blink_stamp = now;
+      }
+    }
+  }
+
+
+  template <typename Output>
+  unsigned long
+  LedControl_t<Output>::time_to_change()
+  {
+    if (m_msec_on == 0) return 0;
+
+    unsigned long now     = millis();
+    unsigned long elapsed = now - m_blink_stamp;
+    unsigned long phase   = (m_is_on) ? m_msec_on : m_msec_off;
+    if (now < m_blink_stamp || elapsed > phase) return 1;
+    return phase + 1 - elapsed;
+  }
+
+  // Compiled once, in LED.cpp
+  extern template class LedControl_t<LedMask_t>;
+
 }
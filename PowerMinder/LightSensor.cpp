@@ -19,46 +19,91 @@
 
 #include <Arduino.h>
 #include "LightSensor.h"
+#include "Profile.h"
 
 using namespace PowerMinder;
 
-LightSensor_t::LightSensor_t(unsigned char pin)
-  : m_pin(pin)
+
+void
+LightSensor_t::init()
 {
-  init();
+  pinMode(m_pin, INPUT);
+
+  // The ambient light level is calibrated from the first samples
+  m_confidence    = 0;
+  m_pulse_samples = 0;
 }
 
 
-LightSensor_t::~LightSensor_t()
+uint16_t
+LightSensor_t::current()
 {
+  PROFILE_SCOPE(LIGHT_IO);
+  uint16_t value = analogRead(m_pin);
+  PROFILE_READ();
+  update(value);
+  return value;
+}
+
+
+uint8_t
+LightSensor_t::pin()
+{
+  return m_pin;
 }
 
 
 void
-LightSensor_t::init()
+LightSensor_t::update(uint16_t value)
 {
-  pinMode(m_pin, INPUT);
+  uint16_t level = value << 6;
 
-  // Calibrate the ambient light level
-  uint32_t sum = 0;
-  int n = 0;
-  while (n++ < 40) {
-    delayMicroseconds(4);
-    sum += analogRead(m_pin);
+  // The first sample seeds the baseline
+  if (m_confidence == 0) {
+    m_level = level;
+    m_confidence = 1;
+    m_pulse_samples = 0;
+    return;
   }
-  m_baseline = sum / n;
+
+  // Pulses must not pull the baseline up.
+  // But if it stays bright for too long, the ambient light has changed.
+  if (value > baseline() + PULSE_THRESHOLD) {
+    if (++m_pulse_samples == MAX_PULSE_SAMPLES) m_confidence = 0;
+    return;
+  }
+  m_pulse_samples = 0;
+
+  // Track a running minimum: follow darker samples quickly
+  // and brighter ones very slowly, so the baseline sits at the bottom
+  // of the noise band.
+  if (level < m_level) {
+    // A large drop means the ambient light has changed: trust it less
+    if (value + PULSE_THRESHOLD < baseline()) m_confidence = (m_confidence >> 1) + 1;
+    m_level -= (m_level - level) >> 2;
+  }
+  else m_level += (level - m_level) >> 6;
+
+  if (m_confidence < 255) m_confidence++;
 }
 
 
 uint16_t
-LightSensor_t::current()
+LightSensor_t::baseline()
 {
-  return analogRead(m_pin);
+  return (m_level + 32) >> 6;
 }
 
 
-uint16_t
-LightSensor_t::baseline()
+uint8_t
+LightSensor_t::confidence()
+{
+  return m_confidence;
+}
+
+
+bool
+LightSensor_t::is_calibrated()
 {
-  return m_baseline;
+  return m_confidence >= CALIBRATED;
 }
@@ -21,11 +21,23 @@
 
 namespace PowerMinder {
 
-  /** Class to manage the light-sensitive resistor */
+  /** Class to manage the light-sensitive resistor
+   *
+   *  The ambient light baseline is not measured up-front: it is tracked
+   *  continuously from the samples returned by current() (or fed via update()).
+   *  Samples brighter than the baseline by more than PULSE_THRESHOLD are
+   *  considered part of a meter pulse and are not folded into the baseline.
+   */
   class LightSensor_t {
 
   public:
-    /** Initialize and calibrate the sensor */
+    /** Brightness above the baseline that is considered a light pulse */
+    static const uint16_t PULSE_THRESHOLD = 0x0040;
+
+    /** Confidence level at which the baseline is considered calibrated */
+    static const uint8_t  CALIBRATED = 40;
+
+    /** Initialize the sensor and restart the calibration. Does not sample the sensor. */
     void init();
 
     /** Return the current light level reading, scaled to a value in the 0-1023 range.
@@ -33,23 +45,46 @@ namespace PowerMinder {
      *  Scale may not be perfectly linear.
      *  It may not be possible to reach the limits of the scale.
      *
+     *  The reading is also used to update the baseline.
+     *
      * Experiments with unit #2 showed values of ~0x0260 for ambient/no light conditions
      * and values of ~0x02FC when lit with a white LED from 4" away.
      */
     uint16_t current();
 
-    /** Return the baseline ambient light level as measured during calibration */
+    /** Analog pin number reading the light sensor, to obtain readings by other means */
+    uint8_t pin();
+
+    /** Update the baseline with a reading obtained by other means (e.g. ADC interrupt) */
+    void update(uint16_t value);   ///< Light level reading, 0-1023
+
+    /** Return the baseline ambient light level as currently tracked */
     uint16_t baseline();
 
+    /** Return the confidence in the baseline: the number of ambient samples
+     *  folded in since the last (re)calibration, saturating at 255 */
+    uint8_t confidence();
+
+    /** Has the baseline been tracked for long enough to be trusted? */
+    bool is_calibrated();
+
   // Looks like Sketches don't support private constructors...
   //private:
     /** Create a light sensor control class */
-    LightSensor_t(uint8_t pin);                ///< Analog pin number reading the light sensor
-    ~LightSensor_t();
+    constexpr LightSensor_t(uint8_t pin)       ///< Analog pin number reading the light sensor
+      : m_pin(pin), m_level(0), m_confidence(0), m_pulse_samples(0)
+    {
+    }
 
   private:
+    /** Number of consecutive pulse samples after which the ambient light
+     *  level is assumed to have changed and the calibration restarts */
+    static const uint8_t MAX_PULSE_SAMPLES = 255;
+
     uint8_t  m_pin;
-    uint16_t m_baseline;
+    uint16_t m_level;        ///< Baseline, in 1/64th of a reading
+    uint8_t  m_confidence;
+    uint8_t  m_pulse_samples;
   };
 
 }
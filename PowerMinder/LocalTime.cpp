@@ -0,0 +1,411 @@
+//------------------------------------------------------------------------------
+//   Copyright 2014 Janick Bergeron
+//   All Rights Reserved Worldwide
+//
+//   Licensed under the Apache License, Version 2.0 (the
+//   "License"); you may not use this file except in
+//   compliance with the License.  You may obtain a copy of
+//   the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in
+//   writing, software distributed under the License is
+//   distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+//   CONDITIONS OF ANY KIND, either express or implied.  See
+//   the License for the specific language governing
+//   permissions and limitations under the License.
+//------------------------------------------------------------------------------
+
+
+
+
+#include "LocalTime.h"
+
+using namespace PowerMinder;
+
+
+constexpr LocalTime_t::rule_t LocalTime_t::US_START;
+constexpr LocalTime_t::rule_t LocalTime_t::US_END;
+constexpr LocalTime_t::rule_t LocalTime_t::EU_START;
+constexpr LocalTime_t::rule_t LocalTime_t::EU_END;
+
+
+/** Days before the specified month (1-13), in non-leap years.
+ *  Computed rather than tabulated: a table would take 26 bytes of SRAM on the ATtiny85.
+ */
+static inline uint16_t
+daysBeforeMonth(uint8_t month)
+{
+  return (367 * month - 362) / 12 - ((month > 2) ? 2 : 0);
+}
+
+
+/** Number of days in the specified month */
+static uint8_t
+monthDays(uint8_t year,
+	  uint8_t month)
+{
+  return daysBeforeMonth(month + 1) - daysBeforeMonth(month) + (month == 2 && year % 4 == 0);
+}
+
+
+void
+LocalTime_t::init()
+{
+  m_start.month = 0;
+  m_count       = 0;
+  m_cursor      = 0;
+  m_dst         = false;
+  m_next        = 0xFFFFFFFF;
+  m_now         = 0;
+}
+
+
+void
+LocalTime_t::init(rule_t start,
+		  rule_t end)
+{
+  init();
+  m_start = start;
+  m_end   = end;
+
+  // The transitions are computed by the first conversion
+  m_next = 0;
+}
+
+
+bool
+LocalTime_t::toLocal(uint8_t &year,
+		     uint8_t &month,
+		     uint8_t &day,
+		     uint8_t &dayOfWeek,
+		     uint8_t &hour,
+		     uint8_t  min)
+{
+  m_now = minutes(year, month, day, hour, min);
+  if (m_now >= m_next) m_seek(year, m_now);
+
+  if (!m_dst) return false;
+
+  if (++hour == 24) {
+    hour      = 0;
+    dayOfWeek = dayOfWeek % 7 + 1;
+    if (++day > monthDays(year, month)) {
+      day = 1;
+      if (++month > 12) {
+	month = 1;
+	year++;
+      }
+    }
+  }
+  return true;
+}
+
+
+uint16_t
+LocalTime_t::realMinutes(uint16_t wallMinutes)
+{
+  if (m_now + wallMinutes < m_next) return wallMinutes;
+
+  // The wall clock jumps by an hour on the way.
+  // A local time skipped at the start of daylight saving time is reached at the transition.
+  int32_t real = (int32_t) wallMinutes + (m_dst ? 60 : -60);
+  if (real < (int32_t) (m_next - m_now)) real = m_next - m_now;
+
+  return (real > 65535) ? 65535 : real;
+}
+
+
+int8_t
+LocalTime_t::shift(uint8_t  year,
+		   uint8_t  month,
+		   uint8_t  day,
+		   uint8_t &hour) const
+{
+  if (m_start.month == 0) return 0;
+
+  // The wall clock is still in standard time when moving forward,
+  // and again in standard time after moving back.
+  if (month == m_start.month && day == m_transitionDay(year, m_start)) {
+    hour = m_start.hour;
+    return -1;
+  }
+  if (month == m_end.month && day == m_transitionDay(year, m_end)) {
+    hour = m_end.hour;
+    return 1;
+  }
+  return 0;
+}
+
+
+uint32_t
+LocalTime_t::minutes(uint8_t year,
+		     uint8_t month,
+		     uint8_t day,
+		     uint8_t hour,
+		     uint8_t min)
+{
+  uint16_t days = year * 365 + (year + 3) / 4 + daysBeforeMonth(month) + day - 1;
+  if (month > 2 && year % 4 == 0) days++;
+
+  return days * 1440UL + hour * 60 + min;
+}
+
+
+uint8_t
+LocalTime_t::m_transitionDay(uint8_t year,
+			     rule_t  rule)
+{
+  // 2000-01-01 was a Saturday
+  uint8_t first = (minutes(year, rule.month, 1, 0, 0) / 1440 + 6) % 7 + 1;
+  uint8_t day   = 1 + (8 - first) % 7 + (rule.week - 1) * 7;
+  if (day > monthDays(year, rule.month)) day -= 7;
+
+  return day;
+}
+
+
+void
+LocalTime_t::m_fill(uint8_t year)
+{
+  m_count = 0;
+  for (uint8_t y = year; y < year + DST_YEARS && y < 100; y++) {
+    uint32_t start = minutes(y, m_start.month, m_transitionDay(y, m_start), m_start.hour, 0);
+    uint32_t end   = minutes(y, m_end.month, m_transitionDay(y, m_end), m_end.hour, 0);
+
+    // South of the equator, the year starts in daylight saving time
+    m_changes[m_count++] = (start < end) ? start : end;
+    m_changes[m_count++] = (start < end) ? end : start;
+  }
+}
+
+
+void
+LocalTime_t::m_seek(uint8_t  year,
+		    uint32_t now)
+{
+  if (m_start.month == 0) return;
+
+  while (m_cursor < m_count && m_changes[m_cursor] <= now) m_cursor++;
+  if (m_cursor == m_count) {
+    m_fill(year);
+    m_cursor = 0;
+    while (m_cursor < m_count && m_changes[m_cursor] <= now) m_cursor++;
+  }
+
+  // Every transition flips daylight saving time
+  m_dst  = (m_cursor % 2 == 1) != (m_end.month < m_start.month);
+  m_next = (m_cursor < m_count) ? m_changes[m_cursor] : 0xFFFFFFFF;
+}
+
+
+#ifdef TEST
+#include <stdio.h>
+
+/** A date & time, advanced one minute at a time */
+typedef struct {
+  uint8_t year, month, day, dayOfWeek, hour, min;
+} when_t;
+
+static void
+tick(when_t &t)
+{
+  if (++t.min < 60) return;
+  t.min = 0;
+  if (++t.hour < 24) return;
+  t.hour = 0;
+  t.dayOfWeek = t.dayOfWeek % 7 + 1;
+  if (++t.day <= monthDays(t.year, t.month)) return;
+  t.day = 1;
+  if (++t.month <= 12) return;
+  t.month = 1;
+  t.year++;
+}
+
+
+/** Rules and the dates of their transitions, from the tz database */
+typedef struct {
+  const char           *name;
+  LocalTime_t::rule_t   start;
+  LocalTime_t::rule_t   end;
+  uint8_t               dates[7][4];   ///< Start MM DD & end MM DD, 2014-2020
+} zone_t;
+
+static const zone_t zones[] = {
+  {"US (America/New_York)", LocalTime_t::US_START, LocalTime_t::US_END,
+   {{3,  9, 11, 2}, {3,  8, 11, 1}, {3, 13, 11, 6}, {3, 12, 11, 5}, {3, 11, 11, 4}, {3, 10, 11, 3}, {3,  8, 11, 1}}},
+  {"EU (Europe/Paris)", LocalTime_t::EU_START, LocalTime_t::EU_END,
+   {{3, 30, 10, 26}, {3, 29, 10, 25}, {3, 27, 10, 30}, {3, 26, 10, 29}, {3, 25, 10, 28}, {3, 31, 10, 27}, {3, 29, 10, 25}}},
+  // From the 1st Sunday in October at 02:00 to the 1st Sunday in April at 03:00 DST
+  {"Southern (Australia/Sydney)", {10, 1, 2}, {4, 1, 2},
+   {{10, 5, 4, 6}, {10, 4, 4, 5}, {10, 2, 4, 3}, {10, 1, 4, 2}, {10, 7, 4, 1}, {10, 6, 4, 7}, {10, 4, 4, 5}}}
+};
+
+
+/** Real minutes until the local time first reaches "wall" minutes after the local time at "now", by brute force */
+static uint16_t
+reach(const zone_t   &zone,
+      when_t        now,
+      uint16_t        wall)
+{
+  LocalTime_t local;
+  local.init(zone.start, zone.end);
+
+  uint32_t target = 0;
+  for (uint16_t real = 0; ; real++, tick(now)) {
+    when_t l = now;
+    local.toLocal(l.year, l.month, l.day, l.dayOfWeek, l.hour, l.min);
+    uint32_t at = LocalTime_t::minutes(l.year, l.month, l.day, l.hour, l.min);
+    if (real == 0) target = at + wall;
+    if (at >= target) return real;
+  }
+}
+
+
+int
+main()
+{
+  int errors = 0;
+
+  // 2014-01-01 was a Wednesday: 14 years & 4 leap days after 2000-01-01
+  bool ok = (LocalTime_t::minutes(14, 1, 1, 0, 0) == (14 * 365 + 4) * 1440UL &&
+	     LocalTime_t::minutes(16, 3, 1, 12, 30) - LocalTime_t::minutes(16, 2, 28, 12, 30) == 2 * 1440UL);
+  printf("%s: Minutes since 2000\n", (ok) ? "PASS" : "FAIL");
+  if (!ok) errors++;
+
+  for (unsigned int z = 0; z < sizeof(zones) / sizeof(zones[0]); z++) {
+    const zone_t &zone = zones[z];
+    LocalTime_t   local;
+    local.init(zone.start, zone.end);
+
+    // Only the transition dates shift the wall clock, by the rule hours
+    bool dates = true;
+    for (uint8_t y = 0; y < 7; y++) {
+      for (uint8_t month = 1; month <= 12; month++) {
+	for (uint8_t day = 1; day <= monthDays(14 + y, month); day++) {
+	  uint8_t hour  = 0xFF;
+	  int8_t  shift = local.shift(14 + y, month, day, hour);
+	  int8_t  want  = 0;
+	  uint8_t at    = 0xFF;
+	  if (month == zone.dates[y][0] && day == zone.dates[y][1]) {
+	    want = -1;
+	    at   = zone.start.hour;
+	  }
+	  if (month == zone.dates[y][2] && day == zone.dates[y][3]) {
+	    want = 1;
+	    at   = zone.end.hour;
+	  }
+	  if (shift != want || hour != at) {
+	    printf("ERROR: %s: shift() is %d at %02d:00 on 20%02d-%02d-%02d, not %d\n", zone.name, shift, hour, 14 + y, month, day, want);
+	    dates = false;
+	  }
+	}
+      }
+    }
+    printf("%s: %s: transition dates, 2014-2020\n", (dates) ? "PASS" : "FAIL", zone.name);
+    if (!dates) errors++;
+
+    // Every minute from 2013-12-31 to 2021-01-01, in standard time.
+    // The local time is the standard time, or the standard time 60 minutes later.
+    // Every local hour is seen for 60 minutes, except the one skipped or repeated by shift().
+    when_t std   = {13, 12, 31, 3, 0, 0};
+    when_t ahead = std;
+    for (int i = 0; i < 60; i++) tick(ahead);
+    uint8_t  seen[24]  = {0};
+    uint8_t  seenDay   = 0;
+    bool     times     = true;
+    bool     hours     = true;
+    uint16_t spans     = 0;
+    bool     dst       = false;
+    uint32_t start = 0, end = 0;
+    while (std.year < 21) {
+      // Transitions of the current year, in standard minutes
+      if (std.year >= 14 && std.month == 1 && std.day == 1 && std.hour == 0 && std.min == 0) {
+	const uint8_t *d = zone.dates[std.year - 14];
+	start = LocalTime_t::minutes(std.year, d[0], d[1], zone.start.hour, 0);
+	end   = LocalTime_t::minutes(std.year, d[2], d[3], zone.end.hour, 0);
+      }
+      uint32_t now  = LocalTime_t::minutes(std.year, std.month, std.day, std.hour, std.min);
+      bool     want = (start < end) ? (now >= start && now < end) : (now < end || now >= start);
+      if (std.year < 14) want = (zone.end.month < zone.start.month);
+
+      when_t l = std;
+      bool is_dst = local.toLocal(l.year, l.month, l.day, l.dayOfWeek, l.hour, l.min);
+      const when_t &e = (want) ? ahead : std;
+      if (is_dst != want || l.year != e.year || l.month != e.month || l.day != e.day ||
+	  l.dayOfWeek != e.dayOfWeek || l.hour != e.hour || l.min != e.min) {
+	if (times) printf("ERROR: %s: 20%02d-%02d-%02d %02d:%02d standard is 20%02d-%02d-%02d %02d:%02d (%d), not 20%02d-%02d-%02d %02d:%02d\n",
+			  zone.name, std.year, std.month, std.day, std.hour, std.min,
+			  l.year, l.month, l.day, l.hour, l.min, l.dayOfWeek, e.year, e.month, e.day, e.hour, e.min);
+	times = false;
+      }
+      if (is_dst != dst) spans++;
+      dst = is_dst;
+
+      // A new local day: check the hours of the previous one (complete days only)
+      if (l.day != seenDay) {
+	if (seenDay != 0 && l.year >= 14 && !(l.year == 14 && l.month == 1 && l.day == 1)) {
+	  when_t y = l;
+	  // The previous local day
+	  y.day = seenDay;
+	  if (seenDay > l.day) y.month = (l.month == 1) ? 12 : l.month - 1;
+	  if (seenDay > l.day && l.month == 1) y.year--;
+	  uint8_t hour  = 0xFF;
+	  int8_t  shift = local.shift(y.year, y.month, y.day, hour);
+	  for (uint8_t h = 0; h < 24; h++) {
+	    uint8_t want = (h != hour) ? 60 : (shift < 0) ? 0 : 120;
+	    if (seen[h] != want) {
+	      if (hours) printf("ERROR: %s: Local hour %02d:00 on 20%02d-%02d-%02d seen for %d minutes, not %d\n",
+				zone.name, h, y.year, y.month, y.day, seen[h], want);
+	      hours = false;
+	    }
+	  }
+	}
+	for (uint8_t h = 0; h < 24; h++) seen[h] = 0;
+	seenDay = l.day;
+      }
+      seen[l.hour]++;
+
+      tick(std);
+      tick(ahead);
+    }
+    ok = times && spans == 14 + (zone.end.month < zone.start.month);
+    printf("%s: %s: toLocal() every minute, %d changes\n", (ok) ? "PASS" : "FAIL", zone.name, spans);
+    if (!ok) errors++;
+    printf("%s: %s: hours skipped & repeated\n", (hours) ? "PASS" : "FAIL", zone.name);
+    if (!hours) errors++;
+
+    // Real time to a local time, from up to 3 hours before each transition (from midnight) to 2 hours after.
+    // A local time skipped is reached at the transition, one repeated the first time.
+    ok = true;
+    for (uint8_t y = 0; ok && y < 7; y++) {
+      for (uint8_t t = 0; ok && t < 2; t++) {
+	const LocalTime_t::rule_t &rule = (t == 0) ? zone.start : zone.end;
+	when_t from = {(uint8_t) (14 + y), zone.dates[y][2 * t], zone.dates[y][2 * t + 1], 1, 0, 0};
+	if (rule.hour >= 3) from.hour = rule.hour - 3;
+	for (uint16_t m = 0; ok && m < 300; m += 10) {
+	  LocalTime_t probe;
+	  probe.init(zone.start, zone.end);
+	  when_t l = from;
+	  probe.toLocal(l.year, l.month, l.day, l.dayOfWeek, l.hour, l.min);
+	  for (uint16_t wall = 0; ok && wall <= 300; wall += 15) {
+	    uint16_t real = probe.realMinutes(wall);
+	    uint16_t want = reach(zone, from, wall);
+	    if (real != want) {
+	      printf("ERROR: %s: %d wall minutes from 20%02d-%02d-%02d %02d:%02d standard is %d real minutes, not %d\n",
+		     zone.name, wall, from.year, from.month, from.day, from.hour, from.min, real, want);
+	      ok = false;
+	    }
+	  }
+	  for (uint8_t i = 0; i < 10; i++) tick(from);
+	}
+      }
+    }
+    printf("%s: %s: realMinutes() across the transitions\n", (ok) ? "PASS" : "FAIL", zone.name);
+    if (!ok) errors++;
+  }
+
+  return (errors) ? 1 : 0;
+}
+#endif
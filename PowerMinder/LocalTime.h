@@ -0,0 +1,139 @@
+//------------------------------------------------------------------------------
+//   Copyright 2014 Janick Bergeron
+//   All Rights Reserved Worldwide
+//
+//   Licensed under the Apache License, Version 2.0 (the
+//   "License"); you may not use this file except in
+//   compliance with the License.  You may obtain a copy of
+//   the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in
+//   writing, software distributed under the License is
+//   distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+//   CONDITIONS OF ANY KIND, either express or implied.  See
+//   the License for the specific language governing
+//   permissions and limitations under the License.
+//------------------------------------------------------------------------------
+
+
+
+#ifndef _LocalTime_h
+#define _LocalTime_h
+
+#include <stdint.h>
+
+/** Number of years of daylight saving time transitions computed at once (2 or more).
+ *  Each year costs 8 bytes of SRAM.
+ */
+#ifndef DST_YEARS
+#define DST_YEARS 2
+#endif
+
+namespace PowerMinder {
+
+  /** Class to map the standard time kept by the RTC to the local time.
+   *
+   *  Keeping the RTC in standard time makes its time monotonic: the interval log
+   *  never has a gap or an overlap. Tariffs are defined on the local wall clock.
+   *
+   *  The transitions into and out of daylight saving time are computed from
+   *  the rules for DST_YEARS years at once, in standard minutes since 2000, and
+   *  are followed by a cursor: converting a time costs one comparison with the
+   *  next transition. The table is recomputed when the cursor runs off its end.
+   *
+   *  The clock must not go backward, except by calling init() again.
+   */
+  class LocalTime_t {
+
+  public:
+    /** Date & time of a transition: the n-th Sunday of a month, at an hour in standard time */
+    typedef struct {
+      uint8_t month;   ///< 1-12
+      uint8_t week;    ///< 1-4, 5 == last Sunday
+      uint8_t hour;    ///< 0-22, in standard time
+    } rule_t;
+
+    /** North American rules: from the 2nd Sunday in March at 02:00 to the 1st Sunday in November at 02:00 DST */
+    static constexpr rule_t US_START = {3,  2, 2};
+    static constexpr rule_t US_END   = {11, 1, 1};
+
+    /** European rules, for Central European Time: the last Sundays in March & October at 01:00 UTC */
+    static constexpr rule_t EU_START = {3,  5, 2};
+    static constexpr rule_t EU_END   = {10, 5, 2};
+
+    /** Keep the local time in standard time */
+    void init();
+
+    /** Use the specified daylight saving time rules, one hour ahead of standard time */
+    void init(rule_t start,   ///< Transition to daylight saving time
+	      rule_t end);    ///< Transition back to standard time
+
+    /** Convert a standard time to local time, in place.
+     *  Returns TRUE if daylight saving time is in effect.
+     */
+    bool toLocal(uint8_t &year,        ///< 0-99 (2000-2099)
+		 uint8_t &month,       ///< 1-12
+		 uint8_t &day,         ///< 1-31
+		 uint8_t &dayOfWeek,   ///< 1-7  (1 == Sunday)
+		 uint8_t &hour,        ///< 0-23
+		 uint8_t  min);        ///< 0-59
+
+    /** Real time until a local time, in minutes, from the time last converted by toLocal().
+     *  The local time is specified as a wall-clock duration, e.g. Calendar::getTimeToNextCost(),
+     *  that is 60 minutes too long across the start of daylight saving time
+     *  and 60 minutes too short across its end. Saturates at 65535.
+     */
+    uint16_t realMinutes(uint16_t wallMinutes);
+
+    /** Change of the wall clock on the specified local date:
+     *  -1 if a local hour is skipped, +1 if it is repeated, 0 otherwise.
+     *  Sets the hour that is skipped or repeated.
+     */
+    int8_t shift(uint8_t  year,          ///< 0-99
+		 uint8_t  month,         ///< 1-12
+		 uint8_t  day,           ///< 1-31
+		 uint8_t &hour) const;   ///< 0-23
+
+    /** Minutes since 2000-01-01 00:00 */
+    static uint32_t minutes(uint8_t year,    ///< 0-99
+			    uint8_t month,   ///< 1-12
+			    uint8_t day,     ///< 1-31
+			    uint8_t hour,    ///< 0-23
+			    uint8_t min);    ///< 0-59
+
+  // Looks like Sketches don't support private constructors...
+  //private:
+    /** Create a local time in standard time. Call init() before use. */
+    constexpr LocalTime_t()
+      : m_start(), m_end(), m_changes(), m_count(0), m_cursor(0), m_dst(false),
+	m_next(0xFFFFFFFF), m_now(0)
+    {
+    }
+
+  private:
+    /** Day of the month of a transition in the specified year */
+    static uint8_t m_transitionDay(uint8_t year,
+				   rule_t  rule);
+
+    /** Compute the transitions of DST_YEARS years, starting with the specified one */
+    void m_fill(uint8_t year);
+
+    /** Point the cursor to the first transition after the specified time */
+    void m_seek(uint8_t  year,
+		uint32_t now);
+
+    rule_t   m_start;                     ///< Transition to daylight saving time
+    rule_t   m_end;                       ///< Transition back to standard time
+    uint32_t m_changes[2 * DST_YEARS];    ///< Transitions, in standard minutes, in order
+    uint8_t  m_count;                     ///< Number of transitions (0 without DST)
+    uint8_t  m_cursor;                    ///< Next transition
+    bool     m_dst;                       ///< Daylight saving time in effect
+    uint32_t m_next;                      ///< Time of the next transition
+    uint32_t m_now;                       ///< Time last converted
+  };
+
+}
+
+#endif
@@ -0,0 +1,593 @@
+//------------------------------------------------------------------------------
+//   Copyright 2014 Janick Bergeron
+//   All Rights Reserved Worldwide
+//
+//   Licensed under the Apache License, Version 2.0 (the
+//   "License"); you may not use this file except in
+//   compliance with the License.  You may obtain a copy of
+//   the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in
+//   writing, software distributed under the License is
+//   distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+//   CONDITIONS OF ANY KIND, either express or implied.  See
+//   the License for the specific language governing
+//   permissions and limitations under the License.
+//------------------------------------------------------------------------------
+
+
+#include <stdint.h>
+#include "Crc16.h"
+#include "OpticalLink.h"
+
+using namespace PowerMinder;
+
+/** Number of similar runs required to lock onto the bit clock of the preamble */
+static const uint8_t PREAMBLE_RUNS = 8;
+
+
+void
+OpticalReceiver_t::init()
+{
+  m_state   = HUNT;
+  m_similar = 0;
+  m_half    = 0;
+  m_pos     = 0;
+}
+
+
+bool
+OpticalReceiver_t::update(uint16_t value,
+			  uint16_t baseline)
+{
+  // Slice halfway to the lit level, with some hysteresis
+  uint16_t slice = baseline + m_threshold;
+  uint16_t hyst  = m_threshold / 4;
+  if (m_high > slice) {
+    hyst  = (m_high - baseline) / 8;
+    slice = baseline + (m_high - baseline) / 2;
+  }
+  bool lit = (m_lit) ? (value + hyst >= slice) : (value > slice + hyst);
+
+  if (lit && value > m_peak) m_peak = value;
+  if (m_lit && !lit) {
+    // Follow the lit level from one lit run to the next
+    m_high = (m_high > baseline + m_threshold) ? (m_high + m_peak) / 2 : m_peak;
+    m_peak = 0;
+  }
+
+  if (lit == m_lit) {
+    if (m_run < 255) m_run++;
+
+    // Lose the lock if the signal stops toggling
+    if (m_state != HUNT && ((uint16_t) m_run << 4) >= m_half * 5 / 2) m_state = HUNT;
+    return false;
+  }
+
+  m_lit = lit;
+  uint8_t packets = m_packets;
+  m_edge(lit);
+  m_run = 1;
+  return m_packets != packets;
+}
+
+
+void
+OpticalReceiver_t::m_edge(bool rising)
+{
+  uint16_t run = (uint16_t) m_run << 4;
+
+  if (m_state == HUNT) {
+    // The preamble toggles every bit period (a "long" run):
+    // look for a series of similar runs
+    if (m_run < 2 * MIN_HALF_BIT || m_run == 255) {
+      m_similar = 0;
+      return;
+    }
+    int16_t delta = run - m_half;
+    if (m_similar == 0 || delta > (int16_t) (m_half / 4) || -delta > (int16_t) (m_half / 4)) {
+      m_half = run;
+      m_similar = 1;
+      return;
+    }
+    m_half += delta / 4;
+    if (++m_similar < PREAMBLE_RUNS) return;
+
+    // Locked! A long run always ends in the middle of a bit
+    m_half   /= 2;
+    m_state   = SYNC;
+    m_shift   = 0;
+    m_mid     = true;
+    m_bit(rising);
+    return;
+  }
+
+  // A half-bit (short) or a full-bit (long) run?
+  if (run < m_half / 2 || run >= m_half * 5 / 2) {
+    m_state = HUNT;
+    m_similar = 0;
+    return;
+  }
+  if (run >= m_half * 3 / 2) {
+    // A long run can only go from the middle of a bit to the middle of the next one
+    if (!m_mid) {
+      m_state = HUNT;
+      m_similar = 0;
+      return;
+    }
+    run /= 2;
+  }
+  else m_mid = !m_mid;
+
+  // Follow the transmitter's clock
+  m_half += ((int16_t) (run - m_half)) / 8;
+
+  if (m_mid) m_bit(rising);
+}
+
+
+bool
+OpticalReceiver_t::m_bit(bool bit)
+{
+  m_shift = (m_shift >> 1) | (bit ? 0x80 : 0x00);
+
+  if (m_state == SYNC) {
+    if (m_shift == START) {
+      m_state = FRAME;
+      m_nbits = 0;
+      m_pos   = 0;
+    }
+    return false;
+  }
+
+  if (++m_nbits < 8) return false;
+  m_nbits = 0;
+
+  m_buffer[m_pos++] = m_shift;
+  if (m_pos == 1 && (m_shift == 0 || m_shift > MAX_PAYLOAD)) {
+    m_errors++;
+    init();
+    return false;
+  }
+  if (m_pos < m_buffer[0] + 3) return false;
+
+  // Got the entire packet
+  m_state   = HUNT;
+  m_similar = 0;
+
+  uint16_t crc = m_buffer[m_pos-2] | (m_buffer[m_pos-1] << 8);
+  if (crc16(m_buffer, m_pos - 2) != crc) {
+    m_errors++;
+    m_pos = 0;
+    return false;
+  }
+
+  m_packets++;
+  return true;
+}
+
+
+bool
+OpticalReceiver_t::is_locked()
+{
+  return m_state != HUNT;
+}
+
+
+const uint8_t *
+OpticalReceiver_t::payload()
+{
+  return m_buffer + 1;
+}
+
+
+uint8_t
+OpticalReceiver_t::length()
+{
+  return (m_pos == 0) ? 0 : m_buffer[0];
+}
+
+
+uint8_t
+OpticalReceiver_t::packets()
+{
+  return m_packets;
+}
+
+
+uint8_t
+OpticalReceiver_t::errors()
+{
+  return m_errors;
+}
+
+
+void
+TariffLoader_t::init()
+{
+  m_loaded = (m_isValid(0)) ? 0 : (m_isValid(1)) ? 1 : NONE;
+  m_slot   = (m_loaded == 0) ? 1 : 0;
+  m_stored = 0;
+}
+
+
+TariffLoader_t::status_t
+TariffLoader_t::load(const uint8_t *payload,
+		     uint8_t        len)
+{
+  if (len < 3) return FAILED;
+
+  uint16_t offset = payload[0] | (payload[1] << 8);
+  uint8_t  n      = len - 2;
+
+  // A new image never overwrites the last one loaded
+  if (offset == 0) {
+    m_stored = 0;
+    if (m_slot == m_loaded) m_slot ^= 1;
+  }
+
+  // Sent again?
+  if (offset < m_stored && offset + n <= m_stored) return m_status();
+
+  if (offset != m_stored || offset + n > m_size) {
+    m_stored = 0;
+    return FAILED;
+  }
+
+  for (uint8_t i = 0; i < n; i++) m_write(m_addr(m_slot, offset + i), payload[2 + i]);
+  m_stored += n;
+
+  return m_status();
+}
+
+
+TariffLoader_t::status_t
+TariffLoader_t::m_status()
+{
+  if (m_stored < TariffImage_t::HEADER_SIZE) return INCOMPLETE;
+
+  uint16_t size = m_read(m_addr(m_slot, 4)) | (m_read(m_addr(m_slot, 5)) << 8);
+  if (size > m_size) {
+    m_stored = 0;
+    return FAILED;
+  }
+  if (m_stored < size) return INCOMPLETE;
+
+  if (!m_isValid(m_slot)) {
+    m_stored = 0;
+    return FAILED;
+  }
+
+  // Only now is the previous image dropped, by overwriting its magic number
+  if (m_loaded != m_slot) {
+    if (m_loaded != NONE) m_write(m_addr(m_loaded, 0), 0);
+    m_loaded = m_slot;
+  }
+  return LOADED;
+}
+
+
+bool
+TariffLoader_t::m_isValid(uint8_t slot)
+{
+  TariffImage_t image;
+  return image.open(m_addr(slot, 0), m_size, m_read);
+}
+
+
+#ifdef TEST
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "Calendar.h"
+
+/** Manchester-encode a packet into half-bit light levels, with some idle time on either side */
+static std::vector<bool>
+encode(const uint8_t *payload,
+       uint8_t        len,
+       bool           corrupt = false)
+{
+  std::vector<uint8_t> bytes(4, (uint8_t) OpticalReceiver_t::PREAMBLE);
+  bytes.push_back((uint8_t) OpticalReceiver_t::START);
+  bytes.push_back(len);
+  bytes.insert(bytes.end(), payload, payload + len);
+  uint16_t crc = crc16(&bytes[5], len + 1);
+  bytes.push_back(crc & 0xFF);
+  bytes.push_back(crc >> 8);
+  if (corrupt) bytes[7] ^= 0x10;
+
+  std::vector<bool> halves(8, false);
+  for (size_t i = 0; i < bytes.size(); i++) {
+    for (int b = 0; b < 8; b++) {
+      bool bit = (bytes[i] >> b) & 1;
+      halves.push_back(!bit);
+      halves.push_back(bit);
+    }
+  }
+  halves.insert(halves.end(), 8, false);
+  return halves;
+}
+
+
+/** Synthesize light sensor readings for a series of half-bit levels.
+ *  The edges are displaced by up to +/-jitter samples from their ideal position,
+ *  the screen has a first-order response and the sensor is noisy.
+ */
+static void
+synthesize(std::vector<uint16_t> &trace,
+	   const std::vector<bool> &halves,
+	   int                      samplesPerHalf,
+	   int                      jitter,
+	   int                      noise,
+	   int                      lag)
+{
+  double level = 0x260;
+  int    edge  = 0;
+  for (size_t i = 0; i < halves.size(); i++) {
+    int next = (i + 1) * samplesPerHalf + ((jitter) ? rand() % (2 * jitter + 1) - jitter : 0);
+    int n    = next - edge;
+    edge = next;
+    double target = (halves[i]) ? 0x2FC : 0x260;
+    while (n-- > 0) {
+      level += (target - level) / (lag + 1);
+      trace.push_back(level + ((noise) ? rand() % (2 * noise + 1) - noise : 0));
+    }
+  }
+}
+
+
+/** Where the test images are stored, instead of the EEPROM: two slots, not at address 0 */
+static const uint16_t BASE = 16;
+static const uint16_t SLOT = 80;
+static uint8_t store[BASE + 2 * SLOT];
+
+static void
+store_write(uint8_t *addr,
+	    uint8_t  data)
+{
+  store[(uintptr_t) addr] = data;
+}
+
+static uint8_t
+store_read(const uint8_t *addr)
+{
+  return store[(uintptr_t) addr];
+}
+
+
+static int
+receive(const std::vector<uint16_t>  &trace,
+	OpticalReceiver_t            &rx,
+	TariffLoader_t               *loader = 0,
+	TariffLoader_t::status_t     *status = 0)
+{
+  int n = 0;
+  for (size_t i = 0; i < trace.size(); i++) {
+    if (!rx.update(trace[i], 0x260)) continue;
+    n++;
+    if (loader) *status = loader->load(rx.payload(), rx.length());
+  }
+  return n;
+}
+
+
+/** Split an image in packets of up to "part" bytes, each prefixed by its offset */
+static std::vector<std::vector<uint8_t> >
+split(const uint8_t *image,
+      uint16_t       len,
+      uint8_t        part)
+{
+  std::vector<std::vector<uint8_t> > packets;
+  for (uint16_t offset = 0; offset < len; offset += part) {
+    std::vector<uint8_t> packet;
+    packet.push_back(offset & 0xFF);
+    packet.push_back(offset >> 8);
+    packet.insert(packet.end(), image + offset, image + ((offset + part < len) ? offset + part : len));
+    packets.push_back(packet);
+  }
+  return packets;
+}
+
+
+/** The image last loaded, in the store */
+static const uint8_t *
+loaded(const TariffLoader_t &loader)
+{
+  return (loader.image()) ? store + (uintptr_t) loader.image() : 0;
+}
+
+
+/** Load a sequence of packets. Returns the status after the last one */
+static TariffLoader_t::status_t
+load(TariffLoader_t                           &loader,
+     const std::vector<std::vector<uint8_t> > &packets)
+{
+  TariffLoader_t::status_t status = TariffLoader_t::FAILED;
+  for (size_t i = 0; i < packets.size(); i++) status = loader.load(packets[i].data(), packets[i].size());
+  return status;
+}
+
+
+int
+main(int argc, const char* argv[])
+{
+  int errors = 0;
+
+  srand(1);
+
+  // A priced four-season, three-schedule tariff, too large for one packet
+  TariffImage_t::tariff_t tariff;
+  memset(&tariff, 0, sizeof(tariff));
+  static const uint8_t seasons[4][4] = {{1, 1, 0, 1}, {5, 1, 2, 1}, {7, 4, 1, 1}, {11, 1, 0, 1}};
+  for (int i = 0; i < 4; i++) {
+    tariff.season[i].month   = seasons[i][0];
+    tariff.season[i].day     = seasons[i][1];
+    tariff.season[i].workday = seasons[i][2];
+    tariff.season[i].weekend = seasons[i][3];
+  }
+  tariff.seasons = 4;
+  static const uint8_t schedules[3][6] = {{4, 0x00, (PARTIAL_PEAK << 6) | 16, (ON_PEAK << 6) | 28, (OFF_PEAK << 6) | 42},
+					  {1, 0x00},
+					  {5, 0x00, (PARTIAL_PEAK << 6) | 14, (ON_PEAK << 6) | 28, (PARTIAL_PEAK << 6) | 42, (OFF_PEAK << 6) | 44}};
+  for (int i = 0; i < 3; i++) {
+    tariff.schedule[i].changes = schedules[i][0];
+    memcpy(tariff.schedule[i].change, &schedules[i][1], schedules[i][0]);
+  }
+  tariff.schedules = 3;
+  tariff.priced    = true;
+  tariff.price[0]  = 1210;
+  tariff.price[1]  = 1850;
+  tariff.price[2]  = 3170;
+
+  uint8_t  image[128];
+  uint16_t len = TariffImage_t::encode(tariff, image, sizeof(image));
+  std::vector<std::vector<uint8_t> > packets = split(image, len, OpticalReceiver_t::MAX_PAYLOAD - 2);
+  if (len == 0 || packets.size() < 2) {
+    printf("FAIL: The test tariff must be valid and need several packets\n");
+    return 1;
+  }
+
+  // Clean, jittery and laggy/noisy signals at various rates,
+  // down to the highest bit rate (MIN_HALF_BIT samples per half-bit).
+  // The first packet is also sent corrupted, then again.
+  static const int cases[][4] = {{2, 0, 0, 0}, {3, 0, 4, 0}, {4, 0, 8, 1},
+				 {8, 1, 8, 2}, {17, 2, 16, 4}, {50, 6, 16, 12}};
+  for (unsigned int c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+    std::vector<uint16_t> trace;
+    for (size_t p = 0; p < packets.size(); p++) {
+      synthesize(trace, encode(packets[p].data(), packets[p].size(), p == 0), cases[c][0], cases[c][1], cases[c][2], cases[c][3]);
+      if (p == 0) synthesize(trace, encode(packets[p].data(), packets[p].size()), cases[c][0], cases[c][1], cases[c][2], cases[c][3]);
+    }
+
+    OpticalReceiver_t        rx;
+    TariffLoader_t           loader(BASE, SLOT, store_write, store_read);
+    TariffLoader_t::status_t status = TariffLoader_t::FAILED;
+    Calendar                 calendar;
+    memset(store, 0xFF, sizeof(store));
+    loader.init();
+    calendar.init();
+    int n = receive(trace, rx, &loader, &status);
+    bool ok = (n == (int) packets.size() && rx.errors() == 1
+	       && rx.length() == packets.back().size()
+	       && memcmp(rx.payload(), packets.back().data(), packets.back().size()) == 0
+	       && status == TariffLoader_t::LOADED
+	       && memcmp(loaded(loader), image, len) == 0
+	       && calendar.useImage(loaded(loader), SLOT));
+    printf("%s: %d samples/half-bit, jitter %d, noise %d, lag %d: %d packets, %d errors\n",
+	   (ok) ? "PASS" : "FAIL", cases[c][0], cases[c][1], cases[c][2], cases[c][3], n, rx.errors());
+    if (!ok) errors++;
+  }
+
+  // Parts sent again are ignored, parts out of order or past the end of the storage fail the image.
+  // Smaller parts, so there are more than two.
+  {
+    std::vector<std::vector<uint8_t> > parts = split(image, len, 16);
+    TariffLoader_t loader(BASE, SLOT, store_write, store_read);
+    memset(store, 0xFF, sizeof(store));
+    loader.init();
+
+    std::vector<std::vector<uint8_t> > again;
+    for (size_t p = 0; p < parts.size(); p++) {
+      again.push_back(parts[p]);
+      if (p > 0) again.push_back(parts[p]);
+    }
+    bool ok = (load(loader, again) == TariffLoader_t::LOADED && memcmp(loaded(loader), image, len) == 0);
+
+    ok = ok && loader.load(parts[0].data(), parts[0].size()) == TariffLoader_t::INCOMPLETE;
+    ok = ok && loader.load(parts.back().data(), parts.back().size()) == TariffLoader_t::FAILED;
+    ok = ok && loader.load(parts[1].data(), parts[1].size()) == TariffLoader_t::FAILED;
+
+    // A packet with no data, a part past the end
+    uint8_t empty[] = {0, 0};
+    ok = ok && loader.load(empty, sizeof(empty)) == TariffLoader_t::FAILED;
+    TariffLoader_t small(BASE, len - 1, store_write, store_read);
+    small.init();
+    ok = ok && load(small, parts) == TariffLoader_t::FAILED;
+
+    // The whole image again
+    ok = ok && load(loader, parts) == TariffLoader_t::LOADED;
+    printf("%s: Parts sent again, out of order or too large\n", (ok) ? "PASS" : "FAIL");
+    if (!ok) errors++;
+  }
+
+  // An image that does not fit, or a corrupted one, is only found invalid once complete
+  {
+    TariffLoader_t loader(BASE, SLOT, store_write, store_read);
+    loader.init();
+
+    bool ok = true;
+    std::vector<std::vector<uint8_t> > bad = packets;
+    bad[0][2 + 4] = SLOT + 1;
+    bad[0][2 + 5] = 0;
+    ok = ok && loader.load(bad[0].data(), bad[0].size()) == TariffLoader_t::FAILED;
+
+    bad = packets;
+    bad.back().back() ^= 0x01;
+    ok = ok && loader.load(bad[0].data(), bad[0].size()) == TariffLoader_t::INCOMPLETE;
+    ok = ok && load(loader, bad) == TariffLoader_t::FAILED;
+    printf("%s: Images too large or corrupted\n", (ok) ? "PASS" : "FAIL");
+    if (!ok) errors++;
+  }
+
+  // A load that stops partway or fails keeps the image last loaded, also after a reset.
+  // A complete one replaces it, in the other slot.
+  {
+    TariffImage_t::tariff_t newer = tariff;
+    newer.price[ON_PEAK] = 4250;
+    uint8_t  newImage[128];
+    uint16_t newLen = TariffImage_t::encode(newer, newImage, sizeof(newImage));
+    std::vector<std::vector<uint8_t> > parts = split(newImage, newLen, 16);
+
+    TariffLoader_t loader(BASE, SLOT, store_write, store_read);
+    memset(store, 0xFF, sizeof(store));
+    loader.init();
+    bool ok = (loaded(loader) == 0 && load(loader, packets) == TariffLoader_t::LOADED);
+    const uint8_t *first = loaded(loader);
+
+    std::vector<std::vector<uint8_t> > partway(parts.begin(), parts.end() - 1);
+    ok = ok && load(loader, partway) == TariffLoader_t::INCOMPLETE;
+    ok = ok && loaded(loader) == first && memcmp(first, image, len) == 0;
+    TariffLoader_t reset(BASE, SLOT, store_write, store_read);
+    reset.init();
+    ok = ok && loaded(reset) == first;
+
+    std::vector<std::vector<uint8_t> > bad = parts;
+    bad.back().back() ^= 0x01;
+    ok = ok && load(loader, bad) == TariffLoader_t::FAILED;
+    ok = ok && loaded(loader) == first && memcmp(first, image, len) == 0;
+    TariffImage_t kept;
+    ok = ok && kept.open(first, SLOT) && kept.price(ON_PEAK) == 3170;
+
+    ok = ok && load(loader, parts) == TariffLoader_t::LOADED;
+    ok = ok && loaded(loader) != first && memcmp(loaded(loader), newImage, newLen) == 0;
+    reset.init();
+    ok = ok && loaded(reset) == loaded(loader) && !kept.open(first, SLOT);
+
+    ok = ok && load(loader, packets) == TariffLoader_t::LOADED && loaded(loader) == first;
+    printf("%s: Failed loads keep the image last loaded\n", (ok) ? "PASS" : "FAIL");
+    if (!ok) errors++;
+  }
+
+  // A recorded trace: one 16-bit reading per sample, native byte order
+  if (argc > 1) {
+    FILE *fp = fopen(argv[1], "rb");
+    if (fp == NULL) {
+      fprintf(stderr, "ERROR: Cannot open \"%s\".\n", argv[1]);
+      return 1;
+    }
+    std::vector<uint16_t> trace;
+    uint16_t sample;
+    while (fread(&sample, sizeof(sample), 1, fp) == 1) trace.push_back(sample);
+    fclose(fp);
+
+    OpticalReceiver_t rx;
+    int n = receive(trace, rx);
+    printf("%s: %d packets, %d errors\n", argv[1], n, rx.errors());
+  }
+
+  return (errors) ? 1 : 0;
+}
+#endif
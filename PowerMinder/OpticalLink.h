@@ -0,0 +1,204 @@
+//------------------------------------------------------------------------------
+//   Copyright 2014 Janick Bergeron
+//   All Rights Reserved Worldwide
+//
+//   Licensed under the Apache License, Version 2.0 (the
+//   "License"); you may not use this file except in
+//   compliance with the License.  You may obtain a copy of
+//   the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in
+//   writing, software distributed under the License is
+//   distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+//   CONDITIONS OF ANY KIND, either express or implied.  See
+//   the License for the specific language governing
+//   permissions and limitations under the License.
+//------------------------------------------------------------------------------
+
+
+#ifndef _OpticalLink_h
+#define _OpticalLink_h
+
+#include <stdint.h>
+#include "Tariff.h"
+
+namespace PowerMinder {
+
+  /** Class to receive data packets flashed at the light sensor (e.g. by a phone screen).
+   *
+   *  Until a lit level has been seen, a sample is lit when it is brighter than
+   *  the ambient light level by the threshold. Then the signal is sliced halfway
+   *  between the ambient and lit levels, with some hysteresis, so slow screen
+   *  transitions do not distort the duty cycle.
+   *  Bits are Manchester-encoded, LSB first: a '1' is a dark-to-lit transition
+   *  in the middle of the bit period, a '0' a lit-to-dark one.
+   *  The bit rate is recovered from the signal itself, so any rate
+   *  with a half-bit period of at least MIN_HALF_BIT samples can be received.
+   *
+   *  A packet is:
+   *
+   *      0x55 0x55 0x55 0x55     Preamble (alternating bits) for bit clock recovery
+   *      0x7E                    Start of packet
+   *      LEN                     Payload length, 1..MAX_PAYLOAD
+   *      PAYLOAD[LEN]
+   *      CRC_LO CRC_HI           CRC-16 of LEN & PAYLOAD
+   */
+  class OpticalReceiver_t {
+
+  public:
+    /** Maximum number of payload bytes in a packet.
+     *  The receive buffer lives in SRAM: a tariff image takes several packets.
+     */
+    static const uint8_t MAX_PAYLOAD = 16;
+
+    /** Minimum number of samples per half-bit period (the maximum is ~100) */
+    static const uint8_t MIN_HALF_BIT = 2;
+
+    /** Preamble byte */
+    static const uint8_t PREAMBLE = 0x55;
+
+    /** Start of packet byte */
+    static const uint8_t START = 0x7E;
+
+    /** Forget any partially-received packet and look for a new one */
+    void init();
+
+    /** Process a light sensor sample taken at a regular interval.
+     *  Returns TRUE when a valid packet has been received.
+     *  The packet remains available until the start of the next one.
+     */
+    bool update(uint16_t value,       ///< Light level reading, 0-1023
+		uint16_t baseline);   ///< Ambient light level, 0-1023
+
+    /** Is a bit clock locked? */
+    bool is_locked();
+
+    /** Payload of the last valid packet */
+    const uint8_t *payload();
+
+    /** Length of the last valid packet payload */
+    uint8_t length();
+
+    /** Number of valid packets received (wraps around) */
+    uint8_t packets();
+
+    /** Number of packets with a bad length or CRC (wraps around) */
+    uint8_t errors();
+
+  // Looks like Sketches don't support private constructors...
+  //private:
+    /** Create an optical data receiver */
+    constexpr OpticalReceiver_t(uint16_t threshold = 0x0040)   ///< Brightness above baseline that is lit
+      : m_threshold(threshold), m_state(HUNT), m_lit(0), m_high(0), m_peak(0), m_run(0),
+	m_half(0), m_similar(0), m_mid(0), m_ready(0), m_shift(0), m_nbits(0), m_pos(0),
+	m_buffer(), m_packets(0), m_errors(0)
+    {
+    }
+
+  private:
+    typedef enum {HUNT, SYNC, FRAME} state_t;
+
+    /** Process the edge at the end of a run of m_run identical samples */
+    void m_edge(bool rising);
+
+    /** Process a received bit */
+    bool m_bit(bool bit);
+
+    uint16_t m_threshold;
+    state_t  m_state;
+    bool     m_lit;
+    uint16_t m_high;       ///< Lit level
+    uint16_t m_peak;       ///< Brightest sample in the current lit run
+    uint8_t  m_run;        ///< Samples since the last edge
+    uint16_t m_half;       ///< Half-bit period, in 1/16th of a sample
+    uint8_t  m_similar;    ///< Number of similar runs seen while hunting
+    bool     m_mid;        ///< Was the last edge in the middle of a bit?
+    bool     m_ready;      ///< Has a packet just been received?
+
+    uint8_t  m_shift;
+    uint8_t  m_nbits;
+    uint8_t  m_pos;        ///< Number of bytes received in the packet so far
+    uint8_t  m_buffer[1 + MAX_PAYLOAD + 2];
+
+    uint8_t  m_packets;
+    uint8_t  m_errors;
+  };
+
+
+  /** Class to store a tariff image received by the OpticalReceiver_t, e.g. in EEPROM.
+   *
+   *  An image (see TariffImage_t) too large for one packet is sent in several parts:
+   *
+   *      OFFSET_LO OFFSET_HI   Offset of the part in the image
+   *      DATA[LEN-2]           Part of the image
+   *
+   *  Parts must be sent in order, starting at offset 0. A part sent again is ignored
+   *  and a part at offset 0 starts a new image. The image is complete once the number
+   *  of bytes in its header have been stored, and loaded if it is then found valid.
+   *
+   *  Images are stored alternately in two slots, so that the image last loaded is kept
+   *  until another one is loaded: the previous slot is only invalidated then.
+   *  Should power fail in between, the first slot is used.
+   */
+  class TariffLoader_t {
+
+  public:
+    /** Function writing a byte where the image is stored */
+    typedef void (*write_t)(uint8_t *addr, uint8_t data);
+
+    typedef enum {FAILED,       ///< Invalid, out of order or too large: start again from offset 0
+		  INCOMPLETE,   ///< More parts are expected
+		  LOADED        ///< A complete & valid image is stored
+    } status_t;
+
+    /** Find the image last loaded & expect a new one */
+    void init();
+
+    /** Store a part of an image, as received by the OpticalReceiver_t */
+    status_t load(const uint8_t *payload,   ///< Packet payload
+		  uint8_t        len);      ///< Number of bytes in the payload
+
+    /** Where the image last loaded is stored, 0 if none */
+    const uint8_t *image() const {return (m_loaded == NONE) ? 0 : m_addr(m_loaded, 0);}
+
+  // Looks like Sketches don't support private constructors...
+  //private:
+    /** Create a loader for the specified storage area, e.g. in EEPROM.
+     *  The address of the first slot must not be 0.
+     */
+    constexpr TariffLoader_t(uint16_t               store,   ///< Address of the first of two slots, one after the other
+			     uint16_t               size,    ///< Bytes in a slot
+			     write_t                write,   ///< How to write them
+			     TariffImage_t::read_t  read)    ///< How to read them
+      : m_store(store), m_size(size), m_write(write), m_read(read), m_stored(0), m_slot(0), m_loaded(NONE)
+    {
+    }
+
+  private:
+    /** No slot */
+    static const uint8_t NONE = 0xFF;
+
+    /** Status of the image stored so far */
+    status_t m_status();
+
+    /** Is there a valid image in a slot? */
+    bool m_isValid(uint8_t slot);
+
+    /** Address of a byte of a slot */
+    uint8_t *m_addr(uint8_t  slot,
+		    uint16_t offset) const {return (uint8_t *) (uintptr_t) (m_store + slot * m_size + offset);}
+
+    uint16_t               m_store;
+    uint16_t               m_size;
+    write_t                m_write;
+    TariffImage_t::read_t  m_read;
+    uint16_t               m_stored;    ///< Bytes of the image stored so far
+    uint8_t                m_slot;      ///< Slot of the image being stored
+    uint8_t                m_loaded;    ///< Slot of the image last loaded, NONE if none
+  };
+
+}
+
+#endif
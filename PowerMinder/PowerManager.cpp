@@ -0,0 +1,155 @@
+//------------------------------------------------------------------------------
+//   Copyright 2014 Janick Bergeron
+//   All Rights Reserved Worldwide
+//
+//   Licensed under the Apache License, Version 2.0 (the
+//   "License"); you may not use this file except in
+//   compliance with the License.  You may obtain a copy of
+//   the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in
+//   writing, software distributed under the License is
+//   distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+//   CONDITIONS OF ANY KIND, either express or implied.  See
+//   the License for the specific language governing
+//   permissions and limitations under the License.
+//------------------------------------------------------------------------------
+
+
+
+#include <Arduino.h>
+#include <avr/sleep.h>
+#include <avr/wdt.h>
+
+#include "PowerManager.h"
+#include "Profile.h"
+
+using namespace PowerMinder;
+
+/** The millisecond counter of the Arduino core, incremented by the Timer0 overflow interrupt.
+ *  Define on the compiler command line for a core that names it differently.
+ */
+#ifndef MILLIS_COUNTER
+#define MILLIS_COUNTER timer0_millis
+#endif
+
+extern "C" volatile unsigned long MILLIS_COUNTER;
+
+/** Set when the watchdog ended the last power-down */
+static volatile bool s_watchdog = false;
+
+
+ISR(WDT_vect)
+{
+  s_watchdog = true;
+}
+
+
+/** The conversions of analogRead() only need to wake up the CPU.
+ *  The flag is cleared by servicing the interrupt.
+ */
+ISR(ADC_vect)
+{
+}
+
+
+void
+PowerManager_t::init()
+{
+  m_stopped_us = 0;
+}
+
+
+uint8_t
+PowerManager_t::prescaler(unsigned long ms)
+{
+  for (uint8_t wdp = MAX_PRESCALER + 1; wdp-- > 0;) {
+    unsigned long timeout = 16UL << wdp;
+    if (timeout + timeout / WDT_SLOW + WAKEUP_MS <= ms) return wdp;
+  }
+  return NO_POWER_DOWN;
+}
+
+
+void
+PowerManager_t::sleep(Scheduler_t &scheduler)
+{
+  // Interrupts are enabled by the instruction before SLEEP
+  // so one cannot sneak in between the check and the sleep.
+  cli();
+  unsigned long ms = scheduler.time_to_next();
+  if (ms == 0 && !scheduler.is_idle()) {
+    sei();
+    return;
+  }
+
+  uint8_t wdp = NO_POWER_DOWN;
+  if (scheduler.is_idle()) set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+  else {
+    wdp = prescaler(ms);
+    if (wdp == NO_POWER_DOWN) set_sleep_mode(SLEEP_MODE_IDLE);
+    else {
+      // Timed sequence: interrupt on timeout, no reset
+      s_watchdog = false;
+      wdt_reset();
+      WDTCR = _BV(WDCE) | _BV(WDE);
+      WDTCR = _BV(WDIE) | ((wdp & 0x08) ? _BV(WDP3) : 0) | (wdp & 0x07);
+      set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+    }
+  }
+  sleep_enable();
+  sei();
+  sleep_cpu();
+  sleep_disable();
+
+  if (wdp == NO_POWER_DOWN) return;
+
+  cli();
+  WDTCR = _BV(WDCE) | _BV(WDE);
+  WDTCR = 0;
+  sei();
+
+  unsigned long timeout = 16UL << wdp;
+  m_stopped(((s_watchdog) ? timeout : timeout / 2) * 1000);
+}
+
+
+uint16_t
+PowerManager_t::analogRead(uint8_t pin)
+{
+  // Vcc reference, right-adjusted, /128 prescaler.
+  // Writing ADIF clears a stale completion.
+  ADMUX  = pin & 0x03;
+  ADCSRA = _BV(ADEN) | _BV(ADIF) | _BV(ADIE) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);
+
+  // The conversion starts when the CPU goes to sleep and its interrupt wakes it up.
+  // If another interrupt wakes it up first, wait for the end of the conversion.
+  set_sleep_mode(SLEEP_MODE_ADC);
+  sleep_enable();
+  sleep_cpu();
+  sleep_disable();
+  while (ADCSRA & _BV(ADSC));
+  ADCSRA &= ~_BV(ADIE);
+
+  // ADCL must be read first
+  uint16_t value = ADCL;
+  value |= ADCH << 8;
+  PROFILE_READ();
+
+  m_stopped(CONVERSION_US);
+  return value;
+}
+
+
+void
+PowerManager_t::m_stopped(unsigned long us)
+{
+  us += m_stopped_us;
+  m_stopped_us = us % 1000;
+
+  cli();
+  MILLIS_COUNTER += us / 1000;
+  sei();
+}
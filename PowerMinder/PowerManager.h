@@ -0,0 +1,104 @@
+//------------------------------------------------------------------------------
+//   Copyright 2014 Janick Bergeron
+//   All Rights Reserved Worldwide
+//
+//   Licensed under the Apache License, Version 2.0 (the
+//   "License"); you may not use this file except in
+//   compliance with the License.  You may obtain a copy of
+//   the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in
+//   writing, software distributed under the License is
+//   distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+//   CONDITIONS OF ANY KIND, either express or implied.  See
+//   the License for the specific language governing
+//   permissions and limitations under the License.
+//------------------------------------------------------------------------------
+
+
+
+
+#ifndef _PowerManager_h
+#define _PowerManager_h
+
+#include <stdint.h>
+
+#include "Scheduler.h"
+
+namespace PowerMinder {
+
+  /** Class to put the CPU to sleep until the scheduler's next deadline,
+   *  in the deepest sleep mode that still wakes it up in time.
+   *
+   *  In idle mode, Timer0 keeps running and wakes the CPU up every millisecond.
+   *  In power-down mode, only the watchdog or a pin-change interrupt (the button)
+   *  wakes it up. The CPU powers down for the longest watchdog timeout that,
+   *  with the watchdog oscillator running slow and the wake-up latency, still
+   *  expires before the next deadline, then waits for the rest of it in idle mode.
+   *  If nothing is scheduled, it powers down until the button is pressed.
+   *
+   *  Conversions are done in ADC noise reduction mode, with the CPU asleep.
+   *
+   *  Timer0 is stopped in both of these modes, so the millisecond counter of the
+   *  Arduino core is advanced by the time it was stopped. A pin-change interrupt
+   *  ends a power-down at an unknown time: half the timeout is assumed.
+   *  The error is bounded by the watchdog accuracy (+/-10%) and is corrected
+   *  by the every-minute RTC resync.
+   */
+  class PowerManager_t {
+
+  public:
+    /** The CPU cannot power down until the next deadline */
+    static const uint8_t NO_POWER_DOWN = 0xFF;
+
+    /** Largest watchdog prescaler: the watchdog times out after 16ms << prescaler */
+    static const uint8_t MAX_PRESCALER = 9;
+
+    /** The watchdog oscillator may run slow by up to 1/WDT_SLOW */
+    static const uint8_t WDT_SLOW = 8;
+
+    /** Time to restart the clock and resume after a power-down, in milliseconds */
+    static const uint8_t WAKEUP_MS = 1;
+
+    /** Duration of a conversion: 13 ADC clocks at 125kHz, in microseconds */
+    static const uint8_t CONVERSION_US = 104;
+
+    /** Initialize the power manager */
+    void init();
+
+    /** Sleep until the scheduler's next deadline or an interrupt, unless a task is due.
+     *  Call in the main loop() routine, after Scheduler_t::run().
+     */
+    void sleep(Scheduler_t &scheduler);
+
+    /** Convert an analog input in ADC noise reduction mode (0-1023).
+     *  The power manager services the ADC interrupt, so it cannot be used
+     *  in a sketch that samples with an AdcSampler_t.
+     */
+    uint16_t analogRead(uint8_t pin);        ///< Analog pin number (0-3)
+
+    /** Watchdog prescaler to power down with, for a sleep of up to the specified time
+     *  (NO_POWER_DOWN if it is too short).
+     */
+    static uint8_t prescaler(unsigned long ms);   ///< Time to the next deadline, in milliseconds
+
+  // Looks like Sketches don't support private constructors...
+  //private:
+    /** Create a power manager */
+    constexpr PowerManager_t()
+      : m_stopped_us(0)
+    {
+    }
+
+  private:
+    /** Account for Timer0 having been stopped for the specified time */
+    void m_stopped(unsigned long us);
+
+    uint16_t m_stopped_us;    ///< Time Timer0 was stopped, not yet added to millis(), in microseconds
+  };
+
+}
+
+#endif
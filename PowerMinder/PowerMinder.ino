@@ -8,7 +8,6 @@
 // Next changes code to 
 
 #include <stdint.h>
-#include <stdlib.h> // for malloc and free
 #include <stddef.h>
 
 #include <Arduino.h>
@@ -16,18 +15,65 @@
 #include "LED.h"
 #include "Button.h"
 #include "LightSensor.h"
-//#include "Calendar.h"
+#include "PulseDetector.h"
+#include "SampleGovernor.h"
+#include "Calendar.h"
+#include "OpticalLink.h"
+#include "DemandTracker.h"
+#include "EnergyRollup.h"
+#include "IntervalLog.h"
+#include "LocalTime.h"
+#ifdef FORECAST
+#include "BillForecast.h"
+#endif
+#ifdef TARIFF_HEADER
+// A tariff compiled by tariff-compile -H, e.g. -DTARIFF_HEADER='"PGE.h"'
+#include TARIFF_HEADER
+#endif
+#include "Scheduler.h"
+#include "PowerManager.h"
+#include "Coroutine.h"
+#include "Profile.h"
+#include "Trace.h"
+#include <avr/eeprom.h>
 
 using namespace PowerMinder;
 
 
+//
+// SRAM budget on the ATtiny85 (512 bytes), in bytes.
+// Counted by hand with 2-byte ints & pointers: recount when a class changes.
+//
+//   LEDs, button & light sensor                              35
+//   Pulse detector & sampling governor                       39
+//   Calendar & the default tariff tables                     44
+//   Demand tracker                                           69
+//   Energy rollup (ROLLUP_* == 1, see EnergyRollup.h)        76
+//   Interval log & the pulses of the current interval        13
+//   Scheduler & its 5 tasks                                  69
+//   Optical link, tariff loader & programming coroutine      58
+//   Power manager, display, minute task state & millis()     26
+//                                                           ---
+//                                                           429, leaving ~80 for the stack
+//
+// Options add:
+//   DST       33 (DST_YEARS == 2), leaving ~50 for the stack
+//   TRACE     69 with the default 16 records: use -DTRACE_RECORDS=4 (21) on the device
+//   PROFILE   71: simulator only, it would leave no room for the stack
+//   FORECAST ~500 (~200 with FORECAST_HOURS == 24): simulator only, see below
+//
+
+
 //
 // Hardware Resources
 //
 namespace LED {
-  LED_t red(0);
-  LED_t yellow(1);
-  LED_t green(5);
+  LedControl_t<LedPin_t<0> > red;
+  LedControl_t<LedPin_t<1> > yellow;
+  LedControl_t<LedPin_t<5> > green;
+
+  /** All three, for changes that must appear at once */
+  const LedGroup_t<LedPin_t<0>, LedPin_t<1>, LedPin_t<5> > all(red, yellow, green);
 
   void init()
   {
@@ -42,174 +88,558 @@ namespace LED {
     yellow.loop();
     green.loop();
   }
+
+  /** Time until the next change of a blinking LED (0 == none is blinking) */
+  unsigned long time_to_change()
+  {
+    unsigned long ms = 0;
+    unsigned long times[] = {red.time_to_change(), yellow.time_to_change(), green.time_to_change()};
+    for (uint8_t i = 0; i < 3; i++) {
+      unsigned long t = times[i];
+      if (t > 0 && (ms == 0 || t < ms)) ms = t;
+    }
+    return ms;
+  }
+
+  /** The red & yellow LEDs share their pins with the RTC */
+  void refresh()
+  {
+    red.refresh();
+    yellow.refresh();
+  }
 }
 
 // This Button class does software debouncing for reliable button sensing.
-Button_t button(4, HIGH, HIGH);
+ButtonControl_t<ButtonPin_t<4, HIGH, HIGH> > button;
 
 LightSensor_t light(3);
 
+PulseDetector_t pulses(LightSensor_t::PULSE_THRESHOLD);
+
+SampleGovernor_t governor;
+
+Calendar calendar;
+
+/** 15-minute demand, sliding every minute */
+DemandTracker_t demand;
+
+/** Energy per cost period, per minute/hour/day/month */
+EnergyRollup_t energy;
+
+#ifdef DST
+/** Local time, with the North American daylight saving time rules.
+ *  The RTC must be set to standard time.
+ */
+LocalTime_t local;
+#endif
+
+#ifdef FORECAST
+#ifdef __AVR__
+#error "FORECAST does not fit in the ATtiny85's SRAM: it is for the simulator only (make sim-forecast)"
+#endif
+/** Month-end energy forecast, per cost period.
+ *  Needs ~500 bytes of SRAM, on top of the rest of the sketch: simulator only.
+ */
+BillForecast_t forecast;
+#endif
+
+/** 15-min interval energy log, in EEPROM.
+ *  Changing the size of the log loses its content.
+ *  With steady consumption, 11 pages keep the last 2.8 to 3.1 days (270-297 intervals),
+ *  9 pages the last 2.25 to 2.5 days (216-243 intervals).
+ */
+#ifdef TRACE
+/** The two pages before the tariffs hold the trace instead */
+IntervalLog_t intervals(0, 9);
+
+const uint16_t TRACE_EEPROM = 9 * IntervalLog_t::PAGE_SIZE;
+#else
+IntervalLog_t intervals(0, 11);
+#endif
+
+/** The last five pages of the EEPROM hold two slots for the tariff images loaded over the optical link,
+ *  so that a failed load keeps the previous image.
+ */
+const uint16_t TARIFF_EEPROM      = 11 * IntervalLog_t::PAGE_SIZE;
+const uint16_t TARIFF_EEPROM_SIZE = 80;    ///< Per slot
+
+/** Pulses in the current 15-min interval */
+uint16_t interval_pulses = 0;
+
+Scheduler_t scheduler;
+
+/** Sleeps as deeply as the next deadline allows */
+PowerManager_t power;
+
 
 //
-// Programming Mode
+// "Display" a 16-bit integer value on the LEDs.
 //
-void set_time()
+struct {
+  uint16_t value;
+  uint16_t mask;
+} shown;
+
+void display_step(Task_t &task)
 {
-  // Flash all three LEDs until the button is released then pressed again
-  LED::red.blink(50, 950);
-  LED::yellow.blink(50, 950);
-  LED::green.blink(50, 950);
-  while (!button.has_been_released()) {
-    LED::loop();
-    delay(50);
+  if (LED::green.is_on()) {
+    LED::all.off();
+    if (shown.mask == 0) scheduler.cancel(task);
+    return;
   }
 
-  LED::red.off();
-  LED::yellow.off();
-  LED::green.off();
+  bool msb = (shown.value & shown.mask) != 0;
+  shown.mask >>= 1;
+  bool lsb = (shown.value & shown.mask) != 0;
+  shown.mask >>= 1;
+  // The green LED validates the red & yellow ones: they must all change at once
+  LED::all.write(msb, lsb, true);
+}
+
+Task_t display_task(display_step);
 
+/** "Display" a 16-bit integer value on the LEDs.
+ *  The value is shown two bits at a time, from MSB to LSB
+ *  on the red (MSB) and yellow (LSB) LEDs at 1-sec intervals.
+ *  The value on the red & yellow LEDs is valid when the green LED is ON.
+ *
+ *  For example, the value 0xC9F0 would be blinked as:
+ *
+ *  Red:     *   *   * *
+ *  Yellow:  *     * * *
+ *  Green:   * * * * * * * *
+ *            C   9   F   0
+ *
+ *  The value is displayed by a task: this function returns immediately.
+ */
+
+void
+display(uint16_t value)
+{
+  LED::all.off();
+
+  shown.value = value;
+  shown.mask  = 0x8000;
+  scheduler.every(display_task, 1000);
 }
 
 
 //
-// Interrupt service routine
+// LEDs
 //
-ISR(PCINT0_vect) {
-   button.loop();
+/** Only scheduled while a LED is blinking, for its next change */
+void run_leds(Task_t &task)
+{
+  LED::loop();
+
+  unsigned long ms = LED::time_to_change();
+  if (ms == 0) scheduler.cancel(task);
+  else scheduler.after(task, ms);
 }
 
-void setup()
+Task_t leds_task(run_leds);
+
+/** Blink a LED (see LedControl_t::blink) and follow it */
+template <typename Led>
+void blink(Led     &led,
+	   uint16_t msec_on,
+	   uint16_t msec_off)
 {
-  LED::init();
-  button.init();
-  light.init();
+  led.blink(msec_on, msec_off);
+  scheduler.after(leds_task, 0);
+}
 
-  // Set the RTC CE pin to OUT
-  pinMode(2, OUTPUT);    digitalWrite(2, LOW);
 
-  // Enable pin-change interrupt to detect button presses
-  GIMSK = _BV(PCIE);    // Enable pin change interrupt
-  PCMSK = _BV(PCINT4);  // Enable the interrupt for only pin 4.
+//
+// Light sensor & metering
+//
+int strobe = 0;
 
-  //
-  // Go into programming mode if the button is pressed for at least 3 seconds at boot time
-  //
-  if (button.is_pressed()) {
-    // OK, it's pressed now...
-    LED::yellow.blink(100, 400);
-    unsigned long now = millis();
-    while (millis() - now < 3000) {
-      LED::loop();
-    }
-    LED::yellow.off();
-    // Has it been released in the last 3 seconds?
-    if (!button.has_been_released()) {
-      // Wait for it to be released
-      while (button.is_pressed()) LED::loop();
-      set_time();
-    }
+void sample_light(Task_t &task)
+{
+  unsigned long now = millis();
+  uint16_t brightness;
+  {
+    // The CPU sleeps during the conversion
+    PROFILE_SCOPE(LIGHT_IO);
+    brightness = power.analogRead(light.pin());
   }
+  light.update(brightness);
 
-  // Set up the green LED to blink every second
-  // LED::green.blink(50, 950);
+#undef LIGHT_TEST
+#ifdef LIGHT_TEST
+  // Turn on 1, 2 or 3 LEDs according to the current light level
+  LED::all.write(brightness >= 0x02F0, brightness >= 0x0280, brightness >= 0x0200);
+#endif
+
+#define STROBE_TEST
+#ifdef STROBE_TEST
+  // Turn on red LED when light is detected
+  // Toggle green LED every 10 pulses
+  if (light.is_calibrated()) {
+    if (pulses.update(brightness, light.baseline(), now)) {
+      LED::red.on();
+      demand.pulse();
+      energy.pulse();
+      interval_pulses++;
+      if (++strobe == 10) {
+	strobe = 0;
+	LED::green.toggle();
+      }
+    }
+    else if (!pulses.is_lit()) LED::red.off();
+    governor.update(pulses, now);
+  }
+#endif
 
+  scheduler.after(task, governor.period());
 }
 
-int strobe = 0;
+Task_t sample_task(sample_light);
 
-void loop()
+
+//
+// RTC resync & calendar
+//
+/** Read the date & time from the RTC then close the minute that just ended.
+ *  Runs at the start of every minute, according to the RTC.
+ */
+void every_minute(Task_t &task)
 {
+  static uint8_t last_min = 0xFF;
+
+  // The cost period found is valid from..to, in standard minutes since 2000
+  static uint32_t period_from = 0xFFFFFFFF;
+  static uint32_t period_to   = 0;
+
+  ds1302_struct rtc;
+  DS1302_clock_burst_read((uint8_t *) &rtc);
+  LED::refresh();
+
+  uint8_t year  = bcd2bin(rtc.Year10, rtc.Year);
+  uint8_t month = bcd2bin(rtc.Month10, rtc.Month);
+  uint8_t day   = bcd2bin(rtc.Date10, rtc.Date);
+  uint8_t hour  = bcd2bin(rtc.h24.Hour10, rtc.h24.Hour);
+  uint8_t min   = bcd2bin(rtc.Minutes10, rtc.Minutes);
+  uint8_t sec   = bcd2bin(rtc.Seconds10, rtc.Seconds);
+  TRACE_EVENT(RTC_SYNC, min);
+
+  // Resync with the start of the next minute
+  scheduler.after(task, (60 - sec) * 1000UL);
+
+  // We may be a bit early
+  if (min == last_min) return;
+  last_min = min;
+
+  // Log the interval that just ended, in standard time
+  if (min % 15 == 0) {
+    intervals.append(IntervalLog_t::interval(year, month, day, hour, min) - 1, interval_pulses);
+    interval_pulses = 0;
+  }
+
+  // Tariffs & rollups follow the wall clock
+  uint32_t now = LocalTime_t::minutes(year, month, day, hour, min);
+  uint8_t  dow = rtc.Day;
+#ifdef DST
+  local.toLocal(year, month, day, dow, hour, min);
+#endif
+
+  // The minute that just ended was in the cost period found a minute ago
+  period_t period = calendar.getCurrentCost();
+  demand.tick(period);
+  energy.advance(month, day, hour, period);
+
+#ifdef FORECAST
+  // Billing cycles are calendar months
+  static uint8_t cycle_month = 0;
+  if (month != cycle_month) {
+#ifdef DST
+    const LocalTime_t *dst = &local;
+#else
+    const LocalTime_t *dst = 0;
+#endif
+    forecast.begin(calendar, year, month, 1, (dow + 34 - (day - 1) % 7) % 7 + 1,
+		   BillForecast_t::monthDays(year, month), dst);
+    cycle_month = month;
+  }
+  forecast.advance(day, hour, energy.minute(1), period);
+#endif
+
+  // Only look the cost period up again once it is over, or if the clock was set back.
+  // The time to the next one is on the wall clock, from the start of the 30-min slot.
+  if (now < period_from || now >= period_to) {
+    calendar.findPeriod(month, day, dow, hour, min);
+    uint16_t wall = calendar.getTimeToNextCost() - min % 30;
+#ifdef DST
+    wall = local.realMinutes(wall);
+#endif
+    period_from = now;
+    period_to   = now + wall;
+  }
+#ifdef TRACE
+  if (calendar.getCurrentCost() != period) TRACE_EVENT(PERIOD, calendar.getCurrentCost());
+#endif
+}
+
+Task_t minute_task(every_minute);
+
 
 #undef BUTTON_TEST
 #ifdef BUTTON_TEST
-  LED::loop();
-  
+void button_test(Task_t & /* task */)
+{
   if (button.has_been_pressed() ) LED::red.toggle();
+}
+
+Task_t button_task(button_test);
 #endif
 
 #undef LIGHT_TEST_RAW
 #ifdef LIGHT_TEST_RAW
+void light_test_raw(Task_t & /* task */)
+{
   display(light.current());
-  delay(5000);
+}
+
+Task_t light_raw_task(light_test_raw);
 #endif
 
-#undef LIGHT_TEST
-#ifdef LIGHT_TEST
-  // Turn on 1, 2 or 3 LEDs according to the current light level
-  uint16_t brightness = light.current();
-  if (brightness < 0x0200) {
-    LED::green.off();
-    LED::yellow.off();
-    LED::red.off();
-  }
-  else {
-    LED::green.on();
-    if (brightness < 0x0280) {
-      LED::yellow.off();
-      LED::red.off();
-    }
-    else {
-      LED::yellow.on();
-      if (brightness < 0x02F0) LED::red.off();
-      else LED::red.on();
-    }
+
+#ifdef TRACE
+#if defined(TRACE_TO_RTC) && defined(PROFILE)
+#error "The RTC RAM already holds the profiling snapshot"
+#endif
+
+void trace_to_eeprom(uint8_t offset, uint8_t data, void * /* context */)
+{
+  eeprom_update_byte((uint8_t *) (uintptr_t) (TRACE_EEPROM + offset), data);
+}
+
+void trace_to_rtc(uint8_t offset, uint8_t data, void * /* context */)
+{
+  DS1302_write(DS1302_RAMSTART + 2 * offset, data);
+}
+
+/** Freeze the trace in the EEPROM (or the RTC RAM if TRACE_TO_RTC is defined),
+ *  to be read out and decoded with src/trace-decode.
+ */
+void save_trace()
+{
+#ifdef TRACE_TO_RTC
+  DS1302_write(DS1302_ENABLE, 0);
+  Trace_t::save(trace_to_rtc, 0, 31);
+  LED::refresh();
+#else
+  Trace_t::save(trace_to_eeprom, 0, 2 * IntervalLog_t::PAGE_SIZE);
+#endif
+}
+
+#ifndef PROFILE
+/** Save the trace when the button is pressed, e.g. just after a pulse was missed */
+void trace_button(Task_t & /* task */)
+{
+  if (button.has_been_pressed()) save_trace();
+}
+
+Task_t trace_button_task(trace_button);
+#endif
+#endif
+
+
+#ifdef PROFILE
+/** Save a snapshot of the profiling counters in the RTC RAM */
+void save_profile(Task_t & /* task */)
+{
+  uint8_t snapshot[Profile_t::SNAPSHOT_SIZE];
+  Profile_t::snapshot(snapshot);
+
+  DS1302_write(DS1302_ENABLE, 0);
+  for (uint8_t i = 0; i < Profile_t::SNAPSHOT_SIZE; i++) {
+    DS1302_write(DS1302_RAMSTART + 2 * i, snapshot[i]);
   }
+  LED::refresh();
+}
+
+Task_t save_profile_task(save_profile);
+
+/** Display the next 16-bit value of the snapshot every time the button is pressed */
+void show_profile(Task_t & /* task */)
+{
+  static uint8_t next = 0;
+
+  if (!button.has_been_pressed()) return;
+#ifdef TRACE
+  save_trace();
 #endif
 
-#define STROBE_TEST
-#ifdef STROBE_TEST
-  // Turn on red LED when light is detected
-  // Toggle green LED every 10 pulses
-  int brightness = light.current() - light.baseline();
-  if (brightness > 0x0040) {
-    if (!LED::red.is_on()) {
-      LED::red.on();
-      if (++strobe == 10) {
-	strobe = 0;
-	LED::green.toggle();
+  uint8_t snapshot[Profile_t::SNAPSHOT_SIZE];
+  Profile_t::snapshot(snapshot);
+  uint8_t i = 1 + 2 * next;
+  display(snapshot[i] | (snapshot[i+1] << 8));
+  if (++next == 3 * Profile_t::SUBSYSTEMS) next = 0;
+}
+
+Task_t show_profile_task(show_profile);
+#endif
+
+
+/** Start metering */
+void start()
+{
+#ifdef BUTTON_TEST
+  scheduler.every(button_task, 50);
+#endif
+#ifdef LIGHT_TEST_RAW
+  // Display takes 16 secs, then wait 5 secs
+  scheduler.every(light_raw_task, 21000);
+#endif
+#if defined(TRACE) && !defined(PROFILE)
+  scheduler.every(trace_button_task, 50);
+#endif
+#ifdef PROFILE
+  scheduler.every(save_profile_task, 3600000UL, 3600000UL);
+  scheduler.every(show_profile_task, 50);
+#endif
+  scheduler.after(sample_task, 0);
+  scheduler.after(minute_task, 0);
+}
+
+
+//
+// Programming Mode
+//
+Coroutine_t programming_flow;
+
+OpticalReceiver_t tariff_link(LightSensor_t::PULSE_THRESHOLD);
+
+TariffLoader_t tariff_loader(TARIFF_EEPROM, TARIFF_EEPROM_SIZE, eeprom_update_byte, eeprom_read_byte);
+
+/** Use the tariff image last loaded in the EEPROM, or else the one compiled in, or else the default one */
+void select_tariff()
+{
+  calendar.init();
+  const uint8_t *image = tariff_loader.image();
+  if (image && calendar.useImage(image, TARIFF_EEPROM_SIZE, eeprom_read_byte)) return;
+#ifdef TARIFF_HEADER
+  // Its lookup tables, read in place from flash
+  calendar.useTables(&TARIFF_TABLES);
+#endif
+}
+
+/** Go into programming mode if the button is held for 3 seconds at boot time */
+void programming(Task_t &task)
+{
+  CO_BEGIN(programming_flow);
+
+  // OK, it's pressed now...
+  blink(LED::yellow, 100, 400);
+
+  // Has it been released in the first 3 seconds?
+  CO_AWAIT_OR_TIMEOUT(programming_flow, button.has_been_released(), 3000);
+  LED::yellow.off();
+
+  if (!programming_flow.event()) {
+    // Wait for it to be released
+    CO_AWAIT(programming_flow, !button.is_pressed());
+
+    // Flash all three LEDs until the button is pressed again then released
+    blink(LED::red, 50, 950);
+    blink(LED::yellow, 50, 950);
+    blink(LED::green, 50, 950);
+
+    // Meanwhile, listen for a tariff flashed at the light sensor, sampled every millisecond.
+    // The green LED stays on once one has been loaded, the yellow one while more of it is expected,
+    // the red one on error.
+    tariff_link.init();
+    tariff_loader.init();
+    scheduler.every(task, 1);
+    while (!button.has_been_released()) {
+      {
+	uint16_t brightness = light.current();
+	if (tariff_link.update(brightness, light.baseline())) {
+	  // A complete & valid tariff image replaces the one in use, which is kept until then
+	  TariffLoader_t::status_t status = tariff_loader.load(tariff_link.payload(), tariff_link.length());
+	  if (status == TariffLoader_t::FAILED) LED::red.on();
+	  else if (status == TariffLoader_t::INCOMPLETE) LED::yellow.on();
+	  else {
+	    select_tariff();
+	    blink(LED::yellow, 50, 950);
+	    LED::green.on();
+	  }
+	}
       }
+      CO_YIELD(programming_flow);
     }
+
+    LED::red.off();
+    LED::yellow.off();
+    LED::green.off();
   }
-  else LED::red.off();
-#endif
 
+  scheduler.cancel(task);
+  start();
+
+  CO_END(programming_flow);
 }
 
+Task_t programming_task(programming);
 
-/** "Display" a 16-bit integer value on the LEDs.
- *  The value is shown two bits at a time, from MSB to LSB
- *  on the red (MSB) and yellow (LSB) LEDs at 1-sec intervals.
- *  The value on the red & yellow LEDs is valid when the green LED is ON.
- *
- *  For example, the value 0xC9F0 would be blinked as:
- *
- *  Red:     *   *   * *
- *  Yellow:  *     * * *
- *  Green:   * * * * * * * *
- *            C   9   F   0
- */
 
-void
-display(uint16_t value)
+//
+// Interrupt service routine
+//
+ISR(PCINT0_vect) {
+   TRACE_EVENT(ISR_ENTRY, PINB);
+   PROFILE_SCOPE(PCINT_ISR);
+   button.loop();
+}
+
+void setup()
 {
-  LED::green.off();
-  LED::yellow.off();
-  LED::red.off();
+#ifdef PROFILE
+  Profile_t::init();
+#endif
+#ifdef TRACE
+  Trace_t::init();
+#endif
+  LED::init();
+  button.init();
+  light.init();
+  governor.init();
+  tariff_loader.init();
+  select_tariff();
+  demand.init();
+  energy.init();
+#ifdef DST
+  local.init(LocalTime_t::US_START, LocalTime_t::US_END);
+#endif
+#ifdef FORECAST
+  forecast.init();
+#endif
+  intervals.init();
+  power.init();
+
+  // Set the RTC CE pin to OUT
+  pinMode(2, OUTPUT);    digitalWrite(2, LOW);
 
-  uint16_t mask = 0x8000;
-  while (mask) {
-    if (value & mask) LED::red.on();
-    mask >>= 1;
-    if (value & mask) LED::yellow.on();
-    mask >>= 1;
-    LED::green.on();
+  // Enable pin-change interrupt to detect button presses
+  GIMSK = _BV(PCIE);    // Enable pin change interrupt
+  PCMSK = _BV(PCINT4);  // Enable the interrupt for only pin 4.
 
-    delay(1000);
+  //
+  // Go into programming mode if the button is pressed for at least 3 seconds at boot time
+  //
+  if (button.is_pressed()) scheduler.every(programming_task, 10);
+  else start();
 
-    LED::green.off();
-    LED::yellow.off();
-    LED::red.off();
+  // Set up the green LED to blink every second
+  // blink(LED::green, 50, 950);
 
-    delay(1000);
-  }
+}
+
+
+void loop()
+{
+  scheduler.run();
+  power.sleep(scheduler);
 }
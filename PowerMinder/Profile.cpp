@@ -0,0 +1,177 @@
+//------------------------------------------------------------------------------
+//   Copyright 2014 Janick Bergeron
+//   All Rights Reserved Worldwide
+//
+//   Licensed under the Apache License, Version 2.0 (the
+//   "License"); you may not use this file except in
+//   compliance with the License.  You may obtain a copy of
+//   the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in
+//   writing, software distributed under the License is
+//   distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+//   CONDITIONS OF ANY KIND, either express or implied.  See
+//   the License for the specific language governing
+//   permissions and limitations under the License.
+//------------------------------------------------------------------------------
+
+
+
+#include "Profile.h"
+
+#ifdef PROFILE
+
+#include <Arduino.h>
+#ifdef __AVR__
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#else
+#include <stdio.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#endif
+
+using namespace PowerMinder;
+
+Profile_t::counters_t       Profile_t::s_counters[SUBSYSTEMS];
+volatile uint8_t            Profile_t::s_current = SUBSYSTEMS;
+
+
+#ifdef __AVR__
+/** Timer1 is only 8 bits: count its overflows to make a 24-bit time base */
+static volatile uint16_t overflows = 0;
+
+/** Mask of the valid bits in a time */
+static const Profile_t::ticks_t MASK = 0x00FFFFFF;
+
+ISR(TIMER1_OVF_vect)
+{
+  overflows++;
+}
+#else
+static const Profile_t::ticks_t MASK = ~(Profile_t::ticks_t) 0;
+#endif
+
+
+void
+Profile_t::init()
+{
+#ifdef __AVR__
+  // Timer1 at CK/64, interrupt on overflow
+  TCCR1  = _BV(CS12) | _BV(CS11) | _BV(CS10);
+  TCNT1  = 0;
+  TIMSK |= _BV(TOIE1);
+#endif
+  reset();
+}
+
+
+void
+Profile_t::reset()
+{
+  for (uint8_t i = 0; i < SUBSYSTEMS; i++) {
+    s_counters[i].ticks    = 0;
+    s_counters[i].calls    = 0;
+    s_counters[i].max      = 0;
+    s_counters[i].reads    = 0;
+    s_counters[i].writes   = 0;
+    s_counters[i].delay_us = 0;
+  }
+}
+
+
+Profile_t::ticks_t
+Profile_t::now()
+{
+#ifdef __AVR__
+  uint8_t sreg = SREG;
+  cli();
+  uint8_t  low  = TCNT1;
+  uint16_t high = overflows;
+  // Has it overflowed since we disabled interrupts?
+  if ((TIFR & _BV(TOV1)) && low < 0x80) high++;
+  SREG = sreg;
+
+  return ((ticks_t) high << 8) | low;
+#elif defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+#endif
+}
+
+
+void
+Profile_t::exit(uint8_t subsystem,
+		ticks_t start)
+{
+  ticks_t elapsed = (now() - start) & MASK;
+
+#ifdef __AVR__
+  // The same subsystem may be entered from an ISR
+  uint8_t sreg = SREG;
+  cli();
+#endif
+  counters_t &counters = s_counters[subsystem];
+  counters.ticks += elapsed;
+  counters.calls++;
+  if (elapsed > (count_t) -1) elapsed = (count_t) -1;
+  if (elapsed > counters.max) counters.max = elapsed;
+#ifdef __AVR__
+  SREG = sreg;
+#endif
+}
+
+
+const Profile_t::counters_t &
+Profile_t::counters(subsystem_t subsystem)
+{
+  return s_counters[subsystem];
+}
+
+
+void
+Profile_t::snapshot(uint8_t buffer[SNAPSHOT_SIZE])
+{
+  *buffer++ = SUBSYSTEMS;
+  for (uint8_t i = 0; i < SUBSYSTEMS; i++) {
+    const counters_t &counters = s_counters[i];
+    ticks_t average = (counters.calls) ? counters.ticks / counters.calls : 0;
+
+    ticks_t values[3] = {counters.calls, average, counters.max};
+    for (uint8_t j = 0; j < 3; j++) {
+      if (values[j] > 0xFFFF) values[j] = 0xFFFF;
+      *buffer++ = values[j] & 0xFF;
+      *buffer++ = values[j] >> 8;
+    }
+  }
+}
+
+
+#ifndef __AVR__
+void
+Profile_t::print()
+{
+  static const char *names[SUBSYSTEMS] = {"RTC", "Button", "LED", "Light", "PCINT"};
+
+  printf("Profile (in TSC cycles):\n");
+  printf("  %-8s %10s %14s %10s %10s %10s %10s %10s\n",
+	 "", "Calls", "Total", "Average", "Max", "Reads", "Writes", "Delay us");
+  for (uint8_t i = 0; i < SUBSYSTEMS; i++) {
+    const counters_t &counters = s_counters[i];
+    printf("  %-8s %10lu %14llu %10llu %10lu %10lu %10lu %10lu\n", names[i],
+	   (unsigned long) counters.calls, (unsigned long long) counters.ticks,
+	   (unsigned long long) ((counters.calls) ? counters.ticks / counters.calls : 0),
+	   (unsigned long) counters.max, (unsigned long) counters.reads, (unsigned long) counters.writes,
+	   (unsigned long) counters.delay_us);
+  }
+}
+#endif
+
+#endif
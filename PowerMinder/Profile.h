@@ -0,0 +1,158 @@
+//------------------------------------------------------------------------------
+//   Copyright 2014 Janick Bergeron
+//   All Rights Reserved Worldwide
+//
+//   Licensed under the Apache License, Version 2.0 (the
+//   "License"); you may not use this file except in
+//   compliance with the License.  You may obtain a copy of
+//   the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in
+//   writing, software distributed under the License is
+//   distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+//   CONDITIONS OF ANY KIND, either express or implied.  See
+//   the License for the specific language governing
+//   permissions and limitations under the License.
+//------------------------------------------------------------------------------
+
+
+
+#ifndef _Profile_h
+#define _Profile_h
+
+#include <stdint.h>
+
+/** Uncomment to enable profiling, or define on the compiler command line */
+//#define PROFILE
+
+namespace PowerMinder {
+
+  /** Profiling counters, per subsystem.
+   *
+   *  Time is measured in ticks of Timer1 (prescaled by 64) on the target,
+   *  and in TSC cycles on the host. Scopes are inclusive: time spent in
+   *  a nested scope or an interrupt is also counted in the enclosing scope.
+   *  Pin reads, writes and delays are attributed to the innermost scope.
+   *
+   *  Everything compiles away unless PROFILE is defined.
+   */
+  class Profile_t {
+
+  public:
+    typedef enum {RTC_IO,       ///< DS1302 bit-banging
+		  BUTTON_IO,    ///< Button debouncing
+		  LED_IO,       ///< LED service loop
+		  LIGHT_IO,     ///< Light sensor conversions
+		  PCINT_ISR,    ///< Pin-change interrupt
+		  SUBSYSTEMS} subsystem_t;
+
+#ifdef __AVR__
+    typedef uint32_t ticks_t;
+    typedef uint16_t count_t;
+#else
+    typedef uint64_t ticks_t;
+    typedef uint32_t count_t;
+#endif
+
+    typedef struct {
+      ticks_t  ticks;     ///< Total time in the subsystem
+      count_t  calls;     ///< Number of times it was entered
+      count_t  max;       ///< Longest time in the subsystem, in ticks (saturated)
+      count_t  reads;     ///< Pin & ADC reads
+      count_t  writes;    ///< Pin writes
+      count_t  delay_us;  ///< Time spent in delay loops, in microseconds (saturated)
+    } counters_t;
+
+    /** Size of a snapshot */
+    static const uint8_t SNAPSHOT_SIZE = 1 + 6 * SUBSYSTEMS;
+
+    /** Start the time base & clear the counters */
+    static void init();
+
+    /** Clear the counters */
+    static void reset();
+
+    /** Current time, in ticks */
+    static ticks_t now();
+
+    /** Counters for a subsystem */
+    static const counters_t &counters(subsystem_t subsystem);
+
+    /** Write a compact snapshot of the counters: the number of subsystems,
+     *  then the calls, average ticks & maximum ticks of each subsystem,
+     *  as saturated 16-bit little-endian values. Fits in the DS1302 RAM.
+     */
+    static void snapshot(uint8_t buffer[SNAPSHOT_SIZE]);
+
+#ifndef __AVR__
+    /** Print a report of the counters */
+    static void print();
+#endif
+
+    /** Count a pin or ADC read in the current subsystem */
+    static void read()
+    {
+      if (s_current < SUBSYSTEMS) s_counters[s_current].reads++;
+    }
+
+    /** Count a pin write in the current subsystem */
+    static void write()
+    {
+      if (s_current < SUBSYSTEMS) s_counters[s_current].writes++;
+    }
+
+    /** Count a delay loop in the current subsystem */
+    static void delay(uint16_t us)
+    {
+      if (s_current >= SUBSYSTEMS) return;
+      count_t &total = s_counters[s_current].delay_us;
+      total = ((count_t) (total + us) < total) ? (count_t) -1 : total + us;
+    }
+
+    /** Time spent in a subsystem, until the end of the C++ scope */
+    class Scope_t {
+
+    public:
+      Scope_t(subsystem_t subsystem)
+	: m_subsystem(subsystem), m_previous(s_current), m_start(now())
+      {
+	s_current = subsystem;
+      }
+
+      ~Scope_t()
+      {
+	exit(m_subsystem, m_start);
+	s_current = m_previous;
+      }
+
+    private:
+      uint8_t m_subsystem;
+      uint8_t m_previous;
+      ticks_t m_start;
+    };
+
+  private:
+    static void exit(uint8_t subsystem,
+		     ticks_t start);
+
+    static counters_t       s_counters[SUBSYSTEMS];
+    static volatile uint8_t s_current;   ///< Innermost subsystem (SUBSYSTEMS == none)
+  };
+
+}
+
+#ifdef PROFILE
+#define PROFILE_SCOPE(subsystem) PowerMinder::Profile_t::Scope_t profile_scope_(PowerMinder::Profile_t::subsystem)
+#define PROFILE_READ()           PowerMinder::Profile_t::read()
+#define PROFILE_WRITE()          PowerMinder::Profile_t::write()
+#define PROFILE_DELAY(us)        PowerMinder::Profile_t::delay(us)
+#else
+#define PROFILE_SCOPE(subsystem)
+#define PROFILE_READ()
+#define PROFILE_WRITE()
+#define PROFILE_DELAY(us)
+#endif
+
+#endif
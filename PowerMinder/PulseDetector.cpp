@@ -0,0 +1,123 @@
+//------------------------------------------------------------------------------
+//   Copyright 2014 Janick Bergeron
+//   All Rights Reserved Worldwide
+//
+//   Licensed under the Apache License, Version 2.0 (the
+//   "License"); you may not use this file except in
+//   compliance with the License.  You may obtain a copy of
+//   the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in
+//   writing, software distributed under the License is
+//   distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+//   CONDITIONS OF ANY KIND, either express or implied.  See
+//   the License for the specific language governing
+//   permissions and limitations under the License.
+//------------------------------------------------------------------------------
+
+
+#include "PulseDetector.h"
+#include "Trace.h"
+
+using namespace PowerMinder;
+
+
+bool
+PulseDetector_t::update(uint16_t      value,
+			uint16_t      baseline,
+			unsigned long now)
+{
+#ifdef TRACE
+  if (value > baseline + m_threshold) TRACE_EVENT(SAMPLE, (value - baseline) >> 2);
+#endif
+
+  if (!m_is_lit) {
+    if (value <= baseline + m_threshold) return false;
+
+    // Rising edge: a new pulse
+    m_is_lit = true;
+    if (m_count > 0) m_interval = now - m_rise_stamp;
+    m_rise_stamp = now;
+    m_count++;
+    TRACE_EVENT(PULSE, m_count);
+    return true;
+  }
+
+  // Use some hysteresis to avoid detecting the same pulse twice
+  if (value < baseline + m_threshold / 2) {
+    // Falling edge: the pulse is over
+    m_is_lit = false;
+    unsigned long width = now - m_rise_stamp;
+    m_width = (width > 65535) ? 65535 : width;
+  }
+  return false;
+}
+
+
+bool
+PulseDetector_t::is_lit()
+{
+  return m_is_lit;
+}
+
+
+uint16_t
+PulseDetector_t::count()
+{
+  return m_count;
+}
+
+
+uint16_t
+PulseDetector_t::width()
+{
+  return m_width;
+}
+
+
+unsigned long
+PulseDetector_t::interval()
+{
+  return m_interval;
+}
+
+
+unsigned long
+PulseDetector_t::last_pulse()
+{
+  return m_rise_stamp;
+}
+
+
+#ifdef TEST
+#include <stdio.h>
+
+int
+main()
+{
+  int errors = 0;
+
+  // Pulses are relative to the baseline, with hysteresis
+  PulseDetector_t detector;
+  bool ok = (!detector.update(500, 500, 0) && !detector.is_lit() && detector.count() == 0);
+  ok = ok && detector.update(600, 500, 10) && detector.is_lit() && detector.count() == 1 && detector.last_pulse() == 10;
+  ok = ok && !detector.update(540, 500, 12) && detector.is_lit();
+  ok = ok && !detector.update(600, 500, 14) && detector.count() == 1;
+  ok = ok && !detector.update(520, 500, 30) && !detector.is_lit() && detector.width() == 20 && detector.interval() == 0;
+  ok = ok && !detector.update(750, 700, 50) && !detector.is_lit();
+  printf("%s: Pulse detected once, with hysteresis\n", (ok) ? "PASS" : "FAIL");
+  if (!ok) errors++;
+
+  // Interval between the starts of pulses, widths saturated
+  ok = detector.update(600, 500, 110) && detector.interval() == 100 && detector.width() == 20;
+  ok = ok && !detector.update(500, 500, 200) && detector.width() == 90;
+  ok = ok && detector.update(600, 500, 1000) && detector.count() == 3 && detector.interval() == 890;
+  ok = ok && !detector.update(500, 500, 100000) && detector.width() == 65535;
+  printf("%s: Widths & intervals measured\n", (ok) ? "PASS" : "FAIL");
+  if (!ok) errors++;
+
+  return (errors) ? 1 : 0;
+}
+#endif
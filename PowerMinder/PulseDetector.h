@@ -0,0 +1,76 @@
+//------------------------------------------------------------------------------
+//   Copyright 2014 Janick Bergeron
+//   All Rights Reserved Worldwide
+//
+//   Licensed under the Apache License, Version 2.0 (the
+//   "License"); you may not use this file except in
+//   compliance with the License.  You may obtain a copy of
+//   the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in
+//   writing, software distributed under the License is
+//   distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+//   CONDITIONS OF ANY KIND, either express or implied.  See
+//   the License for the specific language governing
+//   permissions and limitations under the License.
+//------------------------------------------------------------------------------
+
+
+#ifndef _PulseDetector_h
+#define _PulseDetector_h
+
+#include <stdint.h>
+
+namespace PowerMinder {
+
+  /** Class to detect meter light pulses in a stream of light sensor readings.
+   *
+   *  A pulse starts when the reading rises more than the threshold above
+   *  the ambient baseline and ends when it falls back below half the threshold.
+   */
+  class PulseDetector_t {
+
+  public:
+    /** Process a light level reading. Returns TRUE if it starts a new pulse */
+    bool update(uint16_t      value,       ///< Light level reading, 0-1023
+		uint16_t      baseline,    ///< Ambient light level, 0-1023
+		unsigned long now);        ///< Time of the reading, in milliseconds
+
+    /** Is a pulse in progress? */
+    bool is_lit();
+
+    /** Number of pulses detected so far (wraps around) */
+    uint16_t count();
+
+    /** Duration of the last complete pulse, in milliseconds (0 == unknown) */
+    uint16_t width();
+
+    /** Time between the starts of the last two pulses, in milliseconds (0 == unknown) */
+    unsigned long interval();
+
+    /** Time at which the last pulse started, in milliseconds */
+    unsigned long last_pulse();
+
+  // Looks like Sketches don't support private constructors...
+  //private:
+    /** Create a pulse detector */
+    constexpr PulseDetector_t(uint16_t threshold = 0x0040)   ///< Brightness above baseline that is a pulse
+      : m_threshold(threshold), m_is_lit(0), m_count(0),
+	m_width(0), m_interval(0), m_rise_stamp(0)
+    {
+    }
+
+  private:
+    uint16_t      m_threshold;
+    bool          m_is_lit;
+    uint16_t      m_count;
+    uint16_t      m_width;
+    unsigned long m_interval;
+    unsigned long m_rise_stamp;
+  };
+
+}
+
+#endif
@@ -0,0 +1,213 @@
+//------------------------------------------------------------------------------
+//   Copyright 2014 Janick Bergeron
+//   All Rights Reserved Worldwide
+//
+//   Licensed under the Apache License, Version 2.0 (the
+//   "License"); you may not use this file except in
+//   compliance with the License.  You may obtain a copy of
+//   the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in
+//   writing, software distributed under the License is
+//   distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+//   CONDITIONS OF ANY KIND, either express or implied.  See
+//   the License for the specific language governing
+//   permissions and limitations under the License.
+//------------------------------------------------------------------------------
+
+
+#include "SampleGovernor.h"
+
+using namespace PowerMinder;
+
+
+void
+SampleGovernor_t::init()
+{
+  m_state.mode      = ACQUIRE;
+  m_state.period    = MIN_PERIOD;
+  m_state.target    = MIN_PERIOD;
+  m_state.width     = 0;
+  m_state.interval  = 0;
+  m_state.decisions = 0;
+
+  m_seen           = 0;
+  m_sample_stamp   = 0;
+  m_decision_stamp = 0;
+}
+
+
+void
+SampleGovernor_t::update(PulseDetector_t &detector,
+			 unsigned long    now)
+{
+  // A pulse must be over for its width to be known
+  if (!detector.is_lit() && detector.count() != m_seen && detector.width() > 0) {
+    m_seen = detector.count();
+    m_state.mode     = TRACK;
+    m_state.width    = detector.width();
+    m_state.interval = detector.interval();
+
+    // Enough samples in the pulse, and in the gap if pulses are close together
+    uint16_t shortest = m_state.width;
+    if (m_state.interval > 0 && m_state.interval / 2 < shortest) shortest = m_state.interval / 2;
+    m_state.target = shortest / SAMPLES_PER_PULSE;
+    m_decide(now);
+    return;
+  }
+
+  if (m_state.mode == ACQUIRE) return;
+
+  if (m_state.mode == TRACK) {
+    // Have the pulses stopped coming in?
+    unsigned long silence = now - detector.last_pulse();
+    if (silence <= IDLE_STEP || silence / IDLE_INTERVALS <= m_state.interval) return;
+
+    m_state.mode   = IDLE;
+    // Two samples are enough to detect a pulse
+    m_state.target = m_state.width / 2;
+  }
+  m_decide(now);
+}
+
+
+void
+SampleGovernor_t::m_decide(unsigned long now)
+{
+  uint16_t target = m_state.target;
+  if (target < MIN_PERIOD) target = MIN_PERIOD;
+  if (target > MAX_PERIOD) target = MAX_PERIOD;
+
+  uint16_t period = m_state.period;
+  if (target < period) {
+    // Speed up right away: pulses may otherwise be missed
+    period = target;
+  }
+  else if (target > period) {
+    // Slow down gradually, and not too often when idle
+    if (m_state.mode == IDLE && now - m_decision_stamp < IDLE_STEP) return;
+    period = (period * 2 < target) ? period * 2 : target;
+  }
+
+  if (period == m_state.period) return;
+  m_state.period = period;
+  m_state.decisions++;
+  m_decision_stamp = now;
+}
+
+
+bool
+SampleGovernor_t::is_due(unsigned long now)
+{
+  if (now - m_sample_stamp < m_state.period) return false;
+  m_sample_stamp = now;
+  return true;
+}
+
+
+uint16_t
+SampleGovernor_t::period()
+{
+  return m_state.period;
+}
+
+
+const SampleGovernor_t::state_t&
+SampleGovernor_t::state()
+{
+  return m_state;
+}
+
+
+#ifdef TEST
+#include <stdio.h>
+
+static const uint16_t BASELINE = 500;
+
+
+/** Flash pulses of the specified width every interval ms (none if 0), sampled at the period of the governor.
+ *  Returns the time reached.
+ */
+static unsigned long
+run(SampleGovernor_t &governor,
+    PulseDetector_t  &detector,
+    unsigned long     now,
+    unsigned long     until,
+    uint16_t          width,
+    unsigned long     interval)
+{
+  while (now < until) {
+    bool lit = (interval > 0 && now % interval < width);
+    detector.update((lit) ? BASELINE + 200 : BASELINE, BASELINE, now);
+    governor.update(detector, now);
+    now += governor.period();
+  }
+  return now;
+}
+
+
+int
+main()
+{
+  int errors = 0;
+
+  SampleGovernor_t governor;
+  PulseDetector_t  detector;
+  governor.init();
+
+  // As fast as possible until a pulse is measured
+  bool ok = (governor.state().mode == SampleGovernor_t::ACQUIRE && governor.period() == SampleGovernor_t::MIN_PERIOD);
+  unsigned long now = run(governor, detector, 0, 5, 0, 0);
+  ok = ok && governor.state().mode == SampleGovernor_t::ACQUIRE && governor.period() == SampleGovernor_t::MIN_PERIOD;
+
+  // 40-ms pulses every 50 ms: the gap between them sets the period, reached by doubling once per pulse
+  uint16_t decisions = governor.state().decisions;
+  now = run(governor, detector, now, 1000, 40, 50);
+  ok = ok && governor.state().mode == SampleGovernor_t::TRACK && governor.period() == 25 / SampleGovernor_t::SAMPLES_PER_PULSE;
+  ok = ok && (uint16_t) (governor.state().decisions - decisions) == 3;
+  printf("%s: Pulses tracked, period %d ms after %d decisions\n", (ok) ? "PASS" : "FAIL",
+	 governor.period(), governor.state().decisions);
+  if (!ok) errors++;
+
+  // The pulses stop: idle at half the pulse width, approached once per IDLE_STEP at most
+  ok = true;
+  unsigned long changed = 0;
+  uint16_t      period  = governor.period();
+  int           steps   = 0;
+  while (now < 20000) {
+    now = run(governor, detector, now, now + 1, 0, 0);
+    if (governor.period() == period) continue;
+    if (steps++ > 0 && now - changed < SampleGovernor_t::IDLE_STEP) ok = false;
+    if (governor.period() > 2 * period) ok = false;
+    changed = now;
+    period  = governor.period();
+  }
+  ok = ok && governor.state().mode == SampleGovernor_t::IDLE && governor.period() == detector.width() / 2 && steps == 2;
+  printf("%s: Idle at %d ms in %d steps\n", (ok) ? "PASS" : "FAIL", governor.period(), steps);
+  if (!ok) errors++;
+
+  // Narrower pulses speed it up right away, never above half their width
+  uint16_t count = detector.count();
+  while (detector.count() == count || detector.is_lit()) now = run(governor, detector, now, now + 1, 30, 1000);
+  ok = (governor.state().mode == SampleGovernor_t::TRACK && governor.period() <= detector.width() / 4);
+  printf("%s: Sped up to %d ms by a %d-ms pulse\n", (ok) ? "PASS" : "FAIL", governor.period(), detector.width());
+  if (!ok) errors++;
+
+  // Restarted with a new detector, its first pulse is tracked as well
+  SampleGovernor_t again;
+  PulseDetector_t  first;
+  again.init();
+  now = run(again, first, 0, 100, 40, 1000);
+  PulseDetector_t second;
+  again.init();
+  ok = (again.state().mode == SampleGovernor_t::ACQUIRE && again.state().decisions == 0 && again.period() == SampleGovernor_t::MIN_PERIOD);
+  run(again, second, 0, 100, 40, 1000);
+  ok = ok && second.count() == 1 && again.state().mode == SampleGovernor_t::TRACK;
+  printf("%s: Restarted from scratch\n", (ok) ? "PASS" : "FAIL");
+  if (!ok) errors++;
+
+  return (errors) ? 1 : 0;
+}
+#endif
@@ -0,0 +1,110 @@
+//------------------------------------------------------------------------------
+//   Copyright 2014 Janick Bergeron
+//   All Rights Reserved Worldwide
+//
+//   Licensed under the Apache License, Version 2.0 (the
+//   "License"); you may not use this file except in
+//   compliance with the License.  You may obtain a copy of
+//   the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in
+//   writing, software distributed under the License is
+//   distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+//   CONDITIONS OF ANY KIND, either express or implied.  See
+//   the License for the specific language governing
+//   permissions and limitations under the License.
+//------------------------------------------------------------------------------
+
+
+#ifndef _SampleGovernor_h
+#define _SampleGovernor_h
+
+#include <stdint.h>
+#include "PulseDetector.h"
+
+namespace PowerMinder {
+
+  /** Class to adapt the light sensor sampling period to the observed pulses.
+   *
+   *  Pulses must be sampled several times to be detected and measured,
+   *  so the period is derived from the width of the last pulse and,
+   *  when pulses come in fast, from the interval between them.
+   *  A shorter period is adopted as soon as a pulse requires it;
+   *  a longer one is approached by at most doubling once per pulse,
+   *  or once per IDLE_STEP when no pulses are seen.
+   *  The period never exceeds half the last pulse width so a pulse cannot be missed.
+   */
+  class SampleGovernor_t {
+
+  public:
+    /** Governor decision modes */
+    typedef enum mode_e {ACQUIRE = 0,   ///< No pulse measured yet: sample as fast as possible
+			 TRACK   = 1,   ///< Pulses are coming in: sample to measure them
+			 IDLE    = 2    ///< No recent pulses: sample just enough to detect one
+    } mode_t;
+
+    /** Shortest sampling period, in milliseconds */
+    static const uint16_t MIN_PERIOD = 1;
+
+    /** Longest sampling period, in milliseconds */
+    static const uint16_t MAX_PERIOD = 64;
+
+    /** Number of samples desired within a pulse when tracking */
+    static const uint8_t  SAMPLES_PER_PULSE = 4;
+
+    /** Number of missing pulse intervals after which the governor goes idle */
+    static const uint8_t  IDLE_INTERVALS = 4;
+
+    /** Minimum time between two period increases while idle, in milliseconds */
+    static const uint16_t IDLE_STEP = 1000;
+
+    /** Governor decision state, for instrumentation */
+    typedef struct state_s {
+      mode_t        mode;        ///< Current mode
+      uint16_t      period;      ///< Current sampling period, in milliseconds
+      uint16_t      target;      ///< Period the governor is converging to, in milliseconds
+      uint16_t      width;       ///< Last pulse width used in the decision, in milliseconds
+      unsigned long interval;    ///< Last pulse interval used in the decision, in milliseconds
+      uint16_t      decisions;   ///< Number of period changes (wraps around)
+    } state_t;
+
+    /** Restart in ACQUIRE mode */
+    void init();
+
+    /** Take into account the pulses seen by the specified detector.
+     *  Call after every sample. */
+    void update(PulseDetector_t &detector,   ///< Detector fed with the samples
+		unsigned long    now);       ///< Current time, in milliseconds
+
+    /** Is the next sample due? If so, the sampling period restarts at the specified time */
+    bool is_due(unsigned long now);          ///< Current time, in milliseconds
+
+    /** Return the current sampling period, in milliseconds */
+    uint16_t period();
+
+    /** Return the decision state */
+    const state_t& state();
+
+  // Looks like Sketches don't support private constructors...
+  //private:
+    /** Create a sampling governor */
+    constexpr SampleGovernor_t()
+      : m_state(), m_seen(0), m_sample_stamp(0), m_decision_stamp(0)
+    {
+    }
+
+  private:
+    /** Move the period toward the target */
+    void m_decide(unsigned long now);
+
+    state_t       m_state;
+    uint16_t      m_seen;            ///< Pulse count at the last decision
+    unsigned long m_sample_stamp;    ///< Time of the last sample
+    unsigned long m_decision_stamp;  ///< Time of the last decision
+  };
+
+}
+
+#endif
@@ -0,0 +1,283 @@
+//------------------------------------------------------------------------------
+//   Copyright 2014 Janick Bergeron
+//   All Rights Reserved Worldwide
+//
+//   Licensed under the Apache License, Version 2.0 (the
+//   "License"); you may not use this file except in
+//   compliance with the License.  You may obtain a copy of
+//   the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in
+//   writing, software distributed under the License is
+//   distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+//   CONDITIONS OF ANY KIND, either express or implied.  See
+//   the License for the specific language governing
+//   permissions and limitations under the License.
+//------------------------------------------------------------------------------
+
+
+#include <Arduino.h>
+#include <avr/sleep.h>
+
+#include "Scheduler.h"
+
+using namespace PowerMinder;
+
+
+bool
+Task_t::is_scheduled()
+{
+  return m_scheduled;
+}
+
+
+unsigned long
+Task_t::deadline()
+{
+  return m_deadline;
+}
+
+
+void
+Scheduler_t::m_insert(Task_t &task)
+{
+  Task_t **p = &m_first;
+  // Tasks with the same deadline run in the order they were scheduled
+  while (*p && !is_before(task.m_deadline, (*p)->m_deadline)) p = &(*p)->m_next;
+  task.m_next = *p;
+  *p = &task;
+  task.m_scheduled = true;
+}
+
+
+void
+Scheduler_t::m_remove(Task_t &task)
+{
+  if (!task.m_scheduled) return;
+
+  Task_t **p = &m_first;
+  while (*p && *p != &task) p = &(*p)->m_next;
+  if (*p) *p = task.m_next;
+  task.m_scheduled = false;
+}
+
+
+void
+Scheduler_t::every(Task_t        &task,
+		   unsigned long  period,
+		   unsigned long  delay)
+{
+  m_remove(task);
+  task.m_period   = period;
+  task.m_deadline = millis() + delay;
+  m_insert(task);
+}
+
+
+void
+Scheduler_t::after(Task_t        &task,
+		   unsigned long  delay)
+{
+  m_remove(task);
+  if (&task != m_running) task.m_period = 0;
+  task.m_deadline = millis() + delay;
+  m_insert(task);
+}
+
+
+void
+Scheduler_t::cancel(Task_t &task)
+{
+  m_remove(task);
+  task.m_period = 0;
+}
+
+
+uint8_t
+Scheduler_t::run()
+{
+  uint8_t n = 0;
+
+  while (m_first && !is_before(millis(), m_first->m_deadline)) {
+    Task_t &task = *m_first;
+    m_first = task.m_next;
+    task.m_scheduled = false;
+
+    m_running = &task;
+    task.m_function(task);
+    m_running = 0;
+    n++;
+
+    // Reschedule periodic tasks, unless the task rescheduled itself
+    if (task.m_period > 0 && !task.m_scheduled) {
+      task.m_deadline += task.m_period;
+      // Do not try to catch up on missed runs
+      if (is_before(task.m_deadline, millis())) task.m_deadline = millis() + task.m_period;
+      m_insert(task);
+    }
+  }
+
+  return n;
+}
+
+
+void
+Scheduler_t::loop()
+{
+  run();
+
+  // Sleep until the next interrupt unless a task became due in the meantime.
+  // Interrupts are enabled by the instruction before SLEEP
+  // so one cannot sneak in between the check and the sleep.
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  cli();
+  if (m_first == 0 || is_before(millis(), m_first->m_deadline)) {
+    sleep_enable();
+    sei();
+    sleep_cpu();
+    sleep_disable();
+  }
+  sei();
+}
+
+
+bool
+Scheduler_t::is_idle()
+{
+  return m_first == 0;
+}
+
+
+unsigned long
+Scheduler_t::time_to_next()
+{
+  if (m_first == 0) return 0;
+
+  unsigned long now = millis();
+  if (!is_before(now, m_first->m_deadline)) return 0;
+  return (uint32_t) (m_first->m_deadline - now);
+}
+
+
+#ifdef TEST
+// Runs on the host simulator, for millis()
+
+#include <stdio.h>
+#include <string.h>
+
+static Scheduler_t scheduler;
+
+/** Names of the tasks, in the order they ran */
+static char ran[32];
+static int  nran = 0;
+
+static void
+note(char name)
+{
+  if (nran < (int) sizeof(ran) - 1) ran[nran++] = name;
+  ran[nran] = '\0';
+}
+
+static void run_a(Task_t &) {note('a');}
+static void run_b(Task_t &) {note('b');}
+static void run_c(Task_t &) {note('c');}
+static void run_d(Task_t &) {note('d');}
+
+static Task_t a(run_a);
+static Task_t b(run_b);
+static Task_t c(run_c);
+static Task_t d(run_d);
+
+
+/** Run the tasks that are due every ms for the specified number of ms */
+static void
+run(unsigned long ms)
+{
+  for (unsigned long i = 0; i < ms; i++) {
+    delay(1);
+    scheduler.run();
+  }
+}
+
+
+/** Forget the tasks that ran */
+static void
+clear()
+{
+  nran   = 0;
+  ran[0] = '\0';
+}
+
+
+static int errors = 0;
+
+static void
+check(const char *what,
+      bool        ok)
+{
+  printf("%s: %s (ran \"%s\")\n", (ok) ? "PASS" : "FAIL", what, ran);
+  if (!ok) errors++;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+  Sim::init(argc, argv);
+
+  check("Idle without tasks", scheduler.is_idle() && scheduler.time_to_next() == 0);
+
+  // Scheduled out of order; b & d share a deadline and run in the order they were scheduled
+  scheduler.after(a, 30);
+  scheduler.after(b, 10);
+  scheduler.after(c, 20);
+  scheduler.after(d, 10);
+  check("Next deadline", !scheduler.is_idle() && scheduler.time_to_next() == 10);
+  run(9);
+  check("Nothing runs early", nran == 0);
+  run(40);
+  check("Runs in deadline order", strcmp(ran, "bdca") == 0 && scheduler.is_idle());
+
+  // Rescheduling a queued task moves it rather than queuing it twice
+  clear();
+  scheduler.after(a, 10);
+  scheduler.after(b, 20);
+  scheduler.after(a, 30);
+  scheduler.every(c, 15);
+  scheduler.every(c, 20, 5);
+  run(29);
+  check("Moves a rescheduled task", strcmp(ran, "cbc") == 0);
+  run(1);
+  check("Runs it once, at its new time", strcmp(ran, "cbca") == 0);
+  run(40);
+  check("Keeps the new period", strcmp(ran, "cbcacc") == 0);
+  scheduler.cancel(c);
+  run(100);
+  check("Cancels a periodic task", strcmp(ran, "cbcacc") == 0 && scheduler.is_idle());
+
+  // Across the 2^32 ms wrap-around of millis()
+  check("Compares times across the wrap-around",
+	Scheduler_t::is_before(0xFFFFFFF0, 0x10) && !Scheduler_t::is_before(0x10, 0xFFFFFFF0)
+	&& !Scheduler_t::is_before(0x10, 0x10));
+  clear();
+  timer0_millis += 0xFFFFFFFF - 20 - millis();
+  scheduler.after(a, 10);
+  scheduler.after(b, 40);
+  scheduler.every(c, 15, 15);
+  run(15);
+  check("Runs the tasks due before the wrap-around", strcmp(ran, "ac") == 0);
+  check("Time to a deadline after it", scheduler.time_to_next() == 15);
+  run(14);
+  check("Not before their time", strcmp(ran, "ac") == 0 && millis() == 8);
+  run(1);
+  check("Keeps the period across it", strcmp(ran, "acc") == 0);
+  run(10);
+  check("Runs the tasks due after it", strcmp(ran, "accb") == 0);
+  run(5);
+  check("In deadline order", strcmp(ran, "accbc") == 0);
+
+  return (errors == 0) ? 0 : 1;
+}
+#endif
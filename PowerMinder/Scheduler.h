@@ -0,0 +1,130 @@
+//------------------------------------------------------------------------------
+//   Copyright 2014 Janick Bergeron
+//   All Rights Reserved Worldwide
+//
+//   Licensed under the Apache License, Version 2.0 (the
+//   "License"); you may not use this file except in
+//   compliance with the License.  You may obtain a copy of
+//   the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in
+//   writing, software distributed under the License is
+//   distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+//   CONDITIONS OF ANY KIND, either express or implied.  See
+//   the License for the specific language governing
+//   permissions and limitations under the License.
+//------------------------------------------------------------------------------
+
+
+#ifndef _Scheduler_h
+#define _Scheduler_h
+
+#include <stdint.h>
+
+namespace PowerMinder {
+
+  /** A task run by the scheduler */
+  class Task_t {
+
+  public:
+    /** Function implementing a task */
+    typedef void (*function_t)(Task_t &task);   ///< The task being run
+
+    /** Is the task scheduled to run? */
+    bool is_scheduled();
+
+    /** Time at which the task is next scheduled to run, in milliseconds */
+    unsigned long deadline();
+
+  // Looks like Sketches don't support private constructors...
+  //private:
+    /** Create a task */
+    constexpr Task_t(function_t function)         ///< Function to call when the task is due
+      : m_function(function), m_deadline(0), m_period(0),
+	m_next(0), m_scheduled(0)
+    {
+    }
+
+  private:
+    friend class Scheduler_t;
+
+    function_t    m_function;
+    unsigned long m_deadline;
+    unsigned long m_period;       ///< 0 == one-shot
+    Task_t       *m_next;         ///< Next task in deadline order
+    bool          m_scheduled;
+  };
+
+
+  /** Class to run tasks cooperatively, in deadline order.
+   *
+   *  Time is measured by millis(), i.e. by Timer0. Deadlines are compared
+   *  modulo 2^32 so they work across the 49.7-day wrap-around, as long as
+   *  no task is scheduled more than 24 days ahead.
+   *
+   *  When no task is due, loop() sleeps in idle mode until the next interrupt,
+   *  which is at most one Timer0 overflow (~1ms) away.
+   *  PowerManager_t::sleep() may sleep more deeply instead.
+   */
+  class Scheduler_t {
+
+  public:
+    /** Run a task periodically, starting after the specified delay */
+    void every(Task_t        &task,
+	       unsigned long  period,          ///< Period, in milliseconds
+	       unsigned long  delay = 0);      ///< Delay to first run, in milliseconds
+
+    /** Run a task once, after the specified delay.
+     *  A periodic task may call this to change the time of its next run.
+     */
+    void after(Task_t        &task,
+	       unsigned long  delay);          ///< Delay, in milliseconds
+
+    /** Stop running a task */
+    void cancel(Task_t &task);
+
+    /** Run the tasks that are due. Returns the number of tasks that were run. */
+    uint8_t run();
+
+    /** Run the tasks that are due, then sleep until an interrupt.
+     *  Call in the main loop() routine.
+     */
+    void loop();
+
+    /** Is no task scheduled? */
+    bool is_idle();
+
+    /** Time until the next deadline, in milliseconds (0 if a task is due or none is scheduled) */
+    unsigned long time_to_next();
+
+    /** Is time a before time b (modulo 2^32)? */
+    static bool is_before(unsigned long a,
+			  unsigned long b)
+    {
+      return (int32_t) (a - b) < 0;
+    }
+
+  // Looks like Sketches don't support private constructors...
+  //private:
+    /** Create a scheduler */
+    constexpr Scheduler_t()
+      : m_first(0), m_running(0)
+    {
+    }
+
+  private:
+    /** Insert a task in deadline order */
+    void m_insert(Task_t &task);
+
+    /** Remove a task from the schedule */
+    void m_remove(Task_t &task);
+
+    Task_t *m_first;      ///< Task with the earliest deadline
+    Task_t *m_running;    ///< Task being run
+  };
+
+}
+
+#endif
@@ -0,0 +1,215 @@
+//------------------------------------------------------------------------------
+//   Copyright 2014 Janick Bergeron
+//   All Rights Reserved Worldwide
+//
+//   Licensed under the Apache License, Version 2.0 (the
+//   "License"); you may not use this file except in
+//   compliance with the License.  You may obtain a copy of
+//   the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in
+//   writing, software distributed under the License is
+//   distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+//   CONDITIONS OF ANY KIND, either express or implied.  See
+//   the License for the specific language governing
+//   permissions and limitations under the License.
+//------------------------------------------------------------------------------
+
+
+
+#include "Tariff.h"
+#include "Calendar.h"
+#include "Crc16.h"
+#ifndef __AVR__
+#include <stdio.h>
+#include <string.h>
+#endif
+
+using namespace PowerMinder;
+
+
+bool
+TariffImage_t::open(const uint8_t *image,
+		    uint16_t       size,
+		    read_t         read)
+{
+  m_image = 0;
+
+  if (size < HEADER_SIZE + 2) return false;
+  if (read(image) != MAGIC0 || read(image + 1) != MAGIC1 || read(image + 2) != VERSION) return false;
+  if (read(image + 3) & ~PRICED) return false;
+
+  uint16_t len = read(image + 4) | (read(image + 5) << 8);
+  if (len < HEADER_SIZE + 2 || len > size) return false;
+
+  uint16_t crc = CRC16_INIT;
+  for (uint16_t i = 0; i < len - 2; i++) crc = crc16_update(crc, read(image + i));
+  if ((crc & 0xFF) != read(image + len - 2) || (crc >> 8) != read(image + len - 1)) return false;
+
+  m_image     = image;
+  m_read      = read;
+  m_seasons   = read(image + 6);
+  m_schedules = read(image + 7);
+
+  // From now on, only read what was found to be inside the image.
+  // The schedules end where the prices or the CRC start.
+  uint16_t end = len - 2 - ((isPriced()) ? 6 : 0);
+  if (m_seasons == 0 || m_seasons > MAX_SEASONS ||
+      m_schedules == 0 || m_schedules > MAX_SCHEDULES ||
+      HEADER_SIZE + SEASON_SIZE * m_seasons + 2 * m_schedules > end) {
+    m_image = 0;
+    return false;
+  }
+
+  // Seasons must be in chronological order and use existing schedules
+  for (uint8_t i = 0; i < m_seasons; i++) {
+    uint8_t month = startMonth(i);
+    uint8_t day   = startDay(i);
+    if (month < 1 || month > 12 || day < 1 || day > 31 ||
+	scheduleIdx(i, false) >= m_schedules || scheduleIdx(i, true) >= m_schedules ||
+	(i > 0 && (month < startMonth(i-1) || (month == startMonth(i-1) && day <= startDay(i-1))))) {
+      m_image = 0;
+      return false;
+    }
+  }
+
+  // Period changes must start at 00:00 and be in chronological order
+  for (uint8_t i = 0; i < m_schedules; i++) {
+    uint16_t at = offset(i);
+    if (at < HEADER_SIZE + SEASON_SIZE * m_seasons + 2 * m_schedules || at >= end ||
+	changes(i) == 0 || changes(i) > MAX_CHANGES || at + 1 + changes(i) > end) {
+      m_image = 0;
+      return false;
+    }
+    for (uint8_t k = 0; k < changes(i); k++) {
+      uint8_t time = change(i, k) & 0x3F;
+      if ((change(i, k) >> 6) > ON_PEAK || time >= 48 ||
+	  (k == 0 && time != 0) || (k > 0 && time <= (change(i, k-1) & 0x3F))) {
+	m_image = 0;
+	return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+
+#ifndef __AVR__
+uint16_t
+TariffImage_t::encode(const tariff_t &tariff,
+		      uint8_t        *image,
+		      uint16_t        size)
+{
+  if (tariff.seasons == 0 || tariff.seasons > MAX_SEASONS) return 0;
+  if (tariff.schedules == 0 || tariff.schedules > MAX_SCHEDULES) return 0;
+
+  uint32_t len = HEADER_SIZE + SEASON_SIZE * tariff.seasons + 2 * tariff.schedules + 2;
+  for (uint8_t i = 0; i < tariff.schedules; i++) {
+    if (tariff.schedule[i].changes > MAX_CHANGES) return 0;
+    len += 1 + tariff.schedule[i].changes;
+  }
+  if (tariff.priced) len += 6;
+  if (len > size || len > 0xFFFF) return 0;
+
+  uint16_t at = 0;
+  image[at++] = MAGIC0;
+  image[at++] = MAGIC1;
+  image[at++] = VERSION;
+  image[at++] = (tariff.priced) ? PRICED : 0;
+  image[at++] = len & 0xFF;
+  image[at++] = len >> 8;
+  image[at++] = tariff.seasons;
+  image[at++] = tariff.schedules;
+
+  for (uint8_t i = 0; i < tariff.seasons; i++) {
+    image[at++] = tariff.season[i].month;
+    image[at++] = tariff.season[i].day;
+    image[at++] = tariff.season[i].workday;
+    image[at++] = tariff.season[i].weekend;
+  }
+
+  uint16_t offset = at + 2 * tariff.schedules;
+  for (uint8_t i = 0; i < tariff.schedules; i++) {
+    image[at++] = offset & 0xFF;
+    image[at++] = offset >> 8;
+    offset += 1 + tariff.schedule[i].changes;
+  }
+
+  for (uint8_t i = 0; i < tariff.schedules; i++) {
+    image[at++] = tariff.schedule[i].changes;
+    memcpy(image + at, tariff.schedule[i].change, tariff.schedule[i].changes);
+    at += tariff.schedule[i].changes;
+  }
+
+  if (tariff.priced) {
+    for (uint8_t p = 0; p < 3; p++) {
+      image[at++] = tariff.price[p] & 0xFF;
+      image[at++] = tariff.price[p] >> 8;
+    }
+  }
+
+  uint16_t crc = crc16(image, at);
+  image[at++] = crc & 0xFF;
+  image[at++] = crc >> 8;
+
+  // Apply the same rules as the Calendar
+  TariffImage_t check;
+  return (check.open(image, at)) ? at : 0;
+}
+
+
+bool
+TariffImage_t::decode(const uint8_t *image,
+		      uint16_t       size,
+		      tariff_t      &tariff)
+{
+  TariffImage_t in;
+  if (!in.open(image, size)) return false;
+
+  memset(&tariff, 0, sizeof(tariff));
+  tariff.seasons = in.seasons();
+  for (uint8_t i = 0; i < tariff.seasons; i++) {
+    tariff.season[i].month   = in.startMonth(i);
+    tariff.season[i].day     = in.startDay(i);
+    tariff.season[i].workday = in.scheduleIdx(i, false);
+    tariff.season[i].weekend = in.scheduleIdx(i, true);
+  }
+  tariff.schedules = in.schedules();
+  for (uint8_t i = 0; i < tariff.schedules; i++) {
+    tariff.schedule[i].changes = in.changes(i);
+    for (uint8_t k = 0; k < tariff.schedule[i].changes; k++) {
+      tariff.schedule[i].change[k] = in.change(i, k);
+    }
+  }
+  tariff.priced = in.isPriced();
+  for (uint8_t p = 0; p < 3; p++) tariff.price[p] = in.price(p);
+
+  return true;
+}
+
+
+void
+TariffImage_t::print(const tariff_t &tariff)
+{
+  static const char *names[] = {"OFF-PEAK", "MID-PEAK", "ON-PEAK", "??"};
+
+  if (tariff.priced) {
+    printf("Prices: %.2f %.2f %.2f c/kWh\n", tariff.price[0] / 100.0, tariff.price[1] / 100.0, tariff.price[2] / 100.0);
+  }
+  printf("Seasons:\n");
+  for (uint8_t i = 0; i < tariff.seasons; i++) {
+    printf("  %02d/%02d  workdays #%d, weekends #%d\n", tariff.season[i].month, tariff.season[i].day,
+	   tariff.season[i].workday, tariff.season[i].weekend);
+  }
+  for (uint8_t i = 0; i < tariff.schedules; i++) {
+    printf("Schedule #%d:\n", i);
+    for (uint8_t k = 0; k < tariff.schedule[i].changes; k++) {
+      uint8_t time = tariff.schedule[i].change[k] & 0x3F;
+      printf("      %02d:%02d %s\n", time / 2, time % 2 * 30, names[tariff.schedule[i].change[k] >> 6]);
+    }
+  }
+}
+#endif
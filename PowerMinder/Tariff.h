@@ -0,0 +1,199 @@
+//------------------------------------------------------------------------------
+//   Copyright 2014 Janick Bergeron
+//   All Rights Reserved Worldwide
+//
+//   Licensed under the Apache License, Version 2.0 (the
+//   "License"); you may not use this file except in
+//   compliance with the License.  You may obtain a copy of
+//   the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in
+//   writing, software distributed under the License is
+//   distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+//   CONDITIONS OF ANY KIND, either express or implied.  See
+//   the License for the specific language governing
+//   permissions and limitations under the License.
+//------------------------------------------------------------------------------
+
+
+
+#ifndef _Tariff_h
+#define _Tariff_h
+
+#include <stdint.h>
+
+namespace PowerMinder {
+
+  /** A tariff image, executed in place by the Calendar wherever it is stored:
+   *  RAM, flash or EEPROM.
+   *
+   *  Multi-byte fields are little-endian. An image is:
+   *
+   *      'P' 'T'               Magic
+   *      VERSION               Format version (VERSION)
+   *      FLAGS                 PRICED if the prices follow the schedules, other bits are 0
+   *      SIZE_LO SIZE_HI       Size of the image in bytes, including the CRC
+   *      NSEASONS              Number of seasons, 1..MAX_SEASONS
+   *      NSCHEDULES            Number of schedules, 1..MAX_SCHEDULES
+   *      SEASON[NSEASONS]      MM DD WW EE: season starting on MM/DD, in chronological order,
+   *                            with workday schedule WW and weekend schedule EE
+   *      OFFSET[NSCHEDULES]    Offset of each schedule from the start of the image, 16 bits
+   *      SCHEDULE[NSCHEDULES]  N C[N]: N period changes, in chronological order.
+   *                            Each C is (period << 6) | time, in 30-min units.
+   *                            The first one must be for 00:00.
+   *      PRICE[3]              If PRICED: off-peak, partial-peak & on-peak prices, 16 bits,
+   *                            in 1/100th of a cent per kWh
+   *      CRC_LO CRC_HI         CRC-16 of everything before
+   *
+   *  An image is checked once, when opened. It is then read one byte at a time,
+   *  through a function such as eeprom_read_byte(), without being copied.
+   */
+  class TariffImage_t {
+
+  public:
+    static const uint8_t MAGIC0  = 'P';
+    static const uint8_t MAGIC1  = 'T';
+    static const uint8_t VERSION = 1;
+
+    /** FLAGS bit: the image includes prices */
+    static const uint8_t PRICED = 0x01;
+
+    static const uint8_t HEADER_SIZE = 8;
+    static const uint8_t SEASON_SIZE = 4;
+
+    /** Maximum number of seasons in an image */
+    static const uint8_t MAX_SEASONS = 32;
+
+    /** Maximum number of schedules in an image */
+    static const uint8_t MAX_SCHEDULES = 32;
+
+    /** Maximum number of period changes in a schedule (one every 30 mins) */
+    static const uint8_t MAX_CHANGES = 48;
+
+    /** Function reading a byte of an image where it is stored */
+    typedef uint8_t (*read_t)(const uint8_t *addr);
+
+    /** Read a byte of an image in RAM */
+    static uint8_t readRam(const uint8_t *addr) {return *addr;}
+
+    /** Check an image and use it if it is valid. Returns TRUE if succesful. */
+    bool open(const uint8_t *image,            ///< Where the image is stored
+	      uint16_t       size,             ///< Bytes available there
+	      read_t         read = readRam);  ///< How to read them
+
+    /** Stop using the image */
+    void close() {m_image = 0;}
+
+    /** Is a valid image in use? */
+    bool isOpen() const {return m_image != 0;}
+
+    /** Number of seasons */
+    uint8_t seasons() const {return m_seasons;}
+
+    /** Number of schedules */
+    uint8_t schedules() const {return m_schedules;}
+
+    /** Start month (1-12) of a season */
+    uint8_t startMonth(uint8_t season) const {return byte(HEADER_SIZE + SEASON_SIZE * season);}
+
+    /** Start day (1-31) of a season */
+    uint8_t startDay(uint8_t season) const {return byte(HEADER_SIZE + SEASON_SIZE * season + 1);}
+
+    /** Schedule of a season on workdays or weekends */
+    uint8_t scheduleIdx(uint8_t season,
+			bool    weekend) const {return byte(HEADER_SIZE + SEASON_SIZE * season + 2 + weekend);}
+
+    /** Number of period changes in a schedule */
+    uint8_t changes(uint8_t schedule) const {return byte(offset(schedule));}
+
+    /** A period change in a schedule: (period << 6) | time, in 30-min units */
+    uint8_t change(uint8_t schedule,
+		   uint8_t k) const {return byte(offset(schedule) + 1 + k);}
+
+    /** Does the image include prices? */
+    bool isPriced() const {return byte(3) & PRICED;}
+
+    /** Price of a cost period, in 1/100th of a cent per kWh (0 if not priced) */
+    uint16_t price(uint8_t period) const
+    {
+      if (!isPriced()) return 0;
+      uint16_t at = size() - 8 + 2 * period;
+      return byte(at) | (byte(at + 1) << 8);
+    }
+
+#ifndef __AVR__
+    /** A decoded tariff, for the host tools */
+    typedef struct {
+      uint8_t seasons;
+      struct {
+	uint8_t month;
+	uint8_t day;
+	uint8_t workday;          ///< Schedule index
+	uint8_t weekend;          ///< Schedule index
+      } season[MAX_SEASONS];
+      uint8_t schedules;
+      struct {
+	uint8_t changes;
+	uint8_t change[MAX_CHANGES];    ///< (period << 6) | time, in 30-min units
+      } schedule[MAX_SCHEDULES];
+      bool     priced;
+      uint16_t price[3];                ///< In 1/100th of a cent per kWh
+    } tariff_t;
+
+    /** Encode a tariff into an image.
+     *  Returns the size of the image, or 0 if the tariff is invalid or the image does not fit.
+     */
+    static uint16_t encode(const tariff_t &tariff,
+			   uint8_t        *image,
+			   uint16_t        size);
+
+    /** Decode an image. Returns TRUE if the image is valid. */
+    static bool decode(const uint8_t *image,
+		       uint16_t       size,
+		       tariff_t      &tariff);
+
+    /** Print a decoded tariff */
+    static void print(const tariff_t &tariff);
+#endif
+
+  // Looks like Sketches don't support private constructors...
+  //private:
+    /** Create an unused image */
+    constexpr TariffImage_t()
+      : m_image(0), m_read(readRam), m_seasons(0), m_schedules(0)
+    {
+    }
+
+  private:
+    uint8_t byte(uint16_t offset) const {return m_read(m_image + offset);}
+
+    uint16_t size() const {return byte(4) | (byte(5) << 8);}
+
+    uint16_t offset(uint8_t schedule) const
+    {
+      uint16_t at = HEADER_SIZE + SEASON_SIZE * m_seasons + 2 * schedule;
+      return byte(at) | (byte(at + 1) << 8);
+    }
+
+    const uint8_t *m_image;
+    read_t         m_read;
+    uint8_t        m_seasons;
+    uint8_t        m_schedules;
+  };
+
+
+  /** Lookup tables compiled from a tariff by tariff-compile -H, read in place by the Calendar:
+   *  the schedule of a date and the period changes of a schedule are table reads.
+   */
+  typedef struct {
+    const uint8_t          *days;          ///< (weekend << 4) | workday schedule of every date, [month-1][day-1]
+    const uint8_t          *transitions;   ///< Changes to a different cost period, (period << 6) | time, of every schedule
+    const uint8_t          *starts;        ///< Index of the first transition of every schedule, then past the last one
+    TariffImage_t::read_t   read;          ///< How to read the tables
+  } TariffTables_t;
+
+}
+
+#endif
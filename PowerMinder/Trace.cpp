@@ -0,0 +1,206 @@
+//------------------------------------------------------------------------------
+//   Copyright 2014 Janick Bergeron
+//   All Rights Reserved Worldwide
+//
+//   Licensed under the Apache License, Version 2.0 (the
+//   "License"); you may not use this file except in
+//   compliance with the License.  You may obtain a copy of
+//   the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in
+//   writing, software distributed under the License is
+//   distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+//   CONDITIONS OF ANY KIND, either express or implied.  See
+//   the License for the specific language governing
+//   permissions and limitations under the License.
+//------------------------------------------------------------------------------
+
+
+
+#include "Trace.h"
+
+#ifndef __AVR__
+#include <stdio.h>
+#endif
+
+using namespace PowerMinder;
+
+
+#ifdef TRACE
+Trace_t::record_t Trace_t::s_records[TRACE_RECORDS];
+uint8_t           Trace_t::s_next = 0;
+unsigned long     Trace_t::s_last = 0;
+
+
+void
+Trace_t::init()
+{
+  for (uint8_t i = 0; i < TRACE_RECORDS; i++) {
+    s_records[i].event = EMPTY;
+  }
+  s_next = 0;
+  s_last = millis();
+}
+
+
+uint8_t
+Trace_t::save(writer_t  writer,
+	      void     *context,
+	      uint8_t   size)
+{
+  uint8_t max = (size - HEADER_SIZE) / RECORD_SIZE;
+  if (max > TRACE_RECORDS) max = TRACE_RECORDS;
+
+  // Take a copy of the newest records, as more may be recorded
+  // by an interrupt while the (slow) writer is busy
+  record_t copy[TRACE_RECORDS];
+  uint8_t n = 0;
+#ifdef __AVR__
+  uint8_t sreg = SREG;
+  cli();
+#endif
+  uint8_t next = s_next;
+  while (n < max) {
+    const record_t &r = s_records[--next & (TRACE_RECORDS - 1)];
+    if (r.event == EMPTY) break;
+    copy[max - ++n] = r;
+  }
+#ifdef __AVR__
+  SREG = sreg;
+#endif
+
+  uint8_t offset = 0;
+  writer(offset++, MAGIC, context);
+  writer(offset++, n, context);
+  for (uint8_t i = max - n; i < max; i++) {
+    writer(offset++, copy[i].event, context);
+    writer(offset++, copy[i].payload, context);
+    writer(offset++, copy[i].delta & 0xFF, context);
+    writer(offset++, copy[i].delta >> 8, context);
+  }
+
+  return offset;
+}
+#endif
+
+
+#ifndef __AVR__
+int
+Trace_t::decode(const uint8_t *image,
+		uint16_t       size,
+		reader_t       reader,
+		void          *context)
+{
+  if (size < HEADER_SIZE || image[0] != MAGIC) return -1;
+  uint8_t count = image[1];
+  if (size < HEADER_SIZE + count * RECORD_SIZE) return -1;
+
+  int           n    = 0;
+  unsigned long time = 0;
+  unsigned long gap  = 0;
+  for (const uint8_t *p = image + HEADER_SIZE; count > 0; count--, p += RECORD_SIZE) {
+    uint16_t delta = p[2] | (p[3] << 8);
+
+    if (p[0] == GAP) {
+      gap = (unsigned long) delta << 16;
+      continue;
+    }
+    // The time of the first record is the origin
+    if (n > 0) time += gap + delta;
+    gap = 0;
+
+    if (reader) reader(time, p[0], p[1], context);
+    n++;
+  }
+
+  return n;
+}
+
+
+const char *
+Trace_t::name(uint8_t event)
+{
+  static const char *names[EVENTS] = {"EMPTY", "GAP", "ISR", "SAMPLE", "PULSE", "PERIOD", "RTC_SYNC"};
+
+  return (event < EVENTS) ? names[event] : "?";
+}
+
+
+static void
+print_record(unsigned long  time,
+	     uint8_t        event,
+	     uint8_t        payload,
+	     void          *context)
+{
+  unsigned long *previous = (unsigned long *) context;
+
+  printf("%8lu.%03lu  %+8ld ms  %-8s %3d", time / 1000, time % 1000,
+	 (long) (time - *previous), Trace_t::name(event), payload);
+  switch (event) {
+  case Trace_t::ISR_ENTRY: printf("  (PINB=0x%02X)", payload); break;
+  case Trace_t::SAMPLE:    printf("  (%d above baseline)", 4 * payload); break;
+  case Trace_t::PERIOD:    printf("  (%s)", (payload == 0) ? "off-peak" : (payload == 1) ? "partial-peak" : "on-peak"); break;
+  case Trace_t::RTC_SYNC:  printf("  (min %02d)", payload); break;
+  }
+  printf("\n");
+
+  *previous = time;
+}
+
+
+int
+Trace_t::print(const uint8_t *image,
+	       uint16_t       size)
+{
+  if (decode(image, size, 0) < 0) return -1;
+
+  printf("    Time (s)     Delta  Event    Data\n");
+  unsigned long previous = 0;
+  int n = decode(image, size, print_record, &previous);
+  if (n >= 0) printf("%d events\n", n);
+
+  return n;
+}
+#endif
+
+
+#ifdef DECODE
+//
+// Host tool to print the timeline in a trace image,
+// such as a dump of the EEPROM or of the DS1302 RAM
+//
+#include <stdlib.h>
+
+int
+main(int argc, char *argv[])
+{
+  if (argc < 2 || argc > 3) {
+    fprintf(stderr, "Usage: %s image.bin [offset]\n", argv[0]);
+    return 1;
+  }
+
+  FILE *fp = fopen(argv[1], "rb");
+  if (fp == 0) {
+    perror(argv[1]);
+    return 1;
+  }
+  static uint8_t image[1024];
+  size_t size = fread(image, 1, sizeof(image), fp);
+  fclose(fp);
+
+  size_t offset = (argc == 3) ? strtoul(argv[2], 0, 0) : 0;
+  if (offset >= size) {
+    fprintf(stderr, "%s: offset %lu is beyond the end of the image\n", argv[1], (unsigned long) offset);
+    return 1;
+  }
+
+  if (Trace_t::print(image + offset, size - offset) < 0) {
+    fprintf(stderr, "%s: no valid trace at offset %lu\n", argv[1], (unsigned long) offset);
+    return 1;
+  }
+
+  return 0;
+}
+#endif
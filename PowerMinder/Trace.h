@@ -0,0 +1,166 @@
+//------------------------------------------------------------------------------
+//   Copyright 2014 Janick Bergeron
+//   All Rights Reserved Worldwide
+//
+//   Licensed under the Apache License, Version 2.0 (the
+//   "License"); you may not use this file except in
+//   compliance with the License.  You may obtain a copy of
+//   the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in
+//   writing, software distributed under the License is
+//   distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+//   CONDITIONS OF ANY KIND, either express or implied.  See
+//   the License for the specific language governing
+//   permissions and limitations under the License.
+//------------------------------------------------------------------------------
+
+
+
+
+#ifndef _Trace_h
+#define _Trace_h
+
+#include <stdint.h>
+
+/** Uncomment to enable tracing, or define on the compiler command line */
+//#define TRACE
+
+/** Number of records in the trace buffer. Must be a power of 2. */
+#ifndef TRACE_RECORDS
+#define TRACE_RECORDS 16
+#endif
+
+#ifdef TRACE
+#include <Arduino.h>
+#ifdef __AVR__
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#endif
+#endif
+
+namespace PowerMinder {
+
+  /** Circular trace of the last few significant events, to find out
+   *  after the fact why a meter pulse was missed.
+   *
+   *  Each record is 4 bytes: an event, a payload byte and the time since
+   *  the previous record in milliseconds. Gaps longer than 65.535s are
+   *  preceded by a GAP record with the upper 16 bits of the time difference.
+   *
+   *  A trace image is saved as:
+   *
+   *      MAGIC                 0x54 ('T')
+   *      COUNT                 Number of records that follow
+   *      RECORD[COUNT]         Oldest first: EVENT, PAYLOAD, DELTA (little-endian)
+   *
+   *  Recording compiles away unless TRACE is defined.
+   *  Decoding is always available, to the host tools.
+   */
+  class Trace_t {
+
+  public:
+    typedef enum {EMPTY,        ///< Unused record
+		  GAP,          ///< DELTA is the upper 16 bits of the next record's time difference
+		  ISR_ENTRY,    ///< Pin-change interrupt. PAYLOAD is PINB.
+		  SAMPLE,       ///< Light reading above the pulse threshold. PAYLOAD is (reading-baseline)/4.
+		  PULSE,        ///< Pulse detected. PAYLOAD is the pulse count (mod 256).
+		  PERIOD,       ///< Tariff period changed. PAYLOAD is the new period_t.
+		  RTC_SYNC,     ///< Minute task resynced with the RTC. PAYLOAD is the minute.
+		  EVENTS} event_t;
+
+    typedef struct {
+      uint8_t  event;
+      uint8_t  payload;
+      uint16_t delta;     ///< Time since the previous record, in milliseconds
+    } record_t;
+
+    static const uint8_t MAGIC       = 0x54;
+    static const uint8_t HEADER_SIZE = 2;
+    static const uint8_t RECORD_SIZE = 4;
+
+    /** Function called for each byte of the image by save() */
+    typedef void (*writer_t)(uint8_t  offset,    ///< Offset in the image
+			     uint8_t  data,
+			     void    *context);
+
+    /** Function called for each record of an image by decode() */
+    typedef void (*reader_t)(unsigned long  time,      ///< Time since the first record, in milliseconds
+			     uint8_t        event,
+			     uint8_t        payload,
+			     void          *context);
+
+#ifndef __AVR__
+    /** Decode a trace image. GAP records are folded into the time of the next record.
+     *  Returns the number of records, or -1 if the image is invalid.
+     */
+    static int decode(const uint8_t *image,
+		      uint16_t       size,
+		      reader_t       reader,
+		      void          *context = 0);
+
+    /** Name of an event */
+    static const char *name(uint8_t event);
+
+    /** Print the timeline in a trace image. Returns the number of records, or -1 if the image is invalid. */
+    static int print(const uint8_t *image,
+		     uint16_t       size);
+#endif
+
+#ifdef TRACE
+    /** Clear the trace & mark every record EMPTY */
+    static void init();
+
+    /** Record an event. Safe to call from an interrupt service routine. */
+    static void record(event_t event,
+		       uint8_t payload = 0)
+    {
+#ifdef __AVR__
+      uint8_t sreg = SREG;
+      cli();
+#endif
+      unsigned long now   = millis();
+      unsigned long delta = now - s_last;
+      s_last = now;
+      if (delta >> 16) put(GAP, 0, delta >> 16);
+      put(event, payload, delta);
+#ifdef __AVR__
+      SREG = sreg;
+#endif
+    }
+
+    /** Save the newest records that fit in an image of the specified size.
+     *  Returns the number of bytes written.
+     */
+    static uint8_t save(writer_t  writer,
+			void     *context,
+			uint8_t   size);
+
+  private:
+    static void put(uint8_t  event,
+		    uint8_t  payload,
+		    uint16_t delta)
+    {
+      record_t &r = s_records[s_next++ & (TRACE_RECORDS - 1)];
+      r.event   = event;
+      r.payload = payload;
+      r.delta   = delta;
+    }
+
+    static record_t      s_records[TRACE_RECORDS];
+    static uint8_t       s_next;       ///< Index of the next record (wraps around)
+    static unsigned long s_last;       ///< Time of the last record
+#endif
+  };
+
+}
+
+#ifdef TRACE
+#define TRACE_EVENT(event, payload) PowerMinder::Trace_t::record(PowerMinder::Trace_t::event, payload)
+#else
+#define TRACE_EVENT(event, payload)
+#endif
+
+#endif
@@ -108,6 +108,7 @@
 
 #include <Arduino.h>
 #include "rtc.h"
+#include "Profile.h"
 
 // --------------------------------------------------------
 // DS1302_clock_burst_read
@@ -120,6 +121,7 @@
 //
 void DS1302_clock_burst_read( uint8_t *p)
 {
+    PROFILE_SCOPE(RTC_IO);
     int i;
     
     _DS1302_start();
@@ -148,6 +150,7 @@ void DS1302_clock_burst_read( uint8_t *p)
 //
 void DS1302_clock_burst_write( uint8_t *p)
 {
+    PROFILE_SCOPE(RTC_IO);
     int i;
     
     _DS1302_start();
@@ -180,6 +183,7 @@ void DS1302_clock_burst_write( uint8_t *p)
 //
 uint8_t DS1302_read(int address)
 {
+    PROFILE_SCOPE(RTC_IO);
     uint8_t data;
     
     // set lowest bit (read bit) in address
@@ -208,6 +212,7 @@ uint8_t DS1302_read(int address)
 //
 void DS1302_write( int address, uint8_t data)
 {
+    PROFILE_SCOPE(RTC_IO);
     // clear lowest bit (read bit) in address
     bitClear( address, DS1302_READBIT);
     
@@ -234,15 +239,22 @@ void DS1302_write( int address, uint8_t data)
 void _DS1302_start( void)
 {
     digitalWrite( DS1302_CE_PIN, LOW); // default, not enabled
+    PROFILE_WRITE();
     pinMode( DS1302_CE_PIN, OUTPUT);
+    PROFILE_WRITE();
     
     digitalWrite( DS1302_SCLK_PIN, LOW); // default, clock low
+    PROFILE_WRITE();
     pinMode( DS1302_SCLK_PIN, OUTPUT);
+    PROFILE_WRITE();
     
     pinMode( DS1302_IO_PIN, OUTPUT);
+    PROFILE_WRITE();
     
     digitalWrite( DS1302_CE_PIN, HIGH); // start the session
+    PROFILE_WRITE();
     delayMicroseconds( 4);           // tCC = 4us
+    PROFILE_DELAY(4);
 }
 
 
@@ -255,8 +267,10 @@ void _DS1302_stop(void)
 {
     // Set CE low
     digitalWrite( DS1302_CE_PIN, LOW);
+    PROFILE_WRITE();
     
     delayMicroseconds( 4);           // tCWH = 4us
+    PROFILE_DELAY(4);
 }
 
 
@@ -278,14 +292,19 @@ uint8_t _DS1302_toggleread( void)
         // If the 'togglewrite' function was used before
         // this function, the SCLK is already high.
         digitalWrite( DS1302_SCLK_PIN, HIGH);
+        PROFILE_WRITE();
         delayMicroseconds( 1);
+        PROFILE_DELAY(1);
         
         // Clock down, data is ready after some time.
         digitalWrite( DS1302_SCLK_PIN, LOW);
+        PROFILE_WRITE();
         delayMicroseconds( 1);        // tCL=1000ns, tCDD=800ns
+        PROFILE_DELAY(1);
         
         // read bit, and set it in place in 'data' variable
         bitWrite( data, i, digitalRead( DS1302_IO_PIN));
+        PROFILE_READ();
     }
     return( data);
 }
@@ -307,11 +326,15 @@ void _DS1302_togglewrite( uint8_t data, uint8_t release)
     {
         // set a bit of the data on the I/O-line
         digitalWrite( DS1302_IO_PIN, bitRead(data, i));
+        PROFILE_WRITE();
         delayMicroseconds( 1);     // tDC = 200ns
+        PROFILE_DELAY(1);
         
         // clock up, data is read by DS1302
         digitalWrite( DS1302_SCLK_PIN, HIGH);
+        PROFILE_WRITE();
         delayMicroseconds( 1);     // tCH = 1000ns, tCDH = 800ns
+        PROFILE_DELAY(1);
         
         if( release && i == 7)
         {
@@ -324,6 +347,7 @@ void _DS1302_togglewrite( uint8_t data, uint8_t release)
             // and that could cause a shortcut spike
             // on the I/O-line.
             pinMode( DS1302_IO_PIN, INPUT);
+            PROFILE_WRITE();
             
             // For Arduino 1.0.3, removing the pull-up is no longer needed.
             // Setting the pin as 'INPUT' will already remove the pull-up.
@@ -332,7 +356,9 @@ void _DS1302_togglewrite( uint8_t data, uint8_t release)
         else
         {
             digitalWrite( DS1302_SCLK_PIN, LOW);
+            PROFILE_WRITE();
             delayMicroseconds( 1);       // tCL=1000ns, tCDD=800ns
+            PROFILE_DELAY(1);
         }
     }
 }
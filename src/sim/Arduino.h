@@ -0,0 +1,82 @@
+//------------------------------------------------------------------------------
+//   Copyright 2014 Janick Bergeron
+//   All Rights Reserved Worldwide
+//
+//   Licensed under the Apache License, Version 2.0 (the
+//   "License"); you may not use this file except in
+//   compliance with the License.  You may obtain a copy of
+//   the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in
+//   writing, software distributed under the License is
+//   distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+//   CONDITIONS OF ANY KIND, either express or implied.  See
+//   the License for the specific language governing
+//   permissions and limitations under the License.
+//------------------------------------------------------------------------------
+
+
+
+// Stand-in for the Arduino core, for the host simulator
+
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "Simulator.h"
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT        0x0
+#define OUTPUT       0x1
+#define INPUT_PULLUP 0x2
+
+typedef bool    boolean;
+typedef uint8_t byte;
+
+#define bitRead(value, bit)            (((value) >> (bit)) & 0x01)
+#define bitSet(value, bit)             ((value) |= (1UL << (bit)))
+#define bitClear(value, bit)           ((value) &= ~(1UL << (bit)))
+#define bitWrite(value, bit, bitvalue) (bitvalue ? bitSet(value, bit) : bitClear(value, bit))
+
+void pinMode(uint8_t pin,
+	     uint8_t mode);
+
+void digitalWrite(uint8_t pin,
+		  uint8_t value);
+
+int digitalRead(uint8_t pin);
+
+int analogRead(uint8_t pin);
+
+/** Milliseconds added by the sketch for the time Timer0 was stopped, as to the core's counter */
+extern "C" volatile unsigned long timer0_millis;
+
+inline unsigned long micros()
+{
+  return Sim::timer0() + timer0_millis * 1000;
+}
+
+/** Wraps around after 49.7 days, as on the ATtiny85 */
+inline unsigned long millis()
+{
+  return (uint32_t) (Sim::timer0() / 1000 + timer0_millis);
+}
+
+inline void delay(unsigned long ms)
+{
+  Sim::advance(ms * 1000);
+}
+
+inline void delayMicroseconds(unsigned int us)
+{
+  Sim::advance(us);
+}
+
+#endif
@@ -0,0 +1,467 @@
+//------------------------------------------------------------------------------
+//   Copyright 2014 Janick Bergeron
+//   All Rights Reserved Worldwide
+//
+//   Licensed under the Apache License, Version 2.0 (the
+//   "License"); you may not use this file except in
+//   compliance with the License.  You may obtain a copy of
+//   the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in
+//   writing, software distributed under the License is
+//   distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+//   CONDITIONS OF ANY KIND, either express or implied.  See
+//   the License for the specific language governing
+//   permissions and limitations under the License.
+//------------------------------------------------------------------------------
+
+
+
+// Compares the annual cost of candidate tariffs over a year of interval data.
+//
+// Tariffs use the same Calendar code & schedule format as the firmware.
+// A tariff file contains one or more tariffs:
+//
+//     name  E-6 summer                 Starts a new tariff
+//     price 12.1 18.5 31.7             Cents per kWh: off-peak, partial-peak, on-peak.
+//                                      Default is the prices in the image, if any.
+//     image 50 54 01 01 26 00 ...      Tariff image (TariffImage_t), as written by tariff-compile -o
+//                                      and loaded over the optical link, in hex (e.g. xxd -p).
+//                                      May span several lines. Default is the PG&E calendar.
+//
+// Interval data is one energy value per line, in Wh per 15-min interval,
+// starting at midnight on the date specified with -c.
+//
+// Each tariff is expanded into the period of every 30-min slot of the year
+// in one batch by Calendar::findPeriods(), which leaves the Calendar untouched.
+// The cost of every interval is then summed in fixed point.
+// The tariffs are evaluated in parallel, one per thread at a time,
+// each thread with its own Calendar & period buffers.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+#include "Calendar.h"
+#include "Tariff.h"
+
+using namespace PowerMinder;
+
+
+/** Prices are in 1/100th of a cent per kWh */
+static const uint32_t PRICE_UNIT = 100;
+
+/** Number of 15-min intervals in a 30-min slot */
+static const uint8_t INTERVALS_PER_SLOT = 2;
+
+
+struct tariff_s {
+  std::string          name;
+  uint32_t             price[3];   ///< Per period, in PRICE_UNIT per kWh
+  bool                 priced;     ///< Prices were specified, instead of those in the image
+  std::vector<uint8_t> image;      ///< Empty == PG&E defaults
+  uint64_t             cost;       ///< Annual cost, in Wh x PRICE_UNIT per kWh
+  bool                 ok;
+};
+
+
+static double
+wall_seconds()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+/** Date & time of every 30-min slot, in structure-of-arrays form for Calendar::findPeriods() */
+struct slots_s {
+  std::vector<uint8_t> month;
+  std::vector<uint8_t> day;
+  std::vector<uint8_t> dayOfWeek;
+  std::vector<uint8_t> hour;
+  std::vector<uint8_t> min;
+};
+
+
+/** Period buffers of a thread */
+struct periods_s {
+  std::vector<period_t> cost;         ///< Cost period of every 30-min slot
+  std::vector<period_t> next;
+  std::vector<uint16_t> timeToNext;
+};
+
+
+/** Expand a tariff into the cost period of each 30-min slot.
+ *  Calendar::findPeriods() does not change the Calendar, nor any global state,
+ *  and reuses the period found until the next period change.
+ */
+static bool
+expand(const tariff_s   &tariff,
+       const slots_s    &slots,
+       periods_s        &periods)
+{
+  Calendar calendar;
+  calendar.init();
+  if (!tariff.image.empty() && !calendar.useImage(tariff.image.data(), tariff.image.size())) return false;
+
+  calendar.findPeriods(periods.cost.size(), slots.month.data(), slots.day.data(), slots.dayOfWeek.data(),
+		       slots.hour.data(), slots.min.data(),
+		       periods.cost.data(), periods.next.data(), periods.timeToNext.data());
+  return true;
+}
+
+
+/** Annual cost of a tariff, in Wh x PRICE_UNIT per kWh */
+static uint64_t
+cost(const tariff_s              &tariff,
+     const std::vector<period_t> &periods,
+     const std::vector<uint32_t> &energy,
+     std::vector<uint32_t>       &prices)
+{
+  // Per-interval price vector
+  size_t n = energy.size();
+  for (size_t i = 0; i < n; i++) {
+    prices[i] = tariff.price[periods[i / INTERVALS_PER_SLOT]];
+  }
+
+  // Integer sums are exact and associative, so this loop vectorizes
+  uint64_t total = 0;
+  const uint32_t *e = energy.data();
+  const uint32_t *p = prices.data();
+  for (size_t i = 0; i < n; i++) {
+    total += (uint64_t) e[i] * p[i];
+  }
+
+  return total;
+}
+
+
+/** Evaluate the tariffs in parallel */
+static void
+evaluate(std::vector<tariff_s>       &tariffs,
+	 const slots_s               &slots,
+	 const std::vector<uint32_t> &energy,
+	 unsigned                     threads)
+{
+  std::atomic<size_t>      next(0);
+  std::vector<std::thread> workers;
+
+  for (unsigned t = 0; t < threads; t++) {
+    workers.push_back(std::thread([&]() {
+	  periods_s periods;
+	  periods.cost.resize(slots.month.size());
+	  periods.next.resize(slots.month.size());
+	  periods.timeToNext.resize(slots.month.size());
+	  std::vector<uint32_t> prices(energy.size());
+
+	  size_t i;
+	  while ((i = next++) < tariffs.size()) {
+	    tariff_s &tariff = tariffs[i];
+	    tariff.ok   = expand(tariff, slots, periods);
+	    tariff.cost = (tariff.ok) ? cost(tariff, periods.cost, energy, prices) : 0;
+	  }
+	}));
+  }
+  for (unsigned t = 0; t < threads; t++) workers[t].join();
+}
+
+
+/** Read tariffs from a file. Returns FALSE on error */
+static bool
+read_tariffs(const char            *fname,
+	     std::vector<tariff_s> &tariffs)
+{
+  FILE *fp = fopen(fname, "r");
+  if (fp == 0) {
+    perror(fname);
+    return false;
+  }
+
+  char     line[1024];
+  int      lineno = 0;
+  bool     ok     = true;
+  tariff_s *tariff = 0;
+  while (ok && fgets(line, sizeof(line), fp)) {
+    lineno++;
+
+    char *p = line;
+    while (*p == ' ' || *p == '\t') p++;
+    if (*p == '#' || *p == '\n' || *p == '\0') continue;
+    char *eol = p + strcspn(p, "#\r\n");
+    *eol = '\0';
+
+    char keyword[8];
+    int  len;
+    if (sscanf(p, "%7s%n", keyword, &len) != 1) continue;
+    p += len;
+
+    if (strcmp(keyword, "name") == 0) {
+      tariffs.push_back(tariff_s());
+      tariff = &tariffs.back();
+      while (*p == ' ' || *p == '\t') p++;
+      tariff->name = p;
+      tariff->price[0] = tariff->price[1] = tariff->price[2] = 0;
+      tariff->priced = false;
+      continue;
+    }
+    if (tariff == 0) {
+      fprintf(stderr, "%s:%d: Expected a tariff name\n", fname, lineno);
+      ok = false;
+      break;
+    }
+
+    if (strcmp(keyword, "price") == 0) {
+      double cents[3];
+      if (sscanf(p, "%lf %lf %lf", &cents[0], &cents[1], &cents[2]) != 3) {
+	fprintf(stderr, "%s:%d: Expected 3 prices\n", fname, lineno);
+	ok = false;
+      }
+      for (int i = 0; i < 3; i++) tariff->price[i] = cents[i] * PRICE_UNIT + 0.5;
+      tariff->priced = true;
+    }
+    else if (strcmp(keyword, "image") == 0) {
+      unsigned byte;
+      while (sscanf(p, "%x%n", &byte, &len) == 1) {
+	if (byte > 0xFF || tariff->image.size() == 0xFFFF) {
+	  fprintf(stderr, "%s:%d: Invalid tariff image\n", fname, lineno);
+	  ok = false;
+	  break;
+	}
+	tariff->image.push_back(byte);
+	p += len;
+      }
+    }
+    else {
+      fprintf(stderr, "%s:%d: Unknown keyword \"%s\"\n", fname, lineno, keyword);
+      ok = false;
+    }
+  }
+  fclose(fp);
+
+  return ok;
+}
+
+
+/** Use the prices in the images of the tariffs without any specified */
+static void
+image_prices(std::vector<tariff_s> &tariffs)
+{
+  for (size_t i = 0; i < tariffs.size(); i++) {
+    TariffImage_t image;
+    if (tariffs[i].priced || tariffs[i].image.empty()) continue;
+    if (!image.open(tariffs[i].image.data(), tariffs[i].image.size())) continue;
+    for (uint8_t p = 0; p < 3; p++) tariffs[i].price[p] = image.price(p) * PRICE_UNIT / 100;
+  }
+}
+
+
+/** Generate random time-of-use tariffs around the shape of the PG&E one */
+static void
+generate_tariffs(unsigned               count,
+		 std::vector<tariff_s> &tariffs)
+{
+  for (unsigned i = 0; i < count; i++) {
+    tariff_s tariff;
+    char name[32];
+    snprintf(name, sizeof(name), "Random #%u", i);
+    tariff.name = name;
+
+    // Priced images, in 1/100th of a cent per kWh
+    TariffImage_t::tariff_t t;
+    memset(&t, 0, sizeof(t));
+    t.priced = true;
+    t.price[OFF_PEAK]     = 800 + rand() % 700;
+    t.price[PARTIAL_PEAK] = t.price[OFF_PEAK] + 300 + rand() % 700;
+    t.price[ON_PEAK]      = t.price[PARTIAL_PEAK] + 500 + rand() % 2000;
+    tariff.priced = false;
+
+    // Weekdays: partial-peak, on-peak, partial-peak and off-peak again
+    uint8_t t1 = 10 + rand() % 8;
+    uint8_t t2 = t1 + 2 + rand() % 12;
+    uint8_t t3 = t2 + 4 + rand() % 10;
+    uint8_t t4 = t3 + 1 + rand() % 4;
+    // Weekends: on-peak for a few hours
+    uint8_t w1 = 24 + rand() % 10;
+    uint8_t w2 = w1 + 2 + rand() % 8;
+    uint8_t weekday[] = {0 | (OFF_PEAK << 6), (uint8_t) (t1 | (PARTIAL_PEAK << 6)), (uint8_t) (t2 | (ON_PEAK << 6)),
+			 (uint8_t) (t3 | (PARTIAL_PEAK << 6)), (uint8_t) (t4 | (OFF_PEAK << 6))};
+    uint8_t weekend[] = {0 | (OFF_PEAK << 6), (uint8_t) (w1 | (ON_PEAK << 6)), (uint8_t) (w2 | (OFF_PEAK << 6))};
+    t.schedules = 2;
+    t.schedule[0].changes = sizeof(weekday);
+    memcpy(t.schedule[0].change, weekday, sizeof(weekday));
+    t.schedule[1].changes = sizeof(weekend);
+    memcpy(t.schedule[1].change, weekend, sizeof(weekend));
+    t.seasons = 2;
+    t.season[0].month   = 5;
+    t.season[0].day     = 1;
+    t.season[0].weekend = 1;
+    t.season[1].month   = 11;
+    t.season[1].day     = 1;
+    t.season[1].weekend = 1;
+
+    uint8_t image[64];
+    tariff.image.assign(image, image + TariffImage_t::encode(t, image, sizeof(image)));
+
+    tariffs.push_back(tariff);
+  }
+}
+
+
+/** Read interval data. Returns FALSE on error */
+static bool
+read_energy(const char            *fname,
+	    std::vector<uint32_t> &energy)
+{
+  FILE *fp = fopen(fname, "r");
+  if (fp == 0) {
+    perror(fname);
+    return false;
+  }
+
+  char line[64];
+  int  lineno = 0;
+  while (fgets(line, sizeof(line), fp)) {
+    lineno++;
+    char *end;
+    unsigned long wh = strtoul(line, &end, 10);
+    if (end == line) {
+      fprintf(stderr, "%s:%d: Expected an energy value, in Wh\n", fname, lineno);
+      fclose(fp);
+      return false;
+    }
+    energy.push_back(wh);
+  }
+  fclose(fp);
+
+  return true;
+}
+
+
+/** Generate a year of interval data with the same daily profile as the simulator:
+ *  500W, +500W from 7 to 9 and +1500W from 17 to 22, plus some noise
+ */
+static void
+generate_energy(std::vector<uint32_t> &energy)
+{
+  for (size_t i = 0; i < 365 * 96; i++) {
+    uint8_t hour = (i % 96) / 4;
+    uint32_t watts = 500;
+    if (hour >= 7 && hour < 9)   watts += 500;
+    if (hour >= 17 && hour < 22) watts += 1500;
+    watts += rand() % 200;
+    energy.push_back(watts / 4);
+  }
+}
+
+
+static void
+usage(const char *argv0)
+{
+  fprintf(stderr, "Usage: %s [-c YYYY-MM-DD] [-j threads] [-n top] [-g random_tariffs] (intervals.txt | -y) [tariffs.txt...]\n", argv0);
+  exit(1);
+}
+
+
+int
+main(int    argc,
+     char **argv)
+{
+  const char *start     = "2014-01-01";
+  unsigned    threads   = std::thread::hardware_concurrency();
+  unsigned    top       = 10;
+  unsigned    random    = 0;
+  bool        synthetic = false;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "c:j:n:g:y")) != -1) {
+    switch (opt) {
+    case 'c': start = optarg; break;
+    case 'j': threads = atoi(optarg); break;
+    case 'n': top = atoi(optarg); break;
+    case 'g': random = atoi(optarg); break;
+    case 'y': synthetic = true; break;
+    default:  usage(argv[0]);
+    }
+  }
+  if (threads == 0) threads = 1;
+
+  std::vector<uint32_t> energy;
+  if (synthetic) generate_energy(energy);
+  else {
+    if (optind == argc) usage(argv[0]);
+    if (!read_energy(argv[optind++], energy)) return 1;
+  }
+  if (energy.empty()) {
+    fprintf(stderr, "No interval data\n");
+    return 1;
+  }
+
+  std::vector<tariff_s> tariffs;
+  for (int i = optind; i < argc; i++) {
+    if (!read_tariffs(argv[i], tariffs)) return 1;
+  }
+  generate_tariffs(random, tariffs);
+  image_prices(tariffs);
+  if (tariffs.empty()) usage(argv[0]);
+
+  // Date & time of every 30-min slot covered by the interval data
+  struct tm tm;
+  memset(&tm, 0, sizeof(tm));
+  if (sscanf(start, "%d-%d-%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday) != 3) usage(argv[0]);
+  tm.tm_year -= 1900;
+  tm.tm_mon  -= 1;
+  time_t midnight = timegm(&tm);
+  size_t n = (energy.size() + INTERVALS_PER_SLOT - 1) / INTERVALS_PER_SLOT;
+  slots_s slots;
+  slots.month.resize(n);
+  slots.day.resize(n);
+  slots.dayOfWeek.resize(n);
+  slots.hour.resize(n);
+  slots.min.resize(n);
+  for (size_t i = 0; i < n; i++) {
+    time_t t = midnight + i * 1800;
+    gmtime_r(&t, &tm);
+    slots.month[i]     = tm.tm_mon + 1;
+    slots.day[i]       = tm.tm_mday;
+    slots.dayOfWeek[i] = tm.tm_wday + 1;
+    slots.hour[i]      = tm.tm_hour;
+    slots.min[i]       = tm.tm_min;
+  }
+
+  double begin = wall_seconds();
+  evaluate(tariffs, slots, energy, threads);
+  double elapsed = wall_seconds() - begin;
+
+  uint64_t total = 0;
+  for (size_t i = 0; i < energy.size(); i++) total += energy[i];
+
+  std::vector<const tariff_s *> ranked;
+  for (size_t i = 0; i < tariffs.size(); i++) {
+    if (tariffs[i].ok) ranked.push_back(&tariffs[i]);
+    else fprintf(stderr, "%s: Invalid tariff image\n", tariffs[i].name.c_str());
+  }
+  std::sort(ranked.begin(), ranked.end(),
+	    [](const tariff_s *a, const tariff_s *b) {return a->cost < b->cost;});
+
+  printf("%lu intervals from %s, %.1f kWh\n", (unsigned long) energy.size(), start, total / 1000.0);
+  printf("%-24s %12s %10s\n", "Tariff", "Annual cost", "Average");
+  for (size_t i = 0; i < ranked.size() && i < top; i++) {
+    double dollars = ranked[i]->cost / (1000.0 * PRICE_UNIT * 100);
+    printf("%-24s %12.2f %7.2f c/kWh\n", ranked[i]->name.c_str(), dollars,
+	   (total) ? dollars * 100 * 1000 / total : 0.0);
+  }
+  printf("%lu tariffs x %lu intervals in %.1f ms on %u threads\n",
+	 (unsigned long) tariffs.size(), (unsigned long) energy.size(), elapsed * 1000, threads);
+
+  return (ranked.size() == tariffs.size()) ? 0 : 1;
+}
@@ -0,0 +1,551 @@
+//------------------------------------------------------------------------------
+//   Copyright 2014 Janick Bergeron
+//   All Rights Reserved Worldwide
+//
+//   Licensed under the Apache License, Version 2.0 (the
+//   "License"); you may not use this file except in
+//   compliance with the License.  You may obtain a copy of
+//   the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in
+//   writing, software distributed under the License is
+//   distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+//   CONDITIONS OF ANY KIND, either express or implied.  See
+//   the License for the specific language governing
+//   permissions and limitations under the License.
+//------------------------------------------------------------------------------
+
+
+
+// Simulates a fleet of PowerMinder devices, to study their aggregate behavior:
+// tariff transitions hitting many devices at once, RTC drift and the volume
+// of interval log data to export.
+//
+// Every device has its own copy of the firmware state (light sensor, pulse
+// detector, sampling governor, demand tracker, energy rollups & cost period),
+// its own meter & load, and its own drifting RTC. The calendar is shared:
+// Calendar::findPeriods() does not change it. Devices are stepped
+// one minute of virtual time at a time, in chunks, on a work-stealing
+// thread pool. All devices use the same tariff.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+#include "LightSensor.h"
+#include "PulseDetector.h"
+#include "SampleGovernor.h"
+#include "Calendar.h"
+#include "DemandTracker.h"
+#include "EnergyRollup.h"
+#include "IntervalLog.h"
+
+using namespace PowerMinder;
+
+
+/** Virtual time step between synchronizations of the fleet, in microseconds */
+static const uint64_t EPOCH = 60000000;
+
+/** Number of devices in a unit of work */
+static const uint32_t CHUNK = 32;
+
+
+
+static double
+wall_seconds()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+/** Date of each day of the simulation */
+struct day_s {
+  uint8_t month;       ///< 1-12
+  uint8_t day;         ///< 1-31
+  uint8_t dayOfWeek;   ///< 1-7 (1 == Sunday)
+};
+
+static std::vector<day_s> days;
+
+/** Calendar of the tariff, shared by all the devices */
+static Calendar calendar;
+
+
+/** Statistics, per worker thread then for the fleet */
+struct stats_s {
+  uint64_t samples;
+  uint64_t metered;        ///< Pulses flashed by the meters
+  uint64_t detected;       ///< Pulses detected by the devices
+  uint64_t transitions;    ///< Tariff period changes
+  uint64_t log_bytes;      ///< Interval log bytes written, including page headers
+  uint64_t log_pages;
+  uint64_t demand;         ///< Sum of the final 15-min demand of the devices
+  uint16_t max_demand;
+  int64_t  max_skew;       ///< Largest RTC error, in milliseconds
+  std::vector<uint32_t> switching;   ///< Devices changing tariff period, per minute of true time
+
+  void merge(const stats_s &other)
+  {
+    samples     += other.samples;
+    metered     += other.metered;
+    detected    += other.detected;
+    transitions += other.transitions;
+    log_bytes   += other.log_bytes;
+    log_pages   += other.log_pages;
+    demand      += other.demand;
+    if (other.max_demand > max_demand) max_demand = other.max_demand;
+    if (other.max_skew > max_skew) max_skew = other.max_skew;
+    if (other.switching.size() > switching.size()) switching.resize(other.switching.size());
+    for (size_t i = 0; i < other.switching.size(); i++) switching[i] += other.switching[i];
+  }
+};
+
+
+/** A virtual PowerMinder, its meter and its RTC */
+class Device_t {
+
+public:
+  Device_t(uint32_t seed)
+    : m_light(3), m_rng(seed | 1), m_skew(0), m_ppm(0), m_nextSample(0), m_nextMinute(0), m_rtcMinute(0),
+      m_minute(0), m_period(OFF_PEAK), m_periodFrom(0), m_periodTo(0), m_pulseStart(0), m_width(0), m_metered(0), m_watts(0), m_ambient(0), m_intervalPulses(0),
+      m_logOpen(false), m_logOffset(0), m_logLast(0)
+  {
+  }
+
+  void init()
+  {
+    m_light.init();
+    m_pulses = PulseDetector_t(LightSensor_t::PULSE_THRESHOLD);
+    m_governor.init();
+    m_demand.init();
+    m_energy.init();
+
+    // RTCs are set within a few seconds & drift by up to +/-50ppm
+    m_skew       = (int32_t) (m_random() % 10000) - 5000;
+    m_ppm        = (int32_t) (m_random() % 101) - 50;
+    m_watts      = 200 + m_random() % 1500;
+    m_ambient    = 400 + m_random() % 300;
+    m_width      = (20 + m_random() % 21) * 1000;
+    m_pulseStart = (uint64_t) (m_random() % 3600) * 1000;
+    m_nextSample = 0;
+    m_minute     = 0;
+    m_period     = OFF_PEAK;
+    m_periodFrom = 0;
+    m_periodTo   = 0;
+    m_rtcMinute  = (m_skew > 0) ? 1 : 0;
+    m_nextMinute = m_trueTime(m_rtcMinute * 60000LL);
+  }
+
+  /** Run until the specified time, in microseconds */
+  void run(uint64_t  until,
+	   stats_s  &stats)
+  {
+    while (1) {
+      if (m_nextMinute <= m_nextSample) {
+	if (m_nextMinute >= until) break;
+	m_everyMinute(stats);
+	continue;
+      }
+      if (m_nextSample >= until) break;
+      m_sample(stats);
+    }
+
+    int64_t skew = m_rtc(until) - (int64_t) (until / 1000);
+    if (skew < 0) skew = -skew;
+    if (skew > stats.max_skew) stats.max_skew = skew;
+  }
+
+  /** Final statistics */
+  void report(stats_s &stats)
+  {
+    uint16_t demand = m_demand.demand();
+    stats.demand += demand;
+    if (demand > stats.max_demand) stats.max_demand = demand;
+  }
+
+private:
+  uint32_t m_random()
+  {
+    m_rng ^= m_rng << 13;
+    m_rng ^= m_rng >> 17;
+    m_rng ^= m_rng << 5;
+    return m_rng;
+  }
+
+  /** RTC time at a true time, in milliseconds */
+  int64_t m_rtc(uint64_t now)
+  {
+    return (int64_t) (now / 1000) + m_skew + (int64_t) (now / 1000) * m_ppm / 1000000;
+  }
+
+  /** True time at which the RTC shows the specified time, in microseconds */
+  uint64_t m_trueTime(int64_t rtc)
+  {
+    return (uint64_t) ((rtc - m_skew) * 1000000000LL / (1000000 + m_ppm));
+  }
+
+  /** Load at a true time: the simulator's daily profile on top of a base load */
+  uint32_t m_load(uint64_t now)
+  {
+    uint32_t hour  = (now / 3600000000ULL) % 24;
+    uint32_t watts = m_watts;
+    if (hour >= 7 && hour < 9)   watts += 500;
+    if (hour >= 17 && hour < 22) watts += 1500;
+    return watts;
+  }
+
+  /** Light sensor reading at a true time */
+  uint16_t m_brightness(uint64_t now)
+  {
+    // Next meter pulse, at 1 Wh/pulse
+    while (now >= m_pulseStart + m_width) {
+      m_pulseStart += 3600000000ULL / m_load(m_pulseStart);
+      m_metered++;
+    }
+    uint16_t value = m_ambient + m_random() % 9;
+    if (now >= m_pulseStart) value += 200;
+    return value;
+  }
+
+  /** Same as sample_light() in the sketch */
+  void m_sample(stats_s &stats)
+  {
+    uint64_t      now   = m_nextSample;
+    unsigned long ms    = now / 1000;
+    uint16_t      value = m_brightness(now);
+    stats.samples++;
+
+    m_light.update(value);
+    if (m_light.is_calibrated()) {
+      if (m_pulses.update(value, m_light.baseline(), ms)) {
+	m_demand.pulse();
+	m_energy.pulse();
+	m_intervalPulses++;
+	stats.detected++;
+      }
+      m_governor.update(m_pulses, ms);
+    }
+    m_nextSample += m_governor.period() * 1000ULL;
+
+    stats.metered += m_metered;
+    m_metered = 0;
+  }
+
+  /** Same as every_minute() in the sketch, at the start of every RTC minute */
+  void m_everyMinute(stats_s &stats)
+  {
+    uint64_t now     = m_nextMinute;
+    uint32_t rtc     = m_rtcMinute++;
+    uint32_t dayIdx  = rtc / 1440;
+    uint8_t  hour    = (rtc / 60) % 24;
+    uint8_t  min     = rtc % 60;
+    m_nextMinute     = m_trueTime(m_rtcMinute * 60000LL);
+    if (dayIdx >= days.size()) dayIdx = days.size() - 1;
+    const day_s &day = days[dayIdx];
+
+    period_t period = m_period;
+    m_demand.tick(period);
+    m_energy.advance(day.month, day.day, hour, period);
+
+    if (min % 15 == 0) {
+      m_log(stats);
+      m_intervalPulses = 0;
+    }
+
+    // Only look up the cost period when the current one is over
+    if (rtc < m_periodFrom || rtc >= m_periodTo) {
+      period_t next;
+      uint16_t time;
+      calendar.findPeriods(1, &day.month, &day.day, &day.dayOfWeek, &hour, &min, &m_period, &next, &time);
+      m_periodFrom = rtc;
+      m_periodTo   = rtc - min % 30 + time;
+    }
+    if (m_minute++ > 0 && m_period != period) {
+      stats.transitions++;
+      size_t minute = now / 60000000;
+      if (minute >= stats.switching.size()) stats.switching.resize(minute + 1);
+      stats.switching[minute]++;
+    }
+  }
+
+  /** Count the bytes the interval would take in the IntervalLog_t */
+  void m_log(stats_s &stats)
+  {
+    uint8_t record[4];
+    uint8_t n = IntervalLog_t::encode(0, (int32_t) m_intervalPulses - m_logLast, record);
+    if (!m_logOpen || m_logOffset + n > IntervalLog_t::PAGE_SIZE) {
+      m_logOpen   = true;
+      m_logOffset = IntervalLog_t::HEADER_SIZE;
+      n = IntervalLog_t::encode(0, m_intervalPulses, record);
+      stats.log_pages++;
+      stats.log_bytes += IntervalLog_t::HEADER_SIZE;
+    }
+    m_logOffset += n;
+    stats.log_bytes += n;
+    m_logLast    = m_intervalPulses;
+  }
+
+  // Firmware state
+  LightSensor_t    m_light;
+  PulseDetector_t  m_pulses;
+  SampleGovernor_t m_governor;
+  DemandTracker_t  m_demand;
+  EnergyRollup_t   m_energy;
+
+  // Environment
+  uint32_t m_rng;
+  int32_t  m_skew;             ///< RTC error at time 0, in milliseconds
+  int32_t  m_ppm;              ///< RTC drift
+  uint64_t m_nextSample;       ///< True time of the next sample, in microseconds
+  uint64_t m_nextMinute;       ///< True time of the next RTC minute, in microseconds
+  uint32_t m_rtcMinute;        ///< Next RTC minute, since the start of day #0
+  uint32_t m_minute;           ///< Number of minutes processed
+  period_t m_period;           ///< Current cost period, valid for RTC minutes [from, to)
+  uint32_t m_periodFrom;
+  uint32_t m_periodTo;
+  uint64_t m_pulseStart;       ///< True time of the current or next meter pulse, in microseconds
+  uint32_t m_width;            ///< Width of the meter pulses, in microseconds
+  uint32_t m_metered;
+  uint32_t m_watts;            ///< Base load
+  uint16_t m_ambient;
+  uint16_t m_intervalPulses;
+  bool     m_logOpen;
+  uint8_t  m_logOffset;
+  uint16_t m_logLast;
+};
+
+
+/** A thread pool running units of work indexed 0..N-1.
+ *  Each worker starts with a contiguous range of units in its own deque
+ *  and pops from its back; when it runs out, it steals from the front
+ *  of the other workers' deques.
+ */
+class Pool_t {
+
+public:
+  typedef std::function<void (uint32_t unit, unsigned worker)> work_t;
+
+  Pool_t(unsigned threads)
+    : m_queues(threads), m_generation(0), m_busy(0), m_stop(false)
+  {
+    for (unsigned i = 0; i < threads; i++) m_threads.push_back(std::thread(&Pool_t::m_worker, this, i));
+  }
+
+  ~Pool_t()
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_lock);
+      m_stop = true;
+    }
+    m_start.notify_all();
+    for (size_t i = 0; i < m_threads.size(); i++) m_threads[i].join();
+  }
+
+  /** Run all the units of work. Returns when they are all done. */
+  void run(uint32_t      units,
+	   const work_t &work)
+  {
+    unsigned n = m_queues.size();
+    for (unsigned i = 0; i < n; i++) {
+      std::lock_guard<std::mutex> lock(m_queues[i].lock);
+      for (uint32_t u = units * i / n; u < units * (i + 1) / n; u++) m_queues[i].units.push_back(u);
+    }
+
+    std::unique_lock<std::mutex> lock(m_lock);
+    m_work = &work;
+    m_busy = n;
+    m_generation++;
+    m_start.notify_all();
+    m_done.wait(lock, [this]() {return m_busy == 0;});
+  }
+
+  /** Number of units stolen so far */
+  uint64_t steals()
+  {
+    uint64_t total = 0;
+    for (size_t i = 0; i < m_queues.size(); i++) total += m_queues[i].steals;
+    return total;
+  }
+
+private:
+  struct queue_s {
+    std::mutex           lock;
+    std::deque<uint32_t> units;
+    uint64_t             steals = 0;
+  };
+
+  bool m_pop(unsigned  worker,
+	     uint32_t *unit)
+  {
+    queue_s &own = m_queues[worker];
+    {
+      std::lock_guard<std::mutex> lock(own.lock);
+      if (!own.units.empty()) {
+	*unit = own.units.back();
+	own.units.pop_back();
+	return true;
+      }
+    }
+
+    for (size_t i = 1; i < m_queues.size(); i++) {
+      queue_s &victim = m_queues[(worker + i) % m_queues.size()];
+      std::lock_guard<std::mutex> lock(victim.lock);
+      if (!victim.units.empty()) {
+	*unit = victim.units.front();
+	victim.units.pop_front();
+	own.steals++;
+	return true;
+      }
+    }
+    return false;
+  }
+
+  void m_worker(unsigned worker)
+  {
+    uint64_t generation = 0;
+    while (1) {
+      const work_t *work;
+      {
+	std::unique_lock<std::mutex> lock(m_lock);
+	m_start.wait(lock, [&]() {return m_stop || m_generation != generation;});
+	if (m_stop) return;
+	generation = m_generation;
+	work = m_work;
+      }
+
+      uint32_t unit;
+      while (m_pop(worker, &unit)) (*work)(unit, worker);
+
+      std::lock_guard<std::mutex> lock(m_lock);
+      if (--m_busy == 0) m_done.notify_one();
+    }
+  }
+
+  std::vector<queue_s>     m_queues;
+  std::vector<std::thread> m_threads;
+  std::mutex               m_lock;
+  std::condition_variable  m_start;
+  std::condition_variable  m_done;
+  const work_t            *m_work;
+  uint64_t                 m_generation;
+  unsigned                 m_busy;
+  bool                     m_stop;
+};
+
+
+static void
+usage(const char *argv0)
+{
+  fprintf(stderr, "Usage: %s [-n devices] [-d days] [-c YYYY-MM-DD] [-j threads] [-s seed]\n", argv0);
+  exit(1);
+}
+
+
+int
+main(int    argc,
+     char **argv)
+{
+  uint32_t    count   = 1000;
+  double      ndays   = 1;
+  const char *start   = "2014-06-02";
+  unsigned    threads = std::thread::hardware_concurrency();
+  uint32_t    seed    = 1;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "n:d:c:j:s:")) != -1) {
+    switch (opt) {
+    case 'n': count = atol(optarg); break;
+    case 'd': ndays = atof(optarg); break;
+    case 'c': start = optarg; break;
+    case 'j': threads = atoi(optarg); break;
+    case 's': seed = atol(optarg); break;
+    default:  usage(argv[0]);
+    }
+  }
+  if (optind != argc || count == 0 || ndays <= 0) usage(argv[0]);
+  if (threads == 0) threads = 1;
+
+  // Calendar of the simulation, with a spare day for the RTCs running ahead
+  struct tm tm;
+  memset(&tm, 0, sizeof(tm));
+  if (sscanf(start, "%d-%d-%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday) != 3) usage(argv[0]);
+  tm.tm_year -= 1900;
+  tm.tm_mon  -= 1;
+  time_t midnight = timegm(&tm);
+  days.resize((size_t) ndays + 2);
+  for (size_t i = 0; i < days.size(); i++) {
+    time_t t = midnight + i * 86400;
+    gmtime_r(&t, &tm);
+    days[i].month     = tm.tm_mon + 1;
+    days[i].day       = tm.tm_mday;
+    days[i].dayOfWeek = tm.tm_wday + 1;
+  }
+  calendar.init();
+
+  std::vector<Device_t> devices;
+  devices.reserve(count);
+  for (uint32_t i = 0; i < count; i++) {
+    devices.push_back(Device_t(seed * 2654435761U + i * 40503U));
+    devices.back().init();
+  }
+
+  std::vector<stats_s> stats(threads, stats_s());
+
+  Pool_t   pool(threads);
+  uint32_t chunks = (count + CHUNK - 1) / CHUNK;
+  uint64_t end    = (uint64_t) (ndays * 86400e6);
+  uint64_t until  = 0;
+  Pool_t::work_t step = [&](uint32_t chunk, unsigned worker) {
+    uint32_t last = (chunk + 1) * CHUNK;
+    if (last > count) last = count;
+    for (uint32_t i = chunk * CHUNK; i < last; i++) devices[i].run(until, stats[worker]);
+  };
+
+  double begin = wall_seconds();
+  while (until < end) {
+    until = (until + EPOCH < end) ? until + EPOCH : end;
+    pool.run(chunks, step);
+  }
+  double elapsed = wall_seconds() - begin;
+
+  stats_s total = stats_s();
+  for (unsigned i = 0; i < threads; i++) total.merge(stats[i]);
+  for (uint32_t i = 0; i < count; i++) devices[i].report(total);
+
+  uint32_t busiest = 0;
+  uint32_t minutes = 0;
+  for (size_t i = 0; i < total.switching.size(); i++) {
+    if (total.switching[i] > busiest) busiest = total.switching[i];
+    if (total.switching[i]) minutes++;
+  }
+
+  double device_seconds = count * (end / 1e6);
+  printf("%u devices for %g days from %s, on %u threads\n", count, ndays, start, threads);
+  printf("  Device state:        %lu bytes\n", (unsigned long) sizeof(Device_t));
+  printf("  Throughput:          %.3g device-seconds/s (%.1f s wall, %lu steals)\n",
+	 device_seconds / elapsed, elapsed, (unsigned long) pool.steals());
+  printf("  Samples:             %.1f per device-second\n", total.samples / device_seconds);
+  printf("  Meter pulses:        %lu flashed, %lu detected (%+.3f%%)\n",
+	 (unsigned long) total.metered, (unsigned long) total.detected,
+	 (total.metered) ? 100.0 * ((double) total.detected - total.metered) / total.metered : 0.0);
+  printf("  Tariff transitions:  %lu, up to %u devices in the same minute, over %u minutes\n",
+	 (unsigned long) total.transitions, busiest, minutes);
+  printf("  RTC error:           up to %.1f s\n", total.max_skew / 1000.0);
+  printf("  Interval log:        %lu pages, %.1f bytes/device/day to export\n",
+	 (unsigned long) total.log_pages, total.log_bytes / (count * ndays));
+  printf("  15-min demand:       %.1f pulses average, %u max\n", (double) total.demand / count, total.max_demand);
+
+  return 0;
+}
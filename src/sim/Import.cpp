@@ -0,0 +1,749 @@
+//------------------------------------------------------------------------------
+//   Copyright 2014 Janick Bergeron
+//   All Rights Reserved Worldwide
+//
+//   Licensed under the Apache License, Version 2.0 (the
+//   "License"); you may not use this file except in
+//   compliance with the License.  You may obtain a copy of
+//   the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in
+//   writing, software distributed under the License is
+//   distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+//   CONDITIONS OF ANY KIND, either express or implied.  See
+//   the License for the specific language governing
+//   permissions and limitations under the License.
+//------------------------------------------------------------------------------
+
+
+
+// Imports utility interval data (Green Button ESPI XML or CSV),
+// packs it into IntervalLog_t pages and totals the energy per cost period.
+//
+// Files are memory-mapped and parsed in a single pass, without building
+// any tree or copying lines, so multi-year exports are processed at
+// hundreds of MB/s.
+//
+// CSV files need a header line naming their columns, as in the utilities'
+// "Download My Data" exports:
+//
+//     TYPE,DATE,START TIME,END TIME,USAGE,UNITS,COST,NOTES
+//     Electric usage,2014-01-01,00:00,00:14,0.12,kWh,$0.02,
+//
+// Files without one are read as "YYYY-MM-DD,HH:MM,kWh", every 15 minutes.
+// ESPI XML files are read from their IntervalReading, ReadingType and
+// LocalTimeParameters elements.
+//
+// Intervals longer than 15 minutes are split evenly, shorter ones are
+// summed, and the result is numbered & packed exactly as the firmware logs
+// it, in an unbounded sequence of IntervalLog_t::PAGE_SIZE-byte pages.
+//
+// Every month is also projected from its first 14 days by BillForecast_t,
+// to compare its month-end forecast with what was actually consumed.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <vector>
+
+#include "Calendar.h"
+#include "IntervalLog.h"
+#include "BillForecast.h"
+
+using namespace PowerMinder;
+
+
+/** Number of seconds from 1970-01-01 to 2000-01-01, the origin of the interval numbers */
+static const int64_t EPOCH_2000 = 946684800;
+
+
+static double
+wall_seconds()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+/** Writes intervals in the same pages as IntervalLog_t::append(), but never wraps around */
+class Packer_t {
+
+public:
+  Packer_t(FILE *fp)
+    : m_fp(fp), m_open(false), m_seq(0xFF), m_offset(0), m_last(0), m_next(0),
+      m_pages(0), m_dropped(0)
+  {
+  }
+
+  void append(uint32_t interval,
+	      uint16_t energy)
+  {
+    if (m_open && interval < m_next) {
+      // Duplicate or out of order, e.g. the repeated hour at the end of DST
+      m_dropped++;
+      return;
+    }
+
+    if (!m_open || interval - m_next > 15) m_start(interval);
+
+    uint8_t record[4];
+    uint8_t n = IntervalLog_t::encode(interval - m_next, (int32_t) energy - m_last, record);
+    if (m_offset + n > IntervalLog_t::PAGE_SIZE) {
+      m_start(interval);
+      n = IntervalLog_t::encode(0, energy, record);
+    }
+    memcpy(m_page + m_offset, record, n);
+    m_offset += n;
+    m_last = energy;
+    m_next = interval + 1;
+  }
+
+  void close()
+  {
+    if (m_open) m_flush();
+    m_open = false;
+  }
+
+  uint32_t pages()   {return m_pages;}
+  uint32_t dropped() {return m_dropped;}
+
+private:
+  void m_start(uint32_t interval)
+  {
+    if (m_open) m_flush();
+    m_open = true;
+
+    m_seq = (m_seq + 1) % 255;
+    memset(m_page, 0xFF, sizeof(m_page));
+    m_page[0] = m_seq;
+    for (uint8_t i = 0; i < 4; i++) m_page[1 + i] = interval >> (8 * i);
+    m_offset = IntervalLog_t::HEADER_SIZE;
+    m_last   = 0;
+    m_next   = interval;
+  }
+
+  void m_flush()
+  {
+    if (m_fp) fwrite(m_page, 1, sizeof(m_page), m_fp);
+    m_pages++;
+  }
+
+  FILE     *m_fp;
+  bool      m_open;
+  uint8_t   m_page[IntervalLog_t::PAGE_SIZE];
+  uint8_t   m_seq;
+  uint8_t   m_offset;
+  uint16_t  m_last;
+  uint32_t  m_next;
+  uint32_t  m_pages;
+  uint32_t  m_dropped;
+};
+
+
+/** Energy per cost period, per month */
+struct month_s {
+  uint64_t wh[3];
+  uint32_t intervals;
+  uint32_t forecast[3];   ///< Projected on the 15th
+  bool     projected;
+};
+
+
+/** Sums the 15-min intervals, packs them & totals them per cost period */
+class Importer_t {
+
+public:
+  Importer_t(const Calendar &calendar,
+	     Packer_t &packer)
+    : m_calendar(calendar), m_packer(packer), m_interval(0), m_day(0xFFFFFFFF), m_wh(0), m_pending(false),
+      m_periodStart(1), m_periodEnd(0), m_period(OFF_PEAK), m_lookups(0), m_errors(0), m_cycle(~0UL)
+  {
+    m_forecast.init();
+  }
+
+  /** Add the energy consumed over a period of time.
+   *  Periods of 15 minutes or less are summed in their 15-min interval,
+   *  longer ones must start on a 15-min boundary.
+   */
+  void add(uint32_t interval,   ///< Index of the 15-min interval of the start time
+	   uint16_t minutes,    ///< Duration
+	   uint64_t wh)         ///< Energy, in Wh
+  {
+    if (minutes <= 15) {
+      m_add(interval, wh);
+      return;
+    }
+
+    // Spread the energy evenly, with the remainder on the first intervals
+    uint16_t n = minutes / 15;
+    for (uint16_t i = 0; i < n; i++) {
+      m_add(interval + i, wh / n + (i < wh % n));
+    }
+  }
+
+  void close()
+  {
+    if (m_pending) m_flush();
+    m_pending = false;
+    m_packer.close();
+  }
+
+  /** Count an invalid record */
+  void error() {m_errors++;}
+
+  const std::vector<month_s> &months() {return m_months;}
+  uint32_t lookups()                   {return m_lookups;}
+  uint32_t errors()                    {return m_errors;}
+
+private:
+  void m_add(uint32_t interval,
+	     uint64_t wh)
+  {
+    if (m_pending && interval == m_interval) {
+      m_wh += wh;
+      return;
+    }
+    if (m_pending) m_flush();
+    m_pending  = true;
+    m_interval = interval;
+    m_wh       = wh;
+  }
+
+  void m_flush()
+  {
+    m_packer.append(m_interval, (m_wh > 0xFFFF) ? 0xFFFF : m_wh);
+
+    // The date of the interval
+    uint32_t day = m_interval / 96;
+    if (day != m_day) {
+      time_t t = EPOCH_2000 + (time_t) day * 86400;
+      gmtime_r(&t, &m_date);
+      m_day = day;
+    }
+    size_t month = (m_date.tm_year - 100) * 12 + m_date.tm_mon;
+    if (month >= m_months.size()) m_months.resize(month + 1, month_s());
+
+    // Only look up the cost period when the current one is over
+    if (m_interval < m_periodStart || m_interval >= m_periodEnd) {
+      uint8_t  slot      = (m_interval % 96) / 2;
+      uint8_t  mon       = m_date.tm_mon + 1;
+      uint8_t  mday      = m_date.tm_mday;
+      uint8_t  dayOfWeek = (day + 6) % 7 + 1;
+      uint8_t  hour      = slot / 2;
+      uint8_t  min       = (slot % 2) * 30;
+      period_t next;
+      uint16_t time;
+      m_calendar.findPeriods(1, &mon, &mday, &dayOfWeek, &hour, &min, &m_period, &next, &time);
+      m_periodStart = m_interval - m_interval % 2;
+      m_periodEnd   = m_periodStart + 2 * (time / 30);
+      if (m_periodEnd == m_periodStart) m_periodEnd += 2;
+      m_lookups++;
+    }
+
+    m_months[month].wh[m_period] += m_wh;
+    m_months[month].intervals++;
+
+    // Project the month from its first 14 days
+    if (month != m_cycle) {
+      uint32_t first = day - (m_date.tm_mday - 1);
+      m_forecast.begin(m_calendar, m_date.tm_year - 100, m_date.tm_mon + 1, 1, (first + 6) % 7 + 1,
+		       BillForecast_t::monthDays(m_date.tm_year - 100, m_date.tm_mon + 1));
+      m_cycle = month;
+    }
+    if (m_date.tm_mday >= 15 && !m_months[month].projected) {
+      for (int p = 0; p < 3; p++) m_months[month].forecast[p] = m_forecast.forecast((period_t) p);
+      m_months[month].projected = true;
+    }
+    m_forecast.advance(m_date.tm_mday, (m_interval % 96) / 4, (m_wh > 0xFFFF) ? 0xFFFF : m_wh, m_period, 15);
+  }
+
+  const Calendar       &m_calendar;
+  Packer_t             &m_packer;
+  uint32_t              m_interval;     ///< Interval being summed
+  uint32_t              m_day;          ///< Day of m_date, since 2000-01-01
+  struct tm             m_date;
+  uint64_t              m_wh;
+  bool                  m_pending;
+  uint32_t              m_periodStart;  ///< Intervals in the current cost period
+  uint32_t              m_periodEnd;
+  period_t              m_period;
+  uint32_t              m_lookups;
+  uint32_t              m_errors;
+  std::vector<month_s>  m_months;       ///< Since January 2000
+  BillForecast_t        m_forecast;
+  size_t                m_cycle;        ///< Month being forecast
+};
+
+
+//
+// Field parsers, on [p, end) ranges
+//
+
+/** Parse an unsigned decimal number, with up to 3 decimals, in 1/1000th */
+static bool
+parse_milli(const char *p,
+	    const char *end,
+	    uint64_t   *value)
+{
+  uint64_t v = 0;
+  int      decimals = -1;
+  bool     digits   = false;
+  for (; p < end; p++) {
+    if (*p >= '0' && *p <= '9') {
+      if (decimals < 3) {
+	v = v * 10 + (*p - '0');
+	if (decimals >= 0) decimals++;
+      }
+      digits = true;
+    }
+    else if (*p == '.' && decimals < 0) decimals = 0;
+    else if (*p != ' ' && *p != '"' && *p != '\r') return false;
+  }
+  if (decimals < 0) decimals = 0;
+  while (decimals++ < 3) v *= 10;
+  *value = v;
+  return digits;
+}
+
+
+/** Parse a fixed number of digits */
+static bool
+parse_digits(const char *&p,
+	     const char  *end,
+	     uint8_t      n,
+	     int         *value)
+{
+  *value = 0;
+  while (n-- > 0) {
+    if (p == end || *p < '0' || *p > '9') return false;
+    *value = *value * 10 + (*p++ - '0');
+  }
+  return true;
+}
+
+
+/** Parse YYYY-MM-DD or MM/DD/YYYY, optionally followed by HH:MM */
+static bool
+parse_date(const char *p,
+	   const char *end,
+	   int        *year,
+	   int        *month,
+	   int        *day,
+	   int        *minutes)
+{
+  while (p < end && (*p == ' ' || *p == '"')) p++;
+  if (end - p >= 10 && p[4] == '-') {
+    if (!parse_digits(p, end, 4, year) || *p++ != '-' ||
+	!parse_digits(p, end, 2, month) || *p++ != '-' ||
+	!parse_digits(p, end, 2, day)) return false;
+  }
+  else {
+    if (!parse_digits(p, end, 2, month) || *p++ != '/' ||
+	!parse_digits(p, end, 2, day) || *p++ != '/' ||
+	!parse_digits(p, end, 4, year)) return false;
+  }
+
+  while (p < end && (*p == ' ' || *p == 'T')) p++;
+  int h, m;
+  if (minutes && end - p >= 5 &&
+      parse_digits(p, end, 2, &h) && *p++ == ':' && parse_digits(p, end, 2, &m)) *minutes = h * 60 + m;
+
+  return *year >= 2000 && *year < 2100 && *month >= 1 && *month <= 12 && *day >= 1 && *day <= 31;
+}
+
+
+/** Parse HH:MM into minutes */
+static bool
+parse_time(const char *p,
+	   const char *end,
+	   int        *minutes)
+{
+  while (p < end && (*p == ' ' || *p == '"')) p++;
+  int h, m;
+  if (!parse_digits(p, end, 2, &h) || p == end || *p++ != ':' || !parse_digits(p, end, 2, &m)) return false;
+  *minutes = h * 60 + m;
+  return true;
+}
+
+
+/** Case-insensitive comparison of a field with a column name */
+static bool
+is_column(const char *p,
+	  const char *end,
+	  const char *name)
+{
+  while (p < end && (*p == ' ' || *p == '"')) p++;
+  while (end > p && (end[-1] == ' ' || end[-1] == '"' || end[-1] == '\r')) end--;
+  size_t n = strlen(name);
+  return (size_t) (end - p) == n && strncasecmp(p, name, n) == 0;
+}
+
+
+//
+// CSV
+//
+static void
+import_csv(const char *p,
+	   const char *end,
+	   Importer_t &importer)
+{
+  // Default columns
+  int c_date  = 0;
+  int c_start = 1;
+  int c_end   = -1;
+  int c_usage = 2;
+  int c_units = -1;
+
+  const int MAX_FIELDS = 16;
+  const char *field[MAX_FIELDS + 1];
+
+  while (p < end) {
+    const char *eol = (const char *) memchr(p, '\n', end - p);
+    if (eol == 0) eol = end;
+
+    // Split the line
+    int n = 0;
+    field[n++] = p;
+    for (const char *q = p; q < eol && n < MAX_FIELDS; q++) {
+      if (*q == ',') field[n++] = q + 1;
+    }
+    field[n] = eol + 1;
+    const char *line = p;
+    p = eol + 1;
+#define FIELD(c) field[c], field[(c)+1] - 1
+
+    int year, month, day, minutes = 0;
+    if (n <= c_date || n <= c_usage || !parse_date(FIELD(c_date), &year, &month, &day, &minutes)) {
+      // A header line?
+      int date = -1, start = -1, stop = -1, usage = -1, units = -1;
+      for (int i = 0; i < n; i++) {
+	if (is_column(FIELD(i), "DATE"))                                      date  = i;
+	else if (is_column(FIELD(i), "START TIME"))                           start = i;
+	else if (is_column(FIELD(i), "END TIME"))                             stop  = i;
+	else if (is_column(FIELD(i), "USAGE") || is_column(FIELD(i), "VALUE") ||
+		 is_column(FIELD(i), "IMPORT (kWh)"))                         usage = i;
+	else if (is_column(FIELD(i), "UNITS"))                                units = i;
+      }
+      if (date >= 0 && usage >= 0) {
+	c_date  = date;
+	c_start = start;
+	c_end   = stop;
+	c_usage = usage;
+	c_units = units;
+      }
+      // Other header or comment lines are ignored, but not bad data lines
+      else if (line < eol && *line >= '0' && *line <= '9') importer.error();
+      continue;
+    }
+    if (c_start >= 0 && c_start < n && !parse_time(FIELD(c_start), &minutes)) {
+      importer.error();
+      continue;
+    }
+
+    int duration = 15;
+    int last;
+    if (c_end >= 0 && c_end < n && parse_time(FIELD(c_end), &last)) {
+      duration = (last - minutes + 1 + 1440) % 1440;
+      if (duration == 0) duration = 1440;
+    }
+
+    uint64_t milli;
+    if (!parse_milli(FIELD(c_usage), &milli)) {
+      importer.error();
+      continue;
+    }
+    // kWh, unless specified otherwise
+    bool     in_wh = (c_units >= 0 && c_units < n && is_column(FIELD(c_units), "Wh"));
+    uint64_t wh    = (in_wh) ? (milli + 500) / 1000 : milli;
+
+    importer.add(IntervalLog_t::interval(year - 2000, month, day, minutes / 60, minutes % 60), duration, wh);
+#undef FIELD
+  }
+}
+
+
+//
+// Green Button (ESPI) XML
+//
+
+/** Find the next element (start or end tag). Returns its local name, without the namespace prefix */
+static const char *
+next_tag(const char  *p,
+	 const char  *end,
+	 const char **name_end,
+	 bool        *closing)
+{
+  while ((p = (const char *) memchr(p, '<', end - p)) != 0) {
+    p++;
+    if (p == end) return 0;
+    *closing = (*p == '/');
+    if (*closing) p++;
+    if (*p == '?' || *p == '!') continue;
+
+    const char *name = p;
+    while (p < end && *p != '>' && *p != ' ' && *p != '/' && *p != '\t' && *p != '\n') {
+      if (*p++ == ':') name = p;
+    }
+    *name_end = p;
+    return name;
+  }
+  return 0;
+}
+
+
+static bool
+is_tag(const char *name,
+       const char *name_end,
+       const char *tag)
+{
+  size_t n = strlen(tag);
+  return (size_t) (name_end - name) == n && memcmp(name, tag, n) == 0;
+}
+
+
+/** Parse the (signed) integer content of an element */
+static int64_t
+content(const char *p,
+	const char *end)
+{
+  p = (const char *) memchr(p, '>', end - p);
+  if (p == 0) return 0;
+  p++;
+  bool negative = (*p == '-');
+  if (negative) p++;
+  int64_t v = 0;
+  while (p < end && *p >= '0' && *p <= '9') v = v * 10 + (*p++ - '0');
+  return (negative) ? -v : v;
+}
+
+
+static void
+import_xml(const char *p,
+	   const char *end,
+	   Importer_t &importer,
+	   int64_t     tz_offset,
+	   bool        tz_forced)
+{
+  int     power_of_ten = 0;
+  bool    in_reading   = false;
+  int64_t start = 0, duration = 0, value = 0;
+  bool    has_start = false, has_value = false;
+
+  const char *name, *name_end;
+  bool closing;
+  while ((name = next_tag(p, end, &name_end, &closing)) != 0) {
+    p = name_end;
+
+    if (is_tag(name, name_end, "IntervalReading")) {
+      if (!closing) {
+	in_reading = true;
+	has_start  = has_value = false;
+	duration   = 900;
+	continue;
+      }
+      in_reading = false;
+      if (!has_start || !has_value || value < 0 || duration <= 0) {
+	importer.error();
+	continue;
+      }
+
+      // Value is in Wh x 10^powerOfTenMultiplier
+      uint64_t wh = value;
+      for (int i = 0; i < power_of_ten; i++) wh *= 10;
+      for (int i = 0; i > power_of_ten; i--) wh = (wh + 5) / 10;
+
+      int64_t local = start + tz_offset - EPOCH_2000;
+      if (local < 0) {
+	importer.error();
+	continue;
+      }
+      importer.add(local / 900, (duration < 900) ? 15 : duration / 60, wh);
+      continue;
+    }
+    if (closing) continue;
+
+    if (in_reading) {
+      if (is_tag(name, name_end, "start"))         start = content(p, end), has_start = true;
+      else if (is_tag(name, name_end, "duration")) duration = content(p, end);
+      else if (is_tag(name, name_end, "value"))    value = content(p, end), has_value = true;
+    }
+    else if (is_tag(name, name_end, "powerOfTenMultiplier")) power_of_ten = content(p, end);
+    else if (is_tag(name, name_end, "tzOffset") && !tz_forced) tz_offset = content(p, end);
+  }
+}
+
+
+/** Write a synthetic CSV export, hourly or every 15 mins, with the simulator's daily load profile */
+static bool
+generate(const char *fname,
+	 int         years,
+	 int         minutes)
+{
+  FILE *fp = fopen(fname, "w");
+  if (fp == 0) {
+    perror(fname);
+    return false;
+  }
+
+  fprintf(fp, "Name,PowerMinder synthetic data\n\n");
+  fprintf(fp, "TYPE,DATE,START TIME,END TIME,USAGE,UNITS,COST,NOTES\n");
+  struct tm tm;
+  memset(&tm, 0, sizeof(tm));
+  tm.tm_year = 2014 - 1900;
+  tm.tm_mday = 1;
+  time_t t    = timegm(&tm);
+  tm.tm_year += years;
+  time_t stop = timegm(&tm);
+  for (; t < stop; t += minutes * 60) {
+    gmtime_r(&t, &tm);
+    uint32_t watts = 500 + rand() % 200;
+    if (tm.tm_hour >= 7 && tm.tm_hour < 9)   watts += 500;
+    if (tm.tm_hour >= 17 && tm.tm_hour < 22) watts += 1500;
+    uint32_t wh = watts * minutes / 60;
+    int last = tm.tm_hour * 60 + tm.tm_min + minutes - 1;
+    fprintf(fp, "Electric usage,%04d-%02d-%02d,%02d:%02d,%02d:%02d,%u.%03u,kWh,$%u.%02u,\n",
+	    tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, last / 60, last % 60,
+	    wh / 1000, wh % 1000, wh * 15 / 10000, (wh * 15 / 100) % 100);
+  }
+
+  if (fclose(fp) != 0) {
+    perror(fname);
+    return false;
+  }
+  return true;
+}
+
+
+static void
+usage(const char *argv0)
+{
+  fprintf(stderr, "Usage: %s [-o packed.log] [-z tz_offset_hours] [-q] export.(csv|xml)...\n", argv0);
+  fprintf(stderr, "       %s -g years [-m minutes] export.csv\n", argv0);
+  exit(1);
+}
+
+
+int
+main(int    argc,
+     char **argv)
+{
+  const char *output    = 0;
+  int64_t     tz_offset = 0;
+  bool        tz_forced = false;
+  bool        quiet     = false;
+  int         years     = 0;
+  int         minutes   = 15;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "o:z:qg:m:")) != -1) {
+    switch (opt) {
+    case 'o': output = optarg; break;
+    case 'z': tz_offset = (int64_t) (atof(optarg) * 3600); tz_forced = true; break;
+    case 'q': quiet = true; break;
+    case 'g': years = atoi(optarg); break;
+    case 'm': minutes = atoi(optarg); break;
+    default:  usage(argv[0]);
+    }
+  }
+  if (optind == argc) usage(argv[0]);
+
+  if (years > 0) {
+    if (optind + 1 != argc || minutes <= 0) usage(argv[0]);
+    return generate(argv[optind], years, minutes) ? 0 : 1;
+  }
+
+  FILE *fp = 0;
+  if (output) {
+    fp = fopen(output, "wb");
+    if (fp == 0) {
+      perror(output);
+      return 1;
+    }
+  }
+
+  Calendar calendar;
+  calendar.init();
+  Packer_t   packer(fp);
+  Importer_t importer(calendar, packer);
+
+  double   begin = wall_seconds();
+  uint64_t bytes = 0;
+  for (int i = optind; i < argc; i++) {
+    int fd = open(argv[i], O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+      perror(argv[i]);
+      return 1;
+    }
+    if (st.st_size == 0) {
+      close(fd);
+      continue;
+    }
+    const char *image = (const char *) mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED) {
+      perror(argv[i]);
+      return 1;
+    }
+    madvise((void *) image, st.st_size, MADV_SEQUENTIAL);
+
+    const char *p = image;
+    while (p < image + st.st_size && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')) p++;
+    if (*p == '<') import_xml(image, image + st.st_size, importer, tz_offset, tz_forced);
+    else import_csv(image, image + st.st_size, importer);
+
+    munmap((void *) image, st.st_size);
+    bytes += st.st_size;
+  }
+  importer.close();
+  double elapsed = wall_seconds() - begin;
+
+  if (fp && fclose(fp) != 0) {
+    perror(output);
+    return 1;
+  }
+
+  const std::vector<month_s> &months = importer.months();
+  uint64_t total[3]  = {0, 0, 0};
+  uint32_t intervals = 0;
+  unsigned projected = 0;
+  double   error     = 0;
+  if (!quiet) printf("Month      Off-peak kWh  Partial kWh  On-peak kWh   Intervals  Forecast on the 15th\n");
+  for (size_t m = 0; m < months.size(); m++) {
+    if (months[m].intervals == 0) continue;
+    if (!quiet) printf("%04lu-%02lu  %12.3f %12.3f %12.3f %11u", 2000 + m / 12, m % 12 + 1,
+		       months[m].wh[OFF_PEAK] / 1000.0, months[m].wh[PARTIAL_PEAK] / 1000.0,
+		       months[m].wh[ON_PEAK] / 1000.0, months[m].intervals);
+    if (months[m].projected) {
+      double actual = 0, forecast = 0;
+      for (int p = 0; p < 3; p++) {
+	actual   += months[m].wh[p];
+	forecast += months[m].forecast[p];
+      }
+      double e = (actual > 0) ? (forecast - actual) / actual : 0;
+      if (!quiet) printf("  %12.3f (%+.1f%%)", forecast / 1000.0, e * 100);
+      error += (e < 0) ? -e : e;
+      projected++;
+    }
+    if (!quiet) printf("\n");
+    for (int p = 0; p < 3; p++) total[p] += months[m].wh[p];
+    intervals += months[m].intervals;
+  }
+  printf("Total    %12.3f %12.3f %12.3f %11u\n",
+	 total[OFF_PEAK] / 1000.0, total[PARTIAL_PEAK] / 1000.0, total[ON_PEAK] / 1000.0, intervals);
+  printf("%u packed pages, %u duplicate intervals dropped, %u invalid records, %u period lookups\n",
+	 packer.pages(), packer.dropped(), importer.errors(), importer.lookups());
+  if (projected > 0) printf("%u months projected from their first 14 days, mean absolute error %.2f%%\n",
+			    projected, error / projected * 100);
+  printf("%.1f MB in %.1f ms: %.0f MB/s\n", bytes * 1e-6, elapsed * 1e3, bytes * 1e-6 / elapsed);
+
+  return 0;
+}
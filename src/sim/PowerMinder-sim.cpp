@@ -0,0 +1,110 @@
+//------------------------------------------------------------------------------
+//   Copyright 2014 Janick Bergeron
+//   All Rights Reserved Worldwide
+//
+//   Licensed under the Apache License, Version 2.0 (the
+//   "License"); you may not use this file except in
+//   compliance with the License.  You may obtain a copy of
+//   the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in
+//   writing, software distributed under the License is
+//   distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+//   CONDITIONS OF ANY KIND, either express or implied.  See
+//   the License for the specific language governing
+//   permissions and limitations under the License.
+//------------------------------------------------------------------------------
+
+
+
+// Runs the unmodified PowerMinder sketch on the host simulator
+
+#include <stdio.h>
+
+#include "../../PowerMinder/PowerMinder.ino"
+
+
+#ifdef TRACE
+static uint8_t trace[2 * IntervalLog_t::PAGE_SIZE];
+
+static void
+trace_to_memory(uint8_t  offset,
+		uint8_t  data,
+		void    * /* context */)
+{
+  trace[offset] = data;
+}
+#endif
+
+
+static uint32_t logged_intervals = 0;
+static uint32_t logged_energy    = 0;
+
+static void
+count_interval(uint32_t  /* interval */,
+	       uint16_t  energy,
+	       void     * /* context */)
+{
+  logged_intervals++;
+  logged_energy += energy;
+}
+
+
+/** Time until the next task is due */
+static unsigned long
+next_deadline()
+{
+  return scheduler.time_to_next();
+}
+
+
+int
+main(int    argc,
+     char **argv)
+{
+  Sim::init(argc, argv);
+  Sim::idle_hint(next_deadline);
+
+  setup();
+  while (Sim::running()) {
+    loop();
+    Sim::stats.loops++;
+  }
+
+  Sim::report();
+
+  printf("  Pulses detected:   %u (16-bit counter)\n", pulses.count());
+  printf("  Sampling period:   %u ms\n", governor.period());
+  printf("  Demand:            %u pulses/15 mins\n", demand.demand());
+  printf("  This month:        %lu off-peak, %lu partial-peak, %lu on-peak\n",
+	 (unsigned long) energy.thisMonth(OFF_PEAK),
+	 (unsigned long) energy.thisMonth(PARTIAL_PEAK),
+	 (unsigned long) energy.thisMonth(ON_PEAK));
+#ifdef FORECAST
+  printf("  Month-end forecast: %lu off-peak, %lu partial-peak, %lu on-peak\n",
+	 (unsigned long) forecast.forecast(OFF_PEAK),
+	 (unsigned long) forecast.forecast(PARTIAL_PEAK),
+	 (unsigned long) forecast.forecast(ON_PEAK));
+#endif
+  intervals.read(count_interval, 0);
+  printf("  Interval log:      %u intervals, %u pulses\n", logged_intervals, logged_energy);
+
+#ifdef PROFILE
+  Profile_t::print();
+
+  printf("  RTC RAM snapshot: ");
+  for (uint8_t i = 0; i < Profile_t::SNAPSHOT_SIZE; i++) {
+    printf(" %02x", DS1302_read(DS1302_RAMSTART + 2 * i));
+  }
+  printf("\n");
+#endif
+
+#ifdef TRACE
+  printf("Last events:\n");
+  Trace_t::print(trace, Trace_t::save(trace_to_memory, 0, sizeof(trace)));
+#endif
+
+  return 0;
+}
@@ -0,0 +1,333 @@
+//------------------------------------------------------------------------------
+//   Copyright 2014 Janick Bergeron
+//   All Rights Reserved Worldwide
+//
+//   Licensed under the Apache License, Version 2.0 (the
+//   "License"); you may not use this file except in
+//   compliance with the License.  You may obtain a copy of
+//   the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in
+//   writing, software distributed under the License is
+//   distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+//   CONDITIONS OF ANY KIND, either express or implied.  See
+//   the License for the specific language governing
+//   permissions and limitations under the License.
+//------------------------------------------------------------------------------
+
+
+
+// Replays recorded light sensor traces through the pulse detection
+// code of the sketch, to tune it and benchmark it against labeled pulses.
+//
+// A recording is a header followed by one 16-bit little-endian word per sample:
+//
+//     MAGIC                 "PML1"
+//     PERIOD                Sampling period, in microseconds (32-bit little-endian)
+//     SAMPLE[...]           Bits 9-0:  ADC reading, 0-1023
+//                           Bit 15:    Set on the first sample of a labeled meter pulse
+//
+// Recordings are memory-mapped, so they may be much larger than memory.
+// Use -g to generate a synthetic recording.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <vector>
+
+#include "LightSensor.h"
+#include "PulseDetector.h"
+
+using namespace PowerMinder;
+
+
+static const char     MAGIC[4]    = {'P', 'M', 'L', '1'};
+static const size_t   HEADER_SIZE = 8;
+static const uint16_t LABEL       = 0x8000;
+static const uint16_t READING     = 0x03FF;
+
+
+/** Detection statistics */
+struct stats_s {
+  uint64_t samples;
+  double   duration;   ///< Recorded time, in seconds
+  double   cpu;        ///< Replay time, in seconds
+  uint32_t labels;
+  uint32_t detected;
+  uint32_t true_pos;
+  uint32_t false_pos;
+  uint32_t false_neg;
+};
+
+
+static double
+cpu_seconds()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+/** Pair up the detected pulses with the labeled ones, in chronological order.
+ *  A detection within the tolerance of a label is a true positive.
+ */
+static void
+match(const std::vector<unsigned long> &labels,
+      const std::vector<unsigned long> &detected,
+      unsigned long                     tolerance,
+      bool                              verbose,
+      stats_s                          &stats)
+{
+  size_t i = 0;
+  size_t j = 0;
+  while (i < detected.size() || j < labels.size()) {
+    if (i < detected.size() && j < labels.size() &&
+	(detected[i] > labels[j] ? detected[i] - labels[j] : labels[j] - detected[i]) <= tolerance) {
+      stats.true_pos++;
+      i++;
+      j++;
+    }
+    else if (j == labels.size() || (i < detected.size() && detected[i] < labels[j])) {
+      if (verbose) printf("  False positive at %lu ms\n", detected[i]);
+      stats.false_pos++;
+      i++;
+    }
+    else {
+      if (verbose) printf("  False negative at %lu ms\n", labels[j]);
+      stats.false_neg++;
+      j++;
+    }
+  }
+}
+
+
+/** Replay a recording through the same code as the sketch's sample_light() */
+static bool
+replay(const char    *fname,
+       uint16_t       threshold,
+       unsigned long  tolerance,
+       bool           verbose,
+       stats_s       &stats)
+{
+  int fd = open(fname, O_RDONLY);
+  if (fd < 0) {
+    perror(fname);
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0 || (size_t) st.st_size < HEADER_SIZE) {
+    fprintf(stderr, "%s: Not a light sensor recording\n", fname);
+    close(fd);
+    return false;
+  }
+  const uint8_t *image = (const uint8_t *) mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (image == MAP_FAILED) {
+    perror(fname);
+    return false;
+  }
+  if (memcmp(image, MAGIC, sizeof(MAGIC)) != 0) {
+    fprintf(stderr, "%s: Not a light sensor recording\n", fname);
+    munmap((void *) image, st.st_size);
+    return false;
+  }
+  madvise((void *) image, st.st_size, MADV_SEQUENTIAL);
+
+  uint32_t period  = image[4] | (image[5] << 8) | (image[6] << 16) | ((uint32_t) image[7] << 24);
+  size_t   samples = (st.st_size - HEADER_SIZE) / 2;
+  const uint8_t *p = image + HEADER_SIZE;
+
+  LightSensor_t   light(3);
+  PulseDetector_t pulses(threshold);
+  std::vector<unsigned long> labels;
+  std::vector<unsigned long> detected;
+
+  double   start = cpu_seconds();
+  uint64_t now_us = 0;
+  for (size_t i = 0; i < samples; i++, p += 2, now_us += period) {
+    uint16_t sample = p[0] | (p[1] << 8);
+    uint16_t value  = sample & READING;
+    unsigned long now = now_us / 1000;
+
+    if (sample & LABEL) labels.push_back(now);
+
+    light.update(value);
+    if (light.is_calibrated() && pulses.update(value, light.baseline(), now)) detected.push_back(now);
+  }
+  double cpu = cpu_seconds() - start;
+  munmap((void *) image, st.st_size);
+
+  stats_s file;
+  memset(&file, 0, sizeof(file));
+  file.samples  = samples;
+  file.duration = now_us * 1e-6;
+  file.cpu      = cpu;
+  file.labels   = labels.size();
+  file.detected = detected.size();
+  if (verbose) printf("%s:\n", fname);
+  match(labels, detected, tolerance, verbose, file);
+
+  printf("%-24s %10llu samples %8u labels %8u detected %8u TP %6u FP %6u FN %8.1f Ms/s\n", fname,
+	 (unsigned long long) file.samples, file.labels, file.detected,
+	 file.true_pos, file.false_pos, file.false_neg, file.samples / file.cpu * 1e-6);
+
+  stats.samples   += file.samples;
+  stats.duration  += file.duration;
+  stats.cpu       += file.cpu;
+  stats.labels    += file.labels;
+  stats.detected  += file.detected;
+  stats.true_pos  += file.true_pos;
+  stats.false_pos += file.false_pos;
+  stats.false_neg += file.false_neg;
+
+  return true;
+}
+
+
+/** Write a synthetic recording: a slowly drifting ambient light level with noise,
+ *  room lights switched on & off, single-sample glitches and meter pulses of
+ *  various widths & brightness at a varying rate.
+ */
+static bool
+generate(const char *fname,
+	 uint64_t    samples,
+	 uint32_t    period,
+	 unsigned    seed)
+{
+  FILE *fp = fopen(fname, "wb");
+  if (fp == 0) {
+    perror(fname);
+    return false;
+  }
+  srand(seed);
+
+  uint8_t header[HEADER_SIZE];
+  memcpy(header, MAGIC, sizeof(MAGIC));
+  for (uint8_t i = 0; i < 4; i++) header[4 + i] = period >> (8 * i);
+  fwrite(header, 1, sizeof(header), fp);
+
+  double   ambient = 600;
+  int      room    = 0;      // Extra light from the room
+  uint64_t room_until  = 0;
+  uint64_t next_pulse  = 2000000;
+  uint64_t pulse_until = 0;
+  int      brightness  = 0;
+
+  uint16_t buffer[4096];
+  size_t   n = 0;
+  for (uint64_t i = 0; i < samples; i++) {
+    uint64_t now = i * period;
+    uint16_t label = 0;
+
+    ambient += (rand() % 3 - 1) * 0.05;
+    if (ambient < 300) ambient = 300;
+    if (ambient > 900) ambient = 900;
+
+    if (now >= room_until) {
+      room       = (room == 0 && rand() % 4 == 0) ? 40 + rand() % 80 : 0;
+      room_until = now + (uint64_t) (60 + rand() % 600) * 1000000;
+    }
+
+    if (now >= next_pulse) {
+      label       = LABEL;
+      brightness  = 80 + rand() % 240;
+      pulse_until = now + (5 + rand() % 40) * 1000;
+      // 1 Wh/pulse at 200 W to 5 kW
+      next_pulse  = now + (uint64_t) 3600000000ULL / (200 + rand() % 4800);
+    }
+
+    int value = ambient + room + rand() % 9 - 4;
+    if (now < pulse_until) value += brightness;
+    if (rand() % 100000 == 0) value += 100;
+    if (value > 1023) value = 1023;
+
+    uint16_t sample = value | label;
+    buffer[n++] = htole16(sample);
+    if (n == sizeof(buffer) / sizeof(buffer[0])) {
+      fwrite(buffer, sizeof(buffer[0]), n, fp);
+      n = 0;
+    }
+  }
+  fwrite(buffer, sizeof(buffer[0]), n, fp);
+
+  if (fclose(fp) != 0) {
+    perror(fname);
+    return false;
+  }
+  return true;
+}
+
+
+static void
+usage(const char *argv0)
+{
+  fprintf(stderr, "Usage: %s [-t threshold] [-w tolerance_ms] [-v] recording...\n", argv0);
+  fprintf(stderr, "       %s -g samples [-p period_us] [-s seed] recording\n", argv0);
+  exit(1);
+}
+
+
+int
+main(int    argc,
+     char **argv)
+{
+  uint16_t      threshold = LightSensor_t::PULSE_THRESHOLD;
+  unsigned long tolerance = 20;
+  bool          verbose   = false;
+  uint64_t      samples   = 0;
+  uint32_t      period    = 1000;
+  unsigned      seed      = 1;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "t:w:vg:p:s:")) != -1) {
+    switch (opt) {
+    case 't': threshold = strtoul(optarg, 0, 0); break;
+    case 'w': tolerance = atol(optarg); break;
+    case 'v': verbose = true; break;
+    case 'g': samples = strtoull(optarg, 0, 0); break;
+    case 'p': period = atol(optarg); break;
+    case 's': seed = atol(optarg); break;
+    default:  usage(argv[0]);
+    }
+  }
+  if (optind == argc || period == 0) usage(argv[0]);
+
+  if (samples > 0) {
+    if (optind + 1 != argc) usage(argv[0]);
+    return generate(argv[optind], samples, period, seed) ? 0 : 1;
+  }
+
+  stats_s total;
+  memset(&total, 0, sizeof(total));
+  bool ok = true;
+  for (int i = optind; i < argc; i++) {
+    ok = replay(argv[i], threshold, tolerance, verbose, total) && ok;
+  }
+
+  printf("\nThreshold 0x%04X, tolerance %lu ms:\n", threshold, tolerance);
+  printf("  Labeled pulses:    %u\n", total.labels);
+  printf("  Detected pulses:   %u\n", total.detected);
+  printf("  True positives:    %u\n", total.true_pos);
+  printf("  False positives:   %u\n", total.false_pos);
+  printf("  False negatives:   %u\n", total.false_neg);
+  if (total.labels) {
+    printf("  Recall:            %.3f%%\n", 100.0 * total.true_pos / total.labels);
+  }
+  if (total.detected) {
+    printf("  Precision:         %.3f%%\n", 100.0 * total.true_pos / total.detected);
+  }
+  if (total.cpu > 0) {
+    printf("  Throughput:        %.1f Msamples/s, %.0fx real time\n",
+	   total.samples / total.cpu * 1e-6, total.duration / total.cpu);
+  }
+
+  return ok ? 0 : 1;
+}
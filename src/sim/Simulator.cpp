@@ -0,0 +1,1072 @@
+//------------------------------------------------------------------------------
+//   Copyright 2014 Janick Bergeron
+//   All Rights Reserved Worldwide
+//
+//   Licensed under the Apache License, Version 2.0 (the
+//   "License"); you may not use this file except in
+//   compliance with the License.  You may obtain a copy of
+//   the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in
+//   writing, software distributed under the License is
+//   distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+//   CONDITIONS OF ANY KIND, either express or implied.  See
+//   the License for the specific language governing
+//   permissions and limitations under the License.
+//------------------------------------------------------------------------------
+
+
+
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+#include <algorithm>
+
+#include <Arduino.h>
+#include <avr/sleep.h>
+
+#include "Simulator.h"
+
+extern "C" void PCINT0_vect(void) __attribute__((weak));
+extern "C" void ADC_vect(void) __attribute__((weak));
+extern "C" void WDT_vect(void) __attribute__((weak));
+
+/** The Arduino core's millisecond counter only holds the sketch's adjustments:
+ *  Timer0 is simulated by Sim::timer0()
+ */
+extern "C" {
+  volatile unsigned long timer0_millis = 0;
+}
+
+
+//
+// I/O registers
+//
+static uint8_t read_pins();
+static void    write_port(uint8_t value);
+static void    write_ddr(uint8_t value);
+static void    write_pinb(uint8_t value);
+static uint8_t read_sreg();
+static void    write_sreg(uint8_t value);
+static void    write_wdtcr(uint8_t value);
+static void    write_admux(uint8_t value);
+static void    write_adcsra(uint8_t value);
+
+Sim::Register_t PORTB(0, write_port), DDRB(0, write_ddr), PINB(read_pins, write_pinb);
+Sim::Register_t GIMSK, PCMSK, GIFR;
+Sim::Register_t SREG(read_sreg, write_sreg), MCUCR, MCUSR, WDTCR(0, write_wdtcr), PRR;
+Sim::Register_t ADMUX(0, write_admux), ADCSRA(0, write_adcsra), ADCSRB, ADCL, ADCH, DIDR0;
+Sim::Register_t TCCR0A, TCCR0B, TCNT0, TCCR1, TCNT1, GTCCR, OCR1A, OCR1C, TIMSK, TIFR;
+
+
+namespace Sim {
+
+  stats_s stats;
+
+  uint8_t eeprom[EEPROM_SIZE];
+  int32_t eeprom_writes = -1;
+  uint8_t eeprom_torn   = 0xFF;
+
+  /** Virtual time, in microseconds */
+  static uint64_t s_now = 0;
+  static uint64_t s_end = 0;
+  static uint64_t s_awake_since = 0;
+  static uint64_t s_timer0_stopped = 0;  ///< Total time Timer0 was stopped
+  static uint64_t s_watchdog_start = 0;  ///< When the watchdog timeout (re)started
+
+  static bool    s_interrupts = true;
+  static bool    s_pcint_pending = false;
+  static bool    s_in_isr = false;
+  static bool    s_sampled = false;      ///< Has the light sensor been sampled since reset?
+  static uint8_t s_sleep_mode = SLEEP_MODE_IDLE;
+
+  /** Input pins driven from outside the chip */
+  static uint8_t s_driven = 0;
+  static uint8_t s_driven_levels = 0;
+
+  static int s_analog[4] = {-1, -1, -1, -1};
+
+  //
+  // The ADC, when started with ADSC
+  //
+  static const uint64_t ADC_CLOCK_US = 8;   ///< 125kHz
+
+  static bool     s_adc_running = false;
+  static bool     s_adc_pending = false;  ///< Interrupt waiting for interrupts to be enabled
+  static uint8_t  s_adc_channel = 0;      ///< Channel of the conversion in progress
+  static uint64_t s_adc_lock    = 0;      ///< Time at which that channel is locked
+  static uint64_t s_adc_done    = 0;      ///< Time at which that conversion completes
+
+  static idle_hint_t s_idle_hint = 0;
+
+  static bool s_verbose = false;
+
+  static const char *s_eeprom_file = 0;
+
+  static struct timespec s_wall_start;
+
+
+  //
+  // The meter, seen by the light sensor on analog input #3
+  //
+  static const uint8_t  LIGHT_PIN = 3;
+  static const uint16_t AMBIENT   = 0x0100;
+  static const uint16_t LIT       = 0x0200;  ///< Above ambient
+  static const uint16_t NOISE     = 8;       ///< Peak-to-peak
+
+  static uint32_t s_load        = 500;       ///< Base load, in watts
+  static uint32_t s_wh_per_pulse = 1;
+  static uint64_t s_width       = 30000;     ///< Pulse width, in us (S0 pulses are at least 30ms)
+  static uint64_t s_pulse_start = 0;
+  static uint64_t s_next_pulse  = 0;
+  static uint32_t s_pulses      = 0;
+  static uint32_t s_random      = 1;
+
+
+  //
+  // The DS1302 RTC, on pins 0 (SCLK), 1 (IO) & 2 (CE)
+  //
+  static const uint8_t SCLK = _BV(0);
+  static const uint8_t IO   = _BV(1);
+  static const uint8_t CE   = _BV(2);
+
+  static int64_t s_clock_base = 0;   ///< RTC time at s_now == 0, in seconds
+
+  static struct {
+    uint8_t cmd;
+    uint8_t nbits;
+    bool    cmd_done;
+    bool    reading;
+    bool    burst;
+    bool    ram;
+    uint8_t index;
+    uint8_t shift;
+    bool    driving;
+    bool    out;
+    bool    clock_written;
+    uint8_t regs[8];
+    uint8_t wp;
+    uint8_t mem[31];
+  } rtc;
+
+
+  //
+  // Scripted events
+  //
+  struct event_s {
+    uint64_t time;
+    char     cmd[8];
+    int      pin;
+    long     value;
+    int64_t  clock;
+  };
+
+  static std::vector<event_s> s_events;
+  static size_t               s_next_event = 0;
+}
+
+using namespace Sim;
+
+
+static uint8_t
+bcd(uint8_t value)
+{
+  return ((value / 10) << 4) | (value % 10);
+}
+
+
+static uint8_t
+bin(uint8_t value)
+{
+  return (value >> 4) * 10 + (value & 0x0F);
+}
+
+
+/** Levels on the pins, as seen from inside and outside the chip */
+static uint8_t
+levels()
+{
+  uint8_t port = PORTB.m_value;
+  uint8_t ddr  = DDRB.m_value;
+
+  // Undriven inputs are pulled up if PORTB is set, pulled down otherwise
+  uint8_t in = (s_driven_levels & s_driven) | (port & ~s_driven);
+  if (rtc.driving && !(ddr & IO)) in = (in & ~IO) | ((rtc.out) ? IO : 0);
+
+  return ((port & ddr) | (in & ~ddr)) & ((1 << PINS) - 1);
+}
+
+
+/** Current contents of the DS1302 clock registers */
+static void
+rtc_read_clock(uint8_t *regs)
+{
+  time_t t = Sim::clock();
+  struct tm tm;
+  gmtime_r(&t, &tm);
+
+  regs[0] = bcd(tm.tm_sec);
+  regs[1] = bcd(tm.tm_min);
+  regs[2] = bcd(tm.tm_hour);
+  regs[3] = bcd(tm.tm_mday);
+  regs[4] = bcd(tm.tm_mon + 1);
+  regs[5] = tm.tm_wday + 1;
+  regs[6] = bcd(tm.tm_year % 100);
+  regs[7] = rtc.wp;
+}
+
+
+static void
+rtc_write_clock(const uint8_t *regs)
+{
+  struct tm tm;
+  memset(&tm, 0, sizeof(tm));
+  tm.tm_sec  = bin(regs[0] & 0x7F);
+  tm.tm_min  = bin(regs[1] & 0x7F);
+  tm.tm_hour = bin(regs[2] & 0x3F);
+  tm.tm_mday = bin(regs[3] & 0x3F);
+  tm.tm_mon  = bin(regs[4] & 0x1F) - 1;
+  tm.tm_year = bin(regs[6]) + 100;
+  rtc.wp = regs[7] & 0x80;
+
+  Sim::set_clock(timegm(&tm));
+}
+
+
+static uint8_t
+rtc_read()
+{
+  if (rtc.ram) return (rtc.index < sizeof(rtc.mem)) ? rtc.mem[rtc.index] : 0;
+  return (rtc.index < 8) ? rtc.regs[rtc.index] : 0;
+}
+
+
+static void
+rtc_write(uint8_t value)
+{
+  if (rtc.wp && !(!rtc.ram && rtc.index == 7)) return;
+
+  if (rtc.ram) {
+    if (rtc.index < sizeof(rtc.mem)) rtc.mem[rtc.index] = value;
+    return;
+  }
+  if (rtc.index < 8) {
+    rtc.regs[rtc.index] = value;
+    rtc.clock_written = true;
+  }
+}
+
+
+/** The DS1302 reacts to the pins */
+static void
+rtc_update(uint8_t before,
+	   uint8_t after)
+{
+  if (!(before & CE) && (after & CE)) {
+    // Start of a session
+    rtc.cmd      = 0;
+    rtc.nbits    = 0;
+    rtc.cmd_done = false;
+    rtc.reading  = false;
+    rtc.driving  = false;
+    rtc.clock_written = false;
+    stats.rtc_accesses++;
+    return;
+  }
+
+  if ((before & CE) && !(after & CE)) {
+    // End of a session
+    rtc.driving = false;
+    if (rtc.clock_written) rtc_write_clock(rtc.regs);
+    return;
+  }
+
+  if (!(after & CE)) return;
+
+  if (!(before & SCLK) && (after & SCLK)) {
+    // Rising edge: the DS1302 samples the IO pin, unless it is being read
+    bool bit = (after & IO) != 0;
+
+    if (!rtc.cmd_done) {
+      rtc.cmd |= bit << rtc.nbits;
+      if (++rtc.nbits < 8) return;
+
+      rtc.nbits    = 0;
+      rtc.cmd_done = true;
+      if (!(rtc.cmd & 0x80)) {
+	// Not a valid command: ignore the rest of the session
+	rtc.reading = false;
+	rtc.index   = 0xFF;
+	return;
+      }
+      rtc.reading = rtc.cmd & 0x01;
+      rtc.ram     = rtc.cmd & 0x40;
+      rtc.index   = (rtc.cmd >> 1) & 0x1F;
+      rtc.burst   = (rtc.index == 0x1F);
+      if (rtc.burst) rtc.index = 0;
+      // Snapshot the clock, for reading or for partial updates
+      rtc_read_clock(rtc.regs);
+      return;
+    }
+
+    if (rtc.reading) return;
+
+    rtc.shift |= bit << rtc.nbits;
+    if (++rtc.nbits < 8) return;
+    rtc_write(rtc.shift);
+    rtc.shift = 0;
+    rtc.nbits = 0;
+    if (rtc.burst) rtc.index++;
+    return;
+  }
+
+  if ((before & SCLK) && !(after & SCLK)) {
+    // Falling edge: the DS1302 outputs the next bit when being read
+    if (!rtc.cmd_done || !rtc.reading) return;
+
+    rtc.out     = (rtc_read() >> rtc.nbits) & 0x01;
+    rtc.driving = true;
+    if (++rtc.nbits < 8) return;
+    rtc.nbits = 0;
+    if (rtc.burst) rtc.index++;
+  }
+}
+
+
+/** Service an interrupt as soon as interrupts are enabled */
+static void
+pcint()
+{
+  if (!PCINT0_vect) return;
+  if (!s_interrupts || s_in_isr) {
+    s_pcint_pending = true;
+    return;
+  }
+
+  s_pcint_pending = false;
+  s_in_isr = true;
+  stats.interrupts++;
+  PCINT0_vect();
+  s_in_isr = false;
+}
+
+
+/** Something changed on the pins */
+static void
+update(uint8_t before)
+{
+  uint8_t after = levels();
+  if (after == before) return;
+
+  rtc_update(before, after);
+
+  // The RTC may now be driving the IO pin
+  uint8_t now = levels();
+
+  if (s_verbose && !(now & CE)) {
+    uint8_t leds = (before ^ now) & (_BV(0) | _BV(1) | _BV(5));
+    if (leds) printf("%10.3f  LEDs: red %d, yellow %d, green %d\n",
+		     s_now / 1e6, (now >> 0) & 1, (now >> 1) & 1, (now >> 5) & 1);
+  }
+
+  if ((GIMSK.m_value & _BV(PCIE)) && ((before ^ now) & PCMSK.m_value)) pcint();
+}
+
+
+static uint8_t
+read_pins()
+{
+  return levels();
+}
+
+
+static uint8_t
+read_sreg()
+{
+  return (s_interrupts) ? 0x80 : 0;
+}
+
+
+static void
+write_sreg(uint8_t value)
+{
+  Sim::interrupts(value & 0x80);
+}
+
+
+static void
+write_wdtcr(uint8_t value)
+{
+  WDTCR.m_value = value;
+  s_watchdog_start = s_now;
+}
+
+
+static void
+write_admux(uint8_t value)
+{
+  ADMUX.m_value = value;
+
+  // The channel of a conversion started with ADSC is only locked one ADC clock later
+  if (s_adc_running && s_now < s_adc_lock) s_adc_channel = value & 0x0F;
+}
+
+
+static void
+write_adcsra(uint8_t value)
+{
+  // ADIF is cleared by writing a one to it
+  uint8_t flag = ADCSRA.m_value & _BV(ADIF) & ~value;
+  ADCSRA.m_value = (value & ~_BV(ADIF)) | flag;
+
+  if (!(value & _BV(ADEN))) s_adc_running = false;
+  else if ((value & _BV(ADSC)) && !s_adc_running) {
+    // The first conversion takes 25 ADC clocks
+    s_adc_running = true;
+    s_adc_channel = ADMUX.m_value & 0x0F;
+    s_adc_lock    = s_now + ADC_CLOCK_US;
+    s_adc_done    = s_now + 25 * ADC_CLOCK_US;
+  }
+
+  if (s_adc_running) ADCSRA.m_value |= _BV(ADSC);
+  else ADCSRA.m_value &= ~_BV(ADSC);
+}
+
+
+static void
+write_port(uint8_t value)
+{
+  if (!s_sampled) stats.boot_writes++;
+  uint8_t before = levels();
+  PORTB.m_value = value;
+  update(before);
+}
+
+
+static void
+write_ddr(uint8_t value)
+{
+  if (!s_sampled) stats.boot_writes++;
+  uint8_t before = levels();
+  DDRB.m_value = value;
+  update(before);
+}
+
+
+static void
+write_pinb(uint8_t value)
+{
+  // Writing a 1 to PINB toggles the PORTB bit
+  write_port(PORTB.m_value ^ value);
+}
+
+
+//
+// Arduino core
+//
+void
+pinMode(uint8_t pin,
+	uint8_t mode)
+{
+  uint8_t mask = _BV(pin);
+  if (mode == OUTPUT) {
+    DDRB |= mask;
+    return;
+  }
+  DDRB &= ~mask;
+  if (mode == INPUT_PULLUP) PORTB |= mask;
+  else PORTB &= ~mask;
+}
+
+
+void
+digitalWrite(uint8_t pin,
+	     uint8_t value)
+{
+  if (value == LOW) PORTB &= ~_BV(pin);
+  else PORTB |= _BV(pin);
+}
+
+
+int
+digitalRead(uint8_t pin)
+{
+  return (PINB >> pin) & 0x01;
+}
+
+
+int
+analogRead(uint8_t pin)
+{
+  return Sim::analog(pin);
+}
+
+
+//
+// The meter
+//
+/** Power drawn at the current time, in watts */
+static uint32_t
+power()
+{
+  time_t t = Sim::clock();
+  struct tm tm;
+  gmtime_r(&t, &tm);
+
+  uint32_t watts = s_load;
+  if (tm.tm_hour >= 7 && tm.tm_hour < 9)   watts += 500;   // Breakfast
+  if (tm.tm_hour >= 17 && tm.tm_hour < 22) watts += 1500;  // Dinner, laundry, etc...
+  return watts;
+}
+
+
+/** Emit the pulses that are due */
+static void
+meter()
+{
+  while (s_next_pulse <= s_now) {
+    s_pulse_start = s_next_pulse;
+    s_pulses++;
+    uint32_t watts = power();
+    if (watts == 0) watts = 1;
+    s_next_pulse += (uint64_t) s_wh_per_pulse * 3600000000ULL / watts;
+  }
+}
+
+
+/** Level on an analog input */
+static uint16_t
+sample(uint8_t pin)
+{
+  if (pin < 4 && s_analog[pin] >= 0) return s_analog[pin];
+  if (pin != LIGHT_PIN) return 0;
+
+  if (!s_sampled) {
+    s_sampled = true;
+    stats.boot_us = s_now;
+  }
+
+  meter();
+  s_random = s_random * 1103515245 + 12345;
+  uint16_t value = AMBIENT + (s_random >> 16) % NOISE;
+  if (s_pulses > 0 && s_now - s_pulse_start < s_width) value += LIT;
+
+  return value;
+}
+
+
+uint16_t
+Sim::analog(uint8_t pin)
+{
+  // A conversion takes 13 ADC clocks at 125kHz
+  advance(104);
+  return sample(pin);
+}
+
+
+/** Service the ADC interrupt as soon as interrupts are enabled */
+static void
+adc_interrupt()
+{
+  if (!s_interrupts || s_in_isr) {
+    s_adc_pending = true;
+    return;
+  }
+
+  if (!ADC_vect) {
+    fprintf(stderr, "%10.3f  ADC interrupt without a service routine: the AVR resets\n", s_now / 1e6);
+    exit(1);
+  }
+
+  // The flag is cleared when the interrupt is serviced
+  s_adc_pending = false;
+  ADCSRA.m_value &= ~_BV(ADIF);
+  s_in_isr = true;
+  ADC_vect();
+  s_in_isr = false;
+}
+
+
+/** A conversion started with ADSC completes.
+ *  In free-running mode, the next one starts right away, on the channel selected at that time.
+ */
+static void
+adc_complete()
+{
+  uint16_t value = sample(s_adc_channel);
+  ADCL.m_value = value & 0xFF;
+  ADCH.m_value = value >> 8;
+  ADCSRA.m_value |= _BV(ADIF);
+
+  if (ADCSRA.m_value & _BV(ADATE)) {
+    s_adc_channel = ADMUX.m_value & 0x0F;
+    s_adc_lock    = s_now;
+    s_adc_done    = s_now + 13 * ADC_CLOCK_US;
+  }
+  else {
+    s_adc_running = false;
+    ADCSRA.m_value &= ~_BV(ADSC);
+  }
+
+  if (ADCSRA.m_value & _BV(ADIE)) adc_interrupt();
+}
+
+
+void
+Sim::override_analog(uint8_t pin,
+		     int     value)
+{
+  if (pin < 4) s_analog[pin] = value;
+}
+
+
+void
+Sim::load(uint32_t watts)
+{
+  s_load = watts;
+}
+
+
+uint32_t
+Sim::pulses()
+{
+  meter();
+  return s_pulses;
+}
+
+
+//
+// Time
+//
+uint64_t
+Sim::now()
+{
+  return s_now;
+}
+
+
+uint64_t
+Sim::timer0()
+{
+  return s_now - s_timer0_stopped;
+}
+
+
+void
+Sim::set_clock(int64_t seconds)
+{
+  s_clock_base = seconds - (int64_t) (s_now / 1000000);
+}
+
+
+int64_t
+Sim::clock()
+{
+  return s_clock_base + (int64_t) (s_now / 1000000);
+}
+
+
+static void
+execute(const event_s &event)
+{
+  if (strcmp(event.cmd, "pin") == 0) {
+    Sim::drive(event.pin, (uint8_t) event.value);
+  }
+  else if (strcmp(event.cmd, "adc") == 0) {
+    Sim::override_analog(event.pin, event.value);
+  }
+  else if (strcmp(event.cmd, "load") == 0) {
+    Sim::load(event.value);
+  }
+  else if (strcmp(event.cmd, "clock") == 0) {
+    Sim::set_clock(event.clock);
+  }
+}
+
+
+void
+Sim::advance(uint64_t us)
+{
+  uint64_t until = s_now + us;
+
+  for (;;) {
+    uint64_t next = (s_adc_running && s_adc_done <= until) ? s_adc_done : until;
+    if (s_next_event < s_events.size() && s_events[s_next_event].time <= next) {
+      const event_s &event = s_events[s_next_event++];
+      if (event.time > s_now) s_now = event.time;
+      execute(event);
+      continue;
+    }
+    if (!s_adc_running || s_adc_done > until) break;
+
+    s_now = s_adc_done;
+    adc_complete();
+  }
+  s_now = until;
+}
+
+
+/** Service an interrupt that woke up the CPU.
+ *  Without a service routine, the AVR would jump to the reset vector.
+ */
+static void
+wake_up(void        (*isr)(void),
+	const char   *name)
+{
+  if (!isr) {
+    fprintf(stderr, "%10.3f  %s interrupt without a service routine: the AVR resets\n", s_now / 1e6, name);
+    exit(1);
+  }
+  if (!s_interrupts || s_in_isr) return;
+
+  s_in_isr = true;
+  isr();
+  s_in_isr = false;
+}
+
+
+/** Convert in ADC noise reduction mode, with Timer0 stopped.
+ *  Returns TRUE if the conversion complete interrupt woke up the CPU.
+ */
+static bool
+adc_conversion()
+{
+  uint64_t start = s_now;
+  uint16_t value = Sim::analog(ADMUX.m_value & 0x0F);
+  s_timer0_stopped += s_now - start;
+  stats.adc_us     += s_now - start;
+
+  ADCL.m_value   = value & 0xFF;
+  ADCH.m_value   = value >> 8;
+  ADCSRA.m_value = (ADCSRA.m_value & ~_BV(ADSC)) | _BV(ADIF);
+  if (!(ADCSRA.m_value & _BV(ADIE))) return false;
+
+  // The flag is cleared when the interrupt is serviced
+  ADCSRA.m_value &= ~_BV(ADIF);
+  wake_up(ADC_vect, "ADC");
+  return true;
+}
+
+
+/** Sleep with Timer0 stopped until the watchdog or a pin-change interrupt,
+ *  then restart the clock
+ */
+static void
+power_down()
+{
+  uint64_t start = s_now;
+
+  uint8_t  wdtcr    = WDTCR.m_value;
+  bool     watchdog = wdtcr & _BV(WDIE);
+  uint64_t timeout  = 16000ULL << (((wdtcr & _BV(WDP3)) ? 8 : 0) | (wdtcr & 0x07));
+  uint64_t wake     = s_end;
+  if (watchdog) {
+    wake = s_watchdog_start + timeout;
+    while (wake < s_now) wake += timeout;
+  }
+
+  // Only the scripted events causing a pin-change interrupt wake up the CPU
+  bool woken = false;
+  while (!woken && s_next_event < s_events.size() && s_events[s_next_event].time < wake) {
+    uint32_t interrupts = stats.interrupts;
+    advance(s_events[s_next_event].time - s_now);
+    woken = (stats.interrupts != interrupts);
+  }
+  if (!woken) {
+    advance(wake - s_now);
+    if (watchdog) {
+      s_watchdog_start = s_now;
+      stats.watchdogs++;
+      wake_up(WDT_vect, "Watchdog");
+    }
+  }
+
+  advance(WAKEUP_US);
+  s_timer0_stopped    += s_now - start;
+  stats.power_down_us += s_now - start;
+}
+
+
+void
+Sim::sleep()
+{
+  uint64_t awake = s_now - s_awake_since;
+  if (awake > stats.max_awake_us) stats.max_awake_us = awake;
+  uint64_t start = s_now;
+
+  if (s_sleep_mode != SLEEP_MODE_IDLE) {
+    // The ADC noise reduction mode starts a conversion, if the ADC is enabled.
+    // Otherwise, only the watchdog or a pin change can wake up the CPU.
+    if (s_sleep_mode != SLEEP_MODE_ADC || !(ADCSRA.m_value & _BV(ADEN)) || !adc_conversion()) power_down();
+    stats.slept_us += s_now - start;
+    s_awake_since = s_now;
+    return;
+  }
+
+  // Wake up on the next Timer0 tick (every millisecond), or earlier on a scripted event.
+  // Ticks before the sketch's next deadline would only make it go back to sleep.
+  uint64_t wake = s_now + 1000 - timer0() % 1000;
+  if (s_idle_hint && s_sleep_mode == SLEEP_MODE_IDLE) {
+    unsigned long ms = s_idle_hint();
+    if (ms > 1) {
+      stats.skipped_ticks += ms - 1;
+      wake += (ms - 1) * 1000;
+    }
+  }
+  if (s_next_event < s_events.size() && s_events[s_next_event].time < wake) {
+    wake = s_events[s_next_event].time;
+  }
+  if (wake < s_now) wake = s_now;
+
+  stats.slept_us += wake - s_now;
+  advance(wake - s_now);
+  s_awake_since = s_now;
+}
+
+
+void
+Sim::idle_hint(idle_hint_t hint)
+{
+  s_idle_hint = hint;
+}
+
+
+void
+Sim::select_sleep_mode(uint8_t mode)
+{
+  s_sleep_mode = mode;
+}
+
+
+void
+Sim::interrupts(bool enabled)
+{
+  s_interrupts = enabled;
+  if (enabled && s_pcint_pending) pcint();
+  if (enabled && s_adc_pending) adc_interrupt();
+}
+
+
+void
+Sim::drive(uint8_t pin,
+	   uint8_t level)
+{
+  uint8_t before = levels();
+  if (level == 0xFF) s_driven &= ~_BV(pin);
+  else {
+    s_driven |= _BV(pin);
+    if (level) s_driven_levels |= _BV(pin);
+    else s_driven_levels &= ~_BV(pin);
+  }
+  update(before);
+}
+
+
+bool
+Sim::pin(uint8_t pin)
+{
+  return (levels() >> pin) & 0x01;
+}
+
+
+//
+// Scenario
+//
+static bool
+parse_clock(const char *date,
+	    const char *time,
+	    int64_t    *seconds)
+{
+  struct tm tm;
+  memset(&tm, 0, sizeof(tm));
+  if (sscanf(date, "%d-%d-%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday) != 3) return false;
+  if (time && sscanf(time, "%d:%d:%d", &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 3) return false;
+  tm.tm_year -= 1900;
+  tm.tm_mon  -= 1;
+  *seconds = timegm(&tm);
+  return true;
+}
+
+
+static bool
+event_before(const event_s &a,
+	     const event_s &b)
+{
+  return a.time < b.time;
+}
+
+
+bool
+Sim::script(const char *fname)
+{
+  FILE *fp = fopen(fname, "r");
+  if (fp == 0) {
+    perror(fname);
+    return false;
+  }
+
+  char line[256];
+  int  lineno = 0;
+  bool ok     = true;
+  while (fgets(line, sizeof(line), fp)) {
+    lineno++;
+
+    char  *p = line;
+    while (*p == ' ' || *p == '\t') p++;
+    if (*p == '#' || *p == '\n' || *p == '\0') continue;
+
+    double  secs;
+    char    cmd[8], arg1[32], arg2[32];
+    int     n = sscanf(p, "%lf %7s %31s %31s", &secs, cmd, arg1, arg2);
+    event_s event;
+    memset(&event, 0, sizeof(event));
+    event.time = (uint64_t) (secs * 1e6);
+    strcpy(event.cmd, cmd);
+
+    bool valid = (n >= 3);
+    if (valid && strcmp(cmd, "pin") == 0) {
+      event.pin   = atoi(arg1);
+      event.value = (arg2[0] == 'z') ? 0xFF : atoi(arg2);
+      valid = (n == 4 && event.pin < PINS);
+    }
+    else if (valid && strcmp(cmd, "adc") == 0) {
+      event.pin   = atoi(arg1);
+      event.value = atol(arg2);
+      valid = (n == 4 && event.pin < 4);
+    }
+    else if (valid && strcmp(cmd, "load") == 0) {
+      event.value = atol(arg1);
+    }
+    else if (valid && strcmp(cmd, "clock") == 0) {
+      valid = (n == 4 && parse_clock(arg1, arg2, &event.clock));
+    }
+    else valid = false;
+
+    if (!valid) {
+      fprintf(stderr, "%s:%d: Invalid event: %s", fname, lineno, line);
+      ok = false;
+      continue;
+    }
+    s_events.push_back(event);
+  }
+  fclose(fp);
+
+  std::stable_sort(s_events.begin() + s_next_event, s_events.end(), event_before);
+  return ok;
+}
+
+
+static void
+usage(const char *argv0)
+{
+  fprintf(stderr, "Usage: %s [-d days] [-c YYYY-MM-DD] [-l watts] [-k Wh/pulse] [-w ms] [-s script] [-e eeprom.bin] [-v]\n", argv0);
+  exit(1);
+}
+
+
+void
+Sim::init(int    argc,
+	  char **argv)
+{
+  double  days  = 1;
+  int64_t start = 0;
+  parse_clock("2014-05-01", "00:00:00", &start);
+
+  int opt;
+  while ((opt = getopt(argc, argv, "d:c:l:k:w:s:e:v")) != -1) {
+    switch (opt) {
+    case 'd': days = atof(optarg); break;
+    case 'c': if (!parse_clock(optarg, 0, &start)) usage(argv[0]); break;
+    case 'l': s_load = atol(optarg); break;
+    case 'k': s_wh_per_pulse = atol(optarg); break;
+    case 'w': s_width = atol(optarg) * 1000; break;
+    case 's': if (!script(optarg)) exit(1); break;
+    case 'e': s_eeprom_file = optarg; break;
+    case 'v': s_verbose = true; break;
+    default:  usage(argv[0]);
+    }
+  }
+
+  memset(eeprom, 0xFF, sizeof(eeprom));
+  if (s_eeprom_file) {
+    FILE *fp = fopen(s_eeprom_file, "rb");
+    if (fp) {
+      if (fread(eeprom, 1, sizeof(eeprom), fp) != sizeof(eeprom)) {
+	fprintf(stderr, "%s: Short EEPROM image\n", s_eeprom_file);
+      }
+      fclose(fp);
+    }
+  }
+
+  set_clock(start);
+  s_end = s_now + (uint64_t) (days * 86400e6);
+  s_next_pulse = 3600000000ULL * s_wh_per_pulse / power();
+
+  // The button (pin 4) is released, pulled down
+  drive(4, LOW);
+
+  // Events scripted at power-up
+  advance(0);
+
+  clock_gettime(CLOCK_MONOTONIC, &s_wall_start);
+}
+
+
+bool
+Sim::running()
+{
+  return s_now < s_end;
+}
+
+
+static double
+percent(uint64_t us)
+{
+  return (s_now > 0) ? 100.0 * us / s_now : 0;
+}
+
+
+void
+Sim::report()
+{
+  struct timespec wall;
+  clock_gettime(CLOCK_MONOTONIC, &wall);
+  double elapsed = (wall.tv_sec - s_wall_start.tv_sec) + (wall.tv_nsec - s_wall_start.tv_nsec) / 1e9;
+
+  printf("Simulated %.1f days in %.2f secs (%.0fx real time)\n",
+	 s_now / 86400e6, elapsed, (elapsed > 0) ? s_now / 1e6 / elapsed : 0);
+  printf("  loop() calls:      %llu\n", (unsigned long long) stats.loops);
+  printf("  Skipped ticks:     %llu\n", (unsigned long long) stats.skipped_ticks);
+  // The sketch's code runs in no virtual time: only busy-waits (delays, RTC I/O) count as awake
+  printf("  Asleep:            %.2f%% (any sleep mode)\n", percent(stats.slept_us));
+  printf("    Idle:            %.2f%%\n", percent(stats.slept_us - stats.adc_us - stats.power_down_us));
+  printf("    ADC noise red.:  %.2f%%\n", percent(stats.adc_us));
+  printf("    Power-down:      %.2f%%\n", percent(stats.power_down_us));
+  printf("  Longest awake:     %llu us\n", (unsigned long long) stats.max_awake_us);
+  printf("  Interrupts:        %u\n", stats.interrupts);
+  printf("  Watchdog wake-ups: %u\n", stats.watchdogs);
+  printf("  RTC sessions:      %u\n", stats.rtc_accesses);
+  printf("  Boot:              %llu us, %u pin writes to the first light sample\n",
+	 (unsigned long long) stats.boot_us, stats.boot_writes);
+  printf("  Meter pulses:      %u\n", pulses());
+
+  // Typical ATtiny85 supply current at 16MHz & 5V, from the datasheet curves, in mA.
+  // Excludes the LEDs, the light sensor and the DigiSpark regulator & power LED.
+  const double ACTIVE = 9.0, IDLE = 2.5, ADC_NOISE_REDUCTION = 1.2, POWER_DOWN = 0.006;
+  uint64_t idle = stats.slept_us - stats.adc_us - stats.power_down_us;
+  double   mA   = (ACTIVE * (s_now - stats.slept_us) + IDLE * idle
+		   + ADC_NOISE_REDUCTION * stats.adc_us + POWER_DOWN * stats.power_down_us);
+  printf("  MCU current:       %.2f mA (estimated average)\n", (s_now > 0) ? mA / s_now : 0);
+
+  if (s_eeprom_file) {
+    FILE *fp = fopen(s_eeprom_file, "wb");
+    if (fp == 0 || fwrite(eeprom, 1, sizeof(eeprom), fp) != sizeof(eeprom)) perror(s_eeprom_file);
+    if (fp) fclose(fp);
+  }
+}
@@ -0,0 +1,206 @@
+//------------------------------------------------------------------------------
+//   Copyright 2014 Janick Bergeron
+//   All Rights Reserved Worldwide
+//
+//   Licensed under the Apache License, Version 2.0 (the
+//   "License"); you may not use this file except in
+//   compliance with the License.  You may obtain a copy of
+//   the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in
+//   writing, software distributed under the License is
+//   distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+//   CONDITIONS OF ANY KIND, either express or implied.  See
+//   the License for the specific language governing
+//   permissions and limitations under the License.
+//------------------------------------------------------------------------------
+
+
+
+#ifndef _Simulator_h
+#define _Simulator_h
+
+#include <stdint.h>
+
+/** Host simulation of the ATtiny85 and the PowerMinder hardware.
+ *
+ *  Time is virtual: it only advances when the sketch waits (delay, sleep)
+ *  or performs an operation that takes time (analogRead). A sleeping CPU
+ *  wakes up on the next Timer0 tick or pin-change interrupt. In ADC noise
+ *  reduction mode, it wakes up at the end of the conversion. In power-down mode,
+ *  Timer0 is stopped and it wakes up on the watchdog or a pin-change interrupt.
+ *
+ *  The light sensor sees a meter whose LED pulses at a rate that depends
+ *  on a scripted load. The DS1302 RTC is simulated at the pin level,
+ *  through the same 3-wire protocol as the real chip.
+ */
+namespace Sim {
+
+  /** An 8-bit I/O register. Some registers have side effects when accessed */
+  class Register_t {
+
+  public:
+    typedef uint8_t (*read_t)();
+    typedef void    (*write_t)(uint8_t value);
+
+    Register_t(read_t  read  = 0,
+	       write_t write = 0)
+      : m_value(0), m_read(read), m_write(write)
+    {
+    }
+
+    operator uint8_t() const
+    {
+      return (m_read) ? m_read() : m_value;
+    }
+
+    Register_t& operator=(uint8_t value)
+    {
+      if (m_write) m_write(value);
+      else m_value = value;
+      return *this;
+    }
+
+    Register_t& operator|=(uint8_t value) {return *this = *this | value;}
+    Register_t& operator&=(uint8_t value) {return *this = *this & value;}
+    Register_t& operator^=(uint8_t value) {return *this = *this ^ value;}
+
+    uint8_t m_value;
+
+  private:
+    read_t  m_read;
+    write_t m_write;
+  };
+
+
+  /** Number of I/O pins on PORTB */
+  const uint8_t PINS = 6;
+
+  /** Current virtual time, in microseconds */
+  uint64_t now();
+
+  /** Time during which Timer0 was running, in microseconds */
+  uint64_t timer0();
+
+  /** Let virtual time pass, processing the scripted events as they occur */
+  void advance(uint64_t us);
+
+  /** Sleep until the next interrupt, in the selected sleep mode */
+  void sleep();
+
+  /** Time to resume after a power-down: 1K clocks for the PLL clock source, in microseconds */
+  const uint64_t WAKEUP_US = 64;
+
+  /** Function returning the number of milliseconds until the sketch has something to do
+   *  (0 == unknown).
+   */
+  typedef unsigned long (*idle_hint_t)();
+
+  /** When sleeping in idle mode, skip the Timer0 ticks that would only wake up
+   *  the sketch to find nothing to do, as told by the hint function.
+   */
+  void idle_hint(idle_hint_t hint);
+
+  /** Set the sleep mode used by sleep() */
+  void select_sleep_mode(uint8_t mode);
+
+  /** Enable/disable interrupts */
+  void interrupts(bool enabled);
+
+  /** Drive an input pin from outside the chip (0xFF == let it float) */
+  void drive(uint8_t pin,
+	     uint8_t level);
+
+  /** Level on a pin */
+  bool pin(uint8_t pin);
+
+  /** Sample an analog input, after the conversion time */
+  uint16_t analog(uint8_t pin);
+
+  /** Override an analog input (-1 == back to the meter model) */
+  void override_analog(uint8_t pin,
+		       int     value);
+
+
+  //
+  // The meter
+  //
+  /** Set the base load, in watts */
+  void load(uint32_t watts);
+
+  /** Number of pulses emitted by the meter so far */
+  uint32_t pulses();
+
+
+  //
+  // The DS1302 RTC
+  //
+  /** Set the RTC time, in seconds since 1970-01-01 00:00:00 */
+  void set_clock(int64_t seconds);
+
+  /** RTC time, in seconds since 1970-01-01 00:00:00 */
+  int64_t clock();
+
+
+  //
+  // EEPROM
+  //
+  const uint16_t EEPROM_SIZE = 512;
+
+  extern uint8_t eeprom[EEPROM_SIZE];
+
+  /** Power failure: EEPROM writes until the one interrupted by the power loss,
+   *  after which writes are lost (-1 == no power failure)
+   */
+  extern int32_t eeprom_writes;
+
+  /** Bits left erased in the byte whose write is interrupted (0xFF == the whole byte) */
+  extern uint8_t eeprom_torn;
+
+
+  //
+  // Scenario
+  //
+  /** Read a script of timed events. Returns FALSE on error.
+   *
+   *  Each line is "<seconds> <command> <arguments>", where the command is one of:
+   *    pin <n> <0|1|z>     Drive (or let float) input pin n
+   *    adc <n> <value|-1>  Override analog input n, or go back to the meter model
+   *    load <watts>        Set the base load on the meter
+   *    clock <YYYY-MM-DD> <HH:MM:SS>  Set the RTC
+   *
+   *  Blank lines and lines starting with '#' are ignored.
+   */
+  bool script(const char *fname);
+
+  /** Set up the simulation from the command line, then start it */
+  void init(int    argc,
+	    char **argv);
+
+  /** Should the simulation keep going? */
+  bool running();
+
+  /** Print statistics about the simulation */
+  void report();
+
+  /** Statistics, updated by the simulator */
+  struct stats_s {
+    uint64_t loops;         ///< Number of loop() calls
+    uint64_t skipped_ticks; ///< Idle Timer0 ticks skipped, thanks to the idle hint
+    uint64_t slept_us;      ///< Time spent asleep, in any mode. Code runs in no virtual time: the rest is busy-waiting
+    uint64_t adc_us;        ///< Time spent in ADC noise reduction mode
+    uint64_t power_down_us; ///< Time spent in power-down mode, including the wake-up latency
+    uint64_t max_awake_us;  ///< Longest time between two sleeps
+    uint32_t interrupts;    ///< Pin-change interrupts serviced
+    uint32_t watchdogs;     ///< Watchdog interrupts serviced
+    uint32_t rtc_accesses;  ///< DS1302 sessions
+    uint64_t boot_us;       ///< From reset to the first light sample, including static constructors
+    uint32_t boot_writes;   ///< PORTB & DDRB writes from reset to the first light sample
+  };
+
+  extern stats_s stats;
+}
+
+#endif
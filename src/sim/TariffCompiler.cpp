@@ -0,0 +1,595 @@
+//------------------------------------------------------------------------------
+//   Copyright 2014 Janick Bergeron
+//   All Rights Reserved Worldwide
+//
+//   Licensed under the Apache License, Version 2.0 (the
+//   "License"); you may not use this file except in
+//   compliance with the License.  You may obtain a copy of
+//   the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in
+//   writing, software distributed under the License is
+//   distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+//   CONDITIONS OF ANY KIND, either express or implied.  See
+//   the License for the specific language governing
+//   permissions and limitations under the License.
+//------------------------------------------------------------------------------
+
+
+
+
+// Compiles a human-readable tariff into a tariff image (TariffImage_t)
+// and into a C++ header of PROGMEM tables for the firmware.
+//
+// A tariff spec is a sequence of lines:
+//
+//     name     PG&E E-6                         Name of the tariff
+//     price    12.1 18.5 31.7                   Cents per kWh: off-peak, partial-peak, on-peak
+//     schedule weekday 00:00 off 07:00 partial  A named daily schedule: the cost period starting
+//     schedule weekday 14:00 on 21:00 partial   at each time, on 30-min boundaries, in
+//     schedule weekday 22:00 off                chronological order. May span several lines.
+//     season   05/01 weekday weekend            Season starting on MM/DD, with its workday &
+//                                               weekend schedules
+//     holiday  07/04 weekend                    Holiday on MM/DD, with its schedule
+//
+// Periods are "off", "partial" (or "mid") and "on", with an optional "-peak".
+// Comments start with '#'.
+//
+// Holidays are fixed dates. Each becomes a 1-day season, followed by the
+// season it interrupts, as the Calendar expects.
+//
+// The header holds the image, for Calendar::useImage(), and tables that
+// turn the Calendar lookups into table reads, for Calendar::useTables():
+//
+//     TARIFF_DAYS           Workday & weekend schedules of every date
+//     TARIFF_TRANSITIONS    Changes to a different cost period, per schedule
+//
+// Everything Calendar::check() verifies is an error here, plus what would
+// make an image invalid. An image too large for the EEPROM area it is loaded in
+// over the optical link (TariffLoader_t) only gets a warning: it can still be compiled in.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include <map>
+
+#include "Calendar.h"
+#include "Tariff.h"
+
+using namespace PowerMinder;
+
+
+/** Bytes of an EEPROM slot for a tariff image in the sketch (TARIFF_EEPROM_SIZE) */
+static const uint16_t EEPROM_SIZE = 80;
+
+/** Days in months, as Calendar::defineSeason() accepts them */
+static const uint8_t daysInMonth[12] = {31, 28, 31, 30, 31, 30,
+					31, 31, 30, 31, 30, 31};
+
+
+struct named_schedule_s {
+  std::string          name;
+  std::vector<uint8_t> changes;   ///< (period << 6) | time
+  int                  lineno;
+};
+
+struct date_s {
+  uint8_t month;
+  uint8_t day;
+  int     lineno;
+  uint8_t workday;
+  uint8_t weekend;
+};
+
+struct spec_s {
+  std::string             name;
+  bool                    priced;
+  uint16_t                price[3];
+  std::vector<named_schedule_s> schedules;
+  std::vector<date_s>     seasons;
+  std::vector<date_s>     holidays;
+};
+
+
+/** Parse a cost period name. Returns -1 if invalid. */
+static int
+parse_period(const char *word)
+{
+  size_t n = strcspn(word, "-");
+  if (word[n] != '\0' && strcmp(word + n, "-peak") != 0) return -1;
+
+  if (n == 3 && strncmp(word, "off", n) == 0)     return OFF_PEAK;
+  if (n == 7 && strncmp(word, "partial", n) == 0) return PARTIAL_PEAK;
+  if (n == 3 && strncmp(word, "mid", n) == 0)     return PARTIAL_PEAK;
+  if (n == 2 && strncmp(word, "on", n) == 0)      return ON_PEAK;
+  return -1;
+}
+
+
+/** Parse a MM/DD date. Returns FALSE if invalid. */
+static bool
+parse_date(const char *word,
+	   date_s     &date)
+{
+  int month, day, len;
+  if (sscanf(word, "%d/%d%n", &month, &day, &len) != 2 || word[len] != '\0') return false;
+  if (month < 1 || month > 12 || day < 1 || day > daysInMonth[month-1]) return false;
+  date.month = month;
+  date.day   = day;
+  return true;
+}
+
+
+/** Index of a named schedule, or -1 */
+static int
+find_schedule(const spec_s      &spec,
+	      const std::string &name)
+{
+  for (size_t i = 0; i < spec.schedules.size(); i++) {
+    if (spec.schedules[i].name == name) return i;
+  }
+  return -1;
+}
+
+
+/** Read a tariff spec. Returns FALSE on error */
+static bool
+read_spec(const char *fname,
+	  spec_s     &spec)
+{
+  FILE *fp = fopen(fname, "r");
+  if (fp == 0) {
+    perror(fname);
+    return false;
+  }
+
+  std::vector<std::pair<std::vector<std::string>, int> > uses;   // Season & holiday schedule names
+
+  char line[1024];
+  int  lineno = 0;
+  bool ok     = true;
+  spec.priced = false;
+  while (fgets(line, sizeof(line), fp)) {
+    lineno++;
+
+    char *eol = line + strcspn(line, "#\r\n");
+    *eol = '\0';
+
+    std::vector<std::string> words;
+    for (char *word = strtok(line, " \t"); word; word = strtok(0, " \t")) words.push_back(word);
+    if (words.empty()) continue;
+    const std::string &keyword = words[0];
+
+    if (keyword == "name") {
+      spec.name.clear();
+      for (size_t i = 1; i < words.size(); i++) spec.name += ((i > 1) ? " " : "") + words[i];
+    }
+    else if (keyword == "price") {
+      double cents[3];
+      if (words.size() != 4 ||
+	  sscanf(words[1].c_str(), "%lf", &cents[0]) != 1 ||
+	  sscanf(words[2].c_str(), "%lf", &cents[1]) != 1 ||
+	  sscanf(words[3].c_str(), "%lf", &cents[2]) != 1) {
+	fprintf(stderr, "%s:%d: Expected 3 prices\n", fname, lineno);
+	ok = false;
+	continue;
+      }
+      for (int p = 0; p < 3; p++) {
+	if (cents[p] < 0 || cents[p] > 655.35) {
+	  fprintf(stderr, "%s:%d: Prices must be 0..655.35 cents per kWh\n", fname, lineno);
+	  ok = false;
+	}
+	spec.price[p] = cents[p] * 100 + 0.5;
+      }
+      spec.priced = true;
+    }
+    else if (keyword == "schedule") {
+      if (words.size() < 2 || words.size() % 2 != 0) {
+	fprintf(stderr, "%s:%d: Expected a schedule name followed by time & period pairs\n", fname, lineno);
+	ok = false;
+	continue;
+      }
+      int id = find_schedule(spec, words[1]);
+      if (id < 0) {
+	spec.schedules.push_back(named_schedule_s());
+	spec.schedules.back().name   = words[1];
+	spec.schedules.back().lineno = lineno;
+	id = spec.schedules.size() - 1;
+      }
+      named_schedule_s &schedule = spec.schedules[id];
+
+      for (size_t i = 2; i < words.size(); i += 2) {
+	int hours, mins, len;
+	int period = parse_period(words[i+1].c_str());
+	if (sscanf(words[i].c_str(), "%d:%d%n", &hours, &mins, &len) != 2 || words[i][len] != '\0' ||
+	    hours < 0 || hours > 23 || (mins != 0 && mins != 30)) {
+	  fprintf(stderr, "%s:%d: Invalid time \"%s\": must be HH:00 or HH:30\n", fname, lineno, words[i].c_str());
+	  ok = false;
+	  continue;
+	}
+	if (period < 0) {
+	  fprintf(stderr, "%s:%d: Invalid period \"%s\"\n", fname, lineno, words[i+1].c_str());
+	  ok = false;
+	  continue;
+	}
+
+	uint8_t time = hours * 2 + mins / 30;
+	if (schedule.changes.empty() && time != 0) {
+	  fprintf(stderr, "%s:%d: The first period change in schedule \"%s\" is not at 00:00\n",
+		  fname, lineno, schedule.name.c_str());
+	  ok = false;
+	}
+	else if (!schedule.changes.empty() && time <= (schedule.changes.back() & 0x3F)) {
+	  fprintf(stderr, "%s:%d: Period changes in schedule \"%s\" are not in chronological order at %s\n",
+		  fname, lineno, schedule.name.c_str(), words[i].c_str());
+	  ok = false;
+	}
+	else if (!schedule.changes.empty() && period == (schedule.changes.back() >> 6)) {
+	  fprintf(stderr, "%s:%d: WARNING: Period change at %s in schedule \"%s\" does not change the period\n",
+		  fname, lineno, words[i].c_str(), schedule.name.c_str());
+	}
+	schedule.changes.push_back((period << 6) | time);
+      }
+    }
+    else if (keyword == "season" || keyword == "holiday") {
+      size_t n = (keyword == "season") ? 4 : 3;
+      date_s date;
+      if (words.size() != n || !parse_date(words[1].c_str(), date)) {
+	fprintf(stderr, "%s:%d: Expected %s MM/DD %s\n", fname, lineno, keyword.c_str(),
+		(n == 4) ? "workday_schedule weekend_schedule" : "schedule");
+	ok = false;
+	continue;
+      }
+      date.lineno = lineno;
+      ((n == 4) ? spec.seasons : spec.holidays).push_back(date);
+      uses.push_back(std::make_pair(std::vector<std::string>(words.begin() + 2, words.end()), lineno));
+    }
+    else {
+      fprintf(stderr, "%s:%d: Unknown keyword \"%s\"\n", fname, lineno, keyword.c_str());
+      ok = false;
+    }
+  }
+  fclose(fp);
+
+  // Schedules may be used before they are defined
+  size_t s = 0, h = 0;
+  for (size_t i = 0; i < uses.size(); i++) {
+    date_s &date = (uses[i].first.size() == 2) ? spec.seasons[s++] : spec.holidays[h++];
+    int workday = find_schedule(spec, uses[i].first[0]);
+    int weekend = find_schedule(spec, uses[i].first.back());
+    for (size_t j = 0; j < uses[i].first.size(); j++) {
+      if (find_schedule(spec, uses[i].first[j]) < 0) {
+	fprintf(stderr, "%s:%d: Undefined schedule \"%s\"\n", fname, uses[i].second, uses[i].first[j].c_str());
+	ok = false;
+      }
+    }
+    date.workday = workday;
+    date.weekend = weekend;
+  }
+
+  return ok;
+}
+
+
+/** Date as a sortable key */
+static uint16_t
+key(uint8_t month,
+    uint8_t day)
+{
+  return month * 32 + day;
+}
+
+
+/** The season in effect on a date: the last one to start on or before it, or the last one of the year */
+static const date_s &
+in_effect(const std::vector<date_s> &seasons,
+	  uint8_t                    month,
+	  uint8_t                    day)
+{
+  size_t i = 0;
+  while (i < seasons.size() && key(seasons[i].month, seasons[i].day) <= key(month, day)) i++;
+  return seasons[(i == 0) ? seasons.size() - 1 : i - 1];
+}
+
+
+/** Check the spec & build the tariff. Returns FALSE on error */
+static bool
+compile(const char              *fname,
+	const spec_s            &spec,
+	TariffImage_t::tariff_t &tariff)
+{
+  bool ok = true;
+
+  if (spec.schedules.empty()) {
+    fprintf(stderr, "%s: No schedule defined\n", fname);
+    ok = false;
+  }
+  if (spec.seasons.empty()) {
+    fprintf(stderr, "%s: No season defined\n", fname);
+    ok = false;
+  }
+  if (spec.schedules.size() > TariffImage_t::MAX_SCHEDULES) {
+    fprintf(stderr, "%s: Too many schedules: %lu (max %d)\n", fname,
+	    (unsigned long) spec.schedules.size(), TariffImage_t::MAX_SCHEDULES);
+    ok = false;
+  }
+  if (!ok) return false;
+
+  // Seasons must be in chronological order
+  for (size_t i = 1; i < spec.seasons.size(); i++) {
+    if (key(spec.seasons[i].month, spec.seasons[i].day) <= key(spec.seasons[i-1].month, spec.seasons[i-1].day)) {
+      fprintf(stderr, "%s:%d: Season %02d/%02d is not after %02d/%02d\n", fname, spec.seasons[i].lineno,
+	      spec.seasons[i].month, spec.seasons[i].day, spec.seasons[i-1].month, spec.seasons[i-1].day);
+      ok = false;
+    }
+  }
+  if (!ok) return false;
+
+  // Insert the holidays as 1-day seasons
+  std::map<uint16_t, date_s> seasons;
+  for (size_t i = 0; i < spec.seasons.size(); i++) {
+    seasons[key(spec.seasons[i].month, spec.seasons[i].day)] = spec.seasons[i];
+  }
+  std::map<uint16_t, const date_s *> holidays;
+  for (size_t i = 0; i < spec.holidays.size(); i++) {
+    const date_s &h = spec.holidays[i];
+    if (!holidays.insert(std::make_pair(key(h.month, h.day), &h)).second) {
+      fprintf(stderr, "%s:%d: Holiday %02d/%02d is defined twice\n", fname, h.lineno, h.month, h.day);
+      ok = false;
+    }
+  }
+  for (std::map<uint16_t, const date_s *>::iterator h = holidays.begin(); h != holidays.end(); ++h) {
+    date_s next = *h->second;
+    if (++next.day > daysInMonth[next.month-1]) {
+      next.day   = 1;
+      next.month = next.month % 12 + 1;
+    }
+    if (holidays.count(key(next.month, next.day)) || seasons.count(key(next.month, next.day))) continue;
+
+    const date_s &resume = in_effect(spec.seasons, next.month, next.day);
+    next.workday = resume.workday;
+    next.weekend = resume.weekend;
+    seasons[key(next.month, next.day)] = next;
+  }
+  for (std::map<uint16_t, const date_s *>::iterator h = holidays.begin(); h != holidays.end(); ++h) {
+    date_s &day = seasons[h->first];
+    day = *h->second;
+    day.weekend = day.workday;
+  }
+  if (seasons.size() > TariffImage_t::MAX_SEASONS) {
+    fprintf(stderr, "%s: Too many seasons & holidays: %lu seasons once expanded (max %d)\n", fname,
+	    (unsigned long) seasons.size(), TariffImage_t::MAX_SEASONS);
+    ok = false;
+  }
+  if (!ok) return false;
+
+  memset(&tariff, 0, sizeof(tariff));
+  for (std::map<uint16_t, date_s>::iterator s = seasons.begin(); s != seasons.end(); ++s) {
+    tariff.season[tariff.seasons].month   = s->second.month;
+    tariff.season[tariff.seasons].day     = s->second.day;
+    tariff.season[tariff.seasons].workday = s->second.workday;
+    tariff.season[tariff.seasons].weekend = s->second.weekend;
+    tariff.seasons++;
+  }
+
+  // Every used schedule must have been defined, from 00:00
+  std::vector<bool> used(spec.schedules.size(), false);
+  for (uint8_t i = 0; i < tariff.seasons; i++) {
+    used[tariff.season[i].workday] = true;
+    used[tariff.season[i].weekend] = true;
+  }
+  tariff.schedules = spec.schedules.size();
+  for (uint8_t i = 0; i < tariff.schedules; i++) {
+    const named_schedule_s &schedule = spec.schedules[i];
+    if (schedule.changes.empty()) {
+      fprintf(stderr, "%s:%d: Schedule \"%s\" has no period change\n", fname, schedule.lineno, schedule.name.c_str());
+      ok = false;
+      continue;
+    }
+    if (!used[i]) {
+      fprintf(stderr, "%s:%d: WARNING: Schedule \"%s\" is not used\n", fname, schedule.lineno, schedule.name.c_str());
+    }
+    tariff.schedule[i].changes = schedule.changes.size();
+    memcpy(tariff.schedule[i].change, &schedule.changes[0], schedule.changes.size());
+  }
+
+  tariff.priced = spec.priced;
+  for (int p = 0; p < 3; p++) tariff.price[p] = (spec.priced) ? spec.price[p] : 0;
+
+  return ok;
+}
+
+
+/** Write the image and the lookup tables as a C++ header. Returns FALSE on error */
+static bool
+write_header(const char                    *fname,
+	     const char                    *source,
+	     const std::string             &name,
+	     const TariffImage_t::tariff_t &tariff,
+	     const uint8_t                 *image,
+	     uint16_t                       len)
+{
+  if (tariff.schedules > 16) {
+    fprintf(stderr, "%s: The day table holds at most 16 schedules\n", fname);
+    return false;
+  }
+
+  std::vector<uint8_t> transitions;
+  std::vector<uint8_t> starts;
+  for (uint8_t i = 0; i < tariff.schedules; i++) {
+    starts.push_back(transitions.size());
+    for (uint8_t k = 0; k < tariff.schedule[i].changes; k++) {
+      if (k == 0 || (tariff.schedule[i].change[k] >> 6) != (transitions.back() >> 6)) {
+	transitions.push_back(tariff.schedule[i].change[k]);
+      }
+    }
+  }
+  if (transitions.size() > 255) {
+    fprintf(stderr, "%s: The transition table holds at most 255 period changes\n", fname);
+    return false;
+  }
+  starts.push_back(transitions.size());
+
+  FILE *fp = fopen(fname, "w");
+  if (fp == 0) {
+    perror(fname);
+    return false;
+  }
+
+  fprintf(fp, "// Generated by tariff-compile from %s. Do not edit.\n", source);
+  if (!name.empty()) fprintf(fp, "// %s\n", name.c_str());
+  fprintf(fp, "\n#ifndef _CompiledTariff_h\n#define _CompiledTariff_h\n\n");
+  fprintf(fp, "#include <stdint.h>\n#ifdef __AVR__\n#include <avr/pgmspace.h>\n#else\n#define PROGMEM\n#endif\n");
+  fprintf(fp, "#include \"Tariff.h\"\n\n");
+
+  fprintf(fp, "/** Tariff image, for Calendar::useImage(TARIFF_IMAGE, sizeof(TARIFF_IMAGE), tariff_read) */\n");
+  fprintf(fp, "static const uint8_t TARIFF_IMAGE[%d] PROGMEM = {", len);
+  for (uint16_t i = 0; i < len; i++) fprintf(fp, "%s0x%02x", (i % 12) ? ", " : (i) ? ",\n  " : "\n  ", image[i]);
+  fprintf(fp, "};\n\n");
+
+  fprintf(fp, "/** (weekend << 4) | workday schedule of every date. Days past the end of a month repeat its last one */\n");
+  fprintf(fp, "static const uint8_t TARIFF_DAYS[12][31] PROGMEM = {");
+  for (uint8_t month = 1; month <= 12; month++) {
+    fprintf(fp, "%s{", (month > 1) ? ",\n  " : "\n  ");
+    for (uint8_t day = 1; day <= 31; day++) {
+      // The last season to start on or before that day, or the last one of the year
+      uint8_t last = daysInMonth[month-1] + (month == 2);
+      uint8_t d    = (day > last) ? last : day;
+      uint8_t s    = 0;
+      while (s < tariff.seasons && key(tariff.season[s].month, tariff.season[s].day) <= key(month, d)) s++;
+      s = (s == 0) ? tariff.seasons - 1 : s - 1;
+      fprintf(fp, "%s0x%02x", (day == 1) ? "" : (day % 12 == 1) ? ",\n   " : ", ",
+	      (tariff.season[s].weekend << 4) | tariff.season[s].workday);
+    }
+    fprintf(fp, "}");
+  }
+  fprintf(fp, "};\n\n");
+
+  fprintf(fp, "/** Changes to a different cost period, (period << 6) | time, from TARIFF_TRANSITION_START[schedule] */\n");
+  fprintf(fp, "static const uint8_t TARIFF_TRANSITIONS[%lu] PROGMEM = {", (unsigned long) transitions.size());
+  for (size_t i = 0; i < transitions.size(); i++) fprintf(fp, "%s0x%02x", (i % 12) ? ", " : (i) ? ",\n  " : "\n  ", transitions[i]);
+  fprintf(fp, "};\n\n");
+  fprintf(fp, "static const uint8_t TARIFF_TRANSITION_START[%d] PROGMEM = {", tariff.schedules + 1);
+  for (size_t i = 0; i < starts.size(); i++) fprintf(fp, "%s%d", (i) ? ", " : "", starts[i]);
+  fprintf(fp, "};\n\n");
+
+  fputs("/** Read a byte of the image or tables */\n"
+	  "inline uint8_t tariff_read(const uint8_t *addr)\n{\n"
+	  "#ifdef __AVR__\n  return pgm_read_byte(addr);\n#else\n  return *addr;\n#endif\n}\n\n", fp);
+
+  fputs("/** Lookup tables, for Calendar::useTables(&TARIFF_TABLES) */\n"
+	  "static const PowerMinder::TariffTables_t TARIFF_TABLES = {&TARIFF_DAYS[0][0], TARIFF_TRANSITIONS,\n"
+	  "                                                           TARIFF_TRANSITION_START, tariff_read};\n\n", fp);
+
+  if (tariff.priced) {
+    fprintf(fp, "/** Prices of the cost periods, in 1/100th of a cent per kWh */\n");
+    fprintf(fp, "static const uint16_t TARIFF_PRICES[3] = {%d, %d, %d};\n\n", tariff.price[0], tariff.price[1], tariff.price[2]);
+  }
+
+  fprintf(fp, "#endif\n");
+
+  if (fclose(fp) != 0) {
+    perror(fname);
+    return false;
+  }
+  return true;
+}
+
+
+/** Write a binary file. Returns FALSE on error */
+static bool
+write_binary(const char    *fname,
+	     const uint8_t *image,
+	     uint16_t       len)
+{
+  FILE *fp = fopen(fname, "wb");
+  if (fp == 0) {
+    perror(fname);
+    return false;
+  }
+  if (fwrite(image, 1, len, fp) != len || fclose(fp) != 0) {
+    perror(fname);
+    return false;
+  }
+  return true;
+}
+
+
+static void
+usage(const char *argv0)
+{
+  fprintf(stderr, "Usage: %s [-o image.bin] [-H header.h] [-p] tariff.txt\n", argv0);
+  fprintf(stderr, "       %s -d image.bin\n", argv0);
+  exit(1);
+}
+
+
+int
+main(int    argc,
+     char **argv)
+{
+  const char *binary = 0;
+  const char *header = 0;
+  bool        print  = false;
+  bool        decode = false;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "o:H:pd")) != -1) {
+    switch (opt) {
+    case 'o': binary = optarg; break;
+    case 'H': header = optarg; break;
+    case 'p': print = true; break;
+    case 'd': decode = true; break;
+    default:  usage(argv[0]);
+    }
+  }
+  if (optind + 1 != argc) usage(argv[0]);
+
+  static uint8_t          image[0xFFFF];
+  TariffImage_t::tariff_t tariff;
+
+  // Print an existing image
+  if (decode) {
+    FILE *fp = fopen(argv[optind], "rb");
+    if (fp == 0) {
+      perror(argv[optind]);
+      return 1;
+    }
+    size_t len = fread(image, 1, sizeof(image), fp);
+    fclose(fp);
+    if (!TariffImage_t::decode(image, len, tariff)) {
+      fprintf(stderr, "%s: Invalid tariff image\n", argv[optind]);
+      return 1;
+    }
+    TariffImage_t::print(tariff);
+    return 0;
+  }
+
+  spec_s spec;
+  if (!read_spec(argv[optind], spec)) return 1;
+  if (!compile(argv[optind], spec, tariff)) return 1;
+
+  uint16_t len = TariffImage_t::encode(tariff, image, sizeof(image));
+  if (len == 0) {
+    fprintf(stderr, "%s: Cannot be encoded as a tariff image\n", argv[optind]);
+    return 1;
+  }
+
+  // Can it also be loaded over the optical link?
+  if (len > EEPROM_SIZE) {
+    fprintf(stderr, "%s: WARNING: The %d-byte image is too large to be loaded over the optical link (max %d):"
+	    " compile it in\n", argv[optind], len, EEPROM_SIZE);
+  }
+
+  if (print) TariffImage_t::print(tariff);
+  if (binary && !write_binary(binary, image, len)) return 1;
+  if (header && !write_header(header, argv[optind], spec.name, tariff, image, len)) return 1;
+
+  printf("%s: %d seasons, %d schedules, %d-byte image\n", argv[optind], tariff.seasons, tariff.schedules, len);
+  return 0;
+}
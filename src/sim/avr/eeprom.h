@@ -0,0 +1,52 @@
+//------------------------------------------------------------------------------
+//   Copyright 2014 Janick Bergeron
+//   All Rights Reserved Worldwide
+//
+//   Licensed under the Apache License, Version 2.0 (the
+//   "License"); you may not use this file except in
+//   compliance with the License.  You may obtain a copy of
+//   the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in
+//   writing, software distributed under the License is
+//   distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+//   CONDITIONS OF ANY KIND, either express or implied.  See
+//   the License for the specific language governing
+//   permissions and limitations under the License.
+//------------------------------------------------------------------------------
+
+
+
+// EEPROM access, for the host simulator
+
+#ifndef _AVR_EEPROM_H_
+#define _AVR_EEPROM_H_
+
+#include <stdint.h>
+#include "../Simulator.h"
+
+inline uint8_t eeprom_read_byte(const uint8_t *addr)
+{
+  return Sim::eeprom[(uintptr_t) addr % Sim::EEPROM_SIZE];
+}
+
+inline void eeprom_write_byte(uint8_t *addr,
+			      uint8_t  value)
+{
+  // After a power failure, the byte being written is left partly erased
+  if (Sim::eeprom_writes == 0) return;
+  if (Sim::eeprom_writes > 0 && --Sim::eeprom_writes == 0) value |= Sim::eeprom_torn;
+
+  Sim::eeprom[(uintptr_t) addr % Sim::EEPROM_SIZE] = value;
+}
+
+/** Only writes if the value is different */
+inline void eeprom_update_byte(uint8_t *addr,
+			       uint8_t  value)
+{
+  if (eeprom_read_byte(addr) != value) eeprom_write_byte(addr, value);
+}
+
+#endif
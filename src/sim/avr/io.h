@@ -0,0 +1,86 @@
+//------------------------------------------------------------------------------
+//   Copyright 2014 Janick Bergeron
+//   All Rights Reserved Worldwide
+//
+//   Licensed under the Apache License, Version 2.0 (the
+//   "License"); you may not use this file except in
+//   compliance with the License.  You may obtain a copy of
+//   the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in
+//   writing, software distributed under the License is
+//   distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+//   CONDITIONS OF ANY KIND, either express or implied.  See
+//   the License for the specific language governing
+//   permissions and limitations under the License.
+//------------------------------------------------------------------------------
+
+
+
+// ATtiny85 I/O registers, for the host simulator
+
+#ifndef _AVR_IO_H_
+#define _AVR_IO_H_
+
+#include <stdint.h>
+#include "../Simulator.h"
+
+#define _BV(bit) (1 << (bit))
+
+extern Sim::Register_t PORTB, DDRB, PINB;
+extern Sim::Register_t GIMSK, PCMSK, GIFR;
+extern Sim::Register_t SREG, MCUCR, MCUSR, WDTCR, PRR;
+extern Sim::Register_t ADMUX, ADCSRA, ADCSRB, ADCL, ADCH, DIDR0;
+extern Sim::Register_t TCCR0A, TCCR0B, TCNT0, TCCR1, TCNT1, GTCCR, OCR1A, OCR1C, TIMSK, TIFR;
+
+// GIMSK
+#define INT0   6
+#define PCIE   5
+
+// PCMSK
+#define PCINT5 5
+#define PCINT4 4
+#define PCINT3 3
+#define PCINT2 2
+#define PCINT1 1
+#define PCINT0 0
+
+// MCUCR
+#define BODS   7
+#define PUD    6
+#define SE     5
+#define SM1    4
+#define SM0    3
+
+// ADMUX
+#define WDIF   7
+#define WDIE   6
+#define WDP3   5
+#define WDCE   4
+#define WDE    3
+#define WDP2   2
+#define WDP1   1
+#define WDP0   0
+
+#define REFS1  7
+#define REFS0  6
+#define ADLAR  5
+
+// ADCSRA
+#define ADEN   7
+#define ADSC   6
+#define ADATE  5
+#define ADIF   4
+#define ADIE   3
+#define ADPS2  2
+#define ADPS1  1
+#define ADPS0  0
+
+/** The 16-bit ADC data register */
+#define ADC    ((uint16_t) (ADCL | (ADCH << 8)))
+
+#define E2END  (Sim::EEPROM_SIZE - 1)
+
+#endif